@@ -34,6 +34,10 @@
 #define MAX_CREDENTIALS_SIZE 8192
 //! Maximum size of encoded nonce
 #define MAX_ENC_NONCE_SIZE 256
+//! Size of the key of an authenticated session
+#define SESSION_KEY_SIZE 32
+//! Size of the MAC authenticating a request by a session (HMAC-SHA256)
+#define SESSION_MAC_SIZE 32
 //#define MAX_DEVICE_NAME_SIZE 256
 //! Maximum size of function list
 #define MAX_FUNCTION_LIST_SIZE 65536
@@ -45,6 +49,8 @@
 #define MAX_ACTION_VALUE_SIZE 512
 //! Maximum number of arguments a function can have 
 #define MAX_ARGUMENTS_NUMBER 12
+//! Maximum depth of functions passed as arguments to other functions
+#define MAX_FUNCTION_NESTING 16
 #define MAX_PAIR_NAME 64
 #define MAX_PAIR_VALUE 512
 #define MAX_PAIR_ASSERTIONS 16
@@ -75,7 +81,9 @@
 //! Maximum length of resource type description string
 #define RESOURCE_CTRL_MAX_RES_DESCR_LEN 64
 //! Maximum number of resource types a request can consume
-#define RESOURCE_CTRL_MAX_RESOURCES 32
+#define RESOURCE_CTRL_MAX_RESOURCES 128
+//! Number of slots used to find required resources by key, a power of 2
+#define RESOURCE_CTRL_SLOTS (2 * RESOURCE_CTRL_MAX_RESOURCES)
 /****************************************/
 #endif
 
@@ -42,15 +42,25 @@
 #include <linux/proc_fs.h>
 // Spinlock headers
 #include <linux/spinlock.h>
-// Semaphore headers
-#include <asm/semaphore.h>
 // User-space access headers
 #include <asm/uaccess.h>
 // Wait queues headers
 #include <linux/wait.h>
+// List headers
+#include <linux/list.h>
+// Time headers
+#include <linux/time.h>
+// Memory mapping headers
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+// Poll and ioctl headers
+#include <linux/poll.h>
+#include <linux/ioctl.h>
 
 // Admission control header
 #include "kadm_ctrl.h"
+// Device records
+#include "authdev_msg.h"
 
 // Debug macros
 #define DEBUG 1
@@ -75,7 +85,14 @@ MODULE_LICENSE("GPL");
 //! Device minor number
 #define MINOR_NUM 0
 
-typedef enum { IDLE = 0, READING, WRITING } device_state_t;
+//! States of a queued request
+typedef enum {
+  QUEUED = 0, //!< Waiting to be read
+  COPYING, //!< Being copied to user-space
+  INFLIGHT, //!< Read, waiting for a result
+  DONE, //!< Result received
+  ABORTED //!< Device was closed
+} slot_state_t;
 
 //! Device major number
 static unsigned int major_num = MAJOR_NUM;
@@ -85,33 +102,93 @@ static dev_t device;
 static struct cdev *cdevice = NULL;
 //! Proc file structure
 static struct proc_dir_entry *proc_file = NULL;
-//! Device operations lock
-static spinlock_t device_lock;
-//! Specifies if the device is open
+//! Specifies if the device is open. Protected by queue_lock
 static char device_open = 0;
 //! Pending requests
 static unsigned int pending = 0;
-//! Submitted requests queue
-DECLARE_WAIT_QUEUE_HEAD(request_queue);
 //! Device access queue
 DECLARE_WAIT_QUEUE_HEAD(device_queue);
 
-//!< Support major device number parameter
+//! Request queue lock. Protects device_open, the lists, the counters and slot states
+static spinlock_t queue_lock;
+//! Requests waiting to be read
+static LIST_HEAD(queued_list);
+//! Requests read, waiting for a result
+static LIST_HEAD(inflight_list);
+//! Number of requests in queued_list
+static unsigned int queued = 0;
+//! Number of requests in inflight_list
+static unsigned int inflight = 0;
+//! Tag of the next request
+static authdev_tag_t next_tag = 0;
+//! Requests answered
+static unsigned long completed = 0;
+//! Requests that timed out
+static unsigned long timedout = 0;
+//! Requests read
+static unsigned long delays = 0;
+//! Sum of the time requests were queued before being read, in microseconds
+static unsigned long long delay_sum = 0;
+//! Longest time a request was queued before being read, in microseconds
+static unsigned int delay_max = 0;
+
+//! Number of slots in the ring, 0 disables it
+static unsigned int ring_slots = 8;
+//! Ring shared with user-space
+static authdev_ring_t *ring = NULL;
+//! Size of the ring in bytes, rounded up to pages
+static unsigned long ring_size = 0;
+//! Request placed in each ring slot, NULL if it timed out
+static struct request_slot **ring_owner = NULL;
+//! Ring slots handed to user-space, not yet collected
+static unsigned char *ring_busy = NULL;
+//! Number of ring slots not handed to user-space
+static unsigned int ring_free = 0;
+//! Specifies if the ring has been mapped since the device was opened
+static char ring_mapped = 0;
+//! Requests passed through the ring
+static unsigned long ring_requests = 0;
+
+//!< Support major device number and ring size parameters
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2,5,0)
 module_param(major_num,uint,0);
+module_param(ring_slots,uint,0);
 #else
 MODULE_PARM(major_num,"i");
+MODULE_PARM(ring_slots,"i");
 #endif
 
-//! Serving client structure
-static struct client_struct
+//! A request submitted with authdev_submit()
+/** Lives on the stack of the submitter, which waits on it until it is
+ * answered, it times out or the device is closed. */
+struct request_slot
 {
-  device_state_t state; //!< State of client
-  adm_ctrl_request_t request; //!< Request data
-  adm_ctrl_result_t result; //!< Result data
-  struct semaphore sem, //!< Availability semaphore
-  mutex; //!< State access mutex
-} client;
+  struct list_head list; //!< Entry in queued_list or inflight_list
+  authdev_tag_t tag; //!< Tag of the request
+  slot_state_t state; //!< State of the request
+  adm_ctrl_request_t *request; //!< Request data of the submitter
+  adm_ctrl_result_t *result; //!< Result data of the submitter
+  struct timeval queued_at; //!< Time the request was queued
+  int ring_index; //!< Ring slot holding the request, or -1
+  wait_queue_head_t wait; //!< Submitter waiting for a state change
+};
+
+/** \brief Return the microseconds since a request was queued
+*/
+static inline unsigned int
+queue_delay(const struct request_slot *slot)
+{
+  struct timeval now;
+  long sec;
+
+  do_gettimeofday(&now);
+  sec = now.tv_sec - slot->queued_at.tv_sec;
+  if ( sec < 0 )
+    return 0;
+  if ( sec >= 4000 )
+    return ~0U;
+  return (unsigned int)(sec * 1000000 + now.tv_usec - slot->queued_at.tv_usec);
+}
 
 /** \brief Device open operation
   Opens the device. Only one process at a time can open the device.
@@ -122,7 +199,7 @@ authdev_open(struct inode *i,struct file *filp)
 {
   int e = 0;
 
-  spin_lock(&device_lock);
+  spin_lock(&queue_lock);
   if ( device_open )
   {
     DEBUG_CMD(printk(KERN_DEBUG "%s: device is already open\n",MODNAME));
@@ -139,111 +216,389 @@ authdev_open(struct inode *i,struct file *filp)
   DEBUG_CMD(printk(KERN_DEBUG "%s: device opened\n",MODNAME));
 
 ret:
-  spin_unlock(&device_lock);
+  spin_unlock(&queue_lock);
   return e;
 }
 
+/** \brief Abort all requests in a list
+  Must be called with queue_lock held.
+*/
+static void
+abort_list(struct list_head *head)
+{
+  struct request_slot *slot;
+
+  while( !list_empty(head) )
+  {
+    slot = list_entry(head->next,struct request_slot,list);
+    list_del_init(&slot->list);
+    slot->state = ABORTED;
+    wake_up(&slot->wait);
+  }
+}
+
+/** \brief Return all ring slots to the kernel
+  Must be called with queue_lock held.
+*/
+static void
+ring_reset(void)
+{
+  unsigned int i;
+
+  if ( ring == NULL )
+    return;
+  for(i = 0; i < ring->slots ;i++)
+  {
+    ring_owner[i] = NULL;
+    ring_busy[i] = 0;
+    ring->slot[i].state = AUTHDEV_SLOT_FREE;
+  }
+  ring_free = ring->slots;
+}
+
+/** \brief Place queued requests in free ring slots
+  Requests are copied without holding queue_lock, marked COPYING like in
+  authdev_read(), so that their submitters wait for the copy to finish.
+  \return the number of requests placed
+*/
+static int
+ring_fill(void)
+{
+  struct request_slot *slot;
+  authdev_ring_slot_t *rs;
+  unsigned int i;
+  int n = 0;
+
+  while( 1 )
+  {
+    spin_lock(&queue_lock);
+    if ( !ring_mapped || ring_free == 0 || list_empty(&queued_list) )
+    {
+      spin_unlock(&queue_lock);
+      break;
+    }
+    for(i = 0; ring_busy[i] ;i++)
+      ;
+    ring_busy[i] = 1;
+    ring_free--;
+    slot = list_entry(queued_list.next,struct request_slot,list);
+    list_del_init(&slot->list);
+    queued--;
+    slot->state = COPYING;
+    rs = &ring->slot[i];
+    rs->delay = queue_delay(slot);
+    spin_unlock(&queue_lock);
+
+    rs->tag = slot->tag;
+    memcpy(&rs->request,slot->request,sizeof(adm_ctrl_request_t));
+
+    spin_lock(&queue_lock);
+    if ( !ring_mapped || !ring_busy[i] )
+    {
+      // The device was closed while copying
+      slot->state = ABORTED;
+      wake_up(&slot->wait);
+      spin_unlock(&queue_lock);
+      continue;
+    }
+    slot->state = INFLIGHT;
+    slot->ring_index = i;
+    ring_owner[i] = slot;
+    list_add_tail(&slot->list,&inflight_list);
+    inflight++;
+    ring_requests++;
+    delays++;
+    delay_sum += rs->delay;
+    if ( rs->delay > delay_max )
+      delay_max = rs->delay;
+    // The request must be visible before the state
+    wmb();
+    rs->state = AUTHDEV_SLOT_REQUEST;
+    wake_up(&slot->wait);
+    spin_unlock(&queue_lock);
+    n++;
+  }
+
+  if ( n > 0 )
+    wake_up_interruptible(&device_queue);
+  return n;
+}
+
+/** \brief Collect the results stored in the ring
+  Slots whose request timed out are freed without a result.
+  \return the number of results collected
+*/
+static int
+ring_complete(void)
+{
+  struct request_slot *slot;
+  authdev_ring_slot_t *rs;
+  unsigned int i;
+  int n = 0;
+
+  spin_lock(&queue_lock);
+  if ( !ring_mapped )
+  {
+    spin_unlock(&queue_lock);
+    return - EINVAL;
+  }
+  for(i = 0; i < ring->slots ;i++)
+  {
+    rs = &ring->slot[i];
+    if ( !ring_busy[i] || rs->state != AUTHDEV_SLOT_RESULT )
+      continue;
+    // The result must be read after the state
+    rmb();
+    if ( (slot = ring_owner[i]) != NULL )
+    {
+      memcpy(slot->result,&rs->result,sizeof(adm_ctrl_result_t));
+      list_del_init(&slot->list);
+      inflight--;
+      completed++;
+      slot->ring_index = -1;
+      slot->state = DONE;
+      wake_up(&slot->wait);
+      n++;
+    }
+    ring_owner[i] = NULL;
+    ring_busy[i] = 0;
+    ring_free++;
+    rs->state = AUTHDEV_SLOT_FREE;
+  }
+  spin_unlock(&queue_lock);
+
+  ring_fill();
+  return n;
+}
+
+/** \brief Device mmap operation
+  Maps the ring, which from then on receives the queued requests before
+  authdev_read() does.
+  \return 0 on success, - ENODEV if there is no ring, or - EINVAL if the
+  mapping is larger than the ring
+*/
+static int
+authdev_mmap(struct file *filp,struct vm_area_struct *vma)
+{
+  unsigned long off,size = vma->vm_end - vma->vm_start;
+
+  if ( ring == NULL )
+    return - ENODEV;
+  if ( vma->vm_pgoff != 0 || size > ring_size )
+    return - EINVAL;
+
+  vma->vm_flags |= VM_RESERVED;
+  for(off = 0; off < size ;off += PAGE_SIZE)
+    if ( remap_pfn_range(vma,vma->vm_start + off,
+          page_to_pfn(vmalloc_to_page((char *)ring + off)),PAGE_SIZE,
+          vma->vm_page_prot) != 0 )
+      return - EAGAIN;
+
+  spin_lock(&queue_lock);
+  ring_mapped = 1;
+  spin_unlock(&queue_lock);
+  DEBUG_CMD(printk(KERN_DEBUG "%s: ring mapped\n",MODNAME));
+
+  ring_fill();
+  return 0;
+}
+
+/** \brief Device poll operation
+  Readable while there are requests to read, or requests in the ring once it
+  has been mapped. Always writable.
+*/
+static unsigned int
+authdev_poll(struct file *filp,poll_table *wait)
+{
+  unsigned int i,mask = POLLOUT | POLLWRNORM;
+
+  poll_wait(filp,&device_queue,wait);
+
+  spin_lock(&queue_lock);
+  if ( ring_mapped )
+  {
+    for(i = 0; i < ring->slots ;i++)
+      if ( ring->slot[i].state == AUTHDEV_SLOT_REQUEST )
+      {
+        mask |= POLLIN | POLLRDNORM;
+        break;
+      }
+  }
+  else if ( queued > 0 )
+    mask |= POLLIN | POLLRDNORM;
+  spin_unlock(&queue_lock);
+  return mask;
+}
+
+/** \brief Device ioctl operation
+  \return the size of the ring for AUTHDEV_IOC_RING_SIZE, the number of
+  results collected for AUTHDEV_IOC_COMPLETE, or - ENOTTY
+*/
+static int
+authdev_ioctl(struct inode *i,struct file *filp,unsigned int cmd,
+    unsigned long arg)
+{
+  switch( cmd )
+  {
+    case AUTHDEV_IOC_RING_SIZE:
+      return ( ring )? (int)ring_size : - ENODEV;
+    case AUTHDEV_IOC_COMPLETE:
+      return ring_complete();
+    default:
+      return - ENOTTY;
+  }
+}
+
 /** \brief Device release operation
-  Releases the device.
+  Releases the device. Requests that have not been answered fail.
   \return always 0
 */
 static int
 authdev_release(struct inode *i,struct file *filp)
 {
-  if ( down_interruptible(&client.mutex) )
-    return - ERESTARTSYS;
-  spin_lock(&device_lock);
+  // Under the same lock as the requests, so no request is queued after
+  // they are aborted
+  spin_lock(&queue_lock);
   DEBUG_CMD(printk(KERN_DEBUG "%s: device closed\n",MODNAME));
   device_open = 0;
-  client.state = IDLE;
-  spin_unlock(&device_lock);
-  up(&client.mutex);
+  abort_list(&queued_list);
+  abort_list(&inflight_list);
+  queued = inflight = 0;
+  // The ring is no longer mapped, see authdev_mmap()
+  ring_reset();
+  ring_mapped = 0;
+  spin_unlock(&queue_lock);
   return 0;
 }
 
 /** \brief Device read operation
+  Reads as many queued requests as fit in the buffer, at least one. Blocks
+  until a request is queued, unless the device was opened non-blocking.
+  \return the number of bytes read, a multiple of sizeof(authdev_request_t)
 */
 static ssize_t
 authdev_read(struct file *filp,char *buf,size_t count,loff_t *f_pos)
 {
-  DEBUG_CMD(printk(KERN_DEBUG "%s: entering read\n",MODNAME));
-  
-  // Wait if we are not supposed to read
-  if ( wait_event_interruptible(device_queue,client.state == READING) != 0 )
-    return - ERESTARTSYS;
+  struct request_slot *slot;
+  ssize_t done = 0;
+  unsigned int delay;
+  int e;
 
-  DEBUG_CMD(printk(KERN_DEBUG "%s: performing read\n",MODNAME));
+  DEBUG_CMD2(printk(KERN_DEBUG "%s: entering read\n",MODNAME));
 
-  // Do some boundary checking
-  if ( *f_pos >= sizeof(adm_ctrl_request_t) )
-    return 0;
-  if ( (count + *f_pos) > sizeof(adm_ctrl_request_t) )
-    count = sizeof(adm_ctrl_request_t) - *f_pos;
-
-  // Copy data to user-space
-  if ( copy_to_user(buf,&client.request + *f_pos,count) )
-    return - EFAULT;
-
-  if ( down_interruptible(&client.mutex) )
-    return - ERESTARTSYS;
-  *f_pos += count;
-  // Check if we reached the end of the structure
-  if ( *f_pos == sizeof(adm_ctrl_request_t) )
+  if ( count < sizeof(authdev_request_t) )
+    return - EINVAL;
+
+  while( count - done >= sizeof(authdev_request_t) )
   {
-    DEBUG_CMD(printk(KERN_DEBUG "%s: read complete\n",MODNAME));
+    spin_lock(&queue_lock);
+    if ( list_empty(&queued_list) )
+    {
+      spin_unlock(&queue_lock);
+      // Return what we have
+      if ( done > 0 )
+        break;
+      if ( filp->f_flags & O_NONBLOCK )
+        return - EAGAIN;
+      if ( wait_event_interruptible(device_queue,!list_empty(&queued_list)) != 0 )
+        return - ERESTARTSYS;
+      continue;
+    }
+    // The slot cannot go away while it is being copied, see authdev_submit()
+    slot = list_entry(queued_list.next,struct request_slot,list);
+    list_del_init(&slot->list);
+    queued--;
+    slot->state = COPYING;
+    delay = queue_delay(slot);
+    spin_unlock(&queue_lock);
 
-    if ( client.state == READING )
-      client.state = WRITING;
-    // Wake up anyone waiting to write
-    wake_up_interruptible_sync(&device_queue);
+    e = 0;
+    if ( copy_to_user(buf + done,&slot->tag,sizeof(authdev_tag_t)) ||
+        copy_to_user(buf + done + offsetof(authdev_request_t,delay),&delay,
+          sizeof(delay)) ||
+        copy_to_user(buf + done + offsetof(authdev_request_t,request),
+          slot->request,sizeof(adm_ctrl_request_t)) )
+      e = - EFAULT;
+
+    spin_lock(&queue_lock);
+    if ( e == 0 )
+    {
+      slot->state = INFLIGHT;
+      list_add_tail(&slot->list,&inflight_list);
+      inflight++;
+      delays++;
+      delay_sum += delay;
+      if ( delay > delay_max )
+        delay_max = delay;
+    }
+    else
+    {
+      // Put it back for the next reader
+      slot->state = QUEUED;
+      list_add(&slot->list,&queued_list);
+      queued++;
+    }
+    // The submitter may return as soon as the lock is released
+    wake_up(&slot->wait);
+    spin_unlock(&queue_lock);
+
+    if ( e != 0 )
+      return ( done > 0 )? done : e;
+    done += sizeof(authdev_request_t);
   }
-  up(&client.mutex);
-  
-  DEBUG_CMD(printk(KERN_DEBUG "%s: exiting read\n",MODNAME));
-  
-  return count;
+
+  DEBUG_CMD2(printk(KERN_DEBUG "%s: read %d requests\n",MODNAME,
+        (int)(done / sizeof(authdev_request_t))));
+  return done;
 }
 
 /** \brief Device write operation
+  Writes results for requests previously read, in any order.
+  \return the number of bytes written, or - EINVAL if count is not a multiple
+  of sizeof(authdev_result_t)
 */
 static ssize_t
 authdev_write(struct file *filp,const char *buf,size_t count,loff_t *f_pos)
 {
-  DEBUG_CMD(printk(KERN_DEBUG "%s: entering write\n",MODNAME));
+  struct request_slot *slot;
+  struct list_head *pos;
+  authdev_result_t res;
+  size_t done;
 
-  // Wait if we are not supposed to write
-  if ( wait_event_interruptible(device_queue,client.state == WRITING) != 0 )
-    return - ERESTARTSYS;
+  DEBUG_CMD2(printk(KERN_DEBUG "%s: entering write\n",MODNAME));
 
-  DEBUG_CMD(printk(KERN_DEBUG "%s: performing write\n",MODNAME));
+  if ( count == 0 || (count % sizeof(authdev_result_t)) != 0 )
+    return - EINVAL;
 
-  // Do some boundary checking
-  if ( *f_pos >= (sizeof(adm_ctrl_request_t) + sizeof(adm_ctrl_result_t)) )
-    return 0;
-  if ( (count + *f_pos) > (sizeof(adm_ctrl_request_t) + 
-        sizeof(adm_ctrl_result_t)) )
-    count = (sizeof(adm_ctrl_request_t) + sizeof(adm_ctrl_result_t)) - *f_pos;
-
-  // Copy data from user-space
-  if ( copy_from_user(&client.result,buf,count) )
-    return - EFAULT;
-
-  if ( down_interruptible(&client.mutex) )
-    return - ERESTARTSYS;
-  *f_pos += count;
-  if ( *f_pos == (sizeof(adm_ctrl_request_t) + sizeof(adm_ctrl_result_t)) )
+  for(done = 0; done < count ;done += sizeof(authdev_result_t))
   {
-    DEBUG_CMD(printk(KERN_DEBUG "%s: write complete\n",MODNAME));
-    // Rewind
-    *f_pos = 0;
-    if ( client.state == WRITING )
-      client.state = IDLE;
-    // Wake up anyone waiting to get results
-    wake_up_interruptible_sync(&request_queue);
+    if ( copy_from_user(&res,buf + done,sizeof(authdev_result_t)) )
+      return ( done > 0 )? done : - EFAULT;
+
+    spin_lock(&queue_lock);
+    slot = NULL;
+    list_for_each(pos,&inflight_list)
+      if ( list_entry(pos,struct request_slot,list)->tag == res.tag )
+      {
+        slot = list_entry(pos,struct request_slot,list);
+        break;
+      }
+    if ( slot )
+    {
+      memcpy(slot->result,&res.result,sizeof(adm_ctrl_result_t));
+      list_del_init(&slot->list);
+      inflight--;
+      completed++;
+      slot->state = DONE;
+      wake_up(&slot->wait);
+    }
+    else
+      DEBUG_CMD(printk(KERN_DEBUG "%s: no request with tag %u\n",MODNAME,
+            res.tag));
+    spin_unlock(&queue_lock);
   }
-  up(&client.mutex);
 
-  DEBUG_CMD(printk(KERN_DEBUG "%s: exiting write\n",MODNAME));
+  DEBUG_CMD2(printk(KERN_DEBUG "%s: exiting write\n",MODNAME));
   
   return count;
 }
@@ -252,6 +607,9 @@ authdev_write(struct file *filp,const char *buf,size_t count,loff_t *f_pos)
 static struct file_operations dev_ops = {
 read: authdev_read,
 write: authdev_write,
+poll: authdev_poll,
+ioctl: authdev_ioctl,
+mmap: authdev_mmap,
 open: authdev_open,
 release: authdev_release,
 owner: THIS_MODULE
@@ -261,13 +619,16 @@ int
 authdev_submit(adm_ctrl_request_t *request,adm_ctrl_result_t *result,
     long timeout)
 {
-  int e = - ERESTARTSYS;
+  struct request_slot slot;
+  long left;
+  int e;
 
   if ( try_module_get(THIS_MODULE) == 0 )
     return - EAGAIN;
 
+  spin_lock(&queue_lock);
   pending++;
-  DEBUG_CMD(printk(KERN_DEBUG "%s: submitting request %u\n",MODNAME,pending));
+  DEBUG_CMD2(printk(KERN_DEBUG "%s: submitting request %u\n",MODNAME,pending));
   
   if ( device_open == 0 )
   {
@@ -276,53 +637,75 @@ authdev_submit(adm_ctrl_request_t *request,adm_ctrl_result_t *result,
     goto ret;
   }
 
-  if ( down_interruptible(&client.sem) )
-    goto ret;
-
-  memcpy(&client.request,request,sizeof(adm_ctrl_request_t));
   memset(result,0,sizeof(adm_ctrl_result_t));
-  client.state = READING;
-  // Wake any processes waiting to read
-  wake_up_interruptible(&device_queue);
-
-  DEBUG_CMD(printk(KERN_DEBUG "%s: waiting for result\n",MODNAME));
-
-  if ( (e = wait_event_interruptible_timeout(request_queue,client.state == IDLE,
-          timeout)) == 0 )
-  {
-    DEBUG_CMD(printk(KERN_DEBUG "%s: submission timed out\n",MODNAME));
-    e = - ETIME;
-  }
-  else if ( e < 0 )
+  slot.tag = next_tag++;
+  slot.state = QUEUED;
+  slot.request = request;
+  slot.result = result;
+  do_gettimeofday(&slot.queued_at);
+  slot.ring_index = -1;
+  init_waitqueue_head(&slot.wait);
+  list_add_tail(&slot.list,&queued_list);
+  queued++;
+  spin_unlock(&queue_lock);
+
+  // Place it in the ring, or wake any processes waiting to read
+  if ( ring_fill() == 0 )
+    wake_up_interruptible(&device_queue);
+
+  DEBUG_CMD2(printk(KERN_DEBUG "%s: waiting for result of %u\n",MODNAME,
+        slot.tag));
+
+  left = wait_event_interruptible_timeout(slot.wait,slot.state >= DONE,
+      timeout);
+
+  spin_lock(&queue_lock);
+  // A reader may be copying the request from us, let it finish
+  while( slot.state == COPYING )
   {
-    DEBUG_CMD(printk(KERN_DEBUG "%s: submission interrupted\n",MODNAME));
-    goto int_ret;
+    spin_unlock(&queue_lock);
+    wait_event(slot.wait,slot.state != COPYING);
+    spin_lock(&queue_lock);
   }
-  else
-    e = 0;
-
-  /*
-  // Check state. If we were in the process of completetion return the result
-  // else set state to idle and fail
-  down(&client.mutex);
-  if ( client.state == IDLE )
-    e = 0;
-  client.state = IDLE;
-  up(&client.mutex);
-  */
 
-  if ( e == 0 )
+  switch( slot.state )
   {
-    DEBUG_CMD(printk(KERN_DEBUG "%s: copying result\n",MODNAME));
-    memcpy(result,&client.result,sizeof(adm_ctrl_result_t));
+    case DONE:
+      e = 0;
+      break;
+    case ABORTED:
+      DEBUG_CMD(printk(KERN_DEBUG "%s: device closed\n",MODNAME));
+      e = - EAGAIN;
+      break;
+    default:
+      // Still queued or in user-space
+      list_del(&slot.list);
+      if ( slot.state == QUEUED )
+        queued--;
+      else
+        inflight--;
+      // The ring slot stays busy until user-space stores a result in it
+      if ( slot.ring_index >= 0 && ring_owner[slot.ring_index] == &slot )
+        ring_owner[slot.ring_index] = NULL;
+      if ( left < 0 )
+      {
+        DEBUG_CMD(printk(KERN_DEBUG "%s: submission interrupted\n",MODNAME));
+        e = - ERESTARTSYS;
+      }
+      else
+      {
+        DEBUG_CMD(printk(KERN_DEBUG "%s: submission timed out\n",MODNAME));
+        timedout++;
+        e = - ETIME;
+      }
+      break;
   }
- 
-int_ret:
-  up(&client.sem);
+
 ret:
-  module_put(THIS_MODULE);
-  DEBUG_CMD(printk(KERN_DEBUG "%s: submission finished %u\n",MODNAME,pending));
   pending--;
+  spin_unlock(&queue_lock);
+  module_put(THIS_MODULE);
+  DEBUG_CMD2(printk(KERN_DEBUG "%s: submission finished %u\n",MODNAME,pending));
   return e;
 }
 
@@ -332,27 +715,79 @@ static int
 proc_read(char *page, char **start, off_t off, int count, int *eof, void *data)
 {
   int len;
-  char *cur_state = NULL;
 
+  spin_lock(&queue_lock);
   len = sprintf(page,"Device open: %s\n",(device_open==0)?"NO":"YES");
   len += sprintf(page+len,"Requests pending: %u\n",pending);
-  switch( client.state )
-  {
-    case IDLE:
-      cur_state = "IDLE";
-      break;
-    case READING:
-      cur_state = "READING";
-      break;
-    case WRITING:
-      cur_state = "WRITING";
-      break;
-  }
-  len += sprintf(page+len,"Current state: %s\n",cur_state);
+  len += sprintf(page+len,"Requests queued: %u\n",queued);
+  len += sprintf(page+len,"Requests in user-space: %u\n",inflight);
+  len += sprintf(page+len,"Requests completed: %lu\n",completed);
+  len += sprintf(page+len,"Requests timed out: %lu\n",timedout);
+  len += sprintf(page+len,"Queue delay (usec): mean %lu, max %u\n",
+      ( delays > 0 )? (unsigned long)(delay_sum / delays) : 0UL,delay_max);
+  if ( ring )
+    len += sprintf(page+len,"Ring: %u slots, %u free, %s, %lu requests\n",
+        ring->slots,ring_free,( ring_mapped )? "mapped" : "not mapped",
+        ring_requests);
+  spin_unlock(&queue_lock);
   *eof = 1;
   return len;
 }
 
+/** \brief Free the ring
+*/
+static void
+ring_free_all(void)
+{
+  unsigned long off;
+
+  if ( ring )
+  {
+    for(off = 0; off < ring_size ;off += PAGE_SIZE)
+      ClearPageReserved(vmalloc_to_page((char *)ring + off));
+    vfree(ring);
+    ring = NULL;
+  }
+  if ( ring_owner )
+    kfree(ring_owner);
+  if ( ring_busy )
+    kfree(ring_busy);
+  ring_owner = NULL;
+  ring_busy = NULL;
+}
+
+/** \brief Allocate the ring shared with user-space
+  The pages are reserved, so that they can be mapped with remap_pfn_range().
+  \return 0 on success, or - ENOMEM
+*/
+static int
+ring_alloc(void)
+{
+  unsigned long off;
+
+  ring_size = PAGE_ALIGN(sizeof(authdev_ring_t) +
+      ring_slots * sizeof(authdev_ring_slot_t));
+  if ( (ring = vmalloc(ring_size)) == NULL )
+    goto error;
+  memset(ring,0,ring_size);
+  for(off = 0; off < ring_size ;off += PAGE_SIZE)
+    SetPageReserved(vmalloc_to_page((char *)ring + off));
+  ring->version = AUTHDEV_RING_VERSION;
+  ring->slots = ring_slots;
+  ring->slot_size = sizeof(authdev_ring_slot_t);
+
+  ring_owner = kmalloc(ring_slots * sizeof(struct request_slot *),GFP_KERNEL);
+  ring_busy = kmalloc(ring_slots,GFP_KERNEL);
+  if ( ring_owner == NULL || ring_busy == NULL )
+    goto error;
+  ring_reset();
+  return 0;
+
+error:
+  ring_free_all();
+  return - ENOMEM;
+}
+
 /** \brief Module initialisation function 
 */
 static int
@@ -361,15 +796,19 @@ authdev_init(void)
   int e = - EAGAIN;
 
   // Initialise variables
-  client.state = IDLE;
-  sema_init(&client.sem,1);
-  init_MUTEX(&client.mutex);
-  spin_lock_init(&device_lock);
+  spin_lock_init(&queue_lock);
+
+  // Allocate the ring
+  if ( ring_slots > 0 && ring_alloc() != 0 )
+    return - ENOMEM;
 
   // Create proc file
   if ( (proc_file = create_proc_read_entry(PROC_NAME,PROC_PERM,NULL,proc_read,
           NULL)) == NULL )
+  {
+    ring_free_all();
     return - EAGAIN;
+  }
 
   // Register device region
 #if LINUX_VERSION_CODE > KERNEL_VERSION(2,5,0)
@@ -409,6 +848,7 @@ error:
   unregister_chrdev_region(device,1);
 reg_dev_error:
   remove_proc_entry(PROC_NAME,NULL);
+  ring_free_all();
   printk(KERN_INFO "%s failed to initialise\n",MODNAME);
   return e;
 }
@@ -420,6 +860,7 @@ authdev_exit(void)
   cdev_del(cdevice);
   unregister_chrdev_region(device,1);
   remove_proc_entry(PROC_NAME,NULL);
+  ring_free_all();
   printk(KERN_INFO "%s exiting\n",MODNAME);
 }
 
@@ -0,0 +1,113 @@
+/* authdev_msg.h
+
+  Copyright 2004  Georgios Portokalidis <digital_bull@users.sourceforge.net>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef AUTHDEV_MSG_H
+#define AUTHDEV_MSG_H
+
+/*! \file authdev_msg.h
+ *  \brief Records exchanged with the authdev character device
+ *  \author Georgios Portokalidis
+ *
+ *  The same file is used by the kernel module and by user-space, so it
+ *  expects adm_ctrl_request_t and adm_ctrl_result_t to have been defined by
+ *  kadm_ctrl.h or adm_ctrl.h.
+ *
+ *  A read() from the device returns as many queued requests as fit in the
+ *  buffer, at least one, each preceded by its tag. A write() passes back any
+ *  number of results, in any order, each preceded by the tag of the request
+ *  it answers. Results for requests that have timed out are ignored. Several
+ *  threads may read and write the device at the same time.
+ *
+ *  Alternatively, the device can be mmap()ed to access a ring of slots shared
+ *  with the kernel, avoiding the copies and a read() and write() per request.
+ *  The size to map is returned by the AUTHDEV_IOC_RING_SIZE ioctl. The kernel
+ *  places requests in free slots and marks them AUTHDEV_SLOT_REQUEST; poll()
+ *  reports POLLIN while there are such slots. User-space marks the slots it
+ *  serves AUTHDEV_SLOT_BUSY, stores the result in place, marks them
+ *  AUTHDEV_SLOT_RESULT and then calls the AUTHDEV_IOC_COMPLETE ioctl, which
+ *  passes the results to the submitters and frees the slots. The ioctl
+ *  numbers need linux/ioctl.h or sys/ioctl.h to have been included.
+ */
+
+//! Tag identifying a request queued in the device
+typedef unsigned int authdev_tag_t;
+
+//! Request record read from the device
+struct authdev_request
+{
+	authdev_tag_t tag; //!< Tag of the request
+	//! Microseconds the request was queued in the device before being read
+	unsigned int delay;
+	adm_ctrl_request_t request; //!< The request
+};
+//! Request record datatype
+typedef struct authdev_request authdev_request_t;
+
+//! Result record written to the device
+struct authdev_result
+{
+	authdev_tag_t tag; //!< Tag of the request answered
+	adm_ctrl_result_t result; //!< The result
+};
+//! Result record datatype
+typedef struct authdev_result authdev_result_t;
+
+//! Version of the ring layout
+#define AUTHDEV_RING_VERSION 1
+
+//! Slot owned by the kernel
+#define AUTHDEV_SLOT_FREE 0
+//! Slot holding a request for user-space
+#define AUTHDEV_SLOT_REQUEST 1
+//! Slot claimed by a user-space thread
+#define AUTHDEV_SLOT_BUSY 2
+//! Slot holding a result, to be collected by AUTHDEV_IOC_COMPLETE
+#define AUTHDEV_SLOT_RESULT 3
+
+//! Slot of the ring shared with the kernel
+struct authdev_ring_slot
+{
+	volatile unsigned int state; //!< One of AUTHDEV_SLOT_*
+	authdev_tag_t tag; //!< Tag of the request
+	//! Microseconds the request was queued in the device before being placed
+	unsigned int delay;
+	adm_ctrl_request_t request; //!< The request
+	adm_ctrl_result_t result; //!< The result, stored by user-space
+};
+//! Ring slot datatype
+typedef struct authdev_ring_slot authdev_ring_slot_t;
+
+//! Ring shared with the kernel, at the start of the mapping
+struct authdev_ring
+{
+	unsigned int version; //!< AUTHDEV_RING_VERSION
+	unsigned int slots; //!< Number of slots
+	unsigned int slot_size; //!< sizeof(authdev_ring_slot_t)
+	authdev_ring_slot_t slot[0]; //!< The slots
+};
+//! Ring datatype
+typedef struct authdev_ring authdev_ring_t;
+
+//! Return the number of bytes to mmap() to access the ring
+#define AUTHDEV_IOC_RING_SIZE _IO('a',1)
+//! Collect the results of slots marked AUTHDEV_SLOT_RESULT
+/** Returns the number of results collected. */
+#define AUTHDEV_IOC_COMPLETE _IO('a',2)
+
+#endif
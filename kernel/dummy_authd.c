@@ -27,8 +27,13 @@
 #include <string.h>
 
 #include "adm_ctrl.h"
+#include "authdev_msg.h"
+
+//! Largest number of requests read at once
+#define MAX_BATCH 64
 
 static char *device_name = NULL;
+static unsigned int batch = 1;
 
 static inline void
 parse_arguments(int argc,char **argv)
@@ -36,10 +41,15 @@ parse_arguments(int argc,char **argv)
   if ( argc < 2 )
   {
     fprintf(stderr,"%s: Missing argument(s)\n",*argv);
-    fprintf(stderr,"Usage: %s DEVICE_NAME\n",*argv);
+    fprintf(stderr,"Usage: %s DEVICE_NAME [BATCH]\n",*argv);
     exit(1);
   }
   device_name = argv[1];
+  if ( argc > 2 && ((batch = (unsigned int)atoi(argv[2])) < 1 || batch > MAX_BATCH) )
+  {
+    fprintf(stderr,"%s: Batch must be between 1 and %u\n",*argv,MAX_BATCH);
+    exit(1);
+  }
 }
 
 static int fd;
@@ -61,11 +71,19 @@ cleanup(int data)
 int 
 main(int argc,char **argv)
 {
-  adm_ctrl_request_t request;
-  adm_ctrl_result_t result;
+  authdev_request_t *requests;
+  authdev_result_t results[MAX_BATCH];
+  ssize_t r;
+  unsigned int i,n;
 
   parse_arguments(argc,argv);
 
+  if ( (requests = malloc(batch * sizeof(authdev_request_t))) == NULL )
+  {
+    perror("malloc");
+    return 1;
+  }
+
   printf("Opening device %s ...",device_name);
   if ( (fd = open(device_name,O_RDWR)) == -1 )
   {
@@ -83,15 +101,21 @@ main(int argc,char **argv)
   while( 1 )
   {
     printf("Reading ..."); fflush(stdout);
-    if ( read(fd,&request,sizeof(adm_ctrl_request_t)) < sizeof(adm_ctrl_request_t) )
+    if ( (r = read(fd,requests,batch * sizeof(authdev_request_t))) < (ssize_t)sizeof(authdev_request_t) )
     {
       putchar('\n');
       perror("read");
       break;
     }
-    memcpy(&result,&request,sizeof(adm_ctrl_result_t));
-    printf("\nWriting ..."); fflush(stdout);
-    if ( write(fd,&result,sizeof(adm_ctrl_result_t)) < sizeof(adm_ctrl_result_t) )
+    n = r / sizeof(authdev_request_t);
+    // Answer in reverse order, to exercise the matching of tags
+    for(i = 0; i < n ;i++)
+    {
+      results[i].tag = requests[n - i - 1].tag;
+      memcpy(&results[i].result,&requests[n - i - 1].request,sizeof(adm_ctrl_result_t));
+    }
+    printf(" %u\nWriting ...",n); fflush(stdout);
+    if ( write(fd,results,n * sizeof(authdev_result_t)) < (ssize_t)(n * sizeof(authdev_result_t)) )
     {
       putchar('\n');
       perror("write");
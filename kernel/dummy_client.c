@@ -55,7 +55,7 @@ MODULE_LICENSE("GPL");
 //! Proc file permissions
 #define PROC_PERM 0644
 //! Maximum number of threads that can be started
-#define MAX_THREADS_NUM 5U
+#define MAX_THREADS_NUM 32U
 //! Maximum period (in seconds) that can be used
 #define MAX_PERIOD 120LU
 //! Maximum timeout (in seconds) for requests submission
@@ -73,6 +73,14 @@ static long timeout = 2;
 static struct workqueue_struct *thread[MAX_THREADS_NUM];
 //! Threads number queue
 static spinlock_t tn_lock;
+//! Submission counters lock
+static spinlock_t stats_lock;
+//! Requests submitted
+static unsigned long submitted = 0;
+//! Requests that failed
+static unsigned long failed = 0;
+//! Requests that returned a result other than the one expected
+static unsigned long invalid = 0;
 
 struct mywork
 {
@@ -96,17 +104,32 @@ work_run(void *d)
 {
   struct mywork *work = (struct mywork *)d;
 
+  int e;
+
   memset(&work->result,0,sizeof(adm_ctrl_result_t));
-  if ( authdev_submit(&work->request,&work->result,timeout) != 0 )
+  // Make each thread's request distinct, so that results returned to the
+  // wrong thread are detected
+  memcpy(work->request.pubkey,&work->id,sizeof(work->id));
+  e = authdev_submit(&work->request,&work->result,timeout);
+
+  spin_lock(&stats_lock);
+  submitted++;
+  if ( e != 0 )
+  {
+    failed++;
     printk(KERN_INFO "%s: (%u)submission failed\n",MODNAME,work->id);
+  }
   else
   {
-    printk(KERN_INFO "%s: (%u)submission succeeded\n",MODNAME,work->id);
-    if ( memcmp(&work->request,&work->result,sizeof(adm_ctrl_result_t)) == 0 )
-      printk(KERN_INFO "%s: (%u)results valid\n",MODNAME,work->id);
-    else
+    DEBUG_CMD2(printk(KERN_INFO "%s: (%u)submission succeeded\n",MODNAME,work->id));
+    // The dummy authd returns the first bytes of the request as the result
+    if ( memcmp(&work->request,&work->result,sizeof(adm_ctrl_result_t)) != 0 )
+    {
+      invalid++;
       printk(KERN_INFO "%s: (%u)results invalid!\n",MODNAME,work->id);
+    }
   }
+  spin_unlock(&stats_lock);
   if ( work->active && period > 0 )
     queue_delayed_work(thread[work->id],&work->work,period);
 }
@@ -209,6 +232,11 @@ proc_read(char *page, char **start, off_t off, int count, int *eof, void *data)
     len = sprintf(page,"Period: INACTIVE\n");
   len += sprintf(page+len,"Threads number: %u\n",threads);
   len += sprintf(page+len,"Submission timeout: %ld\n",timeout / HZ);
+  spin_lock(&stats_lock);
+  len += sprintf(page+len,"Submitted: %lu\n",submitted);
+  len += sprintf(page+len,"Failed: %lu\n",failed);
+  len += sprintf(page+len,"Invalid results: %lu\n",invalid);
+  spin_unlock(&stats_lock);
   *eof = 1;
   return len;
 }
@@ -291,6 +319,7 @@ dummy_cl_init(void)
   timeout *= HZ;
 
   spin_lock_init(&tn_lock);
+  spin_lock_init(&stats_lock);
 
   // Create proc file
   if ( (proc_file = create_proc_entry(PROC_NAME,PROC_PERM,NULL)) == NULL )
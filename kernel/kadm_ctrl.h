@@ -59,6 +59,14 @@ struct adm_ctrl_result
   int PCV; //!< The compliance value of a flow, as returned by keynote
 	int error; //!< Error feedback
 	size_t resources_num; //!< Number of required resources
+	//! Session opened for an ADMCTRL_SESSION_OPEN request, or 0
+	unsigned int session_id;
+	//! Seconds the session is valid for
+	unsigned int session_lifetime;
+	//! Length of session_key
+	size_t session_key_len;
+	//! Key of the session, encrypted with the public key of the request
+	unsigned char session_key[MAX_ENC_NONCE_SIZE];
 };
 //! Admission control results datatype
 typedef struct adm_ctrl_result adm_ctrl_result_t;
@@ -72,6 +80,13 @@ struct adm_ctrl_pair
 //! Admission control name-value pair datatype
 typedef struct adm_ctrl_pair adm_ctrl_pair_t;
 
+//! Authenticate with the encrypted nonce and open a session
+#define ADMCTRL_SESSION_OPEN 0x1
+//! Authenticate with the MAC of the session in session_id
+#define ADMCTRL_SESSION_USE 0x2
+//! Close the session after authenticating with it
+#define ADMCTRL_SESSION_CLOSE 0x4
+
 //! Admission control request structure
 /** Contains all the required data for a client's request to be authenticated
  * and authorized. */
@@ -97,6 +112,13 @@ struct adm_ctrl_request
   unsigned int functions_num;
   //! The buffer with the serialized function list
   unsigned char function_list[MAX_FUNCTION_LIST_SIZE];
+
+	//! Session flags, see ADMCTRL_SESSION_OPEN
+	unsigned int session_flags;
+	//! Session authenticating the request, with ADMCTRL_SESSION_USE
+	unsigned int session_id;
+	//! HMAC of the other fields with the key of the session
+	unsigned char session_mac[SESSION_MAC_SIZE];
 };
 //! The scampi authorization datatype
 typedef struct adm_ctrl_request adm_ctrl_request_t;
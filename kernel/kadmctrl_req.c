@@ -48,17 +48,164 @@ MODULE_LICENSE("GPL");
 */
 
 
+/** \brief Append zeros to a function list up to an alignment
+
+	\param buf the function list
+	\param off reference to the offset in buf
+	\param align the alignment
+
+	\return 0 on success, or -1 if the list is full
+*/
 static int
-append_string(const char *s,unsigned char *buf,size_t *buf_size)
+append_pad(unsigned char *buf,size_t *off,size_t align)
 {
-	size_t len;
+	size_t noff;
 
-	// Copy function name
-	len = strlen(s) + 1;
-	if ( (len + *buf_size) > MAX_FUNCTION_LIST_SIZE )
+	noff = ADMCTRL_FLIST_ALIGN(*off,align);
+	if ( noff > MAX_FUNCTION_LIST_SIZE )
 		return -1;
-	strcpy(buf + *buf_size,s);
-	*buf_size += len;
+	memset(buf + *off,0,noff - *off);
+	*off = noff;
+	return 0;
+}
+
+/** \brief Append a little-endian number of 4 or 8 bytes to a function list
+
+	\param buf the function list
+	\param off reference to the offset in buf
+	\param v the number
+	\param size the size of the number in the list
+
+	\return 0 on success, or -1 if the list is full
+*/
+static int
+append_number(unsigned char *buf,size_t *off,unsigned long long v,
+    size_t size)
+{
+	if ( append_pad(buf,off,size) != 0 ||
+      (*off + size) > MAX_FUNCTION_LIST_SIZE )
+		return -1;
+	if ( size == 4 )
+		admctrl_put_le32(buf + *off,(unsigned int)v);
+	else
+		admctrl_put_le64(buf + *off,v);
+	*off += size;
+	return 0;
+}
+
+/** \brief Append a length prefixed string to a function list
+
+	\param s the string
+	\param len the length of s
+	\param buf the function list
+	\param off reference to the offset in buf
+
+	\return 0 on success, or -1 if the list is full or s too long
+*/
+static int
+append_string(const char *s,size_t len,unsigned char *buf,size_t *off)
+{
+	if ( len > 0xffff || append_pad(buf,off,2) != 0 ||
+			(*off + 2 + len + 1) > MAX_FUNCTION_LIST_SIZE )
+		return -1;
+	admctrl_put_le16(buf + *off,len);
+	memcpy(buf + *off + 2,s,len);
+	buf[*off + 2 + len] = '\0';
+	*off += 2 + len + 1;
+	return 0;
+}
+
+/** \brief Append the name, library and argument types of a function to a 
+  function list
+	The header of the list is written before the first function, and the
+	arguments are aligned.
+
+	\return 0 on success, or -1 if the list is full
+*/
+static int
+append_function(unsigned char *buf,size_t *off,const char *fname,
+    const char *lname,const char *argt)
+{
+	if ( *off == 0 )
+	{
+		memset(buf,0,ADMCTRL_FLIST_HEADER_SIZE);
+		memcpy(buf,ADMCTRL_FLIST_MAGIC,ADMCTRL_FLIST_MAGIC_SIZE);
+		buf[ADMCTRL_FLIST_MAGIC_SIZE] = ADMCTRL_FLIST_VERSION;
+		*off = ADMCTRL_FLIST_HEADER_SIZE;
+	}
+	if ( append_string(fname,strlen(fname),buf,off) != 0 ||
+			append_string(lname,strlen(lname),buf,off) != 0 ||
+			append_string(argt,strlen(argt),buf,off) != 0 )
+		return -1;
+	return append_pad(buf,off,ADMCTRL_FLIST_ARGS_ALIGN);
+}
+
+/** \brief Encode arguments serialized in the format of authd 0.8
+	See admctrl_req.c
+
+	\return 0 on success, or -1 on error
+*/
+static int
+append_sargs(unsigned char *buf,size_t *off,const char *argt,
+    const unsigned char **args,size_t *args_size,unsigned int depth)
+{
+	const char *fname,*lname,*fargt;
+	unsigned long long ullong;
+	size_t len;
+	int integer;
+
+	for(; *argt != '\0' ; argt++)
+		switch( *argt )
+		{
+			case INT_TYPE:
+				if ( *args_size < sizeof(int) )
+					return -1;
+				memcpy(&integer,*args,sizeof(int));
+				if ( append_number(buf,off,(unsigned int)integer,4) != 0 )
+					return -1;
+				*args += sizeof(int);
+				*args_size -= sizeof(int);
+				break;
+			case ULONG_LONG_TYPE:
+			case DOUBLE_TYPE:
+				if ( *args_size < sizeof(unsigned long long) )
+					return -1;
+				memcpy(&ullong,*args,sizeof(unsigned long long));
+				if ( append_number(buf,off,ullong,8) != 0 )
+					return -1;
+				*args += sizeof(unsigned long long);
+				*args_size -= sizeof(unsigned long long);
+				break;
+			case STRING_TYPE:
+				if ( (len = strnlen((const char *)*args,*args_size)) == *args_size ||
+						append_string((const char *)*args,len,buf,off) != 0 )
+					return -1;
+				*args += len + 1;
+				*args_size -= len + 1;
+				break;
+			case FUNCTION_TYPE:
+				if ( depth >= MAX_FUNCTION_NESTING )
+					return -1;
+				fname = (const char *)*args;
+				if ( (len = strnlen(fname,*args_size)) == *args_size )
+					return -1;
+				lname = fname + len + 1;
+				*args_size -= len + 1;
+				if ( (len = strnlen(lname,*args_size)) == *args_size )
+					return -1;
+				fargt = lname + len + 1;
+				*args_size -= len + 1;
+				if ( (len = strnlen(fargt,*args_size)) == *args_size )
+					return -1;
+				*args_size -= len + 1;
+				*args = (const unsigned char *)fargt + len + 1;
+				if ( append_function(buf,off,fname,lname,fargt) != 0 ||
+						append_sargs(buf,off,fargt,args,args_size,depth + 1) != 0 )
+					return -1;
+				break;
+			default:
+				return -1;
+		}
 	return 0;
 }
 
@@ -115,6 +262,8 @@ const char *value)
 
 /** \brief Add a function with serialised arguments to an admission control 
   request
+	The arguments are serialized in the format of authd 0.8, in the byte order
+	of the host, and are encoded like those of admctrl_req_add_function().
 
 	\param request reference to admission control request structure
 	\param fbuf_off reference to offset in request's serialised functions list
@@ -131,25 +280,21 @@ admctrl_req_add_sfunction(adm_ctrl_request_t *request,size_t *fbuf_off,
     const char *fname,const char *lname,const char *argt,
     const unsigned char *args,size_t args_size)
 {
-	if ( append_string(fname,request->function_list,fbuf_off) != 0 )
-		return -1;
-	if ( append_string(lname,request->function_list,fbuf_off) != 0 )
-		return -1;
-	if ( append_string(argt,request->function_list,fbuf_off) != 0 )
+	size_t off = *fbuf_off;
+
+	if ( append_function(request->function_list,&off,fname,lname,argt) != 0 ||
+			append_sargs(request->function_list,&off,argt,&args,&args_size,0) != 0 ||
+			args_size != 0 )
 		return -1;
-	if ( args_size > 0 )
-	{
-		if ( (args_size + *fbuf_off) > MAX_FUNCTION_LIST_SIZE )
-			return -1;
-		memcpy(request->function_list + *fbuf_off,args,args_size);
-		*fbuf_off += args_size;
-	}
+	*fbuf_off = off;
 	request->functions_num++;
 
 	return 0;
 }
 
 /** \brief Add a function to the session's request
+	The function list is encoded in version ADMCTRL_FLIST_VERSION, see
+	admctrl_argtypes.h.
 
 	\param request reference to an admission control request structure
 	\param fbuf_off reference to offset in request's serialised functions list
@@ -165,70 +310,48 @@ admctrl_req_add_function(adm_ctrl_request_t *request,size_t *fbuf_off,
     const char *fname,const char *lname,const char *argt,...)
 {
 	va_list ap;
-	size_t len;
-	int integer;
+	size_t off = *fbuf_off;
 	unsigned long long ullong;
 	double doubleval;
 	char *string;
+	int e = 0;
 
-	// Copy function name
-	if ( append_string(fname,request->function_list,fbuf_off) != 0 )
-		return -1;
-
-	// Copy function name
-	if ( append_string(lname,request->function_list,fbuf_off) != 0 )
-		return -1;
-
-	// Copy argument types string
-	if ( append_string(argt,request->function_list,fbuf_off) != 0 )
+	if ( append_function(request->function_list,&off,fname,lname,argt) != 0 )
 		return -1;
 
 	// Copy arguments
 	va_start(ap,argt);
-	while( *argt != '\0' )
+	for(; *argt != '\0' && e == 0 ; argt++)
 		switch( *argt )
 		{
 			case INT_TYPE:
-				integer = va_arg(ap,int);
-				if ( (*fbuf_off + sizeof(int)) > MAX_FUNCTION_LIST_SIZE )
-					goto fail;
-				memcpy(request->function_list + *fbuf_off,&integer,sizeof(int));
-				*fbuf_off += sizeof(int);
+				e = append_number(request->function_list,&off,
+            (unsigned int)va_arg(ap,int),4);
 				break;
 			case ULONG_LONG_TYPE:
 				ullong = va_arg(ap,unsigned long long);
-				if ( (*fbuf_off + sizeof(unsigned long long)) > MAX_FUNCTION_LIST_SIZE )
-					goto fail;
-				memcpy(request->function_list + *fbuf_off,&ullong,
-            sizeof(unsigned long long));
-				*fbuf_off += sizeof(unsigned long long);
+				e = append_number(request->function_list,&off,ullong,8);
 				break;
 			case DOUBLE_TYPE:
 				doubleval = va_arg(ap,double);
-				if ( (*fbuf_off + sizeof(double)) > MAX_FUNCTION_LIST_SIZE )
-					goto fail;
-				memcpy(request->function_list + *fbuf_off,&doubleval,sizeof(double));
-				*fbuf_off += sizeof(double);
+				memcpy(&ullong,&doubleval,sizeof(double));
+				e = append_number(request->function_list,&off,ullong,8);
 				break;
 			case STRING_TYPE:
 				string = va_arg(ap,char *);
-				len = strlen(string) + 1;
-				if ( (len + *fbuf_off) > MAX_FUNCTION_LIST_SIZE )
-					return -1;
-				strcpy(request->function_list + *fbuf_off,string);
-				*fbuf_off += len;
+				e = append_string(string,strlen(string),request->function_list,
+            &off);
 				break;
 			default:
-				return -1;
+				e = -1;
 		}
 	va_end(ap);
+	if ( e != 0 )
+		return -1;
+	*fbuf_off = off;
 	request->functions_num++;
 	
 	return 0;
-
-fail:
-	va_end(ap);
-	return -1;
 }
 
 int
@@ -31,6 +31,7 @@
 #include "keynote.h"
 #include "admctrl_config.h"
 #include "adm_ctrl.h"
+#include "adm_ctrl_func.h"
 #include "admctrl_argtypes.h"
 #include "admctrl_errno.h"
 #include "debug.h"
@@ -45,79 +46,12 @@
  *  \author Georgios Portokalidis
  */
 
-//! Function argument value
-union adm_ctrl_funcarg_value
-{
-	int integer; //!< Holds and integer
-	char *cstring; //!< Holds a C string
-	double dbl; //!< Holds a double
-	unsigned long long ullong; //!< Holds an unsigned long long
-};
-//! Function argument value datatype
-typedef union adm_ctrl_funcarg_value adm_ctrl_funcarg_value_t;
-
-
-//! Function argument definition
-/** It holds all the necessary information for a function argument */
-struct adm_ctrl_funcarg
-{
-	char type; //!< The type of the argument
-	adm_ctrl_funcarg_value_t value; //!< The value of the argument
-	//struct adm_ctrl_funcarg *next; //!< Pointer to next function argument
-};
-//! Function arguments datatype
-typedef struct adm_ctrl_funcarg adm_ctrl_funcarg_t;
-
-
-//! Function instance structure
-/** Contains information about the instances of a function. */
-struct adm_ctrl_func_instance
-{
-	unsigned int pos; //!< The position of the function in the list of functions
-	//! The number of arguments this instance has.
-	/** It should be the same as the args field in adm_ctrl_func */
-	unsigned int args;
-	adm_ctrl_funcarg_t *arg; //!< Array containing the arguments this instance was called with. Note that it is also a valid single linked list
-	struct adm_ctrl_func_instance *next; //!< Pointer to next instance
-};
-//! Function instances datatype
-typedef struct adm_ctrl_func_instance adm_ctrl_func_instance_t;
-
-struct adm_ctrl_lib
-{
-	char *name;
-	unsigned int num,
-	first,
-	last;
-	adm_ctrl_func_instance_t *instances;
-	struct adm_ctrl_lib *next;
-};
-typedef struct adm_ctrl_lib adm_ctrl_lib_t;
-
-//! Function type definition
-/** List of function types passed to admission control. Contains one entry for each distinct function used. */
-struct adm_ctrl_func
-{
-	char *name; //<! The name of the function type
-	unsigned int num, //!< Number of instances that it has
-	first, //!< The position of the first instance
-	last; //!< The position of the last instance
-	//! The number of arguments this function accepts.
-	/** All the instances of this function should have the same number of
-	 * arguments, but we set the smallest value here to be safe. */
-	unsigned int args;
-	//adm_ctrl_func_instance_t *instances; //!< Pointer to function instances
-	adm_ctrl_lib_t *library; //! Library implementations of this function type
-	struct adm_ctrl_func *next; //!< Pointer to next function
-};
-//! Function type datatype
-typedef struct adm_ctrl_func adm_ctrl_func_t;
-
-
 //! \brief Number of policy comply values we are going to use 
 #define NUMBER_OF_PCV 2
 //! The policy comply values used with keynote 
 static char *default_PCV[NUMBER_OF_PCV] = { "false", "true" };
+//! Where adm_ctrl_authorise() stores the time spent in each stage, if set
+static adm_ctrl_timing_t *timing = NULL;
 
 
 #if 0
@@ -147,6 +81,48 @@ keynote_debug(const char *o)
 #endif
 
 
+/** \brief Set where the time spent in each stage of adm_ctrl_authorise() is
+ * stored
+ *
+ * \param t reference to the timing structure, or NULL to stop timing
+ */
+void
+adm_ctrl_set_timing(adm_ctrl_timing_t *t)
+{
+	timing = t;
+}
+
+
+/** \brief Start timing a stage
+ *
+ * \param tv where the start time is stored
+ */
+static inline void
+stage_start(struct timeval *tv)
+{
+	if ( timing )
+		gettimeofday(tv,NULL);
+}
+
+
+/** \brief Add the time elapsed since stage_start() to a stage
+ *
+ * \param stage the stage
+ * \param tv the start time
+ */
+static inline void
+stage_stop(int stage,const struct timeval *tv)
+{
+	struct timeval now;
+
+	if ( timing == NULL )
+		return;
+	gettimeofday(&now,NULL);
+	timing->usec[stage] += (now.tv_sec - tv->tv_sec) * 1000000 + now.tv_usec - tv->tv_usec;
+	timing->done |= 1 << stage;
+}
+
+
 /**\brief Load a keynote policy and extract the assertions
  *
  * \param fn the filename to read the policy from
@@ -234,365 +210,756 @@ adm_ctrl_decrypt_nonce(bytestream *src,unsigned int *dest,char *pub)
 }
 
 
-/** \brief Deallocates all the memory reserved for functions
+//! Function instance as read from the buffer, before it is grouped
+struct parsed_instance
+{
+	char *name; //!< The name of the function
+	char *lib; //!< The name of the library
+	char *argt; //!< The types of the arguments
+	unsigned int pos; //!< The position of the function in the list of functions
+	unsigned int args; //!< The number of arguments
+	unsigned int arg; //!< Index of the first argument in the parsed arguments
+	unsigned int group; //!< Index of the function/library group
+};
+
+//! Function/library group, in order of first appearance
+struct parsed_group
+{
+	unsigned int func; //!< Index of the function type group
+	char *lib; //!< The name of the library
+	unsigned int num; //!< Number of instances
+	unsigned int first; //!< The position of the first instance
+	unsigned int last; //!< The position of the last instance
+	unsigned int lib_index; //!< Index of the library in the list
+	unsigned int inst; //!< Index of the first instance in the list
+	unsigned int arg; //!< Index of the first argument in the list
+};
+
+//! Function type group, in order of first appearance
+struct parsed_func
+{
+	char *name; //!< The name of the function
+	char *argt; //!< The types of the arguments
+	unsigned int args; //!< The number of arguments
+	unsigned int libs; //!< Number of library groups
+};
+
+//! State of the deserialization of a function list
+struct parse_state
+{
+	struct parsed_instance *inst; //!< Instances in the order they were read
+	unsigned int inst_num; //!< Number of instances
+	unsigned int inst_size; //!< Instances that fit in inst
+	adm_ctrl_funcarg_t *arg; //!< Arguments of the instances
+	unsigned int arg_num; //!< Number of arguments
+	unsigned int arg_size; //!< Arguments that fit in arg
+	struct parsed_group *group; //!< Function/library groups
+	unsigned int group_num; //!< Number of groups
+	struct parsed_func *func; //!< Function type groups
+	unsigned int func_num; //!< Number of function type groups
+	const admctrl_schema_t *schema; //!< Registry the function ids refer to, or NULL
+};
+
+
+/** \brief Deallocates a function list
  * 
- * \param list a pointer to functions
+ * \param list a pointer to the function list
  */
-static void 
-adm_ctrl_free_functions(adm_ctrl_func_t *list)
+void 
+adm_ctrl_free_functions(adm_ctrl_flist_t *list)
 {
-	adm_ctrl_func_t *lt;
-	adm_ctrl_lib_t *libt;
-	adm_ctrl_func_instance_t *ft;
+	free(list);
+}
+
 
-	// adm_ctrl_func
-	while( list != NULL )
+/** \brief Make room for more elements in an array that doubles when full
+ *
+ * \param array reference to the array
+ * \param size reference to the number of elements that fit in the array
+ * \param num the number of elements needed
+ * \param esize the size of an element
+ *
+ * \return 0 on success, or -1 if no memory was available
+ */
+static int
+grow_array(void **array,unsigned int *size,unsigned int num,size_t esize)
+{
+	unsigned int nsize;
+	void *a;
+
+	if ( num <= *size )
+		return 0;
+	for(nsize = ( *size > 0 )? *size : 16 ; nsize < num ; nsize *= 2)
+		;
+	if ( (a = realloc(*array,nsize * esize)) == NULL )
+		return -1;
+	*array = a;
+	*size = nsize;
+	return 0;
+}
+
+
+/** \brief Size of a value kept in an argument column
+ *
+ * \param type the type of the argument
+ *
+ * \return the size, or 0 if arguments of the type have no column
+ */
+static inline size_t
+column_value_size(char type)
+{
+	switch( type )
 	{
-		lt = list;
-		list = list->next;
-		// adm_ctrl_func.adm_ctrl_lib
-		while( lt->library != NULL )
-		{
-			libt = lt->library;
-			lt->library = lt->library->next;
-			// adm_ctrl_func.adm_ctrl_lib.adm_ctrl_func_instance
-			while( libt->instances != NULL )
-			{
-				ft = libt->instances;
-				libt->instances = libt->instances->next;
-				if ( ft->arg != NULL )
-					free(ft->arg);
-				free(ft);
-			}// End adm_ctrl_func.adm_ctrl_lib.adm_ctrl_func_instance
-			free(libt);
-		}// End adm_ctrl_func.adm_ctrl_lib
-		free(lt);
-	}// End adm_ctrl_func
+		case INT_TYPE:
+		case STRING_TYPE:
+			return sizeof(int);
+		case DOUBLE_TYPE:
+			return sizeof(double);
+		case ULONG_LONG_TYPE:
+			return sizeof(unsigned long long);
+	}
+	return 0;
 }
 
 
-/** \brief Add a function instance for assertion generation
+/** \brief Assign a function instance to its function/library group
  *
- * Allocates a new list, if called with a NULL list argument.
- * If it fails due to lack of memory it deallocates the whole list.
+ * All instances of a function must have the same argument types.
  *
- * \param list a pointer to a function type list
- * \param func_name name of the function type to add
- * \param lib_name name of the library the functions belongs to
- * \param func function instance data
+ * \param ps the state of the deserialization
+ * \param inst the instance
  *
- * \return a pointer to the list on success, or NULL on failure
+ * \return 0 on success, or -1 on failure
  */
-static adm_ctrl_func_t *
-add_function_instance(adm_ctrl_func_t *list,char *func_name,char *lib_name,adm_ctrl_func_instance_t *func)
+static int
+group_instance(struct parse_state *ps,struct parsed_instance *inst)
 {
-  adm_ctrl_func_t *l;
-	adm_ctrl_lib_t *lib;
-	adm_ctrl_func_instance_t *inst;
+	struct parsed_group *g;
+	unsigned int f,i,size;
 
-  // Try to locate function type & library
-  for(l = list,lib = NULL ; l != NULL ; l = l->next)
-		// Located function type
-		if ( strcmp(func_name,l->name) == 0 )
-		{
-			for(lib = l->library ; lib != NULL ; lib = lib->next)
-				// Located library
-				if ( strcmp(lib_name,lib->name) == 0 )
-					break;
+	// Try to locate function type & library
+	// Functions of the schema registry share their strings
+	for(f = 0 ; f < ps->func_num ; f++)
+		if ( inst->name == ps->func[f].name || strcmp(inst->name,ps->func[f].name) == 0 )
 			break;
-		}
-  
-  // New function type
-  if ( l == NULL )
-  {
-		// Generic values
-    if ( ( l = (adm_ctrl_func_t *)malloc(sizeof(adm_ctrl_func_t))) == NULL )
-			goto fail;
-		l->name = func_name;
-    l->num = 1;
-    l->first = l->last = func->pos;
-		l->library = NULL;
-		l->args = func->args;
-		// Connect to list
-		l->next = list;
-		list = l;
-  }
-  // Already existing function type
-  else
-  {
-		// Generic values
-    l->num++;
-		l->first = MIN(func->pos,l->first);
-		l->last = MAX(func->pos,l->last);
-		// Same function different number of arguments
-		if ( l->args != func->args )
-			goto fail;
-  }
 
-	// New Function library
-	if ( lib == NULL )
+	// New function type
+	if ( f == ps->func_num )
 	{
-		if ( (lib = (adm_ctrl_lib_t *)malloc(sizeof(adm_ctrl_lib_t))) == NULL )
-			goto fail;
-		lib->name = lib_name;
-		lib->num = 1;
-    lib->first = lib->last = func->pos;
-		lib->instances = func;
-		// Connect to list
-		lib->next = l->library;
-		l->library = lib;
+		size = ps->func_num;
+		if ( grow_array((void **)&ps->func,&size,f + 1,sizeof(struct parsed_func)) != 0 )
+			return -1;
+		ps->func[f].name = inst->name;
+		ps->func[f].argt = inst->argt;
+		ps->func[f].args = inst->args;
+		ps->func[f].libs = 0;
+		ps->func_num++;
+		i = ps->group_num;
 	}
+	// Same function different arguments
+	else if ( ps->func[f].args != inst->args ||
+			(ps->func[f].argt != inst->argt && strcmp(ps->func[f].argt,inst->argt) != 0) )
+		return -1;
 	else
-	// Already existing function library
+		for(i = 0 ; i < ps->group_num ; i++)
+			if ( ps->group[i].func == f &&
+					(inst->lib == ps->group[i].lib || strcmp(inst->lib,ps->group[i].lib) == 0) )
+				break;
+
+	// New function library
+	if ( i == ps->group_num )
 	{
-		lib->num++;
-		lib->first = MIN(lib->first,func->pos);
-		lib->last = MAX(lib->last,func->pos);
-		// Connect to list
-		for(inst = lib->instances ; inst->next != NULL ; inst = inst->next)
-			;
-		inst->next = func;
-		/*
-		func->next = lib->instances;
-		lib->instances = func;
-		*/
+		size = ps->group_num;
+		if ( grow_array((void **)&ps->group,&size,i + 1,sizeof(struct parsed_group)) != 0 )
+			return -1;
+		g = ps->group + i;
+		g->func = f;
+		g->lib = inst->lib;
+		g->num = 0;
+		g->first = g->last = inst->pos;
+		ps->func[f].libs++;
+		ps->group_num++;
 	}
-
-
-  return list;
-
-fail:
-	if ( l )
-		free(l);
-	if ( lib )
-		free(lib);
-	adm_ctrl_free_functions(list);
-	return NULL;
+	g = ps->group + i;
+	g->num++;
+	g->first = MIN(g->first,inst->pos);
+	g->last = MAX(g->last,inst->pos);
+	inst->group = i;
+	return 0;
 }
 
 
 /** \brief Deserializes a function from the buffer
  *
- * Deserializes a function from the buffer and inserts it to the provided list.
- * If the list doesn't exist it is created.
- * No data are copied from the buffer and the user has to free the list
- * when it is not needed anymore. If it fails for some reason, it 
- * deallocates the whole list.
+ * Deserializes a function from the buffer and appends it, and its arguments,
+ * to the parsed instances.
+ * No data are copied from the buffer.
  * Functions that have other functions as arguments, cause a recursive call
  * that results in the insertion of the argument function in the list with the
  * same index as the calling function.
+ * Sizes are checked before anything is read from the buffer, and numbers are
+ * copied from it, since they are not aligned.
  *
  * FORMAT: name + library + arguments type string + argument + ... 
  *
- * \param list The list to insert
+ * \param ps The state of the deserialization
  * \param index The index of the function being deserialized
+ * \param depth The number of functions this one is an argument of
  * \param buf Reference to the the buffer containing the serialized form.
  * It is updated to point to the next unprocessed serialized function
  * \param buf_size reference to the size of buf. It is updated when the 
  * reference to buf is updated
  *
- * \return The updated function list, or NULL on failure
+ * \return 0 on success, or -1 on failure
  */
-static adm_ctrl_func_t *
-deserialize_function(adm_ctrl_func_t *list,unsigned int index,unsigned char **buf,size_t *buf_size)
+static int
+deserialize_function(struct parse_state *ps,unsigned int index,unsigned int depth,unsigned char **buf,size_t *buf_size)
 {
-	adm_ctrl_func_instance_t *f;
-	char *name,*lib,*argt;
+	struct parsed_instance f;
+	adm_ctrl_funcarg_t *arg;
 	unsigned int j;
 	size_t l;
 
-	if ( (f = (adm_ctrl_func_instance_t *)malloc(sizeof(adm_ctrl_func_instance_t))) == NULL )
-		goto error;
-	f->next = NULL;
-	f->arg = NULL;
-
 	// Index of function
-	f->pos = index;
+	f.pos = index;
 		
 	// Function name
-	name = (char *)*buf;
-	if ( (l = strnlen(name,*buf_size)) == *buf_size )
-		goto error;
-	*buf_size -= l;
+	f.name = (char *)*buf;
+	if ( (l = strnlen(f.name,*buf_size)) == *buf_size )
+		return -1;
+	*buf_size -= l + 1;
 	*buf += l + 1;
 
 	// Library name
-	lib = (char *)*buf;
-	if ( (l = strnlen(lib,*buf_size)) == *buf_size )
-		goto error;
-	*buf_size -= l;
+	f.lib = (char *)*buf;
+	if ( (l = strnlen(f.lib,*buf_size)) == *buf_size )
+		return -1;
+	*buf_size -= l + 1;
 	*buf += l + 1;
 
 	// Number of arguments
-	argt = (char *)*buf;
-	if ( (l = strnlen(argt,*buf_size)) == *buf_size )
-		goto error;
-	*buf_size -= l;
-	f->args = l;
-	if ( f->args > MAX_ARGUMENTS_NUMBER )
-		goto error;
-	*buf += f->args + 1;
+	f.argt = (char *)*buf;
+	if ( (l = strnlen(f.argt,*buf_size)) == *buf_size )
+		return -1;
+	*buf_size -= l + 1;
+	f.args = l;
+	if ( f.args > MAX_ARGUMENTS_NUMBER )
+		return -1;
+	*buf += f.args + 1;
 
 	// Arguments
-	// At this point to avoid allocating memory for each argument,
-	// we allocate once an array for all of them
-	if ( f->args > 0 )
-	{
-		if ( (f->arg = (adm_ctrl_funcarg_t *)malloc(f->args * sizeof(adm_ctrl_funcarg_t))) == NULL )
-			goto error;
-	}
+	// They are reserved before any function arguments append theirs
+	f.arg = ps->arg_num;
+	if ( grow_array((void **)&ps->arg,&ps->arg_size,ps->arg_num + f.args,sizeof(adm_ctrl_funcarg_t)) != 0 )
+		return -1;
+	ps->arg_num += f.args;
 
-	for( j = 0 ; j < f->args ; j++ )
+	for( j = 0 ; j < f.args ; j++ )
 	{
+		// Function arguments may move the array
+		arg = ps->arg + f.arg + j;
 		// Parameter type
-		f->arg[j].type = argt[j];
+		arg->type = f.argt[j];
 		
-		switch( f->arg[j].type )
+		switch( arg->type )
 		{
 			case STRING_TYPE:
-				f->arg[j].value.cstring = (char *)*buf;
-				if ( (l = strnlen(f->arg[j].value.cstring,*buf_size)) == *buf_size )
-					goto error;
-				*buf_size -= l;
+				arg->value.cstring = (char *)*buf;
+				if ( (l = strnlen(arg->value.cstring,*buf_size)) == *buf_size )
+					return -1;
+				*buf_size -= l + 1;
 				*buf += l + 1;
 				break;
 			case INT_TYPE:
-				f->arg[j].value.integer = *(int *)*buf;
-				if ( *buf_size <= sizeof(int) )
-					goto error;
+				if ( *buf_size < sizeof(int) )
+					return -1;
+				memcpy(&arg->value.integer,*buf,sizeof(int));
 				*buf_size -= sizeof(int);
 				*buf += sizeof(int);
 				break;
 			case DOUBLE_TYPE:
-				f->arg[j].value.dbl = *(double *)*buf;
-				if ( *buf_size <= sizeof(double) )
-					goto error;
+				if ( *buf_size < sizeof(double) )
+					return -1;
+				memcpy(&arg->value.dbl,*buf,sizeof(double));
 				*buf_size -= sizeof(double);
 				*buf += sizeof(double);
 				break;
 			case ULONG_LONG_TYPE:
-				f->arg[j].value.ullong = *(unsigned long long *)*buf;
-				if ( *buf_size <= sizeof(unsigned long long) )
-					goto error;
+				if ( *buf_size < sizeof(unsigned long long) )
+					return -1;
+				memcpy(&arg->value.ullong,*buf,sizeof(unsigned long long));
 				*buf_size -= sizeof(unsigned long long);
 				*buf += sizeof(unsigned long long);
 				break;
 			case FUNCTION_TYPE:
-				f->arg[j].value.cstring = (char *)*buf;
+				arg->value.cstring = (char *)*buf;
 				// deserialize_function()advances buf pointer
-				if ( (list = deserialize_function(list,index,buf,buf_size)) == NULL )
-					goto error;
+				if ( depth >= MAX_FUNCTION_NESTING ||
+						deserialize_function(ps,index,depth + 1,buf,buf_size) != 0 )
+					return -1;
 				break;
 			default:
-				goto error;
+				return -1;
 		}
 	}// End of parameters loop
 
-	if ( (list = add_function_instance(list,name,lib,f)) != NULL )
-		return list;
+	if ( grow_array((void **)&ps->inst,&ps->inst_size,ps->inst_num + 1,sizeof(struct parsed_instance)) != 0 ||
+			group_instance(ps,&f) != 0 )
+		return -1;
+	ps->inst[ps->inst_num++] = f;
+	return 0;
+}
 
-error:
-	if ( f )
+
+/** \brief Reads a length prefixed string from a versioned function list
+ *
+ * \param buf the function list
+ * \param off reference to the offset in buf, updated past the string
+ * \param buf_size the size of buf
+ * \param len reference to store the length of the string
+ *
+ * \return the string, or NULL if it does not fit in buf or is not terminated
+ */
+static inline char *
+read_string(unsigned char *buf,size_t *off,size_t buf_size,size_t *len)
+{
+	size_t o;
+
+	o = ADMCTRL_FLIST_ALIGN(*off,2);
+	if ( o + 2 > buf_size )
+		return NULL;
+	*len = admctrl_get_le16(buf + o);
+	if ( *len + 3 > buf_size - o || buf[o + 2 + *len] != '\0' )
+		return NULL;
+	*off = o + 2 + *len + 1;
+	return (char *)buf + o + 2;
+}
+
+
+/** \brief Deserializes a function from a versioned function list
+ *
+ * Like deserialize_function(), for lists in version ADMCTRL_FLIST_VERSION
+ * of the encoding described in admctrl_argtypes.h. Strings are not scanned,
+ * their length is read, and numbers are read at fixed, aligned offsets.
+ * Strings are used up to their first zero. The name, library and argument
+ * types of functions referred to by id point to the schema registry.
+ *
+ * \param ps The state of the deserialization
+ * \param index The index of the function being deserialized
+ * \param depth The number of functions this one is an argument of
+ * \param buf The function list
+ * \param off Reference to the offset of the function in buf. It is updated
+ * to the offset of the next serialized function
+ * \param buf_size The size of buf
+ *
+ * \return 0 on success, or -1 on failure
+ */
+static int
+deserialize_function_v1(struct parse_state *ps,unsigned int index,unsigned int depth,unsigned char *buf,size_t *off,size_t buf_size)
+{
+	struct parsed_instance f;
+	adm_ctrl_funcarg_t *arg;
+	const admctrl_schema_func_t *sf;
+	unsigned long long ullong;
+	unsigned int j;
+	size_t l,o;
+
+	f.pos = index;
+	o = ADMCTRL_FLIST_ALIGN(*off,2);
+	if ( o + 4 <= buf_size && admctrl_get_le16(buf + o) == ADMCTRL_FLIST_SCHEMA_REF )
 	{
-		if ( f->arg )
-			free(f->arg);
-		free(f);
+		if ( ps->schema == NULL ||
+				(sf = admctrl_schema_find(ps->schema,admctrl_get_le16(buf + o + 2))) == NULL )
+			return -1;
+		f.name = sf->name;
+		f.lib = sf->lib;
+		f.argt = sf->argt;
+		l = sf->args;
+		*off = o + 4;
 	}
-	if ( list )
-		adm_ctrl_free_functions(list);
-	return NULL;
+	else if ( (f.name = read_string(buf,off,buf_size,&l)) == NULL ||
+			(f.lib = read_string(buf,off,buf_size,&l)) == NULL ||
+			(f.argt = read_string(buf,off,buf_size,&l)) == NULL )
+		return -1;
+	f.args = l;
+	if ( f.args > MAX_ARGUMENTS_NUMBER )
+		return -1;
+	*off = ADMCTRL_FLIST_ALIGN(*off,ADMCTRL_FLIST_ARGS_ALIGN);
+
+	// Arguments
+	// They are reserved before any function arguments append theirs
+	f.arg = ps->arg_num;
+	if ( grow_array((void **)&ps->arg,&ps->arg_size,ps->arg_num + f.args,sizeof(adm_ctrl_funcarg_t)) != 0 )
+		return -1;
+	ps->arg_num += f.args;
+
+	for( j = 0 ; j < f.args ; j++ )
+	{
+		// Function arguments may move the array
+		arg = ps->arg + f.arg + j;
+		arg->type = f.argt[j];
+
+		switch( arg->type )
+		{
+			case STRING_TYPE:
+				if ( (arg->value.cstring = read_string(buf,off,buf_size,&l)) == NULL )
+					return -1;
+				break;
+			case INT_TYPE:
+				o = ADMCTRL_FLIST_ALIGN(*off,4);
+				if ( o + 4 > buf_size )
+					return -1;
+				arg->value.integer = (int)admctrl_get_le32(buf + o);
+				*off = o + 4;
+				break;
+			case DOUBLE_TYPE:
+			case ULONG_LONG_TYPE:
+				o = ADMCTRL_FLIST_ALIGN(*off,8);
+				if ( o + 8 > buf_size )
+					return -1;
+				ullong = admctrl_get_le64(buf + o);
+				// The host's doubles are IEEE 754, in the byte order of its integers
+				if ( arg->type == DOUBLE_TYPE )
+					memcpy(&arg->value.dbl,&ullong,sizeof(double));
+				else
+					arg->value.ullong = ullong;
+				*off = o + 8;
+				break;
+			case FUNCTION_TYPE:
+				if ( depth >= MAX_FUNCTION_NESTING ||
+						deserialize_function_v1(ps,index,depth + 1,buf,off,buf_size) != 0 )
+					return -1;
+				// The name of the function, which was added last
+				ps->arg[f.arg + j].value.cstring = ps->inst[ps->inst_num - 1].name;
+				break;
+			default:
+				return -1;
+		}
+	}// End of parameters loop
+
+	if ( grow_array((void **)&ps->inst,&ps->inst_size,ps->inst_num + 1,sizeof(struct parsed_instance)) != 0 ||
+			group_instance(ps,&f) != 0 )
+		return -1;
+	ps->inst[ps->inst_num++] = f;
+	return 0;
+}
+
+
+/** \brief Lay out the parsed function instances in a function list
+ *
+ * Function types, and the libraries of each type, are placed in the reverse
+ * order of their first appearance. Instances keep the order they were read
+ * in.
+ *
+ * \param ps the state of the deserialization
+ *
+ * \return the function list, or NULL if no memory was available
+ */
+static adm_ctrl_flist_t *
+build_flist(struct parse_state *ps)
+{
+	adm_ctrl_flist_t *list;
+	adm_ctrl_func_t *func;
+	adm_ctrl_lib_t *lib;
+	adm_ctrl_func_instance_t *inst;
+	struct parsed_instance *pi;
+	struct parsed_group *g;
+	struct parsed_func *pf;
+	unsigned int f,i,j,k,n,a;
+	size_t size,cols;
+	unsigned char *colbuf;
+
+	// Size of the argument columns, each aligned to a double
+	for(i = 0,cols = 0 ; i < ps->group_num ; i++)
+	{
+		pf = ps->func + ps->group[i].func;
+		for(j = 0 ; j < pf->args ; j++)
+			cols += (ps->group[i].num * column_value_size(pf->argt[j]) + sizeof(double) - 1) &
+				~(sizeof(double) - 1);
+	}
+	size = sizeof(adm_ctrl_flist_t) + ps->func_num * sizeof(adm_ctrl_func_t) +
+		ps->group_num * sizeof(adm_ctrl_lib_t) + ps->inst_num * sizeof(adm_ctrl_func_instance_t) +
+		ps->arg_num * sizeof(adm_ctrl_funcarg_t);
+	if ( (list = (adm_ctrl_flist_t *)malloc(size + cols)) == NULL )
+		return NULL;
+	list->num = ps->func_num;
+	list->libs = ps->group_num;
+	list->instances = ps->inst_num;
+	list->args = ps->arg_num;
+	list->func = (adm_ctrl_func_t *)(list + 1);
+	list->lib = (adm_ctrl_lib_t *)(list->func + list->num);
+	list->inst = (adm_ctrl_func_instance_t *)(list->lib + list->libs);
+	list->arg = (adm_ctrl_funcarg_t *)(list->inst + list->instances);
+	colbuf = (unsigned char *)list + size;
+
+	// Function types and libraries, in reverse order of first appearance
+	for(f = ps->func_num,lib = list->lib,n = 0,a = 0 ; f-- > 0 ; )
+	{
+		pf = ps->func + f;
+		func = list->func + (ps->func_num - 1 - f);
+		func->name = pf->name;
+		func->num = 0;
+		func->args = pf->args;
+		func->argt = pf->argt;
+		func->libs = pf->libs;
+		func->library = lib;
+		for(i = ps->group_num ; i-- > 0 ; )
+		{
+			g = ps->group + i;
+			if ( g->func != f )
+				continue;
+			if ( func->num == 0 )
+			{
+				func->first = g->first;
+				func->last = g->last;
+			}
+			func->num += g->num;
+			func->first = MIN(func->first,g->first);
+			func->last = MAX(func->last,g->last);
+
+			lib->name = g->lib;
+			lib->num = g->num;
+			lib->first = g->first;
+			lib->last = g->last;
+			lib->instances = list->inst + n;
+			for(j = 0 ; j < pf->args ; j++)
+			{
+				lib->col[j].values = colbuf;
+				colbuf += (g->num * column_value_size(pf->argt[j]) + sizeof(double) - 1) &
+					~(sizeof(double) - 1);
+			}
+			// The group now counts the instances placed in the library
+			g->lib_index = lib - list->lib;
+			g->inst = n;
+			g->arg = a;
+			g->num = 0;
+			n += lib->num;
+			a += lib->num * pf->args;
+			++lib;
+		}
+	}
+
+	// Instances and their arguments, grouped by library
+	for(k = 0,pi = ps->inst ; k < ps->inst_num ; k++,pi++)
+	{
+		g = ps->group + pi->group;
+		lib = list->lib + g->lib_index;
+		i = g->num++;
+		inst = list->inst + g->inst + i;
+		inst->pos = pi->pos;
+		inst->arg = list->arg + g->arg + i * pi->args;
+		if ( pi->args > 0 )
+			memcpy(inst->arg,ps->arg + pi->arg,pi->args * sizeof(adm_ctrl_funcarg_t));
+		for(j = 0 ; j < pi->args ; j++)
+			switch( inst->arg[j].type )
+			{
+				case INT_TYPE:
+					lib->col[j].integer[i] = inst->arg[j].value.integer;
+					break;
+				case STRING_TYPE:
+					lib->col[j].integer[i] = (int)strlen(inst->arg[j].value.cstring);
+					break;
+				case DOUBLE_TYPE:
+					lib->col[j].dbl[i] = inst->arg[j].value.dbl;
+					break;
+				case ULONG_LONG_TYPE:
+					lib->col[j].ullong[i] = inst->arg[j].value.ullong;
+					break;
+			}
+	}
+	return list;
 }
 
 
 /** \brief Deserialize a function list
  *
- * Deserializes a function list to a adm_ctrl_func_t structure
+ * Deserializes a function list to a adm_ctrl_flist_t structure, in one pass
+ * over the buffer.
  * No data are copied from the buffer and the user has to free the list
  * when it is not needed anymore. If it fails for some reason, it 
  * deallocates the whole list.
+ * Lists that start with the header of ADMCTRL_FLIST_VERSION are read with
+ * deserialize_function_v1(), and lists without a header in the format of
+ * authd 0.8. Other versions are rejected. Function ids are resolved only if
+ * the tag in the header is that of the schema registry.
  *
  * FORMAT: name + arguments type string + argument + ... 
  *
  * \param buf the buffer containing the serialized function definitions
  * \param num the number of functions contained in the buffer
  * \param buf_size the size of buf
+ * \param schema the schema registry, or NULL. The list refers to its strings
  *
  * \return the deserialized function list, or NULL on failure
  *
  */
-static adm_ctrl_func_t *
-adm_ctrl_deserialize_functions(unsigned char *buf,unsigned int num,size_t buf_size)
+adm_ctrl_flist_t *
+adm_ctrl_deserialize_functions(unsigned char *buf,unsigned int num,size_t buf_size,const admctrl_schema_t *schema)
 {
-  adm_ctrl_func_t *list = NULL;
+	struct parse_state ps;
+  adm_ctrl_flist_t *list = NULL;
 	unsigned char *buf_i = buf;
 	unsigned int i;
+	size_t off;
 
   if ( num == 0 )
     return NULL;
 
-  // Functions
-  for( i = 0 ; i < num ; i++ )
-		if ( (list = deserialize_function(list,i,&buf_i,&buf_size)) == NULL)
-			return NULL;
-
+	bzero(&ps,sizeof(ps));
+	if ( buf_size >= ADMCTRL_FLIST_HEADER_SIZE &&
+			memcmp(buf,ADMCTRL_FLIST_MAGIC,ADMCTRL_FLIST_MAGIC_SIZE) == 0 )
+	{
+		if ( buf[ADMCTRL_FLIST_MAGIC_SIZE] != ADMCTRL_FLIST_VERSION )
+			goto cleanup;
+		if ( schema != NULL && admctrl_get_le32(buf + ADMCTRL_FLIST_TAG_OFFSET) == schema->tag )
+			ps.schema = schema;
+		for( i = 0,off = ADMCTRL_FLIST_HEADER_SIZE ; i < num ; i++ )
+			if ( deserialize_function_v1(&ps,i,0,buf,&off,buf_size) != 0 )
+				goto cleanup;
+	}
+	else
+		// Functions
+		for( i = 0 ; i < num ; i++ )
+			if ( deserialize_function(&ps,i,0,&buf_i,&buf_size) != 0 )
+				goto cleanup;
+
+	list = build_flist(&ps);
+
+cleanup:
+	free(ps.inst);
+	free(ps.arg);
+	free(ps.group);
+	free(ps.func);
   return list;
 }
 
 
-/** \brief Processes a function list and generates assertions and resource consumption
+/** \brief Defines a function finding the minimum and maximum of an array
  *
- * Function type actions:
- * \li (function_name) = "defined"
- * \li (function_name).num = (number_of_instances)
- * \li (function_name).first = (position_of_first_instance)
- * \li (function_name).last = (position_of_last_instance)
- * \li (function_name).(lib_name) = "defined"
- * \li (function_name).(lib_name).num = (number_of_instances)
- * \li (function_name).(lib_name).first = (position_of_first_instance)
- * \li (function_name).(lib_name).last = (position_of_last_instance)
- *
- * Function instance actions:
- * \li (function_name).(function_instance_no).pos = (position_of_instance)[DEPRECATED]
- * \li func.(function_position).name = "(function_name)"
- *
- * Function parameters actions:
- * \li (function_name).(function_instance_no).param.(parameter_number) = (parameter_value)[DEPRECATED]
- * \li func.(function_position).param.(parameter_number) = (parameter_value)
- * \li (function_name).param.(parameter_number).min = (parameter_min_value)
- * \li (function_name).param.(parameter_number).max = (parameter_max_value)
- * \li (function_name).(lib_name).param.(parameter_number).min = (parameter_min_value)
- * \li (function_name).(lib_name).param.(parameter_number).max = (parameter_max_value)
+ * The array is reduced four values at a time into independent minimums and
+ * maximums, which the compiler can keep in vector registers. The array
+ * must not be empty.
+ */
+#define ARRAY_MINMAX(name,type) \
+static void \
+name(const type *v,unsigned int n,type *min,type *max) \
+{ \
+	type mn[4],mx[4]; \
+	unsigned int i,k; \
+\
+	for(k = 0 ; k < 4 ; k++) \
+		mn[k] = mx[k] = v[0]; \
+	for(i = 0 ; i + 4 <= n ; i += 4) \
+		for(k = 0 ; k < 4 ; k++) \
+		{ \
+			mn[k] = ( v[i + k] < mn[k] )? v[i + k] : mn[k]; \
+			mx[k] = ( v[i + k] > mx[k] )? v[i + k] : mx[k]; \
+		} \
+	for(; i < n ; i++) \
+	{ \
+		mn[0] = ( v[i] < mn[0] )? v[i] : mn[0]; \
+		mx[0] = ( v[i] > mx[0] )? v[i] : mx[0]; \
+	} \
+	for(k = 1 ; k < 4 ; k++) \
+	{ \
+		mn[0] = ( mn[k] < mn[0] )? mn[k] : mn[0]; \
+		mx[0] = ( mx[k] > mx[0] )? mx[k] : mx[0]; \
+	} \
+	*min = mn[0]; \
+	*max = mx[0]; \
+}
+
+ARRAY_MINMAX(int_minmax,int)
+ARRAY_MINMAX(double_minmax,double)
+ARRAY_MINMAX(ullong_minmax,unsigned long long)
+
+
+/** \brief Find the minimum and maximum value of an argument column
  *
- * \param id keynote session id
- * \param list list of function types & their instances
+ * \param type the type of the argument
+ * \param col the column
+ * \param n the number of values in the column, at least 1
+ * \param min where to store the minimum
+ * \param max where to store the maximum
+ */
+static void
+column_minmax(char type,const adm_ctrl_argcol_t *col,unsigned int n,adm_ctrl_funcarg_value_t *min,adm_ctrl_funcarg_value_t *max)
+{
+	switch( type )
+	{
+		case INT_TYPE:
+		case STRING_TYPE:
+			int_minmax(col->integer,n,&min->integer,&max->integer);
+			break;
+		case DOUBLE_TYPE:
+			double_minmax(col->dbl,n,&min->dbl,&max->dbl);
+			break;
+		case ULONG_LONG_TYPE:
+			ullong_minmax(col->ullong,n,&min->ullong,&max->ullong);
+			break;
+	}
+}
+
+
+/** \brief Widen a minimum and maximum to include another pair
  *
- * \return 0 on success, or -1 on failure
+ * \param type the type of the argument
+ * \param min the minimum to include
+ * \param max the maximum to include
+ * \param tmin the minimum to widen
+ * \param tmax the maximum to widen
+ */
+static void
+value_minmax(char type,const adm_ctrl_funcarg_value_t *min,const adm_ctrl_funcarg_value_t *max,
+		adm_ctrl_funcarg_value_t *tmin,adm_ctrl_funcarg_value_t *tmax)
+{
+	switch( type )
+	{
+		case INT_TYPE:
+		case STRING_TYPE:
+			tmin->integer = MIN(tmin->integer,min->integer);
+			tmax->integer = MAX(tmax->integer,max->integer);
+			break;
+		case DOUBLE_TYPE:
+			tmin->dbl = MIN(tmin->dbl,min->dbl);
+			tmax->dbl = MAX(tmax->dbl,max->dbl);
+			break;
+		case ULONG_LONG_TYPE:
+			tmin->ullong = MIN(tmin->ullong,min->ullong);
+			tmax->ullong = MAX(tmax->ullong,max->ullong);
+			break;
+	}
+}
+
+
+/** \brief Processes a function list, see adm_ctrl_flist_process()
  *
+ * Resource consumption is looked up and aggregated in a per-request table.
  */
 static int
 #ifdef WITH_RESOURCE_CONTROL
-adm_ctrl_flist_process(int id,adm_ctrl_func_t *list,adm_ctrl_result_t *res,resource_ctrl_db_t *db)
+flist_process(int id,adm_ctrl_flist_t *flist,resource_ctrl_table_t *table,resource_ctrl_db_t *db)
 {
-	u_int32_t reskey;
-	snv_constpointer snv_arguments[MAX_ARGUMENTS_NUMBER];
-	resource_consumption_t consumption[RESOURCE_CTRL_MAX_RESOURCES];
+	u_int32_t fid = 0;
+	resource_formula_col_t formula_cols[MAX_ARGUMENTS_NUMBER];
+	resource_consumption_t *consumption = NULL;
 	size_t con_size = 0;
 	int db_status = 0;
-	char has_resources = 0;
+	char has_function = 0,has_resources = 0;
 #else
-adm_ctrl_flist_process(int id,adm_ctrl_func_t *list)
+flist_process(int id,adm_ctrl_flist_t *flist)
 {
 #endif
   char action_name[MAX_ACTION_NAME_SIZE],action_value[MAX_ACTION_VALUE_SIZE];
   adm_ctrl_funcarg_value_t arg_max[MAX_ARGUMENTS_NUMBER],arg_min[MAX_ARGUMENTS_NUMBER];
   adm_ctrl_funcarg_value_t lib_max[MAX_ARGUMENTS_NUMBER],lib_min[MAX_ARGUMENTS_NUMBER];
+  adm_ctrl_func_t *list;
   adm_ctrl_func_instance_t *inst;
 	adm_ctrl_lib_t *lib;
 	unsigned int j,instance_no,libinst_no;
-	int sz;
 
   // FUNCTION TYPES
-  for(; list != NULL ; list = list->next)
+  for(list = flist->func ; list < flist->func + flist->num ; list++)
   {
     // function_name = defined
     //sprintf(action_value,"\"defined\"");
@@ -621,9 +988,26 @@ adm_ctrl_flist_process(int id,adm_ctrl_func_t *list)
     if ( kn_add_action(id,action_name,action_value,0) < 0 )
       return - ADMCTRL_MEMORY_ERROR;
 
+#ifdef WITH_RESOURCE_CONTROL
+		// Function part of the resource keys, once for all libraries
+		if ( db )
+		{
+			switch( (db_status = resource_ctrl_functionid(db,list->name,&fid)) )
+			{
+				case 0:
+					has_function = 1;
+					break;
+				case RESOURCE_DB_NOTFOUND:
+					has_function = 0;
+					break;
+				default:
+					return - ADMCTRL_RESOURCE_CTRL_ERROR;
+			}
+		}
+#endif
 
 		// FUNCTION LIBRARIES
-		for(lib = list->library,instance_no = 0 ; lib != NULL ; lib = lib->next,++instance_no)
+		for(lib = list->library,instance_no = 0 ; instance_no < list->libs ; lib++,++instance_no)
 		{
 			// function_name.lib_name = defined
 			snprintf(action_name,MAX_ACTION_NAME_SIZE,"%s.%s",list->name,lib->name);
@@ -653,42 +1037,29 @@ adm_ctrl_flist_process(int id,adm_ctrl_func_t *list)
 			if ( kn_add_action(id,action_name,action_value,0) < 0 )
 				return - ADMCTRL_MEMORY_ERROR;
 
-			// FUNCTION INSTANCES
 #ifdef WITH_RESOURCE_CONTROL
+			// Fetch function resource consumption information, memoised by the table
 			has_resources = 0;
-#endif
-			for(inst = lib->instances,libinst_no = 0 ; inst != NULL ; inst = inst->next,++libinst_no)
+			if ( has_function )
 			{
-#ifdef WITH_RESOURCE_CONTROL
-				// Fetch function resource consumption information for 1st instance
-				if ( db && libinst_no == 0 )
+				db_status = resource_ctrl_table_lookup(db,table,fid,lib->name,&consumption,&con_size);
+				switch( db_status )
 				{
-					db_status = resource_ctrl_resourcekey(db,list->name,lib->name,&reskey);
-					switch( db_status )
-					{
-						case 0:
-							has_resources = 1;
-							break;
-						case RESOURCE_DB_NOTFOUND:
-							has_resources = 0;
-							break;
-						default:
-							return - ADMCTRL_RESOURCE_CTRL_ERROR;
-					}
-
-					if ( has_resources && (db_status = resource_ctrl_resourceconsumption(db,reskey,consumption,&con_size)) != 0 )
-					{
-            if ( db_status == RESOURCE_DB_NOTFOUND )
-              has_resources = 0;
-            else
-            {
-              DEBUG_CMD2(printf("DEBUG adm_ctrl_flist_process: resource control failure\n"));
-              return - ADMCTRL_RESOURCE_CTRL_ERROR;
-            }
-					}
+					case 0:
+						has_resources = 1;
+						break;
+					case RESOURCE_DB_NOTFOUND:
+						break;
+					default:
+						DEBUG_CMD2(printf("DEBUG adm_ctrl_flist_process: resource control failure\n"));
+						return - ADMCTRL_RESOURCE_CTRL_ERROR;
 				}
+			}
 #endif
 
+			// FUNCTION INSTANCES
+			for(inst = lib->instances,libinst_no = 0 ; libinst_no < lib->num ; inst++,++libinst_no)
+			{
 				// function_name.function_instance.pos = position_of_instance
 				snprintf(action_name,MAX_ACTION_NAME_SIZE,"%s.%u.pos",list->name,instance_no);
 				snprintf(action_value,MAX_ACTION_VALUE_SIZE,"%u",inst->pos);
@@ -710,136 +1081,86 @@ adm_ctrl_flist_process(int id,adm_ctrl_func_t *list)
 					{
 						case INT_TYPE:
 							snprintf(action_value,MAX_ACTION_VALUE_SIZE,"%d",inst->arg[j].value.integer);
-							// Function type MIN-MAX
-							if ( lib == list->library && inst == lib->instances )
-								arg_max[j].integer = arg_min[j].integer = inst->arg[j].value.integer;
-							else
-							{
-								arg_max[j].integer = MAX(arg_max[j].integer,inst->arg[j].value.integer);
-								arg_min[j].integer = MIN(arg_min[j].integer,inst->arg[j].value.integer);
-							}
-							// Library function MIN-MAX
-							if ( inst == lib->instances )
-								lib_max[j].integer = lib_min[j].integer = inst->arg[j].value.integer;
-							else
-							{
-								lib_max[j].integer = MAX(lib_max[j].integer,inst->arg[j].value.integer);
-								lib_min[j].integer = MIN(lib_min[j].integer,inst->arg[j].value.integer);
-							}
-#ifdef WITH_RESOURCE_CONTROL
-							if ( has_resources )
-								snv_arguments[j] = SNV_INT_TO_POINTER(inst->arg[j].value.integer);
-#endif
 							break;
 						case DOUBLE_TYPE:
 							snprintf(action_value,MAX_ACTION_VALUE_SIZE,"%f",inst->arg[j].value.dbl);
-							// Function type MIN-MAX
-							if ( lib == list->library && inst == lib->instances )
-								arg_max[j].dbl = arg_min[j].dbl = inst->arg[j].value.dbl;
-							else
-							{
-								arg_max[j].dbl = MAX(arg_max[j].dbl,inst->arg[j].value.dbl);
-								arg_min[j].dbl = MIN(arg_min[j].dbl,inst->arg[j].value.dbl);
-							}
-							// Library function MIN-MAX
-							if ( inst == lib->instances )
-								lib_max[j].dbl = lib_min[j].dbl = inst->arg[j].value.dbl;
-							else
-							{
-								lib_max[j].dbl = MAX(lib_max[j].dbl,inst->arg[j].value.dbl);
-								lib_min[j].dbl = MIN(lib_min[j].dbl,inst->arg[j].value.dbl);
-							}
-#ifdef WITH_RESOURCE_CONTROL
-							if ( has_resources )
-								snv_arguments[j] = &inst->arg[j].value.dbl;
-#endif
 							break;
 						case STRING_TYPE:
 							snprintf(action_value,MAX_ACTION_VALUE_SIZE,"%s",inst->arg[j].value.cstring);
-							sz = (int)strlen(inst->arg[j].value.cstring);
-							// Function type MIN-MAX
-							if ( lib == list->library && inst == lib->instances )
-								arg_max[j].integer = arg_min[j].integer = sz;
-							else
-							{
-								arg_max[j].integer = MAX(arg_max[j].integer,sz);
-								arg_min[j].integer = MIN(arg_min[j].integer,sz);
-							}
-							// Library function MIN-MAX
-							if ( inst == lib->instances )
-								lib_max[j].integer = lib_min[j].integer = sz;
-							else
-							{
-								lib_max[j].integer = MAX(lib_max[j].integer,sz);
-								lib_min[j].integer = MIN(lib_min[j].integer,sz);
-							}
-#ifdef WITH_RESOURCE_CONTROL
-							if ( has_resources )
-								snv_arguments[j] = SNV_INT_TO_POINTER(sz);
-#endif
 							break;
 						case ULONG_LONG_TYPE:
 							snprintf(action_value,MAX_ACTION_VALUE_SIZE,"%llu",inst->arg[j].value.ullong);
-							// Function type MIN-MAX
-							if ( lib == list->library && inst == lib->instances )
-								arg_max[j].ullong = arg_min[j].ullong = inst->arg[j].value.ullong;
-							else
-							{
-								arg_max[j].ullong = MAX(arg_max[j].ullong,inst->arg[j].value.ullong);
-								arg_min[j].ullong = MIN(arg_min[j].ullong,inst->arg[j].value.ullong);
-							}
-							// Library function MIN-MAX
-							if ( inst == lib->instances )
-								lib_max[j].ullong = lib_min[j].ullong = inst->arg[j].value.ullong;
-							else
-							{
-								lib_max[j].ullong = MAX(lib_max[j].ullong,inst->arg[j].value.ullong);
-								lib_min[j].ullong = MIN(lib_min[j].ullong,inst->arg[j].value.ullong);
-							}
-#ifdef WITH_RESOURCE_CONTROL
-							if ( has_resources )
-								snv_arguments[j] = &inst->arg[j].value.ullong;
-#endif
 							break;
             case FUNCTION_TYPE:
               snprintf(action_value,MAX_ACTION_VALUE_SIZE,"%s",inst->arg[j].value.cstring);
-#ifdef WITH_RESOURCE_CONTROL
-							if ( has_resources )
-								snv_arguments[j] = SNV_INT_TO_POINTER(0);
-#endif
               break;
 						default:
 							return - ADMCTRL_INTERNAL_ERROR;
 					}
 
 					// function_name.instance_no.param.parameter_no == parameter_value
-					sprintf(action_name,"%s.%u.param.%u",list->name,instance_no,j);
+					snprintf(action_name,MAX_ACTION_NAME_SIZE,"%s.%u.param.%u",list->name,instance_no,j);
 					DEBUG_CMD2(printf("DEBUG adm_ctrl_flist_process: %s==%s\n",action_name,action_value));
 					if ( kn_add_action(id,action_name,action_value,0) < 0 )
 						return - ADMCTRL_MEMORY_ERROR;
 
 					// func.function_position.param.parameter_number = parameter_value
-					sprintf(action_name,"func.%u.param.%u",inst->pos,j);
+					snprintf(action_name,MAX_ACTION_NAME_SIZE,"func.%u.param.%u",inst->pos,j);
 					DEBUG_CMD2(printf("DEBUG adm_ctrl_flist_process: %s==%s\n",action_name,action_value));
 					if ( kn_add_action(id,action_name,action_value,0) < 0 )
 						return - ADMCTRL_MEMORY_ERROR;
 	 
 				}//End instance arguments for()
 
+			}//End function instances for()
+
 #ifdef WITH_RESOURCE_CONTROL
-				if ( has_resources && resource_ctrl_aggregate(consumption,con_size,res->required,&res->resources_num,snv_arguments) != 0 )
+			// Resources consumed by all the instances, on the argument columns
+			if ( has_resources )
+			{
+				for(j = 0 ; j < list->args ; j++)
+				{
+					formula_cols[j].values = lib->col[j].values;
+					switch( list->argt[j] )
+					{
+						case INT_TYPE:
+						case STRING_TYPE:
+							// Strings are evaluated as their length
+							formula_cols[j].type = RESOURCE_FORMULA_INT;
+							break;
+						case DOUBLE_TYPE:
+							formula_cols[j].type = RESOURCE_FORMULA_DOUBLE;
+							break;
+						case ULONG_LONG_TYPE:
+							formula_cols[j].type = RESOURCE_FORMULA_ULLONG;
+							break;
+						default:
+							formula_cols[j].type = RESOURCE_FORMULA_NONE;
+							formula_cols[j].values = NULL;
+							break;
+					}
+				}
+				if ( resource_ctrl_table_aggregate_batch(table,consumption,con_size,formula_cols,list->args,lib->num) != 0 )
 					return - ADMCTRL_RESOURCE_CTRL_ERROR;
+			}
 #endif
 
-			}//End function instances for()
-
 
-			// Library instances MIN-MAX
-			for(j = 0 ; j < lib->instances->args ; j++)
+			// Library instances MIN-MAX, and function type MIN-MAX so far
+			for(j = 0 ; j < list->args ; j++)
 			{
+				column_minmax(list->argt[j],lib->col + j,lib->num,lib_min + j,lib_max + j);
+				if ( lib == list->library )
+				{
+					arg_min[j] = lib_min[j];
+					arg_max[j] = lib_max[j];
+				}
+				else
+					value_minmax(list->argt[j],lib_min + j,lib_max + j,arg_min + j,arg_max + j);
+
 				// function_name.lib_name.param.param_no.max = maximum_value
 				snprintf(action_name,MAX_ACTION_NAME_SIZE,"%s.%s.param.%u.max",list->name,lib->name,j);
-				switch( lib->instances->arg[j].type )
+				switch( list->argt[j] )
 				{
 					case INT_TYPE:
 					case STRING_TYPE:
@@ -856,7 +1177,7 @@ adm_ctrl_flist_process(int id,adm_ctrl_func_t *list)
 					default:
 						return - ADMCTRL_INTERNAL_ERROR;;
 				}
-        if ( lib->instances->arg[j].type != FUNCTION_TYPE )
+        if ( list->argt[j] != FUNCTION_TYPE )
         {
           DEBUG_CMD2(printf("DEBUG adm_ctrl_flist_process: %s==%s\n",action_name,action_value));
           if ( kn_add_action(id,action_name,action_value,0) < 0 ) 
@@ -865,7 +1186,7 @@ adm_ctrl_flist_process(int id,adm_ctrl_func_t *list)
 
 				// function_name.lib_name.param.param_no.min = minimum_value
 				snprintf(action_name,MAX_ACTION_NAME_SIZE,"%s.%s.param.%u.min",list->name,lib->name,j);
-				switch( lib->instances->arg[j].type )
+				switch( list->argt[j] )
 				{
 					case INT_TYPE:
 					case STRING_TYPE:
@@ -882,7 +1203,7 @@ adm_ctrl_flist_process(int id,adm_ctrl_func_t *list)
 					default:
 						return - ADMCTRL_INTERNAL_ERROR;
 				}
-        if ( lib->instances->arg[j].type != FUNCTION_TYPE )
+        if ( list->argt[j] != FUNCTION_TYPE )
         {
           DEBUG_CMD2(printf("DEBUG adm_ctrl_flist_process: %s==%s\n",action_name,action_value));
           if ( kn_add_action(id,action_name,action_value,0) < 0 ) 
@@ -893,11 +1214,11 @@ adm_ctrl_flist_process(int id,adm_ctrl_func_t *list)
 		}// End function libraries for()
 
 		// Function type MIN-MAX
-		for(j = 0 ; j < list->library->instances->args ; j++)
+		for(j = 0 ; j < list->args ; j++)
 		{
 			// function_name.param.param_no.max = maximum_value
 			snprintf(action_name,MAX_ACTION_NAME_SIZE,"%s.param.%u.max",list->name,j);
-			switch( list->library->instances->arg[j].type )
+			switch( list->argt[j] )
 			{
 				case INT_TYPE:
 				case STRING_TYPE:
@@ -914,7 +1235,7 @@ adm_ctrl_flist_process(int id,adm_ctrl_func_t *list)
 				default:
 					return - ADMCTRL_INTERNAL_ERROR;
 			}
-      if ( list->library->instances->arg[j].type != FUNCTION_TYPE )
+      if ( list->argt[j] != FUNCTION_TYPE )
       {
         DEBUG_CMD2(printf("DEBUG adm_ctrl_flist_process: %s==%s\n",action_name,action_value));
         if ( kn_add_action(id,action_name,action_value,0) < 0 ) 
@@ -923,7 +1244,7 @@ adm_ctrl_flist_process(int id,adm_ctrl_func_t *list)
 
 			// function_name.param.param_no.min = minimum_value
 			snprintf(action_name,MAX_ACTION_NAME_SIZE,"%s.param.%u.min",list->name,j);
-			switch( list->library->instances->arg[j].type )
+			switch( list->argt[j] )
 			{
 				case INT_TYPE:
 				case STRING_TYPE:
@@ -940,7 +1261,7 @@ adm_ctrl_flist_process(int id,adm_ctrl_func_t *list)
 				default:
 					return - ADMCTRL_INTERNAL_ERROR;
 			}
-      if ( list->library->instances->arg[j].type != FUNCTION_TYPE )
+      if ( list->argt[j] != FUNCTION_TYPE )
       {
         DEBUG_CMD2(printf("DEBUG adm_ctrl_flist_process: %s==%s\n",action_name,action_value));
         if ( kn_add_action(id,action_name,action_value,0) < 0 ) 
@@ -951,20 +1272,78 @@ adm_ctrl_flist_process(int id,adm_ctrl_func_t *list)
   }// End function types for()
 
 #ifdef WITH_RESOURCE_CONTROL
-	//if ( has_resources )
-		for(j = 0 ; j < res->resources_num ; ++j)
-		{
-			snprintf(action_name,MAX_ACTION_NAME_SIZE,"RESOURCE.%u",res->required[j].rkey);
-			snprintf(action_value,MAX_ACTION_VALUE_SIZE,"%u",res->required[j].required);
-			DEBUG_CMD2(printf("DEBUG adm_ctrl_flist_process: %s==%s\n",action_name,action_value));
-			if ( kn_add_action(id,action_name,action_value,0) < 0 ) 
-				return - ADMCTRL_MEMORY_ERROR;
-		}
+	for(j = 0 ; j < table->required_num ; ++j)
+	{
+		snprintf(action_name,MAX_ACTION_NAME_SIZE,"RESOURCE.%u",table->required[j].rkey);
+		snprintf(action_value,MAX_ACTION_VALUE_SIZE,"%u",table->required[j].required);
+		DEBUG_CMD2(printf("DEBUG adm_ctrl_flist_process: %s==%s\n",action_name,action_value));
+		if ( kn_add_action(id,action_name,action_value,0) < 0 ) 
+			return - ADMCTRL_MEMORY_ERROR;
+	}
 #endif
 
 	return 0;
 }
 
+
+/** \brief Processes a function list and generates assertions and resource consumption
+ *
+ * Function type actions:
+ * \li (function_name) = "defined"
+ * \li (function_name).num = (number_of_instances)
+ * \li (function_name).first = (position_of_first_instance)
+ * \li (function_name).last = (position_of_last_instance)
+ * \li (function_name).(lib_name) = "defined"
+ * \li (function_name).(lib_name).num = (number_of_instances)
+ * \li (function_name).(lib_name).first = (position_of_first_instance)
+ * \li (function_name).(lib_name).last = (position_of_last_instance)
+ *
+ * Function instance actions:
+ * \li (function_name).(function_instance_no).pos = (position_of_instance)[DEPRECATED]
+ * \li func.(function_position).name = "(function_name)"
+ *
+ * Function parameters actions:
+ * \li (function_name).(function_instance_no).param.(parameter_number) = (parameter_value)[DEPRECATED]
+ * \li func.(function_position).param.(parameter_number) = (parameter_value)
+ * \li (function_name).param.(parameter_number).min = (parameter_min_value)
+ * \li (function_name).param.(parameter_number).max = (parameter_max_value)
+ * \li (function_name).(lib_name).param.(parameter_number).min = (parameter_min_value)
+ * \li (function_name).(lib_name).param.(parameter_number).max = (parameter_max_value)
+ *
+ * Resource actions:
+ * \li RESOURCE.(resource_key) = (required_amount)
+ *
+ * \param id keynote session id
+ * \param flist list of function types & their instances
+ * \param res result where the required resources are stored
+ * \param db resource control database, or NULL
+ *
+ * \return 0 on success, or -1 on failure
+ *
+ */
+int
+#ifdef WITH_RESOURCE_CONTROL
+adm_ctrl_flist_process(int id,adm_ctrl_flist_t *flist,adm_ctrl_result_t *res,resource_ctrl_db_t *db)
+{
+	resource_ctrl_table_t table;
+	int e;
+
+	resource_ctrl_table_init(&table);
+	if ( (e = flist_process(id,flist,&table,db)) == 0 )
+	{
+		memcpy(res->required,table.required,table.required_num * sizeof(resource_required_t));
+		res->resources_num = table.required_num;
+	}
+	resource_ctrl_table_free(&table);
+	return e;
+}
+#else
+adm_ctrl_flist_process(int id,adm_ctrl_flist_t *flist)
+{
+	return flist_process(id,flist);
+}
+#endif
+
 /** \brief Generates assertions from name-value pairs
  *
  * \param id The id of the keynote session to use
@@ -973,7 +1352,7 @@ adm_ctrl_flist_process(int id,adm_ctrl_func_t *list)
  *
  * \return zero on success, or less than zero on failure
  */
-static int
+int
 adm_ctrl_generate_pair_assertions(int id,unsigned int pairs,adm_ctrl_pair_t pair[MAX_PAIR_ASSERTIONS])
 {
 	unsigned int i;
@@ -1014,45 +1393,30 @@ add_default_assertions(int id)
   return err;
 }
 
-/** \brief Checks the credentials and resource consumption of request against a policy
+
+/** \brief Adds the policy, the credentials and the authorizer of a request
+ * to a keynote session
  *
+ * \param id The id of the keynote session to use
  * \param auth admission control request
  * \param policy admission control policy
- * \param res admission control result datatype where results are going to be stored
- * \param db reference to resource control database
  *
- * \return the index of the PCV that corresponds to the provided credentials,
- *  or less that zero for error
+ * \return zero on success, or less than zero on failure
  */
 int
-#ifdef WITH_RESOURCE_CONTROL
-adm_ctrl_authorise(adm_ctrl_request_t *auth,adm_ctrl_policy_t *policy,adm_ctrl_result_t *res,resource_ctrl_db_t *db)
-#else
-adm_ctrl_authorise(adm_ctrl_request_t *auth,adm_ctrl_policy_t *policy,adm_ctrl_result_t *res)
-#endif
+adm_ctrl_add_assertions(int id,adm_ctrl_request_t *auth,adm_ctrl_policy_t *policy)
 {
-	int kn_session_id,i,creds_num = 0;
+	int i,creds_num = 0;
 	char **credentials = NULL;
   char *pkstring;
-	adm_ctrl_func_t *flist = NULL;
 	int auth_error = 0;
 
-  res->PCV = 0;
-	res->error = 0;
-
-	// Initialize session
-	if ( (kn_session_id = kn_init()) < 0 )
-	{
-		DEBUG_CMD(fprintf(stderr,"adm_ctrl_authorise: couldn't start a keynote session\n"));
-		return - ADMCTRL_MEMORY_ERROR;
-	}
-
 	// Add assertions to keynote session
 	for( i = 0; i < policy->assertions_num ; i++ )
 	{
-		if ( kn_add_assertion(kn_session_id,policy->assertions[i],strlen(policy->assertions[i]),ASSERT_FLAG_LOCAL) < 0 )
+		if ( kn_add_assertion(id,policy->assertions[i],strlen(policy->assertions[i]),ASSERT_FLAG_LOCAL) < 0 )
 		{
-      DEBUG_CMD(fprintf(stderr,"adm_ctrl_authorise: error adding policy assertions\n"));
+      DEBUG_CMD(fprintf(stderr,"adm_ctrl_add_assertions: error adding policy assertions\n"));
 			switch( keynote_errno )
 			{
 				case ERROR_SYNTAX:
@@ -1065,23 +1429,22 @@ adm_ctrl_authorise(adm_ctrl_request_t *auth,adm_ctrl_policy_t *policy,adm_ctrl_r
 					auth_error = - ADMCTRL_INTERNAL_ERROR;
 					break;
 			}
-			goto error;
+			return auth_error;
 		}
 	}
 
 	// Add credentials
 	if ( (credentials = kn_read_asserts(auth->credentials,strnlen(auth->credentials,MAX_CREDENTIALS_SIZE),&creds_num)) == NULL )
 	{
-		DEBUG_CMD(fprintf(stderr,"adm_ctrl_authorise: couldn't extract credential assertions\n"));
-		auth_error = - ADMCTRL_MEMORY_ERROR;
-		goto error;
+		DEBUG_CMD(fprintf(stderr,"adm_ctrl_add_assertions: couldn't extract credential assertions\n"));
+		return - ADMCTRL_MEMORY_ERROR;
 	}
-	
+
 	// Add credential assertions to keynote session
 	for( i = 0; i < creds_num ; i++ )
-		if ( kn_add_assertion(kn_session_id,credentials[i],strlen(credentials[i]),0) < 0 )
+		if ( kn_add_assertion(id,credentials[i],strlen(credentials[i]),0) < 0 )
 		{
-			DEBUG_CMD(fprintf(stderr,"adm_ctrl_authorise: error when adding credential assertion\n"));
+			DEBUG_CMD(fprintf(stderr,"adm_ctrl_add_assertions: error when adding credential assertion\n"));
 			switch( keynote_errno )
 			{
 				case ERROR_SYNTAX:
@@ -1094,20 +1457,20 @@ adm_ctrl_authorise(adm_ctrl_request_t *auth,adm_ctrl_policy_t *policy,adm_ctrl_r
 					auth_error = - ADMCTRL_INTERNAL_ERROR;
 					break;
 			}
-			goto error;
+			goto exit;
 		}
 
 	// Add authorizer
   if ( (pkstring = kn_get_string(auth->pubkey)) == NULL )
   {
-		DEBUG_CMD(fprintf(stderr,"adm_ctrl_authorise: couldn't get authorizer's string\n"));
+		DEBUG_CMD(fprintf(stderr,"adm_ctrl_add_assertions: couldn't get authorizer's string\n"));
     auth_error = - ADMCTRL_PUBKEY_ERROR;
-    goto error;
+    goto exit;
   }
 
-	if ( kn_add_authorizer(kn_session_id,pkstring) < 0 )
+	if ( kn_add_authorizer(id,pkstring) < 0 )
 	{
-		DEBUG_CMD(fprintf(stderr,"adm_ctrl_authorise: couldn't add authorizer\n"));
+		DEBUG_CMD(fprintf(stderr,"adm_ctrl_add_assertions: couldn't add authorizer\n"));
 		switch( keynote_errno )
 		{
 			case ERROR_SYNTAX:
@@ -1120,10 +1483,61 @@ adm_ctrl_authorise(adm_ctrl_request_t *auth,adm_ctrl_policy_t *policy,adm_ctrl_r
 				auth_error = - ADMCTRL_INTERNAL_ERROR;
 				break;
 		}
-		goto error;
+		goto exit;
 	}
 
+exit:
+	for(i = 0 ; i < creds_num ; ++i)
+		free(credentials[i]);
+	free(credentials);
+
+	return auth_error;
+}
+
+
+/** \brief Checks the credentials and resource consumption of request against a policy
+ *
+ * \param auth admission control request
+ * \param policy admission control policy
+ * \param res admission control result datatype where results are going to be stored
+ * \param db reference to resource control database
+ *
+ * \return the index of the PCV that corresponds to the provided credentials,
+ *  or less that zero for error
+ */
+int
+#ifdef WITH_RESOURCE_CONTROL
+adm_ctrl_authorise(adm_ctrl_request_t *auth,adm_ctrl_policy_t *policy,adm_ctrl_result_t *res,resource_ctrl_db_t *db)
+#else
+adm_ctrl_authorise(adm_ctrl_request_t *auth,adm_ctrl_policy_t *policy,adm_ctrl_result_t *res)
+#endif
+{
+	int kn_session_id;
+	adm_ctrl_flist_t *flist = NULL;
+	int auth_error = 0;
+	struct timeval tv;
+
+  res->PCV = 0;
+	res->error = 0;
+	if ( timing )
+		bzero(timing,sizeof(adm_ctrl_timing_t));
+
+	// Initialize session
+	if ( (kn_session_id = kn_init()) < 0 )
+	{
+		DEBUG_CMD(fprintf(stderr,"adm_ctrl_authorise: couldn't start a keynote session\n"));
+		return - ADMCTRL_MEMORY_ERROR;
+	}
+
+	// Add policy, credentials and authorizer
+	stage_start(&tv);
+	auth_error = adm_ctrl_add_assertions(kn_session_id,auth,policy);
+	stage_stop(ADM_CTRL_STAGE_ASSERTIONS,&tv);
+	if ( auth_error != 0 )
+		goto error;
+
 	// Add the device name action
+	stage_start(&tv);
 	if ( (auth_error = adm_ctrl_generate_pair_assertions(kn_session_id,auth->pairs_num,auth->pair_assertions)) < 0 )
 	{
 		DEBUG_CMD2(fprintf(stderr,"adm_ctrl_authorise: error while adding name-value pairs\n"));
@@ -1132,23 +1546,30 @@ adm_ctrl_authorise(adm_ctrl_request_t *auth,adm_ctrl_policy_t *policy,adm_ctrl_r
 
   if ( add_default_assertions(kn_session_id) < 0 )
     goto error;
+	stage_stop(ADM_CTRL_STAGE_ACTIONS,&tv);
 
 	// Add the functions' specifications
 	if ( auth->functions_num > 0 )
 	{
 		DEBUG_CMD2(printf("DEBUG adm_ctrl_authorise: calling adm_ctrl_deserialize_functions\n"));
-		if ( (flist = adm_ctrl_deserialize_functions(auth->function_list,auth->functions_num,MAX_FUNCTION_LIST_SIZE)) == NULL )
+		stage_start(&tv);
+		flist = adm_ctrl_deserialize_functions(auth->function_list,auth->functions_num,MAX_FUNCTION_LIST_SIZE,policy->schema);
+		stage_stop(ADM_CTRL_STAGE_DESERIALIZE,&tv);
+		if ( flist == NULL )
 		{
 			DEBUG_CMD2(fprintf(stderr,"adm_ctrl_authorise: deserialization gobacked\n"));
 			auth_error = - ADMCTRL_FUNCFORMAT_ERROR;
 			goto error;
 		}
 		DEBUG_CMD2(printf("DEBUG adm_ctrl_authorise: calling adm_ctrl_generate_func_assertions\n"));
+		stage_start(&tv);
 #ifdef WITH_RESOURCE_CONTROL
-		if ( (auth_error = adm_ctrl_flist_process(kn_session_id,flist,res,db)) != 0 )
+		auth_error = adm_ctrl_flist_process(kn_session_id,flist,res,db);
 #else
-		if ( (auth_error = adm_ctrl_flist_process(kn_session_id,flist)) != 0 )
+		auth_error = adm_ctrl_flist_process(kn_session_id,flist);
 #endif
+		stage_stop(ADM_CTRL_STAGE_ACTIONS,&tv);
+		if ( auth_error != 0 )
 		{
 			DEBUG_CMD(fprintf(stderr,"adm_ctrl_authorise: processing function list failed\n"));
 			goto error;
@@ -1156,7 +1577,10 @@ adm_ctrl_authorise(adm_ctrl_request_t *auth,adm_ctrl_policy_t *policy,adm_ctrl_r
 	}
 
 	// Finally do the checking
-	if ( (res->PCV = kn_do_query(kn_session_id,default_PCV,NUMBER_OF_PCV)) < 0 )
+	stage_start(&tv);
+	res->PCV = kn_do_query(kn_session_id,default_PCV,NUMBER_OF_PCV);
+	stage_stop(ADM_CTRL_STAGE_QUERY,&tv);
+	if ( res->PCV < 0 )
 	{
 		DEBUG_CMD2(fprintf(stderr,"adm_ctrl_authorise: keynote query failed\n"));
 		switch( keynote_errno )
@@ -1180,7 +1604,10 @@ adm_ctrl_authorise(adm_ctrl_request_t *auth,adm_ctrl_policy_t *policy,adm_ctrl_r
 #ifdef WITH_RESOURCE_CONTROL
 	else if ( res->PCV == 1 && db )
 	{
-		if ( (auth_error = resource_ctrl_check(db,res->required,res->resources_num)) > 0 )
+		stage_start(&tv);
+		auth_error = resource_ctrl_check(db,res->required,res->resources_num);
+		stage_stop(ADM_CTRL_STAGE_RESOURCES,&tv);
+		if ( auth_error > 0 )
 		{
 			DEBUG_CMD2(printf("DEBUG adm_ctrl_authorise: required resource %d unavailable\n",auth_error));
 			res->resources_num = (size_t)auth_error;
@@ -1200,13 +1627,6 @@ error:
 	if ( res->error == 0 )
 		res->error = auth_error;
 
-	if ( credentials )
-	{
-		for(i = 0 ; i < creds_num ; ++i)
-			free(credentials[i]);
-		free(credentials);
-	}
-
 	if ( flist )
 		adm_ctrl_free_functions(flist);
 
@@ -24,6 +24,7 @@
 
 #include <admctrl_config.h>
 #include <bytestream.h>
+#include <admctrl_schema.h>
 
 #ifdef WITH_RESOURCE_CONTROL
 #include <resource_ctrl.h>
@@ -53,6 +54,8 @@ struct adm_ctrl_policy
 	char data[MAX_POLICY_SIZE]; //!< The policy data as read from the file
 	char **assertions; //!< An array pointing to the different assertions in the policy
 	int assertions_num; //!< The number of assertions in the policy
+	//! Schema registry the function ids of requests refer to, or NULL
+	const admctrl_schema_t *schema;
 };
 //! Admission control policy datatype
 typedef struct adm_ctrl_policy adm_ctrl_policy_t;
@@ -65,6 +68,14 @@ struct adm_ctrl_result
   int PCV; //!< The compliance value of a flow, as returned by keynote
 	int error; //!< Error feedback
 	size_t resources_num; //!< Number of required resources
+	//! Session opened for an ADMCTRL_SESSION_OPEN request, or 0
+	unsigned int session_id;
+	//! Seconds the session is valid for
+	unsigned int session_lifetime;
+	//! Length of session_key
+	size_t session_key_len;
+	//! Key of the session, encrypted with the public key of the request
+	unsigned char session_key[MAX_ENC_NONCE_SIZE];
 #ifdef WITH_RESOURCE_CONTROL
 	resource_required_t required[RESOURCE_CTRL_MAX_RESOURCES]; //!< Requires resources array
 #endif
@@ -81,6 +92,13 @@ struct adm_ctrl_pair
 //! Admission control name-value pair datatype
 typedef struct adm_ctrl_pair adm_ctrl_pair_t;
 
+//! Authenticate with the encrypted nonce and open a session
+#define ADMCTRL_SESSION_OPEN 0x1
+//! Authenticate with the MAC of the session in session_id
+#define ADMCTRL_SESSION_USE 0x2
+//! Close the session after authenticating with it
+#define ADMCTRL_SESSION_CLOSE 0x4
+
 //! Admission control request structure
 /** Contains all the required data for a client's request to be authenticated
  * and authorized. */
@@ -106,6 +124,13 @@ struct adm_ctrl_request
   unsigned int functions_num;
   //! The buffer with the serialized function list
   unsigned char function_list[MAX_FUNCTION_LIST_SIZE];
+
+	//! Session flags, see ADMCTRL_SESSION_OPEN
+	unsigned int session_flags;
+	//! Session authenticating the request, with ADMCTRL_SESSION_USE
+	unsigned int session_id;
+	//! HMAC of the other fields with the key of the session
+	unsigned char session_mac[SESSION_MAC_SIZE];
 };
 //! The scampi authorization datatype
 typedef struct adm_ctrl_request adm_ctrl_request_t;
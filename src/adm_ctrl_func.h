@@ -0,0 +1,168 @@
+/* adm_ctrl_func.h
+
+  Copyright 2004  Georgios Portokalidis <digital_bull@users.sourceforge.net>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef ADM_CTRL_FUNC_H
+#define ADM_CTRL_FUNC_H
+
+#include "adm_ctrl.h"
+
+/*! \file adm_ctrl_func.h
+ *  \brief Function list datatypes and the stages of authorisation
+ *  \author Georgios Portokalidis
+ *
+ *  These are internal to authd. They are exported so the stages of
+ *  adm_ctrl_authorise() can be exercised separately by tests/stage_bench.
+ */
+
+//! Function argument value
+union adm_ctrl_funcarg_value
+{
+	int integer; //!< Holds and integer
+	char *cstring; //!< Holds a C string
+	double dbl; //!< Holds a double
+	unsigned long long ullong; //!< Holds an unsigned long long
+};
+//! Function argument value datatype
+typedef union adm_ctrl_funcarg_value adm_ctrl_funcarg_value_t;
+
+
+//! Function argument definition
+/** It holds all the necessary information for a function argument */
+struct adm_ctrl_funcarg
+{
+	char type; //!< The type of the argument
+	adm_ctrl_funcarg_value_t value; //!< The value of the argument
+	//struct adm_ctrl_funcarg *next; //!< Pointer to next function argument
+};
+//! Function arguments datatype
+typedef struct adm_ctrl_funcarg adm_ctrl_funcarg_t;
+
+
+//! Function instance structure
+/** Contains information about the instances of a function. */
+struct adm_ctrl_func_instance
+{
+	unsigned int pos; //!< The position of the function in the list of functions
+	//! The arguments this instance was called with, as many as the args field in adm_ctrl_func
+	adm_ctrl_funcarg_t *arg;
+};
+//! Function instances datatype
+typedef struct adm_ctrl_func_instance adm_ctrl_func_instance_t;
+
+//! Values of one argument of all the instances of a library
+/** Kept column-wise so that their minimum and maximum are found in one pass
+ * over an array. STRING_TYPE arguments keep their length, and FUNCTION_TYPE
+ * arguments have no column. */
+union adm_ctrl_argcol
+{
+	int *integer; //!< INT_TYPE values or STRING_TYPE lengths
+	double *dbl; //!< DOUBLE_TYPE values
+	unsigned long long *ullong; //!< ULONG_LONG_TYPE values
+	void *values; //!< Any of the above
+};
+//! Argument column datatype
+typedef union adm_ctrl_argcol adm_ctrl_argcol_t;
+
+//! Library implementation of a function type
+/** Its instances are consecutive in the instances array of the list */
+struct adm_ctrl_lib
+{
+	char *name; //!< The name of the library
+	unsigned int num, //!< Number of instances that it has
+	first, //!< The position of the first instance
+	last; //!< The position of the last instance
+	adm_ctrl_func_instance_t *instances; //!< The first instance
+	adm_ctrl_argcol_t col[MAX_ARGUMENTS_NUMBER]; //!< One column for each argument, num values each
+};
+//! Function library datatype
+typedef struct adm_ctrl_lib adm_ctrl_lib_t;
+
+//! Function type definition
+/** Contains one entry for each distinct function used. Its libraries are
+ * consecutive in the libraries array of the list */
+struct adm_ctrl_func
+{
+	char *name; //<! The name of the function type
+	unsigned int num, //!< Number of instances that it has
+	first, //!< The position of the first instance
+	last; //!< The position of the last instance
+	//! The number of arguments this function accepts.
+	/** All the instances of this function have the same number of
+	 * arguments. */
+	unsigned int args;
+	//! The types of the arguments, shared by all instances
+	char *argt;
+	unsigned int libs; //!< Number of library implementations
+	adm_ctrl_lib_t *library; //!< The first library implementation of this function type
+};
+//! Function type datatype
+typedef struct adm_ctrl_func adm_ctrl_func_t;
+
+//! Function list passed to admission control
+/** Built in one allocation by adm_ctrl_deserialize_functions(). Function
+ * types, libraries, instances and arguments are each kept in an array, and
+ * every entry refers to a range of the next array. The instances of a
+ * library, and their arguments, are consecutive. */
+struct adm_ctrl_flist
+{
+	unsigned int num; //!< Number of function types
+	unsigned int libs; //!< Number of libraries of all function types
+	unsigned int instances; //!< Number of function instances
+	unsigned int args; //!< Number of arguments of all instances
+	adm_ctrl_func_t *func; //!< Function types
+	adm_ctrl_lib_t *lib; //!< Libraries, grouped by function type
+	adm_ctrl_func_instance_t *inst; //!< Instances, grouped by library
+	adm_ctrl_funcarg_t *arg; //!< Arguments, grouped by instance
+};
+//! Function list datatype
+typedef struct adm_ctrl_flist adm_ctrl_flist_t;
+
+
+//! Stages of adm_ctrl_authorise() that are timed
+enum adm_ctrl_stage
+{
+	ADM_CTRL_STAGE_ASSERTIONS, //!< Policy, credentials and authorizer
+	ADM_CTRL_STAGE_DESERIALIZE, //!< Deserializing the function list
+	ADM_CTRL_STAGE_ACTIONS, //!< Generating pair, default and function actions
+	ADM_CTRL_STAGE_QUERY, //!< The keynote query
+	ADM_CTRL_STAGE_RESOURCES, //!< Checking the availability of resources
+	ADM_CTRL_STAGES
+};
+
+//! Time spent in each stage of adm_ctrl_authorise()
+struct adm_ctrl_timing
+{
+	unsigned int done; //!< Bitmask of the stages that were run
+	unsigned int usec[ADM_CTRL_STAGES]; //!< Microseconds spent in each stage
+};
+//! Authorisation timing datatype
+typedef struct adm_ctrl_timing adm_ctrl_timing_t;
+
+void adm_ctrl_set_timing(adm_ctrl_timing_t *t);
+void adm_ctrl_free_functions(adm_ctrl_flist_t *list);
+adm_ctrl_flist_t *adm_ctrl_deserialize_functions(unsigned char *buf,unsigned int num,size_t buf_size,const admctrl_schema_t *schema);
+int adm_ctrl_add_assertions(int id,adm_ctrl_request_t *auth,adm_ctrl_policy_t *policy);
+int adm_ctrl_generate_pair_assertions(int id,unsigned int pairs,adm_ctrl_pair_t pair[MAX_PAIR_ASSERTIONS]);
+#ifdef WITH_RESOURCE_CONTROL
+int adm_ctrl_flist_process(int id,adm_ctrl_flist_t *flist,adm_ctrl_result_t *res,resource_ctrl_db_t *db);
+#else
+int adm_ctrl_flist_process(int id,adm_ctrl_flist_t *flist);
+#endif
+
+#endif
@@ -0,0 +1,298 @@
+/* adm_ctrl_session.c
+
+  Copyright 2004  Georgios Portokalidis <digital_bull@users.sourceforge.net>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/rsa.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
+
+#include "keynote.h"
+#include "admctrl_config.h"
+#include "adm_ctrl.h"
+#include "adm_ctrl_session.h"
+#include "admctrl_errno.h"
+#include "debug.h"
+
+/*! \file adm_ctrl_session.c
+ *  \brief Authenticated sessions kept by authd
+ *  \author Georgios Portokalidis
+ */
+
+
+/** \brief Hash the public key of a request
+*/
+static void
+pubkey_hash(const adm_ctrl_request_t *req,unsigned char *hash)
+{
+	const unsigned char *end;
+
+	end = memchr(req->pubkey,'\0',MAX_PUBKEY_SIZE);
+	SHA256(req->pubkey,( end )? (size_t)(end - req->pubkey) : MAX_PUBKEY_SIZE,hash);
+}
+
+
+/** \brief Find the reference to a session in its bucket
+
+	\return the reference pointing to the session, or to the end of the bucket
+	if it doesn't exist
+*/
+static adm_ctrl_session_t **
+session_find(adm_ctrl_sessions_t *s,unsigned int id)
+{
+	adm_ctrl_session_t **sp;
+
+	for(sp = s->bucket + (id & s->mask) ; *sp && (*sp)->id != id ; sp = &(*sp)->next)
+		;
+	return sp;
+}
+
+
+/** \brief Remove the session a reference points to
+*/
+static void
+session_remove(adm_ctrl_sessions_t *s,adm_ctrl_session_t **sp)
+{
+	adm_ctrl_session_t *session = *sp;
+
+	*sp = session->next;
+	OPENSSL_cleanse(session->key,SESSION_KEY_SIZE);
+	free(session);
+	--s->num;
+}
+
+
+/** \brief Encrypt the key of a session with the public key of a request
+
+	\return 0 on success, or a negative error code on failure
+*/
+static int
+encrypt_key(const adm_ctrl_request_t *req,const unsigned char *key,adm_ctrl_result_t *res)
+{
+	struct keynote_deckey dk;
+	char *pkstring;
+	int len = -1;
+
+	if ( (pkstring = kn_get_string((char *)req->pubkey)) == NULL ||
+			kn_decode_key(&dk,pkstring,KEYNOTE_PUBLIC_KEY) < 0 )
+		return - ADMCTRL_PUBKEY_ERROR;
+
+	if ( dk.dec_algorithm == KEYNOTE_ALGORITHM_RSA &&
+			RSA_size((RSA *)dk.dec_key) <= MAX_ENC_NONCE_SIZE )
+		len = RSA_public_encrypt(SESSION_KEY_SIZE,(unsigned char *)key,res->session_key,
+				(RSA *)dk.dec_key,RSA_PKCS1_OAEP_PADDING);
+	kn_free_key(&dk);
+
+	if ( len <= 0 )
+	{
+		DEBUG_CMD(fprintf(stderr,"adm_ctrl_session_open: couldn't encrypt session key\n"));
+		return - ADMCTRL_PUBKEY_ERROR;
+	}
+	res->session_key_len = (size_t)len;
+	return 0;
+}
+
+
+/** \brief Initialise a table of sessions
+
+	\param s The table
+	\param max Maximum number of sessions, 0 to disable sessions
+	\param lifetime Seconds a session is valid for
+
+	\return 0 on success, or -1 if no memory was available
+*/
+int
+adm_ctrl_sessions_init(adm_ctrl_sessions_t *s,unsigned int max,unsigned int lifetime)
+{
+	unsigned int buckets;
+
+	bzero(s,sizeof(adm_ctrl_sessions_t));
+	if ( max == 0 )
+		return 0;
+
+	// A power of 2, at least as many as the sessions
+	for(buckets = 1 ; buckets < max ; buckets <<= 1)
+		;
+	if ( (s->bucket = calloc(buckets,sizeof(adm_ctrl_session_t *))) == NULL )
+		return -1;
+	s->mask = buckets - 1;
+	s->max = max;
+	s->lifetime = lifetime;
+	return 0;
+}
+
+
+/** \brief Destroy a table of sessions
+*/
+void
+adm_ctrl_sessions_destroy(adm_ctrl_sessions_t *s)
+{
+	if ( s->bucket == NULL )
+		return;
+	adm_ctrl_sessions_revoke(s);
+	free(s->bucket);
+	s->bucket = NULL;
+}
+
+
+/** \brief Open a session for an authenticated request
+	Stores the id, lifetime and encrypted key of the session in the result.
+	The result is left unchanged if the session couldn't be opened, since the
+	request itself has been authenticated.
+
+	\param s The table of sessions
+	\param req The request, authenticated with its encrypted nonce
+	\param res The result of the request
+
+	\return 0 on success, or a negative error code on failure
+*/
+int
+adm_ctrl_session_open(adm_ctrl_sessions_t *s,const adm_ctrl_request_t *req,adm_ctrl_result_t *res)
+{
+	adm_ctrl_session_t *session,**sp;
+	int e;
+
+	if ( s->max == 0 )
+		return - ADMCTRL_SESSION_ERROR;
+	if ( s->num >= s->max && adm_ctrl_sessions_expire(s) == 0 )
+	{
+		DEBUG_CMD(fprintf(stderr,"adm_ctrl_session_open: too many sessions\n"));
+		return - ADMCTRL_SESSION_ERROR;
+	}
+	if ( (session = calloc(1,sizeof(adm_ctrl_session_t))) == NULL )
+		return - ADMCTRL_MEMORY_ERROR;
+
+	// Pick an unused id, 0 means no session
+	do {
+		if ( RAND_bytes((unsigned char *)&session->id,sizeof(session->id)) != 1 )
+			goto rand_error;
+	} while( session->id == 0 || *(sp = session_find(s,session->id)) != NULL );
+	if ( RAND_bytes(session->key,SESSION_KEY_SIZE) != 1 )
+		goto rand_error;
+
+	if ( (e = encrypt_key(req,session->key,res)) != 0 )
+	{
+		OPENSSL_cleanse(session->key,SESSION_KEY_SIZE);
+		free(session);
+		return e;
+	}
+	pubkey_hash(req,session->pubkey_hash);
+	session->expires = time(NULL) + s->lifetime;
+	*sp = session;
+	++s->num;
+
+	res->session_id = session->id;
+	res->session_lifetime = s->lifetime;
+	return 0;
+
+rand_error:
+	free(session);
+	return - ADMCTRL_INTERNAL_ERROR;
+}
+
+
+/** \brief Authenticate a request by the MAC of its session
+	The session must exist, not have expired and belong to the public key of
+	the request. If the request has ADMCTRL_SESSION_CLOSE set, the session is
+	closed after authenticating it.
+
+	\param s The table of sessions
+	\param req The request
+
+	\return 1 on successful authentication, - ADMCTRL_SESSION_ERROR, or
+	- ADMCTRL_MEMORY_ERROR if the MAC couldn't be computed
+*/
+int
+adm_ctrl_session_authenticate(adm_ctrl_sessions_t *s,const adm_ctrl_request_t *req)
+{
+	adm_ctrl_session_t **sp,*session;
+	unsigned char mac[SESSION_MAC_SIZE],hash[SHA256_DIGEST_LENGTH];
+
+	if ( s->max == 0 || *(sp = session_find(s,req->session_id)) == NULL )
+		return - ADMCTRL_SESSION_ERROR;
+	session = *sp;
+	if ( session->expires <= time(NULL) )
+	{
+		session_remove(s,sp);
+		return - ADMCTRL_SESSION_ERROR;
+	}
+
+	// Nothing else in the request is trusted before the MAC is checked
+	if ( adm_ctrl_session_mac(session->key,req,mac) != 0 )
+		return - ADMCTRL_MEMORY_ERROR;
+	if ( CRYPTO_memcmp(mac,req->session_mac,SESSION_MAC_SIZE) != 0 )
+		return - ADMCTRL_SESSION_ERROR;
+	pubkey_hash(req,hash);
+	if ( memcmp(hash,session->pubkey_hash,SHA256_DIGEST_LENGTH) != 0 )
+		return - ADMCTRL_SESSION_ERROR;
+
+	if ( req->session_flags & ADMCTRL_SESSION_CLOSE )
+		session_remove(s,sp);
+	return 1;
+}
+
+
+/** \brief Remove the sessions that have expired
+
+	\param s The table of sessions
+
+	\return the number of sessions removed
+*/
+unsigned int
+adm_ctrl_sessions_expire(adm_ctrl_sessions_t *s)
+{
+	adm_ctrl_session_t **sp;
+	unsigned int i,n = 0;
+	time_t now = time(NULL);
+
+	for(i = 0 ; s->num > 0 && i <= s->mask ; i++)
+		for(sp = s->bucket + i ; *sp ; )
+			if ( (*sp)->expires <= now )
+			{
+				session_remove(s,sp);
+				++n;
+			}
+			else
+				sp = &(*sp)->next;
+	return n;
+}
+
+
+/** \brief Revoke all sessions
+	Clients have to authenticate with their encrypted nonce again.
+
+	\param s The table of sessions
+
+	\return the number of sessions revoked
+*/
+unsigned int
+adm_ctrl_sessions_revoke(adm_ctrl_sessions_t *s)
+{
+	unsigned int i,n = s->num;
+
+	for(i = 0 ; s->num > 0 && i <= s->mask ; i++)
+		while( s->bucket[i] )
+			session_remove(s,s->bucket + i);
+	return n;
+}
@@ -0,0 +1,140 @@
+/* adm_ctrl_session.h
+
+  Copyright 2004  Georgios Portokalidis <digital_bull@users.sourceforge.net>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef ADM_CTRL_SESSION_H
+#define ADM_CTRL_SESSION_H
+
+#include <time.h>
+#include <sys/types.h>
+#include <openssl/hmac.h>
+#include <openssl/sha.h>
+#include "adm_ctrl.h"
+
+/*! \file adm_ctrl_session.h
+ *  \brief Authenticated sessions kept by authd
+ *  \author Georgios Portokalidis
+ *
+ *  A client that authenticates with its encrypted nonce can ask for a
+ *  session with ADMCTRL_SESSION_OPEN. authd returns the id of the session
+ *  and a random key, encrypted with the public key of the request, so only
+ *  the owner of the private key can use it. Later requests with the same
+ *  public key set ADMCTRL_SESSION_USE and carry the HMAC of the whole request
+ *  with the key, see adm_ctrl_session_mac(), instead of the encrypted nonce,
+ *  which saves authd an RSA operation. Sessions expire after a fixed
+ *  lifetime, are closed by ADMCTRL_SESSION_CLOSE and can all be revoked at
+ *  once.
+ */
+
+//! Session
+struct adm_ctrl_session
+{
+	unsigned int id; //!< Id of the session
+	time_t expires; //!< Time the session expires
+	unsigned char key[SESSION_KEY_SIZE]; //!< Key of the session
+	unsigned char pubkey_hash[SHA256_DIGEST_LENGTH]; //!< Hash of the public key
+	struct adm_ctrl_session *next; //!< Next session in the same bucket
+};
+//! Session datatype
+typedef struct adm_ctrl_session adm_ctrl_session_t;
+
+//! Table of sessions
+struct adm_ctrl_sessions
+{
+	adm_ctrl_session_t **bucket; //!< Hash table of sessions, by id
+	unsigned int mask; //!< Number of buckets - 1
+	unsigned int num; //!< Number of sessions
+	unsigned int max; //!< Maximum number of sessions, 0 if disabled
+	unsigned int lifetime; //!< Seconds a session is valid for
+};
+//! Table of sessions datatype
+typedef struct adm_ctrl_sessions adm_ctrl_sessions_t;
+
+
+/** \brief Add a number to a MAC in network byte order
+*/
+static inline void
+adm_ctrl_session_mac_u32(HMAC_CTX *ctx,u_int32_t v)
+{
+	unsigned char b[4];
+
+	b[0] = (unsigned char)(v >> 24);
+	b[1] = (unsigned char)(v >> 16);
+	b[2] = (unsigned char)(v >> 8);
+	b[3] = (unsigned char)v;
+	HMAC_Update(ctx,b,sizeof(b));
+}
+
+/** \brief Compute the MAC of a request authenticated by a session
+	The MAC is the HMAC-SHA256, with the key of the session, of every field
+	of the request but session_mac, in the order they are declared. Arrays
+	are taken whole and numbers as 32-bit words in network byte order, the
+	length of the encrypted nonce as two of them, so the MAC depends neither
+	on the padding nor on the byte order of the hosts.
+
+	\param key The key of the session
+	\param req The request
+	\param mac Buffer of SESSION_MAC_SIZE bytes to store the MAC
+
+	\return 0 on success, or -1 if no memory was available
+*/
+static inline int
+adm_ctrl_session_mac(const unsigned char *key,const adm_ctrl_request_t *req,unsigned char *mac)
+{
+	unsigned int len = SESSION_MAC_SIZE;
+#if (OPENSSL_VERSION_NUMBER < 0x10100000L)
+	HMAC_CTX hctx,*ctx = &hctx;
+
+	HMAC_CTX_init(ctx);
+#else
+	HMAC_CTX *ctx;
+
+	if ( (ctx = HMAC_CTX_new()) == NULL )
+		return -1;
+#endif
+	HMAC_Init_ex(ctx,key,SESSION_KEY_SIZE,EVP_sha256(),NULL);
+	HMAC_Update(ctx,req->pubkey,MAX_PUBKEY_SIZE);
+	HMAC_Update(ctx,req->credentials,MAX_CREDENTIALS_SIZE);
+	adm_ctrl_session_mac_u32(ctx,req->nonce);
+	HMAC_Update(ctx,req->encrypted_nonce,MAX_ENC_NONCE_SIZE);
+	adm_ctrl_session_mac_u32(ctx,(u_int32_t)((u_int64_t)req->encrypted_nonce_len >> 32));
+	adm_ctrl_session_mac_u32(ctx,(u_int32_t)req->encrypted_nonce_len);
+	adm_ctrl_session_mac_u32(ctx,req->pairs_num);
+	// Pairs only hold characters, so they have no padding
+	HMAC_Update(ctx,(const unsigned char *)req->pair_assertions,sizeof(req->pair_assertions));
+	adm_ctrl_session_mac_u32(ctx,req->functions_num);
+	HMAC_Update(ctx,req->function_list,MAX_FUNCTION_LIST_SIZE);
+	adm_ctrl_session_mac_u32(ctx,req->session_flags);
+	adm_ctrl_session_mac_u32(ctx,req->session_id);
+	HMAC_Final(ctx,mac,&len);
+#if (OPENSSL_VERSION_NUMBER < 0x10100000L)
+	HMAC_CTX_cleanup(ctx);
+#else
+	HMAC_CTX_free(ctx);
+#endif
+	return 0;
+}
+
+int adm_ctrl_sessions_init(adm_ctrl_sessions_t *s,unsigned int max,unsigned int lifetime);
+void adm_ctrl_sessions_destroy(adm_ctrl_sessions_t *s);
+int adm_ctrl_session_open(adm_ctrl_sessions_t *s,const adm_ctrl_request_t *req,adm_ctrl_result_t *res);
+int adm_ctrl_session_authenticate(adm_ctrl_sessions_t *s,const adm_ctrl_request_t *req);
+unsigned int adm_ctrl_sessions_expire(adm_ctrl_sessions_t *s);
+unsigned int adm_ctrl_sessions_revoke(adm_ctrl_sessions_t *s);
+
+#endif
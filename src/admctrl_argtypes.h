@@ -23,6 +23,23 @@
 /** \file admctrl_argtypes.h
 	\brief Defines the function argument types that can be used with admission control
   \author Georgios Portokalidis
+
+	A serialized function list is encoded in one of two ways. Version 1 starts
+	with the ADMCTRL_FLIST_HEADER_SIZE bytes of ADMCTRL_FLIST_MAGIC, the
+	version and the 32 bit tag of the schema registry the list refers to, or
+	0. Each function follows as its name, its library, its argument types
+	string and its arguments, in order. Strings are the 16 bit length, then
+	the characters and a terminating zero. Instead of the three strings, a
+	function can be ADMCTRL_FLIST_SCHEMA_REF followed by its 16 bit id in the
+	schema registry, see admctrl_schema.h. Integers are 32 bits, unsigned
+	long longs 64 bits and doubles IEEE 754 doubles of 64 bits, all
+	little-endian. Every number, including string lengths, is aligned to its
+	size from the start of the list, with zeros as padding, and the arguments
+	of a function start aligned to 8 bytes. A function argument is a whole
+	function.
+
+	Lists without the header are in the format of authd 0.8: zero terminated
+	strings and numbers in the byte order and size of the host, not aligned.
 	*/
 
 //! Function argument types
@@ -32,4 +49,71 @@
 #define FUNCTION_TYPE 'F'
 #define ULONG_LONG_TYPE 'L'
 
+//! Version of the function list encoding written by admctrl_req_add_function()
+#define ADMCTRL_FLIST_VERSION 1
+//! Size of the header of a versioned function list
+#define ADMCTRL_FLIST_HEADER_SIZE 8
+//! First bytes of the header of a versioned function list, followed by the version
+/** A list of authd 0.8 cannot start with an empty function name */
+#define ADMCTRL_FLIST_MAGIC "\0FL"
+//! Size of ADMCTRL_FLIST_MAGIC
+#define ADMCTRL_FLIST_MAGIC_SIZE 3
+//! Offset of the tag of the schema registry in the header of a versioned function list
+#define ADMCTRL_FLIST_TAG_OFFSET 4
+//! Length of the name of a function that refers to the schema registry by id
+/** Longer strings can't be encoded */
+#define ADMCTRL_FLIST_SCHEMA_REF 0xffff
+//! Alignment of the arguments of a function in a versioned function list
+#define ADMCTRL_FLIST_ARGS_ALIGN 8
+
+//! Round an offset in a versioned function list up to an alignment
+#define ADMCTRL_FLIST_ALIGN(off,a) (((off) + (a) - 1) & ~((size_t)(a) - 1))
+
+//! Store a 16 bit little-endian number
+static inline void
+admctrl_put_le16(unsigned char *p,unsigned int v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+}
+
+//! Store a 32 bit little-endian number
+static inline void
+admctrl_put_le32(unsigned char *p,unsigned int v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
+
+//! Store a 64 bit little-endian number
+static inline void
+admctrl_put_le64(unsigned char *p,unsigned long long v)
+{
+	admctrl_put_le32(p,(unsigned int)(v & 0xffffffffULL));
+	admctrl_put_le32(p + 4,(unsigned int)(v >> 32));
+}
+
+//! Load a 16 bit little-endian number
+static inline unsigned int
+admctrl_get_le16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+//! Load a 32 bit little-endian number
+static inline unsigned int
+admctrl_get_le32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+//! Load a 64 bit little-endian number
+static inline unsigned long long
+admctrl_get_le64(const unsigned char *p)
+{
+	return admctrl_get_le32(p) | ((unsigned long long)admctrl_get_le32(p + 4) << 32);
+}
+
 #endif
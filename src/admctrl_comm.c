@@ -44,9 +44,7 @@
 int
 admctrl_comm_init(admctrl_comm_t *comm)
 {
-	size_t shm_size = MAX(sizeof(adm_ctrl_request_t),sizeof(adm_ctrl_result_t));
-
-	if ( (comm->shm_addr = shm_create(comm->key,shm_size,&comm->shm_id)) == NULL )
+	if ( (comm->shm_addr = shm_create(comm->key,ADMCTRL_COMM_SHM_SIZE,&comm->shm_id)) == NULL )
 		return - ADMCTRL_COMM_SHM_ERROR;
 
 	if ( (comm->sem_id = shm_create_sem(comm->key)) < 0 )
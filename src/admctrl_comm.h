@@ -22,9 +22,15 @@
 
 #include <sys/types.h>
 
+#include "adm_ctrl.h"
+
 /** \file admctrl_comm.h
 	\brief Admission control IPC communication definitions
 	\author Georgios Portokalidis
+
+	The shared memory segment starts with an admctrl_comm_header, followed by
+	MAX_IPC_BATCH slots. A client places num requests in the first slots and
+	authd replaces each one with its result, so a batch costs one exchange.
 */
 
 //! Errors definitions
@@ -34,6 +40,20 @@ enum {
 };
 
 
+//! Header of the shared memory segment
+struct admctrl_comm_header
+{
+	u_int32_t num; //!< Number of requests in the slots, and then of results
+	u_int32_t reserved; //!< Keeps the slots aligned
+};
+
+//! Size of a slot of the shared memory segment
+#define ADMCTRL_COMM_SLOT_SIZE (MAX(sizeof(adm_ctrl_request_t),sizeof(adm_ctrl_result_t)))
+//! Size of the shared memory segment
+#define ADMCTRL_COMM_SHM_SIZE (sizeof(struct admctrl_comm_header) + MAX_IPC_BATCH * ADMCTRL_COMM_SLOT_SIZE)
+//! Address of the i-th slot of the shared memory segment at addr
+#define ADMCTRL_COMM_SLOT(addr,i) ((void *)((char *)(addr) + sizeof(struct admctrl_comm_header) + (i) * ADMCTRL_COMM_SLOT_SIZE))
+
 // IPC information structure
 struct admctrl_comm
 {
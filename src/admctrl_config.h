@@ -34,6 +34,10 @@
 #define MAX_CREDENTIALS_SIZE 8192
 //! Maximum size of encoded nonce
 #define MAX_ENC_NONCE_SIZE 256
+//! Size of the key of an authenticated session
+#define SESSION_KEY_SIZE 32
+//! Size of the MAC authenticating a request by a session (HMAC-SHA256)
+#define SESSION_MAC_SIZE 32
 //#define MAX_DEVICE_NAME_SIZE 256
 //! Maximum size of function list
 #define MAX_FUNCTION_LIST_SIZE 65536
@@ -45,9 +49,13 @@
 #define MAX_ACTION_VALUE_SIZE 512
 //! Maximum number of arguments a function can have 
 #define MAX_ARGUMENTS_NUMBER 12
+//! Maximum depth of functions passed as arguments to other functions
+#define MAX_FUNCTION_NESTING 16
 #define MAX_PAIR_NAME 64
 #define MAX_PAIR_VALUE 512
 #define MAX_PAIR_ASSERTIONS 16
+//! Maximum number of requests served in one exchange with authd through shared memory
+#define MAX_IPC_BATCH 16
 /******************************************/
 
 
@@ -57,12 +65,16 @@
 #define DEFAULT_SHM_FILE "/tmp/.authd"
 //! The project id to use for shared memory
 #define DEFAULT_SHM_PROJECT_ID 'A'
+//! The project id to use for authd's statistics segment
+#define DEFAULT_STATS_PROJECT_ID 'S'
 //! The file where scampi's policy is defined
 #define DEFAULT_POLICY_FILE "/etc/authd/policy"
 //! Resource control home
 #define DEFAULT_RESOURCE_CTRL_HOME "/etc/authd/resourcectrl"
 //! Resource control database name
 #define DEFAULT_RESOURCE_DBNAME "resource.db"
+//! Maximum number of sessions authd keeps
+#define DEFAULT_MAX_SESSIONS 1024
 //! The string to prepended to SYSLOG entries
 #define SYSLOG_PREPEND "authd"
 /***********************************************/
@@ -75,7 +87,13 @@
 //! Maximum length of resource type description string
 #define RESOURCE_CTRL_MAX_RES_DESCR_LEN 64
 //! Maximum number of resource types a request can consume
-#define RESOURCE_CTRL_MAX_RESOURCES 32
+#define RESOURCE_CTRL_MAX_RESOURCES 128
+//! Number of slots used to find required resources by key, a power of 2
+#define RESOURCE_CTRL_SLOTS (2 * RESOURCE_CTRL_MAX_RESOURCES)
+//! Interval in seconds at which authd expires resource leases
+#define RESOURCE_CTRL_LEASE_TICK 1
+//! Number of slots in authd's lease timer wheel. Each slot covers one second
+#define RESOURCE_CTRL_LEASE_WHEEL_SLOTS 512
 /****************************************/
 #endif
 
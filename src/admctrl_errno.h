@@ -37,7 +37,8 @@ enum {
 	ADMCTRL_SYNTAX_ERROR, //!< Authorisation failed due to syntax error
 	ADMCTRL_AUTHENTICATION_ERROR, //!< Nonce challenge failed
 	ADMCTRL_RESOURCE_CTRL_ERROR, //!< Error while calculating request's resource consumption
-	ADMCTRL_RESOURCE_CTRL_FAIL //!< Resource control failed. Resource requirements cannot be satisfied
+	ADMCTRL_RESOURCE_CTRL_FAIL, //!< Resource control failed. Resource requirements cannot be satisfied
+	ADMCTRL_SESSION_ERROR //!< Session unknown, expired, revoked or MAC invalid
 };
 
 #endif
@@ -22,6 +22,7 @@
 #endif
 
 #include <errno.h>
+#include <stdarg.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -34,6 +35,7 @@
 #include "bytestream.h"
 #include "admctrl_argtypes.h"
 #include "admctrl_req.h"
+#include "admctrl_schema.h"
 
 /*! \file admctrl_req.c
   \brief Contains methods to construct an admission control request
@@ -41,22 +43,265 @@
 */
 
 
+/** \brief Append zeros to a function list up to an alignment
+
+	\param buf the function list
+	\param off reference to the offset in buf
+	\param align the alignment
+
+	\return 0 on success, or -1 if the list is full
+*/
 static int
-append_string(const char *s,unsigned char *buf,size_t *buf_size)
+append_pad(unsigned char *buf,size_t *off,size_t align)
 {
-	size_t len;
+	size_t noff;
 
-	// Copy function name
-	len = strlen(s) + 1;
-	if ( (len + *buf_size) > MAX_FUNCTION_LIST_SIZE )
+	noff = ADMCTRL_FLIST_ALIGN(*off,align);
+	if ( noff > MAX_FUNCTION_LIST_SIZE )
 		return -1;
-	strcpy(buf + *buf_size,s);
-	*buf_size += len;
+	memset(buf + *off,0,noff - *off);
+	*off = noff;
+	return 0;
+}
+
+
+/** \brief Append a little-endian number of 4 or 8 bytes to a function list
+
+	\param buf the function list
+	\param off reference to the offset in buf
+	\param v the number
+	\param size the size of the number in the list
+
+	\return 0 on success, or -1 if the list is full
+*/
+static int
+append_number(unsigned char *buf,size_t *off,unsigned long long v,size_t size)
+{
+	if ( append_pad(buf,off,size) != 0 || (*off + size) > MAX_FUNCTION_LIST_SIZE )
+		return -1;
+	if ( size == 4 )
+		admctrl_put_le32(buf + *off,(unsigned int)v);
+	else
+		admctrl_put_le64(buf + *off,v);
+	*off += size;
+	return 0;
+}
+
+
+/** \brief Append a length prefixed string to a function list
+
+	\param s the string
+	\param len the length of s
+	\param buf the function list
+	\param off reference to the offset in buf
+
+	\return 0 on success, or -1 if the list is full or s too long
+*/
+static int
+append_string(const char *s,size_t len,unsigned char *buf,size_t *off)
+{
+	if ( len >= ADMCTRL_FLIST_SCHEMA_REF || append_pad(buf,off,2) != 0 ||
+			(*off + 2 + len + 1) > MAX_FUNCTION_LIST_SIZE )
+		return -1;
+	admctrl_put_le16(buf + *off,len);
+	memcpy(buf + *off + 2,s,len);
+	buf[*off + 2 + len] = '\0';
+	*off += 2 + len + 1;
+	return 0;
+}
+
+
+//! Write the header of a function list before its first function
+static void
+begin_list(unsigned char *buf,size_t *off)
+{
+	if ( *off > 0 )
+		return;
+	memset(buf,0,ADMCTRL_FLIST_HEADER_SIZE);
+	memcpy(buf,ADMCTRL_FLIST_MAGIC,ADMCTRL_FLIST_MAGIC_SIZE);
+	buf[ADMCTRL_FLIST_MAGIC_SIZE] = ADMCTRL_FLIST_VERSION;
+	*off = ADMCTRL_FLIST_HEADER_SIZE;
+}
+
+
+/** \brief Append the name, library and argument types of a function to a function list
+	The header of the list is written before the first function, and the
+	arguments are aligned.
+
+	\return 0 on success, or -1 if the list is full
+*/
+static int
+append_function(unsigned char *buf,size_t *off,const char *fname,const char *lname,const char *argt)
+{
+	begin_list(buf,off);
+	if ( append_string(fname,strlen(fname),buf,off) != 0 ||
+			append_string(lname,strlen(lname),buf,off) != 0 ||
+			append_string(argt,strlen(argt),buf,off) != 0 )
+		return -1;
+	return append_pad(buf,off,ADMCTRL_FLIST_ARGS_ALIGN);
+}
+
+
+/** \brief Append a reference to a function of a schema registry to a function list
+	The header of the list is written before the first function, and the tag
+	of the registry is stored in it. All the references of a list must be to
+	the same registry.
+
+	\param buf the function list
+	\param off reference to the offset in buf
+	\param schema the registry
+	\param id the id of the function
+	\param argt reference to store the argument types of the function
+
+	\return 0 on success, or -1 on failure
+*/
+static int
+append_function_id(unsigned char *buf,size_t *off,const admctrl_schema_t *schema,unsigned int id,const char **argt)
+{
+	const admctrl_schema_func_t *sf;
+	unsigned int tag;
+
+	if ( (sf = admctrl_schema_find(schema,id)) == NULL )
+		return -1;
+	begin_list(buf,off);
+	tag = admctrl_get_le32(buf + ADMCTRL_FLIST_TAG_OFFSET);
+	if ( (tag != 0 && tag != schema->tag) || append_pad(buf,off,2) != 0 ||
+			(*off + 4) > MAX_FUNCTION_LIST_SIZE )
+		return -1;
+	admctrl_put_le32(buf + ADMCTRL_FLIST_TAG_OFFSET,schema->tag);
+	admctrl_put_le16(buf + *off,ADMCTRL_FLIST_SCHEMA_REF);
+	admctrl_put_le16(buf + *off + 2,id);
+	*off += 4;
+	*argt = sf->argt;
+	return append_pad(buf,off,ADMCTRL_FLIST_ARGS_ALIGN);
+}
+
+
+/** \brief Encode arguments given as a variable argument list
+
+	\param buf the function list
+	\param off reference to the offset in buf
+	\param argt the argument types
+	\param ap the arguments
+
+	\return 0 on success, or -1 on error
+*/
+static int
+append_vargs(unsigned char *buf,size_t *off,const char *argt,va_list ap)
+{
+	unsigned long long ullong;
+	double doubleval;
+	char *string;
+	int e = 0;
+
+	for(; *argt != '\0' && e == 0 ; argt++)
+		switch( *argt )
+		{
+			case INT_TYPE:
+				e = append_number(buf,off,(unsigned int)va_arg(ap,int),4);
+				break;
+			case ULONG_LONG_TYPE:
+				ullong = va_arg(ap,unsigned long long);
+				e = append_number(buf,off,ullong,8);
+				break;
+			case DOUBLE_TYPE:
+				// The host's doubles are IEEE 754, in the byte order of its integers
+				doubleval = va_arg(ap,double);
+				memcpy(&ullong,&doubleval,sizeof(double));
+				e = append_number(buf,off,ullong,8);
+				break;
+			case STRING_TYPE:
+				string = va_arg(ap,char *);
+				e = append_string(string,strlen(string),buf,off);
+				break;
+			default:
+				e = -1;
+		}
+	return e;
+}
+
+
+/** \brief Encode arguments serialized in the format of authd 0.8
+	Numbers are in the byte order and size of the host and strings are zero
+	terminated. Function arguments are the name, library and argument types
+	strings of the function, followed by its arguments.
+
+	\param buf the function list
+	\param off reference to the offset in buf
+	\param argt the argument types
+	\param args reference to the serialized arguments, advanced past them
+	\param args_size reference to the size of args
+	\param depth the number of functions these arguments are nested in
+
+	\return 0 on success, or -1 on error
+*/
+static int
+append_sargs(unsigned char *buf,size_t *off,const char *argt,const unsigned char **args,size_t *args_size,unsigned int depth)
+{
+	const char *fname,*lname,*fargt;
+	unsigned long long ullong;
+	size_t len;
+	int integer;
+
+	for(; *argt != '\0' ; argt++)
+		switch( *argt )
+		{
+			case INT_TYPE:
+				if ( *args_size < sizeof(int) )
+					return -1;
+				memcpy(&integer,*args,sizeof(int));
+				if ( append_number(buf,off,(unsigned int)integer,4) != 0 )
+					return -1;
+				*args += sizeof(int);
+				*args_size -= sizeof(int);
+				break;
+			case ULONG_LONG_TYPE:
+			case DOUBLE_TYPE:
+				// The host's doubles are IEEE 754, in the byte order of its integers
+				if ( *args_size < sizeof(unsigned long long) )
+					return -1;
+				memcpy(&ullong,*args,sizeof(unsigned long long));
+				if ( append_number(buf,off,ullong,8) != 0 )
+					return -1;
+				*args += sizeof(unsigned long long);
+				*args_size -= sizeof(unsigned long long);
+				break;
+			case STRING_TYPE:
+				if ( (len = strnlen((const char *)*args,*args_size)) == *args_size ||
+						append_string((const char *)*args,len,buf,off) != 0 )
+					return -1;
+				*args += len + 1;
+				*args_size -= len + 1;
+				break;
+			case FUNCTION_TYPE:
+				if ( depth >= MAX_FUNCTION_NESTING )
+					return -1;
+				fname = (const char *)*args;
+				if ( (len = strnlen(fname,*args_size)) == *args_size )
+					return -1;
+				lname = fname + len + 1;
+				*args_size -= len + 1;
+				if ( (len = strnlen(lname,*args_size)) == *args_size )
+					return -1;
+				fargt = lname + len + 1;
+				*args_size -= len + 1;
+				if ( (len = strnlen(fargt,*args_size)) == *args_size )
+					return -1;
+				*args_size -= len + 1;
+				*args = (const unsigned char *)fargt + len + 1;
+				if ( append_function(buf,off,fname,lname,fargt) != 0 ||
+						append_sargs(buf,off,fargt,args,args_size,depth + 1) != 0 )
+					return -1;
+				break;
+			default:
+				return -1;
+		}
 	return 0;
 }
 
 
 /** \brief Set authentication and authorisation information for an admission control request
+	The request is authenticated by the encrypted nonce, not by a session.
 
 	\param request reference to admission control request structure
 	\param nonce nonce used for client authentication
@@ -69,10 +314,11 @@ void
 admctrl_req_set_authinfo(adm_ctrl_request_t *request,const unsigned char *pub,const unsigned char *creds,unsigned int nonce,const unsigned char *enc_nonce,size_t enc_nonce_len)
 {
   strncpy(request->pubkey,pub,MAX_PUBKEY_SIZE);
-  strncpy(request->credentials,creds,MAX_PUBKEY_SIZE);
+  strncpy(request->credentials,creds,MAX_CREDENTIALS_SIZE);
   request->nonce = nonce;
   request->encrypted_nonce_len = enc_nonce_len;
   memcpy(request->encrypted_nonce,enc_nonce,MIN(enc_nonce_len,MAX_ENC_NONCE_SIZE));
+  request->session_flags = 0;
 }
 
 
@@ -98,6 +344,10 @@ admctrl_req_add_nvpair(adm_ctrl_request_t *request,const char *name,const char *
 }
 
 /** \brief Add a function with serialised arguments to an admission control request
+	The arguments are serialized in the format of authd 0.8, in the byte order
+	of the host, and are encoded like those of admctrl_req_add_function().
+	Function arguments are the name, library and argument types strings of the
+	function, followed by its arguments.
 
 	\param request reference to admission control request structure
 	\param fbuf_off reference to offset in request's serialised functions list
@@ -112,25 +362,23 @@ admctrl_req_add_nvpair(adm_ctrl_request_t *request,const char *name,const char *
 int
 admctrl_req_add_sfunction(adm_ctrl_request_t *request,size_t *fbuf_off,const char *fname,const char *lname,const char *argt,const unsigned char *args,size_t args_size)
 {
-	if ( append_string(fname,request->function_list,fbuf_off) != 0 )
-		return -1;
-	if ( append_string(lname,request->function_list,fbuf_off) != 0 )
-		return -1;
-	if ( append_string(argt,request->function_list,fbuf_off) != 0 )
+	size_t off = *fbuf_off;
+
+	if ( append_function(request->function_list,&off,fname,lname,argt) != 0 ||
+			append_sargs(request->function_list,&off,argt,&args,&args_size,0) != 0 ||
+			args_size != 0 )
 		return -1;
-	if ( args_size > 0 )
-	{
-		if ( (args_size + *fbuf_off) > MAX_FUNCTION_LIST_SIZE )
-			return -1;
-		memcpy(request->function_list + *fbuf_off,args,args_size);
-		*fbuf_off += args_size;
-	}
+	*fbuf_off = off;
 	request->functions_num++;
 
 	return 0;
 }
 
 /** \brief Add a function to the session's request
+	The function list is encoded in version ADMCTRL_FLIST_VERSION of the
+	format described in admctrl_argtypes.h, which does not depend on the
+	host. Functions can't be passed as arguments, see
+	admctrl_req_add_sfunction().
 
 	\param request reference to an admission control request structure
 	\param fbuf_off reference to offset in request's serialised functions list
@@ -145,67 +393,83 @@ int
 admctrl_req_add_function(adm_ctrl_request_t *request,size_t *fbuf_off,const char *fname,const char *lname,const char *argt,...)
 {
 	va_list ap;
-	size_t len;
-	int integer;
-	unsigned long long ullong;
-	double doubleval;
-	char *string;
-
-	// Copy function name
-	if ( append_string(fname,request->function_list,fbuf_off) != 0 )
-		return -1;
+	size_t off = *fbuf_off;
+	int e;
 
-	// Copy function name
-	if ( append_string(lname,request->function_list,fbuf_off) != 0 )
-		return -1;
-
-	// Copy argument types string
-	if ( append_string(argt,request->function_list,fbuf_off) != 0 )
+	if ( append_function(request->function_list,&off,fname,lname,argt) != 0 )
 		return -1;
 
 	// Copy arguments
 	va_start(ap,argt);
-	while( *argt != '\0' )
-		switch( *argt )
-		{
-			case INT_TYPE:
-				integer = va_arg(ap,int);
-				if ( (*fbuf_off + sizeof(int)) > MAX_FUNCTION_LIST_SIZE )
-					goto fail;
-				memcpy(request->function_list + *fbuf_off,&integer,sizeof(int));
-				*fbuf_off += sizeof(int);
-				break;
-			case ULONG_LONG_TYPE:
-				ullong = va_arg(ap,unsigned long long);
-				if ( (*fbuf_off + sizeof(unsigned long long)) > MAX_FUNCTION_LIST_SIZE )
-					goto fail;
-				memcpy(request->function_list + *fbuf_off,&ullong,sizeof(unsigned long long));
-				*fbuf_off += sizeof(unsigned long long);
-				break;
-			case DOUBLE_TYPE:
-				doubleval = va_arg(ap,double);
-				if ( (*fbuf_off + sizeof(double)) > MAX_FUNCTION_LIST_SIZE )
-					goto fail;
-				memcpy(request->function_list + *fbuf_off,&doubleval,sizeof(double));
-				*fbuf_off += sizeof(double);
-				break;
-			case STRING_TYPE:
-				string = va_arg(ap,char *);
-				len = strlen(string) + 1;
-				if ( (len + *fbuf_off) > MAX_FUNCTION_LIST_SIZE )
-					return -1;
-				strcpy(request->function_list + *fbuf_off,string);
-				*fbuf_off += len;
-				break;
-			default:
-				return -1;
-		}
+	e = append_vargs(request->function_list,&off,argt,ap);
 	va_end(ap);
+	if ( e != 0 )
+		return -1;
+	*fbuf_off = off;
 	request->functions_num++;
 	
 	return 0;
+}
+
+/** \brief Add a function of a schema registry to the session's request
+	The function is referred to by its id, and authd must have loaded the same
+	registry. Like admctrl_req_add_function() otherwise.
+
+	\param request reference to an admission control request structure
+	\param fbuf_off reference to offset in request's serialised functions list
+	\param schema the schema registry
+	\param id the id of the function in the registry
+	\param ... variable list containing function's arguments
+
+	\return 0 on success, or -1 on failure
+*/
+int
+admctrl_req_add_function_id(adm_ctrl_request_t *request,size_t *fbuf_off,const admctrl_schema_t *schema,unsigned int id,...)
+{
+	va_list ap;
+	size_t off = *fbuf_off;
+	const char *argt;
+	int e;
+
+	if ( append_function_id(request->function_list,&off,schema,id,&argt) != 0 )
+		return -1;
 
-fail:
+	va_start(ap,id);
+	e = append_vargs(request->function_list,&off,argt,ap);
 	va_end(ap);
-	return -1;
+	if ( e != 0 )
+		return -1;
+	*fbuf_off = off;
+	request->functions_num++;
+
+	return 0;
+}
+
+/** \brief Add a function of a schema registry with serialised arguments to an admission control request
+	The function is referred to by its id, and authd must have loaded the same
+	registry. Like admctrl_req_add_sfunction() otherwise.
+
+	\param request reference to admission control request structure
+	\param fbuf_off reference to offset in request's serialised functions list
+	\param schema the schema registry
+	\param id the id of the function in the registry
+	\param args buffer containing serialised arguments
+	\param args_size size of the serialised arguments
+
+	\return 0 on success, or -1 on error
+*/
+int
+admctrl_req_add_sfunction_id(adm_ctrl_request_t *request,size_t *fbuf_off,const admctrl_schema_t *schema,unsigned int id,const unsigned char *args,size_t args_size)
+{
+	size_t off = *fbuf_off;
+	const char *argt;
+
+	if ( append_function_id(request->function_list,&off,schema,id,&argt) != 0 ||
+			append_sargs(request->function_list,&off,argt,&args,&args_size,0) != 0 ||
+			args_size != 0 )
+		return -1;
+	*fbuf_off = off;
+	request->functions_num++;
+
+	return 0;
 }
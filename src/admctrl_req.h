@@ -21,6 +21,7 @@
 #define ADMCTRL_REQ_H
 
 #include <adm_ctrl.h>
+#include <admctrl_schema.h>
 
 /*! \file admctrl_req.h
   \brief Definition of methos to help construct an admission control request
@@ -31,5 +32,19 @@ void admctrl_req_set_authinfo(adm_ctrl_request_t *,const unsigned char *,const u
 int admctrl_req_add_nvpair(adm_ctrl_request_t *,const char *,const char *);
 int admctrl_req_add_function(adm_ctrl_request_t *,size_t *,const char *,const char *,const char *,...);
 int admctrl_req_add_sfunction(adm_ctrl_request_t *,size_t *,const char *,const char *,const char *,const unsigned char *,size_t);
+int admctrl_req_add_function_id(adm_ctrl_request_t *,size_t *,const admctrl_schema_t *,unsigned int,...);
+int admctrl_req_add_sfunction_id(adm_ctrl_request_t *,size_t *,const admctrl_schema_t *,unsigned int,const unsigned char *,size_t);
+
+//! Encrypts nonces with a client's private key
+typedef struct admctrl_signer admctrl_signer_t;
+
+admctrl_signer_t *admctrl_signer_new(const char *);
+void admctrl_signer_destroy(admctrl_signer_t *);
+int admctrl_signer_precompute(admctrl_signer_t *,unsigned int);
+int admctrl_signer_sign(admctrl_signer_t *,adm_ctrl_request_t *,unsigned int);
+int admctrl_signer_sign_next(admctrl_signer_t *,adm_ctrl_request_t *);
+void admctrl_signer_use_sessions(admctrl_signer_t *,char);
+int admctrl_signer_update(admctrl_signer_t *,const adm_ctrl_result_t *);
+int admctrl_signer_end_session(admctrl_signer_t *,adm_ctrl_request_t *);
 
 #endif
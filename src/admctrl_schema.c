@@ -0,0 +1,233 @@
+/* admctrl_schema.c
+
+  Copyright 2004  Georgios Portokalidis <digital_bull@users.sourceforge.net>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include "admctrl_config.h"
+#include "admctrl_argtypes.h"
+#include "admctrl_schema.h"
+
+/*! \file admctrl_schema.c
+ *  \brief Registry of function schemas shared by clients and authd
+ *  \author Georgios Portokalidis
+ */
+
+//! Fields of a line of a schema registry
+#define SCHEMA_FIELDS 4
+
+
+//! FNV-1a hash of a number of bytes, continuing from h
+static unsigned int
+fnv_hash(unsigned int h,const unsigned char *p,size_t len)
+{
+	for(; len > 0 ; len--,p++)
+	{
+		h ^= *p;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+
+/** \brief Split a line in white space separated fields, in place
+
+	\param line the line, which must be zero terminated
+	\param field array of SCHEMA_FIELDS to store the fields
+
+	\return the number of fields, or SCHEMA_FIELDS + 1 if there are more
+*/
+static unsigned int
+split_line(char *line,char **field)
+{
+	unsigned int n = 0;
+
+	for(;;)
+	{
+		while ( isspace((unsigned char)*line) )
+			line++;
+		if ( *line == '\0' )
+			return n;
+		if ( n == SCHEMA_FIELDS )
+			return n + 1;
+		field[n++] = line;
+		while ( *line != '\0' && !isspace((unsigned char)*line) )
+			line++;
+		if ( *line != '\0' )
+			*line++ = '\0';
+	}
+}
+
+
+/** \brief Load a schema registry from a file
+
+	The tag of the registry is a hash of its functions in the order of their
+	ids, so it doesn't depend on the order of the lines, white space or
+	comments.
+
+	\param fn the filename to read the registry from
+	\param schema the structure to store the registry loaded
+
+	\return 0 on success, or -1 on failure
+*/
+int
+admctrl_schema_load(const char *fn,admctrl_schema_t *schema)
+{
+	struct entry
+	{
+		unsigned long id;
+		char *field[SCHEMA_FIELDS];
+	} *entry = NULL,*e;
+	unsigned int entries = 0,i,size = 0;
+	unsigned char id_bytes[4];
+	char *line,*next,*end,*t;
+	FILE *fl;
+	long len;
+
+	bzero(schema,sizeof(admctrl_schema_t));
+
+	// Read the whole file
+	if ( (fl = fopen(fn,"r")) == NULL )
+		return -1;
+	if ( fseek(fl,0,SEEK_END) != 0 || (len = ftell(fl)) < 0 || fseek(fl,0,SEEK_SET) != 0 ||
+			(schema->data = malloc(len + 1)) == NULL ||
+			fread(schema->data,1,len,fl) != (size_t)len )
+	{
+		fclose(fl);
+		goto error;
+	}
+	fclose(fl);
+	schema->data[len] = '\0';
+
+	// Parse the lines in place
+	for(line = schema->data ; line != NULL ; line = next)
+	{
+		if ( (next = strchr(line,'\n')) != NULL )
+			*next++ = '\0';
+		while ( isspace((unsigned char)*line) )
+			line++;
+		if ( *line == '\0' || *line == '#' )
+			continue;
+
+		if ( entries == size )
+		{
+			size = ( size > 0 )? size * 2 : 64;
+			if ( (e = realloc(entry,size * sizeof(struct entry))) == NULL )
+				goto error;
+			entry = e;
+		}
+		e = entry + entries;
+		if ( split_line(line,e->field) != SCHEMA_FIELDS )
+			goto invalid;
+		e->id = strtoul(e->field[0],&end,10);
+		if ( *end != '\0' || !isdigit((unsigned char)e->field[0][0]) || e->id > ADMCTRL_SCHEMA_MAX_ID )
+			goto invalid;
+		t = e->field[3];
+		if ( strcmp(t,"-") == 0 )
+			*t = '\0';
+		for(; *t != '\0' ; t++)
+			if ( *t != STRING_TYPE && *t != INT_TYPE && *t != DOUBLE_TYPE &&
+					*t != FUNCTION_TYPE && *t != ULONG_LONG_TYPE )
+				goto invalid;
+		if ( strlen(e->field[3]) > MAX_ARGUMENTS_NUMBER )
+			goto invalid;
+		if ( e->id >= schema->size )
+			schema->size = e->id + 1;
+		entries++;
+	}
+
+	// Index by id
+	if ( schema->size > 0 &&
+			(schema->func = calloc(schema->size,sizeof(admctrl_schema_func_t))) == NULL )
+		goto error;
+	for(i = 0,e = entry ; i < entries ; i++,e++)
+	{
+		if ( schema->func[e->id].name != NULL )
+			goto invalid;
+		schema->func[e->id].name = e->field[1];
+		schema->func[e->id].lib = e->field[2];
+		schema->func[e->id].argt = e->field[3];
+		schema->func[e->id].args = strlen(e->field[3]);
+	}
+	schema->num = entries;
+	free(entry);
+
+	// Tag
+	for(i = 0,schema->tag = 2166136261U ; i < schema->size ; i++)
+	{
+		if ( schema->func[i].name == NULL )
+			continue;
+		admctrl_put_le32(id_bytes,i);
+		schema->tag = fnv_hash(schema->tag,id_bytes,sizeof(id_bytes));
+		schema->tag = fnv_hash(schema->tag,(unsigned char *)schema->func[i].name,strlen(schema->func[i].name) + 1);
+		schema->tag = fnv_hash(schema->tag,(unsigned char *)schema->func[i].lib,strlen(schema->func[i].lib) + 1);
+		schema->tag = fnv_hash(schema->tag,(unsigned char *)schema->func[i].argt,schema->func[i].args + 1);
+	}
+	// 0 means that a function list refers to no registry
+	if ( schema->tag == 0 )
+		schema->tag = 1;
+	return 0;
+
+invalid:
+	errno = EINVAL;
+error:
+	free(entry);
+	admctrl_schema_free(schema);
+	return -1;
+}
+
+
+/** \brief Release the memory of a schema registry
+
+	\param schema the registry
+*/
+void
+admctrl_schema_free(admctrl_schema_t *schema)
+{
+	free(schema->func);
+	free(schema->data);
+	bzero(schema,sizeof(admctrl_schema_t));
+}
+
+
+/** \brief Find the id of a function in a schema registry
+
+	\param schema the registry
+	\param name the name of the function
+	\param lib the library of the function
+
+	\return the id, or -1 if the function is not in the registry
+*/
+int
+admctrl_schema_id(const admctrl_schema_t *schema,const char *name,const char *lib)
+{
+	unsigned int i;
+
+	for(i = 0 ; i < schema->size ; i++)
+		if ( schema->func[i].name != NULL && strcmp(schema->func[i].name,name) == 0 &&
+				strcmp(schema->func[i].lib,lib) == 0 )
+			return (int)i;
+	return -1;
+}
@@ -0,0 +1,90 @@
+/* admctrl_schema.h
+
+  Copyright 2004  Georgios Portokalidis <digital_bull@users.sourceforge.net>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef ADMCTRL_SCHEMA_H
+#define ADMCTRL_SCHEMA_H
+
+/*! \file admctrl_schema.h
+ *  \brief Registry of function schemas shared by clients and authd
+ *  \author Georgios Portokalidis
+ *
+ *  A schema registry maps function ids to the name, library and argument
+ *  types of a function. It is loaded from a file with one function per
+ *  line:
+ *
+ *  ID FUNCTION LIBRARY ARGUMENT_TYPES
+ *
+ *  separated by white space, where ARGUMENT_TYPES is - for a function
+ *  without arguments. Empty lines and lines starting with # are ignored.
+ *  Ids are between 0 and ADMCTRL_SCHEMA_MAX_ID.
+ *
+ *  When clients and authd load the same registry, a function list can refer
+ *  to a function by its id instead of carrying its name, library and
+ *  argument types, see admctrl_req_add_function_id(). The tag of the
+ *  registry is stored in the header of the list, and authd only resolves
+ *  ids of lists with the tag of its own registry.
+ */
+
+//! Largest function id of a schema registry
+#define ADMCTRL_SCHEMA_MAX_ID 0xffff
+
+//! Schema of a function
+struct admctrl_schema_func
+{
+	char *name; //!< Name of the function, NULL if the id is not used
+	char *lib; //!< Library of the function
+	char *argt; //!< Argument types of the function
+	unsigned int args; //!< Number of arguments
+};
+//! Function schema datatype
+typedef struct admctrl_schema_func admctrl_schema_func_t;
+
+//! Schema registry
+struct admctrl_schema
+{
+	char *data; //!< Contents of the file, which the schemas point to
+	admctrl_schema_func_t *func; //!< Schemas, indexed by id
+	unsigned int size; //!< Number of ids in func, the largest id + 1
+	unsigned int num; //!< Number of functions
+	unsigned int tag; //!< Hash of the schemas, never 0
+};
+//! Schema registry datatype
+typedef struct admctrl_schema admctrl_schema_t;
+
+
+/** \brief Find the schema of a function id
+
+	\param schema the registry
+	\param id the id of the function
+
+	\return the schema, or NULL if the id is not in the registry
+*/
+static inline const admctrl_schema_func_t *
+admctrl_schema_find(const admctrl_schema_t *schema,unsigned int id)
+{
+	if ( id >= schema->size || schema->func[id].name == NULL )
+		return NULL;
+	return schema->func + id;
+}
+
+int admctrl_schema_load(const char *fn,admctrl_schema_t *schema);
+void admctrl_schema_free(admctrl_schema_t *schema);
+int admctrl_schema_id(const admctrl_schema_t *schema,const char *name,const char *lib);
+
+#endif
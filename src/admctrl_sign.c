@@ -0,0 +1,506 @@
+/* admctrl_sign.c
+
+  Copyright 2004  Georgios Portokalidis <digital_bull@users.sourceforge.net>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <openssl/rsa.h>
+#include <openssl/rand.h>
+#include "keynote.h"
+#include "admctrl_req.h"
+#include "admctrl_errno.h"
+#include "adm_ctrl_session.h"
+#include "debug.h"
+
+/*! \file admctrl_sign.c
+  \brief Encryption of nonces with a client's private key
+  \author Georgios Portokalidis
+
+  Encrypting the nonce with the private key is the most expensive part of
+  building a request. A signer decodes the key once and keeps it, so that
+  OpenSSL can also keep its Montgomery and blinding values between requests.
+
+  Clients that choose their own nonces, instead of being given one by the
+  service, can have a thread encrypt nonces ahead of time with
+  admctrl_signer_precompute(). admctrl_signer_sign_next() then only copies
+  one of them in the request.
+
+  A signer can also have authd open a session, with
+  admctrl_signer_use_sessions(). The next request asks for a session, and
+  once its result is given to admctrl_signer_update(), requests are
+  authenticated by the MAC of their nonce with the key of the session, until
+  it expires or authd rejects it. Then the signer encrypts the nonce and asks
+  for a new session again.
+*/
+
+//! Nonce encrypted ahead of time
+struct signed_nonce
+{
+	unsigned int nonce; //!< The nonce
+	size_t len; //!< Length of the encrypted nonce
+	unsigned char enc[MAX_ENC_NONCE_SIZE]; //!< The encrypted nonce
+};
+
+//! Signer
+struct admctrl_signer
+{
+	struct keynote_deckey dk; //!< Decoded private key
+	RSA *rsa; //!< RSA key of dk
+	pthread_mutex_t lock; //!< Protects ready, ready_num, head and stop
+	pthread_cond_t cond; //!< Signaled when a nonce is used or on stop
+	struct signed_nonce *ready; //!< Ring of nonces encrypted ahead of time
+	unsigned int ready_max; //!< Size of the ring
+	unsigned int ready_num; //!< Nonces in the ring
+	unsigned int head; //!< First nonce in the ring
+	pthread_t thread; //!< Thread encrypting nonces ahead of time
+	char started; //!< Thread was created
+	char stop; //!< Thread should exit
+	char sessions; //!< Sessions are used, protected by lock
+	char session_opening; //!< A request asked for a session, protected by lock
+	unsigned int session_id; //!< Id of the session, 0 for none, protected by lock
+	time_t session_expires; //!< Time the session expires, protected by lock
+	unsigned char session_key[SESSION_KEY_SIZE]; //!< Key of the session, protected by lock
+};
+
+
+/*************************************************************************/
+/*               	STATIC FUNCTIONS IMPLEMENTATION                        */
+/*************************************************************************/
+
+/** \brief Encrypt a nonce with the private key of a signer
+
+	\return the length of the encrypted nonce, or 0 on failure
+*/
+static size_t
+encrypt_nonce(admctrl_signer_t *s,unsigned int nonce,unsigned char *enc)
+{
+	int len;
+
+	len = RSA_private_encrypt(sizeof(unsigned int),(unsigned char *)&nonce,
+			enc,s->rsa,RSA_PKCS1_PADDING);
+	return ( len > 0 )? (size_t)len : 0;
+}
+
+/** \brief Choose a random nonce
+*/
+static int
+random_nonce(unsigned int *nonce)
+{
+	return ( RAND_bytes((unsigned char *)nonce,sizeof(unsigned int)) == 1 )? 0 : -1;
+}
+
+/** \brief Authenticate a request by the session of a signer, if it has one
+	Otherwise the request asks for a session, if sessions are used and no other
+	request has already asked for one.
+
+	The MAC covers the whole request, so its actions must already be added.
+
+	\param s reference to the signer
+	\param request reference to admission control request structure, with its
+	nonce set
+
+	\return 1 if the request was authenticated by the session, or 0 if its
+	nonce has to be encrypted
+*/
+static int
+session_sign(admctrl_signer_t *s,adm_ctrl_request_t *request)
+{
+	unsigned char key[SESSION_KEY_SIZE];
+	unsigned int id;
+
+	request->session_flags = 0;
+	pthread_mutex_lock(&s->lock);
+	if ( s->session_id != 0 && time(NULL) >= s->session_expires )
+	{
+		s->session_id = 0;
+		memset(s->session_key,0,SESSION_KEY_SIZE);
+	}
+	if ( (id = s->session_id) == 0 )
+	{
+		if ( s->sessions && !s->session_opening )
+		{
+			s->session_opening = 1;
+			request->session_flags = ADMCTRL_SESSION_OPEN;
+		}
+		pthread_mutex_unlock(&s->lock);
+		return 0;
+	}
+	memcpy(key,s->session_key,SESSION_KEY_SIZE);
+	pthread_mutex_unlock(&s->lock);
+
+	request->session_flags = ADMCTRL_SESSION_USE;
+	request->session_id = id;
+	request->encrypted_nonce_len = 0;
+	if ( adm_ctrl_session_mac(key,request,request->session_mac) != 0 )
+	{
+		memset(key,0,SESSION_KEY_SIZE);
+		request->session_flags = 0;
+		request->session_id = 0;
+		return 0;
+	}
+	memset(key,0,SESSION_KEY_SIZE);
+	return 1;
+}
+
+/** \brief Thread routine encrypting nonces ahead of time
+	Keeps the ring full until the signer is destroyed.
+
+	\param arg reference to the signer
+
+	\return always NULL
+*/
+static void *
+precompute_run(void *arg)
+{
+	admctrl_signer_t *s = (admctrl_signer_t *)arg;
+	struct signed_nonce sn;
+	sigset_t blksigs;
+
+	// Leave signals to the threads of the caller
+	sigfillset(&blksigs);
+	pthread_sigmask(SIG_BLOCK,&blksigs,NULL);
+
+	pthread_mutex_lock(&s->lock);
+	while( !s->stop )
+	{
+		if ( s->ready_num == s->ready_max )
+		{
+			pthread_cond_wait(&s->cond,&s->lock);
+			continue;
+		}
+		pthread_mutex_unlock(&s->lock);
+
+		if ( random_nonce(&sn.nonce) != 0 ||
+				(sn.len = encrypt_nonce(s,sn.nonce,sn.enc)) == 0 )
+		{
+			DEBUG_CMD(fprintf(stderr,"admctrl_signer: couldn't encrypt nonce\n"));
+			pthread_mutex_lock(&s->lock);
+			break;
+		}
+
+		pthread_mutex_lock(&s->lock);
+		memcpy(s->ready + (s->head + s->ready_num) % s->ready_max,&sn,sizeof(sn));
+		++s->ready_num;
+	}
+	pthread_mutex_unlock(&s->lock);
+	return NULL;
+}
+
+
+
+/*************************************************************************/
+/*               	PUBLIC FUNCTIONS IMPLEMENTATION                        */
+/*************************************************************************/
+
+/** \brief Create a signer for encrypting nonces with a private key
+
+	\param priv the client's private key, encoded by KeyNote as in the
+	private key files
+
+	\return a new signer, or NULL on error. errno is set to ENOMEM if no
+	memory was available, or to EINVAL if the key is not a valid RSA key that
+	produces encrypted nonces of at most MAX_ENC_NONCE_SIZE bytes
+*/
+admctrl_signer_t *
+admctrl_signer_new(const char *priv)
+{
+	admctrl_signer_t *s;
+	char *key;
+
+	if ( (s = calloc(1,sizeof(admctrl_signer_t))) == NULL )
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+	pthread_mutex_init(&s->lock,NULL);
+	pthread_cond_init(&s->cond,NULL);
+
+	if ( (key = kn_get_string((char *)priv)) == NULL ||
+			kn_decode_key(&s->dk,key,KEYNOTE_PRIVATE_KEY) != 0 )
+		goto key_error;
+	if ( s->dk.dec_algorithm != KEYNOTE_ALGORITHM_RSA )
+	{
+		kn_free_key(&s->dk);
+		goto key_error;
+	}
+	s->rsa = (RSA *)s->dk.dec_key;
+	if ( RSA_size(s->rsa) > MAX_ENC_NONCE_SIZE )
+	{
+		kn_free_key(&s->dk);
+		goto key_error;
+	}
+	return s;
+
+key_error:
+	DEBUG_CMD(fprintf(stderr,"admctrl_signer_new: couldn't decode private key\n"));
+	pthread_cond_destroy(&s->cond);
+	pthread_mutex_destroy(&s->lock);
+	free(s);
+	errno = EINVAL;
+	return NULL;
+}
+
+/** \brief Destroy a signer
+	Stops the thread started by admctrl_signer_precompute().
+
+	\param s reference to the signer
+*/
+void
+admctrl_signer_destroy(admctrl_signer_t *s)
+{
+	if ( s->started )
+	{
+		pthread_mutex_lock(&s->lock);
+		s->stop = 1;
+		pthread_cond_signal(&s->cond);
+		pthread_mutex_unlock(&s->lock);
+		pthread_join(s->thread,NULL);
+	}
+	if ( s->ready )
+	{
+		memset(s->ready,0,s->ready_max * sizeof(struct signed_nonce));
+		free(s->ready);
+	}
+	memset(s->session_key,0,SESSION_KEY_SIZE);
+	kn_free_key(&s->dk);
+	pthread_cond_destroy(&s->cond);
+	pthread_mutex_destroy(&s->lock);
+	free(s);
+}
+
+/** \brief Encrypt nonces chosen by the signer ahead of time
+	Starts a thread that keeps up to num nonces encrypted for
+	admctrl_signer_sign_next(). Can only be called once for a signer.
+
+	\param s reference to the signer
+	\param num number of nonces to keep encrypted
+
+	\return 0 on success, or -1 on error. errno is set to EINVAL if num is 0 or
+	the thread was already started, to ENOMEM if no memory was available, or by
+	pthread_create()
+*/
+int
+admctrl_signer_precompute(admctrl_signer_t *s,unsigned int num)
+{
+	int e;
+
+	if ( num == 0 || s->started )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if ( (s->ready = calloc(num,sizeof(struct signed_nonce))) == NULL )
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+	s->ready_max = num;
+	if ( (e = pthread_create(&s->thread,NULL,precompute_run,s)) != 0 )
+	{
+		free(s->ready);
+		s->ready = NULL;
+		s->ready_max = 0;
+		errno = e;
+		return -1;
+	}
+	s->started = 1;
+	return 0;
+}
+
+/** \brief Place a nonce given by the service, and its encryption, in a request
+	The public key and credentials of the request are not changed, see
+	admctrl_req_set_authinfo(). If the signer holds a session, the MAC of the
+	request is placed instead, so its actions must already be added.
+
+	\param s reference to the signer
+	\param request reference to admission control request structure
+	\param nonce nonce given by the service
+
+	\return 0 on success, or -1 if the nonce couldn't be encrypted
+*/
+int
+admctrl_signer_sign(admctrl_signer_t *s,adm_ctrl_request_t *request,unsigned int nonce)
+{
+	size_t len;
+
+	request->nonce = nonce;
+	if ( session_sign(s,request) )
+		return 0;
+	if ( (len = encrypt_nonce(s,nonce,request->encrypted_nonce)) == 0 )
+		return -1;
+	request->encrypted_nonce_len = len;
+	return 0;
+}
+
+/** \brief Place a nonce chosen by the signer, and its encryption, in a request
+	A nonce encrypted ahead of time is used, if there is one. Otherwise a new
+	nonce is chosen and encrypted. If the signer holds a session, a new nonce
+	and its MAC are placed instead. Only for services that let clients choose
+	their nonces. Can be called by several threads at once. With a session the
+	MAC covers the whole request, so its actions must already be added.
+
+	\param s reference to the signer
+	\param request reference to admission control request structure
+
+	\return 2 if the request was authenticated by the session, 1 if a nonce
+	encrypted ahead of time was used, 0 if one was encrypted now, or -1 if the
+	nonce couldn't be chosen or encrypted
+*/
+int
+admctrl_signer_sign_next(admctrl_signer_t *s,adm_ctrl_request_t *request)
+{
+	struct signed_nonce *sn;
+	unsigned int nonce;
+
+	if ( random_nonce(&request->nonce) != 0 )
+		return -1;
+	if ( session_sign(s,request) )
+		return 2;
+
+	pthread_mutex_lock(&s->lock);
+	if ( s->ready_num > 0 )
+	{
+		sn = s->ready + s->head;
+		request->nonce = sn->nonce;
+		request->encrypted_nonce_len = sn->len;
+		memcpy(request->encrypted_nonce,sn->enc,sn->len);
+		s->head = (s->head + 1) % s->ready_max;
+		--s->ready_num;
+		pthread_cond_signal(&s->cond);
+		pthread_mutex_unlock(&s->lock);
+		return 1;
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	nonce = request->nonce;
+	if ( (request->encrypted_nonce_len = encrypt_nonce(s,nonce,request->encrypted_nonce)) == 0 )
+		return -1;
+	return 0;
+}
+
+/** \brief Have authd open sessions for the requests of a signer
+	Sessions must be enabled in authd. Results of requests must be given to
+	admctrl_signer_update().
+
+	\param s reference to the signer
+	\param use 1 to use sessions, 0 to stop asking for new ones
+*/
+void
+admctrl_signer_use_sessions(admctrl_signer_t *s,char use)
+{
+	pthread_mutex_lock(&s->lock);
+	s->sessions = use;
+	s->session_opening = 0;
+	pthread_mutex_unlock(&s->lock);
+}
+
+/** \brief Update the session of a signer from the result of a request
+	Adopts the session authd opened in the result, or forgets the session if
+	authd rejected it, e.g. because it expired or was revoked.
+
+	\param s reference to the signer
+	\param result the result of a request signed by the signer
+
+	\return 1 if a session was adopted, 0 if the session didn't change or was
+	forgotten, or -1 if the key of the session couldn't be decrypted
+*/
+int
+admctrl_signer_update(admctrl_signer_t *s,const adm_ctrl_result_t *result)
+{
+	unsigned char key[MAX_ENC_NONCE_SIZE];
+	int len = 0,ret = 0;
+
+	if ( result->session_id != 0 )
+	{
+		if ( result->session_key_len > MAX_ENC_NONCE_SIZE ||
+				(len = RSA_private_decrypt(result->session_key_len,result->session_key,
+						key,s->rsa,RSA_PKCS1_OAEP_PADDING)) != SESSION_KEY_SIZE )
+		{
+			DEBUG_CMD(fprintf(stderr,"admctrl_signer_update: couldn't decrypt session key\n"));
+			ret = -1;
+		}
+		else
+			ret = 1;
+	}
+
+	pthread_mutex_lock(&s->lock);
+	if ( ret == 1 )
+	{
+		s->session_id = result->session_id;
+		memcpy(s->session_key,key,SESSION_KEY_SIZE);
+		// Leave a second for the requests in flight
+		s->session_expires = time(NULL) + result->session_lifetime - 1;
+	}
+	else if ( result->error == - ADMCTRL_SESSION_ERROR )
+	{
+		s->session_id = 0;
+		memset(s->session_key,0,SESSION_KEY_SIZE);
+	}
+	s->session_opening = 0;
+	pthread_mutex_unlock(&s->lock);
+
+	memset(key,0,sizeof(key));
+	return ret;
+}
+
+/** \brief Close the session of a signer with a request
+	The request, signed by the session, closes it once authenticated. Its MAC
+	is computed again to cover the flag. The signer forgets the session and
+	asks for a new one, if sessions are still used.
+
+	\param s reference to the signer
+	\param request reference to admission control request structure, signed by
+	the signer
+
+	\return 1 if the request closes the session, or 0 if it wasn't
+	authenticated by the current session of the signer, or its MAC couldn't be
+	computed
+*/
+int
+admctrl_signer_end_session(admctrl_signer_t *s,adm_ctrl_request_t *request)
+{
+	int ret = 0;
+
+	if ( !(request->session_flags & ADMCTRL_SESSION_USE) )
+		return 0;
+
+	pthread_mutex_lock(&s->lock);
+	if ( s->session_id == request->session_id )
+	{
+		request->session_flags |= ADMCTRL_SESSION_CLOSE;
+		if ( adm_ctrl_session_mac(s->session_key,request,request->session_mac) == 0 )
+		{
+			s->session_id = 0;
+			memset(s->session_key,0,SESSION_KEY_SIZE);
+			ret = 1;
+		}
+		else
+			request->session_flags &= ~ADMCTRL_SESSION_CLOSE;
+	}
+	pthread_mutex_unlock(&s->lock);
+	return ret;
+}
@@ -41,6 +41,7 @@
 #include "admctrlcl.h"
 #include "shm.h"
 #include "shm_sync.h"
+#include "admctrl_comm.h"
 #include "iolib.h"
 #include "debug.h"
 
@@ -73,6 +74,8 @@ struct socket_data
   SSL *ssl; //!< SSL session
   //BIO *sbio; //! BIO for communication with server
 	char use_CA; //! Use accepted CAs list
+	SSL_SESSION *session; //!< Session of the last connection, resumed by the next one
+	char reuse_session; //!< Resume SSL sessions
 #endif
 };
 
@@ -103,6 +106,11 @@ free_ssl_client(admctrlcl_t *client)
 {
 		struct socket_data *sd = (struct socket_data *)client->comm;
 
+		if ( sd->session )
+		{
+			SSL_SESSION_free(sd->session);
+			sd->session = NULL;
+		}
 		if ( sd->ssl_ctx )
 		{
 			if ( sd->ssl )
@@ -182,16 +190,27 @@ ssl_connect(admctrlcl_t *client)
 		return -1;
 	}
 	SSL_set_bio(sd->ssl,sbio,sbio);
+	// Offer the session of the previous connection to skip the key exchange
+	if ( sd->session )
+		SSL_set_session(sd->ssl,sd->session);
 	if ( iolib_ssl_connect(sd->ssl,sd->socket,&client->timeout) <= 0 )
 		goto shutdown;
 	if ( sd->use_CA && check_cert(sd->ssl,sd->server_hostname) != 0 )
 		goto shutdown;
 
-	DEBUG_CMD2(printf("ssl_connect: handshake completed\n"));
+	DEBUG_CMD2(printf("ssl_connect: handshake completed%s\n",
+				SSL_session_reused(sd->ssl)? " (session resumed)" : ""));
 	return 0;
 
 shutdown:
 	SSL_shutdown(sd->ssl);
+	SSL_clear(sd->ssl);
+	// Don't offer a session the server refused or that failed verification
+	if ( sd->session )
+	{
+		SSL_SESSION_free(sd->session);
+		sd->session = NULL;
+	}
 	return -1;
 }
 #endif
@@ -208,18 +227,20 @@ socket_close(admctrlcl_t *client)
 	return e;
 }
 
+#ifndef HAVE_SEMTIMEDOP
 static void
 ipc_expired(int data) 
 {
 	errno = ETIME;
 }
+#endif
 
 static int
 ipc_init(admctrlcl_t *client)
 {
 	struct ipc_data *id = (struct ipc_data *)client->comm;
 
-	if ( (id->addr = shm_create(id->key,MAX(sizeof(adm_ctrl_request_t),sizeof(adm_ctrl_result_t)),&id->shm_id)) == NULL )
+	if ( (id->addr = shm_create(id->key,ADMCTRL_COMM_SHM_SIZE,&id->shm_id)) == NULL )
 	{
 		DEBUG_CMD2(perror("shm_create"));
 		return -1;
@@ -227,10 +248,12 @@ ipc_init(admctrlcl_t *client)
 	if ( (id->sem_id = shm_create_sem(id->key)) < 0 )
 	{
 		DEBUG_CMD2(perror("shm_create_sem"));
-		shm_destroy(id->addr,id->shm_id);
+		shm_close(id->addr);
 		return -1;
 	}
+#ifndef HAVE_SEMTIMEDOP
 	signal(SIGALRM,ipc_expired);
+#endif
 	return 0;
 }
 
@@ -239,14 +262,13 @@ ipc_destroy(admctrlcl_t *client)
 {
 	struct ipc_data *id = (struct ipc_data *)client->comm;
 
+#ifndef HAVE_SEMTIMEDOP
 	signal(SIGALRM,SIG_DFL);
+#endif
 
-	if ( shm_destroy(id->addr,id->shm_id) )
-		return -1;
-	if ( shm_destroy_sem(id->sem_id) )
-		return -1;
-
-	return 0;
+	// Only detach, the segment and semaphores belong to authd and are
+	// shared with every other client
+	return shm_close(id->addr);
 }
 
 static int
@@ -286,7 +308,18 @@ static void
 ssl_close(admctrlcl_t *client)
 {
 	struct socket_data *sd = (struct socket_data *)client->comm;
+
+	// Keep the session only now, since the server may send session tickets
+	// after the handshake
+	if ( sd->reuse_session )
+	{
+		if ( sd->session )
+			SSL_SESSION_free(sd->session);
+		sd->session = SSL_get1_session(sd->ssl);
+	}
 	SSL_shutdown(sd->ssl);
+	// Prepare the SSL structure for the next connection
+	SSL_clear(sd->ssl);
 }
 #endif
 
@@ -348,32 +381,162 @@ mem_error:
 	return -1;
 }
 
+/** \brief Exchange a number of requests and their results through shared memory
+	The caller must hold the lock of the segment. authd serves all the
+	requests before signaling, so a result may overlap a later request. Waits
+	for the results with semtimedop() where available, since the process-wide
+	SIGALRM timer cannot be shared by clients in several threads.
+
+	\param num number of requests, at most MAX_IPC_BATCH
+*/
 static int
-ipc_submit(admctrlcl_t *client)
+ipc_exchange(admctrlcl_t *client,const adm_ctrl_request_t *const *reqs,adm_ctrl_result_t *const *results,size_t num)
 {
-	int e = -1;
+	int e;
+	size_t i;
 	struct ipc_data *id = (struct ipc_data *)client->comm;
+	struct admctrl_comm_header *header = (struct admctrl_comm_header *)id->addr;
+#ifndef HAVE_SEMTIMEDOP
 	struct itimerval timer = { {0,0},
 		{client->timeout.tv_sec,client->timeout.tv_usec} };
+#endif
 
-	if ( shm_lock(id->sem_id) != 0 )
-		return -1;
-	memcpy(id->addr,client->data.request,sizeof(adm_ctrl_request_t));
+	for(i = 0; i < num ;i++)
+		memcpy(ADMCTRL_COMM_SLOT(id->addr,i),reqs[i],sizeof(adm_ctrl_request_t));
+	header->num = (u_int32_t)num;
 	if ( shm_data_ready(id->sem_id) != 0 )
-		goto ipc_fail;
+		return -1;
+#ifdef HAVE_SEMTIMEDOP
+	if ( client->timeout.tv_sec || client->timeout.tv_usec )
+		e = shm_result_timedwait(id->sem_id,&client->timeout);
+	else
+		e = shm_result_wait(id->sem_id);
+#else
 	setitimer(ITIMER_REAL,&timer,NULL);
 	e = shm_result_wait(id->sem_id);
 	bzero(&timer,sizeof(struct itimerval));
 	setitimer(ITIMER_REAL,&timer,NULL);
-	if ( e == 0 )
-		memcpy(client->data.result,id->addr,sizeof(adm_ctrl_result_t));
+#endif
+	if ( e != 0 )
+		return e;
+	// authd answers with no results if it rejected the batch
+	if ( header->num != num )
+	{
+		errno = EPROTO;
+		return -1;
+	}
+	for(i = 0; i < num ;i++)
+		memcpy(results[i],ADMCTRL_COMM_SLOT(id->addr,i),sizeof(adm_ctrl_result_t));
+	return 0;
+}
 
-ipc_fail:
+/** \brief Submit a request through shared memory
+*/
+static int
+ipc_submit(admctrlcl_t *client)
+{
+	int e;
+	struct ipc_data *id = (struct ipc_data *)client->comm;
+	const adm_ctrl_request_t *req = client->data.request;
+
+	if ( shm_lock(id->sem_id) != 0 )
+		return -1;
+	e = ipc_exchange(client,&req,&client->data.result,1);
 	shm_unlock(id->sem_id);
 
 	return e;
 }
 
+/** \brief Submit a number of requests through shared memory
+	Up to MAX_IPC_BATCH requests are placed in the segment at once and served
+	by authd in one exchange. The lock of the segment is taken for each
+	exchange, so that other clients are not kept waiting for the whole batch.
+
+	\return the number of results received
+*/
+static size_t
+ipc_submit_batch(admctrlcl_t *client,const adm_ctrl_request_t *const *reqs,adm_ctrl_result_t *const *results,size_t num)
+{
+	struct ipc_data *id = (struct ipc_data *)client->comm;
+	size_t done = 0,n;
+	int e;
+
+	while( done < num )
+	{
+		if ( shm_lock(id->sem_id) != 0 )
+			break;
+		n = ( num - done > MAX_IPC_BATCH )? MAX_IPC_BATCH : num - done;
+		e = ipc_exchange(client,reqs + done,results + done,n);
+		if ( e != 0 )
+			e = errno;
+		shm_unlock(id->sem_id);
+		if ( e != 0 )
+		{
+			errno = e;
+			break;
+		}
+		done += n;
+	}
+	return done;
+}
+
+/** \brief Send a request through a socket, or an SSL connection
+*/
+static int
+socket_send(admctrlcl_t *client,const adm_ctrl_request_t *req)
+{
+	struct socket_data *sd = (struct socket_data *)client->comm;
+
+#ifdef HAVE_LIBSSL
+	if ( client->type == SSL_CL )
+		return ( iolib_ssl_write(sd->ssl,sd->socket,(void *)req,sizeof(adm_ctrl_request_t),&client->timeout) < (int)sizeof(adm_ctrl_request_t) )? -1 : 0;
+#endif
+	return ( iolib_write(sd->socket,(unsigned char *)req,sizeof(adm_ctrl_request_t),&client->timeout) <= 0 )? -1 : 0;
+}
+
+/** \brief Receive a result through a socket, or an SSL connection
+*/
+static int
+socket_recv(admctrlcl_t *client,adm_ctrl_result_t *res)
+{
+	struct socket_data *sd = (struct socket_data *)client->comm;
+
+#ifdef HAVE_LIBSSL
+	if ( client->type == SSL_CL )
+		return ( iolib_ssl_read(sd->ssl,sd->socket,(unsigned char *)res,sizeof(adm_ctrl_result_t),&client->timeout) < (int)sizeof(adm_ctrl_result_t) )? -1 : 0;
+#endif
+	return ( iolib_read(sd->socket,(unsigned char *)res,sizeof(adm_ctrl_result_t),&client->timeout) <= 0 )? -1 : 0;
+}
+
+/** \brief Submit a number of requests over one connection
+	Up to ADMCTRLCL_BATCH_WINDOW requests are sent ahead of the results
+	received, so a batch costs about one round trip per window instead of
+	one per request. The server answers them in order. The window keeps both
+	ends from blocking on full socket buffers.
+
+	\return the number of results received
+*/
+static size_t
+socket_submit_batch(admctrlcl_t *client,const adm_ctrl_request_t *const *reqs,adm_ctrl_result_t *const *results,size_t num)
+{
+	size_t sent = 0,received = 0;
+
+	while( received < num )
+	{
+		if ( sent < num && sent - received < ADMCTRLCL_BATCH_WINDOW )
+		{
+			if ( socket_send(client,reqs[sent]) != 0 )
+				break;
+			++sent;
+		}
+		else if ( socket_recv(client,results[received]) != 0 )
+			break;
+		else
+			++received;
+	}
+	return received;
+}
+
 
 
 /*************************************************************************/
@@ -525,6 +688,7 @@ admctrlcl_use_SSL(admctrlcl_t *cl,const char *key,const char *ca)
 #endif
 			sd->use_CA = 1;
 		}
+		sd->reuse_session = 1;
 
 		cl->type = SSL_CL;
 		return 0;
@@ -547,6 +711,39 @@ ssl_error:
 	return -1;
 }
 
+/** \brief Enable or disable resuming SSL sessions
+	When enabled, which is the default after admctrlcl_use_SSL(), each new
+	connection offers the session of the previous one to the server. A resumed
+	session skips the public key operations of the handshake, which is what
+	non-persistent clients pay for every request.
+
+	\param cl reference to admission control client
+	\param reuse 1 to resume sessions, 0 to perform a full handshake every time
+
+	\return 0 on success, or -1 on error. errno is set to ENOPROTOOPT if SSL was
+	not enabled for the client
+*/
+int
+admctrlcl_SSL_reuse_session(admctrlcl_t *cl,char reuse)
+{
+#ifdef HAVE_LIBSSL
+	if ( cl->type == SSL_CL )
+	{
+		struct socket_data *sd = (struct socket_data *)cl->comm;
+
+		sd->reuse_session = reuse;
+		if ( !reuse && sd->session )
+		{
+			SSL_SESSION_free(sd->session);
+			sd->session = NULL;
+		}
+		return 0;
+	}
+#endif
+	errno = ENOPROTOOPT;
+	return -1;
+}
+
 /** \brief Destroy an admission control client structure
 
 	\param cl reference to admission control client
@@ -657,7 +854,6 @@ admctrlcl_reset(admctrlcl_t *client)
 int
 admctrlcl_submit_request(admctrlcl_t *client)
 {
-	struct socket_data *sd;
 	int e = -1;
 
 	if ( client->persistent == 0 && do_comm_open(client) != 0 )
@@ -669,22 +865,17 @@ admctrlcl_submit_request(admctrlcl_t *client)
 	switch( client->type )
 	{
 		case SOCKET_CL:
-			sd = (struct socket_data *)client->comm;
-			if ( iolib_write(sd->socket,(unsigned char *)client->data.request,sizeof(adm_ctrl_request_t),&client->timeout) <= 0 )
-				goto fail;
-			if ( iolib_read(sd->socket,(unsigned char *)client->data.result,sizeof(adm_ctrl_result_t),&client->timeout) <= 0 )
+			if ( socket_send(client,client->data.request) != 0 ||
+					socket_recv(client,client->data.result) != 0 )
 				goto fail;
 			break;
 		case SSL_CL:
 #ifdef HAVE_LIBSSL
-			sd = (struct socket_data *)client->comm;
-			if ( iolib_ssl_write(sd->ssl,sd->socket,client->data.request,sizeof(adm_ctrl_request_t),&client->timeout) < (int)sizeof(adm_ctrl_request_t) )
-				goto fail;
-			if ( iolib_ssl_read(sd->ssl,sd->socket,client->data.result,sizeof(adm_ctrl_result_t),&client->timeout) < (int)sizeof(adm_ctrl_result_t) )
+			if ( socket_send(client,client->data.request) != 0 ||
+					socket_recv(client,client->data.result) != 0 )
 				goto fail;
 			break;
 #else
-			e = -1;
 			errno = ENOPROTOOPT;
 			goto fail;
 #endif
@@ -703,3 +894,109 @@ fail:
 	}
 	return e;
 }
+
+/** \brief Submit a number of requests to admission control, given by reference
+	Restoring many flows with admctrlcl_submit_request() costs a round trip,
+	or a lock and wait cycle, per request. Persistent socket and SSL clients
+	send the requests over their connection ahead of the results. IPC clients
+	place up to MAX_IPC_BATCH requests in shared memory at once, and authd
+	serves them in one exchange. Results are stored in the order of the
+	requests. The request and result structures of the client are not used.
+
+	Non-persistent socket and SSL clients cannot assume that the server keeps
+	the connection open after the first result, so they still use a connection
+	per request.
+
+	\param client reference to admission control client
+	\param reqs array of references to the requests to submit
+	\param results array of references to store the results. For IPC clients
+	a result may overlap a later request of the same exchange
+	\param num number of requests
+
+	\return the number of results received. If less than num, the remaining
+	requests were not answered and errno is set by IPC, socket I/O or SSL calls
+	depending on admission control client type, or to EPROTO if authd rejected
+	a batch
+*/
+size_t
+admctrlcl_submit_vector(admctrlcl_t *client,const adm_ctrl_request_t *const *reqs,adm_ctrl_result_t *const *results,size_t num)
+{
+	size_t done = 0,n;
+	int e;
+
+	// Non-persistent socket clients use a new connection for every request
+	do
+	{
+		if ( client->persistent == 0 && do_comm_open(client) != 0 )
+		{
+			DEBUG_CMD2(printf("Initialising communications failed\n"));
+			return done;
+		}
+
+		n = 0;
+		switch( client->type )
+		{
+			case SOCKET_CL:
+#ifdef HAVE_LIBSSL
+			case SSL_CL:
+#endif
+				if ( client->persistent )
+					n = socket_submit_batch(client,reqs,results,num);
+				else if ( done < num && socket_send(client,reqs[done]) == 0 &&
+						socket_recv(client,results[done]) == 0 )
+					n = 1;
+				break;
+			case IPC_CL:
+				n = ipc_submit_batch(client,reqs,results,num);
+				break;
+			default:
+				errno = ENOPROTOOPT;
+				break;
+		}
+		e = errno;
+		done += n;
+
+		if ( client->persistent == 0 && do_comm_close(client) != 0 )
+		{
+			DEBUG_CMD(printf("WARNING admctrlcl_submit_vector: communication not closed cleanly\n"));
+		}
+	} while( client->persistent == 0 && client->type != IPC_CL && n == 1 && done < num );
+
+	errno = e;
+	return done;
+}
+
+/** \brief Submit an array of requests to admission control
+	Like admctrlcl_submit_vector(), in groups of ADMCTRLCL_BATCH_WINDOW
+	requests.
+
+	\param client reference to admission control client
+	\param reqs array of requests to submit
+	\param results array to store the results
+	\param num number of requests
+
+	\return the number of results received. If less than num, errno is set
+	as for admctrlcl_submit_vector()
+*/
+size_t
+admctrlcl_submit_batch(admctrlcl_t *client,const adm_ctrl_request_t *reqs,adm_ctrl_result_t *results,size_t num)
+{
+	const adm_ctrl_request_t *req_refs[ADMCTRLCL_BATCH_WINDOW];
+	adm_ctrl_result_t *res_refs[ADMCTRLCL_BATCH_WINDOW];
+	size_t done = 0,n,i;
+
+	while( done < num )
+	{
+		n = ( num - done > ADMCTRLCL_BATCH_WINDOW )? ADMCTRLCL_BATCH_WINDOW : num - done;
+		for(i = 0; i < n ;i++)
+		{
+			req_refs[i] = reqs + done + i;
+			res_refs[i] = results + done + i;
+		}
+		i = admctrlcl_submit_vector(client,req_refs,res_refs,n);
+		done += i;
+		if ( i < n )
+			break;
+	}
+	return done;
+}
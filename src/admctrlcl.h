@@ -30,6 +30,9 @@
 
 typedef enum { SOCKET_CL, SSL_CL, IPC_CL } admctrlcl_type;
 
+//! Requests of a batch sent ahead of their results
+#define ADMCTRLCL_BATCH_WINDOW 16
+
 //! Data used by an admission control client to store active request and result
 struct admctrlcl_data
 {
@@ -55,6 +58,7 @@ typedef struct admctrlcl admctrlcl_t;
 admctrlcl_t *admctrlcl_new_ipc(const char *,int,char,struct timeval *,adm_ctrl_request_t *,adm_ctrl_result_t *);
 admctrlcl_t *admctrlcl_new_socket(const char *,int,char,struct timeval *,adm_ctrl_request_t *,adm_ctrl_result_t *);
 int admctrlcl_use_SSL(admctrlcl_t *,const char *,const char *);
+int admctrlcl_SSL_reuse_session(admctrlcl_t *,char);
 void admctrlcl_destroy(admctrlcl_t *);
 extern inline void admctrlcl_set_request(admctrlcl_t *,const adm_ctrl_request_t *);
 extern inline adm_ctrl_result_t *admctrlcl_get_result(admctrlcl_t *);
@@ -62,5 +66,36 @@ int admctrlcl_comm_open(admctrlcl_t *);
 int admctrlcl_comm_close(admctrlcl_t *);
 extern inline void admctrlcl_reset(admctrlcl_t *);
 int admctrlcl_submit_request(admctrlcl_t *);
+size_t admctrlcl_submit_batch(admctrlcl_t *,const adm_ctrl_request_t *,adm_ctrl_result_t *,size_t);
+size_t admctrlcl_submit_vector(admctrlcl_t *,const adm_ctrl_request_t *const *,adm_ctrl_result_t *const *,size_t);
+
+//! Asynchronous submission context
+typedef struct admctrlcl_async admctrlcl_async_t;
+//! Handle of a request submitted asynchronously
+typedef struct admctrlcl_handle admctrlcl_handle_t;
+//! Completion callback
+/** Called by admctrlcl_async_dispatch() with the handle, 0 or the errno of a
+ * failed submission, the result and the argument given on submission. The
+ * handle and the result are freed when it returns. */
+typedef void (*admctrlcl_callback)(admctrlcl_handle_t *,int,const adm_ctrl_result_t *,void *);
+
+admctrlcl_async_t *admctrlcl_async_new(admctrlcl_t **,unsigned int);
+void admctrlcl_async_destroy(admctrlcl_async_t *);
+int admctrlcl_async_fd(admctrlcl_async_t *);
+admctrlcl_handle_t *admctrlcl_async_submit(admctrlcl_async_t *,const adm_ctrl_request_t *,admctrlcl_callback,void *);
+int admctrlcl_async_cancel(admctrlcl_async_t *,admctrlcl_handle_t *);
+int admctrlcl_async_dispatch(admctrlcl_async_t *);
+unsigned int admctrlcl_async_pending(admctrlcl_async_t *);
+
+//! Pool of clients shared by several threads
+typedef struct admctrlcl_pool admctrlcl_pool_t;
+
+admctrlcl_pool_t *admctrlcl_pool_new(admctrlcl_t **,unsigned int);
+void admctrlcl_pool_destroy(admctrlcl_pool_t *);
+adm_ctrl_request_t *admctrlcl_pool_request(admctrlcl_pool_t *);
+adm_ctrl_result_t *admctrlcl_pool_result(admctrlcl_pool_t *);
+int admctrlcl_pool_submit(admctrlcl_pool_t *,const adm_ctrl_request_t *,adm_ctrl_result_t *);
+size_t admctrlcl_pool_submit_vector(admctrlcl_pool_t *,const adm_ctrl_request_t *const *,adm_ctrl_result_t *const *,size_t);
+unsigned long admctrlcl_pool_waits(admctrlcl_pool_t *);
 
 #endif
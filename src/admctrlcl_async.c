@@ -0,0 +1,468 @@
+/* admctrlcl_async.c
+
+  Copyright 2004  Georgios Portokalidis <digital_bull@users.sourceforge.net>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include "admctrlcl.h"
+#include "debug.h"
+
+/*! \file admctrlcl_async.c
+  \brief Asynchronous submission of requests for admission control clients
+  \author Georgios Portokalidis
+
+  Requests are queued and submitted by worker threads, one for each of the
+  clients given to admctrlcl_async_new(), so the transport of the clients
+  doesn't matter. Each worker submits with its own client, so as many
+  requests are in flight as there are clients. Completed requests are kept
+  until admctrlcl_async_dispatch() calls their callbacks in the thread of
+  the caller, and a byte is written to a pipe for each of them, so that
+  the caller can wait for completions with select() or poll().
+*/
+
+//! States of a request submitted asynchronously
+typedef enum {
+	HANDLE_QUEUED, //!< Waiting for a worker
+	HANDLE_INFLIGHT, //!< Being submitted by a worker
+	HANDLE_CANCELLED, //!< Cancelled while being submitted
+	HANDLE_DONE, //!< Waiting for its callback to be called
+	HANDLE_DISPATCHED //!< Its callback is being called
+} handle_state_t;
+
+//! Request submitted asynchronously
+struct admctrlcl_handle
+{
+	adm_ctrl_request_t request; //!< Copy of the request
+	adm_ctrl_result_t result; //!< The result
+	int error; //!< 0, or errno if the submission failed
+	handle_state_t state; //!< State of the request
+	admctrlcl_callback cb; //!< Completion callback
+	void *arg; //!< Argument of the callback
+	struct admctrlcl_handle *prev; //!< Previous handle in its list
+	struct admctrlcl_handle *next; //!< Next handle in its list
+};
+
+//! Doubly linked list of handles
+struct handle_list
+{
+	admctrlcl_handle_t *head; //!< First handle
+	admctrlcl_handle_t *tail; //!< Last handle
+};
+
+//! Worker submitting requests with one client
+struct async_worker
+{
+	pthread_t thread; //!< Thread
+	struct admctrlcl_async *async; //!< Context it belongs to
+	admctrlcl_t *client; //!< Client used to submit
+	char started; //!< Thread was created
+};
+
+//! Asynchronous submission context
+struct admctrlcl_async
+{
+	pthread_mutex_t lock; //!< Protects the lists, the states and stop
+	pthread_cond_t cond; //!< Signaled when a request is queued or on stop
+	struct handle_list queued; //!< Requests waiting for a worker
+	struct handle_list done; //!< Requests waiting for dispatch
+	unsigned int pending; //!< Requests submitted but not dispatched
+	char stop; //!< Workers should exit
+	int notify[2]; //!< Pipe written on completion, read by dispatch
+	unsigned int workers_num; //!< Number of workers
+	struct async_worker *workers; //!< Workers
+};
+
+
+/*************************************************************************/
+/*               	STATIC FUNCTIONS IMPLEMENTATION                        */
+/*************************************************************************/
+
+static void
+list_append(struct handle_list *l,admctrlcl_handle_t *h)
+{
+	h->next = NULL;
+	h->prev = l->tail;
+	if ( l->tail )
+		l->tail->next = h;
+	else
+		l->head = h;
+	l->tail = h;
+}
+
+static void
+list_remove(struct handle_list *l,admctrlcl_handle_t *h)
+{
+	if ( h->prev )
+		h->prev->next = h->next;
+	else
+		l->head = h->next;
+	if ( h->next )
+		h->next->prev = h->prev;
+	else
+		l->tail = h->prev;
+	h->prev = h->next = NULL;
+}
+
+/** \brief Submit a request with the client of a worker
+	The client sends and receives directly from the handle, instead of its
+	own request and result.
+*/
+static void
+worker_submit(admctrlcl_t *client,admctrlcl_handle_t *h)
+{
+	adm_ctrl_request_t *req = client->data.request;
+	adm_ctrl_result_t *res = client->data.result;
+
+	client->data.request = &h->request;
+	client->data.result = &h->result;
+	h->error = ( admctrlcl_submit_request(client) == 0 )? 0 : errno;
+	client->data.request = req;
+	client->data.result = res;
+}
+
+/** \brief Worker thread routine
+	Takes queued requests until the context is destroyed.
+
+	\param arg reference to the worker
+
+	\return always NULL
+*/
+static void *
+worker_run(void *arg)
+{
+	struct async_worker *w = (struct async_worker *)arg;
+	struct admctrlcl_async *a = w->async;
+	admctrlcl_handle_t *h;
+	sigset_t blksigs;
+	char c = 0;
+
+	// Leave signals to the threads of the caller
+	sigfillset(&blksigs);
+	pthread_sigmask(SIG_BLOCK,&blksigs,NULL);
+
+	pthread_mutex_lock(&a->lock);
+	while( 1 )
+	{
+		while( !a->stop && a->queued.head == NULL )
+			pthread_cond_wait(&a->cond,&a->lock);
+		if ( a->stop )
+			break;
+		h = a->queued.head;
+		list_remove(&a->queued,h);
+		h->state = HANDLE_INFLIGHT;
+		pthread_mutex_unlock(&a->lock);
+
+		worker_submit(w->client,h);
+
+		pthread_mutex_lock(&a->lock);
+		if ( h->state == HANDLE_CANCELLED )
+		{
+			free(h);
+			continue;
+		}
+		h->state = HANDLE_DONE;
+		list_append(&a->done,h);
+		// A full pipe is already readable, and the done list is what counts
+		while( write(a->notify[1],&c,1) < 0 && errno != EAGAIN )
+			if ( errno != EINTR )
+			{
+				DEBUG_CMD(perror("worker_run: write"));
+				break;
+			}
+	}
+	pthread_mutex_unlock(&a->lock);
+	return NULL;
+}
+
+
+/*************************************************************************/
+/*               	PUBLIC FUNCTIONS IMPLEMENTATION                        */
+/*************************************************************************/
+
+
+/** \brief Create a context for submitting requests asynchronously
+	A worker thread is started for each client, submitting requests with it.
+	The clients must have been created, and opened if persistent, and must
+	not be used by the caller until admctrlcl_async_destroy(). They can be of
+	any type. IPC clients should use the same key, since they are serialised
+	by authd anyway.
+
+	\param clients array of admission control clients
+	\param num number of clients in the array
+
+	\return a new context, or NULL on error. errno is set to EINVAL if there
+	are no clients, ENOMEM if no memory was available, or by pipe() or
+	pthread_create()
+*/
+admctrlcl_async_t *
+admctrlcl_async_new(admctrlcl_t **clients,unsigned int num)
+{
+	admctrlcl_async_t *a;
+	unsigned int i;
+	int e;
+
+	if ( num == 0 )
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	if ( (a = calloc(1,sizeof(admctrlcl_async_t))) == NULL )
+		goto mem_error;
+	pthread_mutex_init(&a->lock,NULL);
+	pthread_cond_init(&a->cond,NULL);
+	a->notify[0] = a->notify[1] = -1;
+	if ( (a->workers = calloc(num,sizeof(struct async_worker))) == NULL )
+		goto mem_error;
+	a->workers_num = num;
+
+	if ( pipe(a->notify) != 0 )
+		goto error;
+	fcntl(a->notify[0],F_SETFL,O_NONBLOCK);
+	fcntl(a->notify[1],F_SETFL,O_NONBLOCK);
+
+	for(i = 0; i < num ;i++)
+	{
+		a->workers[i].async = a;
+		a->workers[i].client = clients[i];
+		if ( (e = pthread_create(&a->workers[i].thread,NULL,worker_run,&a->workers[i])) != 0 )
+		{
+			errno = e;
+			goto error;
+		}
+		a->workers[i].started = 1;
+	}
+
+	return a;
+
+mem_error:
+	errno = ENOMEM;
+error:
+	if ( a )
+	{
+		e = errno;
+		admctrlcl_async_destroy(a);
+		errno = e;
+	}
+	return NULL;
+}
+
+/** \brief Destroy an asynchronous submission context
+	Requests not yet dispatched are dropped without calling their callbacks.
+	It waits for requests being submitted to complete. The clients are not
+	destroyed.
+
+	\param a reference to the context
+*/
+void
+admctrlcl_async_destroy(admctrlcl_async_t *a)
+{
+	admctrlcl_handle_t *h;
+	unsigned int i;
+
+	pthread_mutex_lock(&a->lock);
+	a->stop = 1;
+	pthread_cond_broadcast(&a->cond);
+	pthread_mutex_unlock(&a->lock);
+
+	if ( a->workers )
+	{
+		for(i = 0; i < a->workers_num ;i++)
+			if ( a->workers[i].started )
+				pthread_join(a->workers[i].thread,NULL);
+		free(a->workers);
+	}
+
+	while( (h = a->queued.head) != NULL )
+	{
+		list_remove(&a->queued,h);
+		free(h);
+	}
+	while( (h = a->done.head) != NULL )
+	{
+		list_remove(&a->done,h);
+		free(h);
+	}
+	if ( a->notify[0] >= 0 )
+		close(a->notify[0]);
+	if ( a->notify[1] >= 0 )
+		close(a->notify[1]);
+	pthread_cond_destroy(&a->cond);
+	pthread_mutex_destroy(&a->lock);
+	free(a);
+}
+
+/** \brief Return a file descriptor that becomes readable on completion
+	It is readable while there are requests to dispatch. Only
+	admctrlcl_async_dispatch() should read from it.
+
+	\param a reference to the context
+
+	\return the file descriptor
+*/
+int
+admctrlcl_async_fd(admctrlcl_async_t *a)
+{
+	return a->notify[0];
+}
+
+/** \brief Submit a request asynchronously
+	The request is copied and submitted by the first worker available.
+
+	\param a reference to the context
+	\param req the request
+	\param cb callback called by admctrlcl_async_dispatch() on completion
+	\param arg argument passed to the callback
+
+	\return the handle of the request, valid until its callback returns or it
+	is cancelled, or NULL if no memory was available
+*/
+admctrlcl_handle_t *
+admctrlcl_async_submit(admctrlcl_async_t *a,const adm_ctrl_request_t *req,
+		admctrlcl_callback cb,void *arg)
+{
+	admctrlcl_handle_t *h;
+
+	if ( (h = malloc(sizeof(admctrlcl_handle_t))) == NULL )
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+	memcpy(&h->request,req,sizeof(adm_ctrl_request_t));
+	bzero(&h->result,sizeof(adm_ctrl_result_t));
+	h->error = 0;
+	h->state = HANDLE_QUEUED;
+	h->cb = cb;
+	h->arg = arg;
+
+	pthread_mutex_lock(&a->lock);
+	list_append(&a->queued,h);
+	a->pending++;
+	pthread_cond_signal(&a->cond);
+	pthread_mutex_unlock(&a->lock);
+
+	return h;
+}
+
+/** \brief Cancel a request submitted asynchronously
+	Its callback will not be called and the handle is no longer valid. A
+	request already being submitted still reaches the server, but its result
+	is discarded.
+
+	\param a reference to the context
+	\param h handle of the request
+
+	\return 0 on success, or -1 if the callback of the request has already
+	been called. errno is set to EINVAL
+*/
+int
+admctrlcl_async_cancel(admctrlcl_async_t *a,admctrlcl_handle_t *h)
+{
+	int e = 0;
+
+	pthread_mutex_lock(&a->lock);
+	switch( h->state )
+	{
+		case HANDLE_QUEUED:
+			list_remove(&a->queued,h);
+			free(h);
+			break;
+		case HANDLE_INFLIGHT:
+			// The worker frees it
+			h->state = HANDLE_CANCELLED;
+			break;
+		case HANDLE_DONE:
+			list_remove(&a->done,h);
+			free(h);
+			break;
+		default:
+			errno = EINVAL;
+			e = -1;
+			break;
+	}
+	if ( e == 0 )
+		a->pending--;
+	pthread_mutex_unlock(&a->lock);
+	return e;
+}
+
+/** \brief Call the callbacks of completed requests
+	Never blocks. It should be called when the descriptor returned by
+	admctrlcl_async_fd() is readable.
+
+	\param a reference to the context
+
+	\return the number of callbacks called
+*/
+int
+admctrlcl_async_dispatch(admctrlcl_async_t *a)
+{
+	admctrlcl_handle_t *h;
+	char buf[64];
+	int n = 0;
+
+	while( read(a->notify[0],buf,sizeof(buf)) > 0 )
+		;
+
+	while( 1 )
+	{
+		pthread_mutex_lock(&a->lock);
+		if ( (h = a->done.head) != NULL )
+		{
+			list_remove(&a->done,h);
+			h->state = HANDLE_DISPATCHED;
+			a->pending--;
+		}
+		pthread_mutex_unlock(&a->lock);
+		if ( h == NULL )
+			break;
+
+		DEBUG_CMD2(printf("admctrlcl_async_dispatch: request completed (%d)\n",h->error));
+		if ( h->cb )
+			h->cb(h,h->error,&h->result,h->arg);
+		free(h);
+		n++;
+	}
+	return n;
+}
+
+/** \brief Return the number of requests submitted but not yet dispatched
+
+	\param a reference to the context
+
+	\return the number of requests
+*/
+unsigned int
+admctrlcl_async_pending(admctrlcl_async_t *a)
+{
+	unsigned int n;
+
+	pthread_mutex_lock(&a->lock);
+	n = a->pending;
+	pthread_mutex_unlock(&a->lock);
+	return n;
+}
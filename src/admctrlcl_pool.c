@@ -0,0 +1,358 @@
+/* admctrlcl_pool.c
+
+  Copyright 2004  Georgios Portokalidis <digital_bull@users.sourceforge.net>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include "admctrlcl.h"
+#include "debug.h"
+
+/*! \file admctrlcl_pool.c
+  \brief Pool of admission control clients shared by several threads
+  \author Georgios Portokalidis
+
+  A client owns one request, one result and one connection, so it can only
+  be used by one thread at a time. A pool keeps the clients given to
+  admctrlcl_pool_new() and lends an idle one to each submission, so as many
+  threads can submit at once as there are clients. Threads that find no
+  idle client wait for one to be returned. Each thread using the pool also
+  gets its own request and result buffers, allocated on first use.
+*/
+
+//! Request and result buffers of a thread
+struct pool_buffers
+{
+	adm_ctrl_request_t request; //!< Request of the thread
+	adm_ctrl_result_t result; //!< Result of the thread
+	struct admctrlcl_pool *pool; //!< Pool they belong to
+	struct pool_buffers *prev; //!< Previous buffers of the pool
+	struct pool_buffers *next; //!< Next buffers of the pool
+};
+
+//! Pool of clients
+struct admctrlcl_pool
+{
+	pthread_mutex_t lock; //!< Protects the idle clients, the buffers and waits
+	pthread_cond_t cond; //!< Signaled when a client is returned
+	admctrlcl_t **idle; //!< Idle clients
+	unsigned int idle_num; //!< Number of idle clients
+	unsigned int clients_num; //!< Number of clients
+	unsigned long waits; //!< Submissions that waited for an idle client
+	pthread_key_t key; //!< Buffers of the calling thread
+	struct pool_buffers *buffers; //!< Buffers of all threads
+};
+
+
+/*************************************************************************/
+/*               	STATIC FUNCTIONS IMPLEMENTATION                        */
+/*************************************************************************/
+
+/** \brief Free the buffers of an exiting thread
+*/
+static void
+buffers_free(void *arg)
+{
+	struct pool_buffers *b = (struct pool_buffers *)arg;
+	struct admctrlcl_pool *pool = b->pool;
+
+	pthread_mutex_lock(&pool->lock);
+	if ( b->prev )
+		b->prev->next = b->next;
+	else
+		pool->buffers = b->next;
+	if ( b->next )
+		b->next->prev = b->prev;
+	pthread_mutex_unlock(&pool->lock);
+	free(b);
+}
+
+/** \brief Get the buffers of the calling thread, allocating them on first use
+
+	\return the buffers, or NULL if no memory was available
+*/
+static struct pool_buffers *
+buffers_get(admctrlcl_pool_t *pool)
+{
+	struct pool_buffers *b;
+
+	if ( (b = pthread_getspecific(pool->key)) != NULL )
+		return b;
+	if ( (b = calloc(1,sizeof(struct pool_buffers))) == NULL )
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+	b->pool = pool;
+	pthread_mutex_lock(&pool->lock);
+	if ( (b->next = pool->buffers) != NULL )
+		b->next->prev = b;
+	pool->buffers = b;
+	pthread_mutex_unlock(&pool->lock);
+	pthread_setspecific(pool->key,b);
+	return b;
+}
+
+/** \brief Take an idle client, waiting for one to be returned if needed
+*/
+static admctrlcl_t *
+client_get(admctrlcl_pool_t *pool)
+{
+	admctrlcl_t *client;
+
+	pthread_mutex_lock(&pool->lock);
+	if ( pool->idle_num == 0 )
+	{
+		++pool->waits;
+		do {
+			pthread_cond_wait(&pool->cond,&pool->lock);
+		} while( pool->idle_num == 0 );
+	}
+	client = pool->idle[--pool->idle_num];
+	pthread_mutex_unlock(&pool->lock);
+	return client;
+}
+
+/** \brief Return a client taken with client_get()
+*/
+static void
+client_put(admctrlcl_pool_t *pool,admctrlcl_t *client)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->idle[pool->idle_num++] = client;
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+
+
+/*************************************************************************/
+/*               	PUBLIC FUNCTIONS IMPLEMENTATION                        */
+/*************************************************************************/
+
+/** \brief Create a pool of clients that can be used by several threads
+
+	\param clients array of clients to be used by the pool. They can be of any
+	type, must have been opened with admctrlcl_comm_open() if persistent, and
+	must not be used directly until the pool is destroyed. IPC clients can only
+	use a timeout in several threads if semtimedop() is available
+	\param num number of clients
+
+	\return a new pool, or NULL on error. errno is set to EINVAL if num is 0,
+	ENOMEM if no memory was available, or by pthread_key_create()
+*/
+admctrlcl_pool_t *
+admctrlcl_pool_new(admctrlcl_t **clients,unsigned int num)
+{
+	admctrlcl_pool_t *pool;
+	unsigned int i;
+	int e;
+
+	if ( num == 0 )
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	if ( (pool = calloc(1,sizeof(admctrlcl_pool_t))) == NULL )
+		goto mem_error;
+	if ( (pool->idle = calloc(num,sizeof(admctrlcl_t *))) == NULL )
+		goto mem_error;
+	if ( (e = pthread_key_create(&pool->key,buffers_free)) != 0 )
+	{
+		free(pool->idle);
+		free(pool);
+		errno = e;
+		return NULL;
+	}
+	pthread_mutex_init(&pool->lock,NULL);
+	pthread_cond_init(&pool->cond,NULL);
+	for(i = 0; i < num ;i++)
+		pool->idle[i] = clients[i];
+	pool->idle_num = pool->clients_num = num;
+
+	return pool;
+
+mem_error:
+	if ( pool )
+		free(pool);
+	errno = ENOMEM;
+	return NULL;
+}
+
+/** \brief Destroy a pool of clients
+	No thread may be submitting through the pool. The buffers of all threads
+	are freed, while the clients are not destroyed.
+
+	\param pool reference to the pool
+*/
+void
+admctrlcl_pool_destroy(admctrlcl_pool_t *pool)
+{
+	struct pool_buffers *b;
+
+	pthread_key_delete(pool->key);
+	while( (b = pool->buffers) != NULL )
+	{
+		pool->buffers = b->next;
+		free(b);
+	}
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->idle);
+	free(pool);
+}
+
+/** \brief Get the request buffer of the calling thread
+	Can be used to build a request submitted with admctrlcl_pool_submit(),
+	instead of allocating one.
+
+	\param pool reference to the pool
+
+	\return the request buffer, or NULL if no memory was available
+*/
+adm_ctrl_request_t *
+admctrlcl_pool_request(admctrlcl_pool_t *pool)
+{
+	struct pool_buffers *b;
+
+	return ( (b = buffers_get(pool)) != NULL )? &b->request : NULL;
+}
+
+/** \brief Get the result buffer of the calling thread
+
+	\param pool reference to the pool
+
+	\return the result buffer, or NULL if no memory was available
+*/
+adm_ctrl_result_t *
+admctrlcl_pool_result(admctrlcl_pool_t *pool)
+{
+	struct pool_buffers *b;
+
+	return ( (b = buffers_get(pool)) != NULL )? &b->result : NULL;
+}
+
+/** \brief Submit a request with an idle client of the pool
+	Waits until a client is idle. The client sends and receives directly from
+	the given buffers, instead of its own request and result. Can be called
+	by several threads at once.
+
+	\param pool reference to the pool
+	\param req request to submit, or NULL for the request buffer of the thread
+	\param res buffer to store the result, or NULL for the result buffer of the
+	thread
+
+	\return 0 on success, or -1 on error. errno is set as for
+	admctrlcl_submit_request(), or to ENOMEM if the buffers of the thread
+	couldn't be allocated
+*/
+int
+admctrlcl_pool_submit(admctrlcl_pool_t *pool,const adm_ctrl_request_t *req,adm_ctrl_result_t *res)
+{
+	struct pool_buffers *b;
+	adm_ctrl_request_t *own_req;
+	adm_ctrl_result_t *own_res;
+	admctrlcl_t *client;
+	int e;
+
+	if ( req == NULL || res == NULL )
+	{
+		if ( (b = buffers_get(pool)) == NULL )
+			return -1;
+		if ( req == NULL )
+			req = &b->request;
+		if ( res == NULL )
+			res = &b->result;
+	}
+
+	client = client_get(pool);
+
+	own_req = client->data.request;
+	own_res = client->data.result;
+	client->data.request = (adm_ctrl_request_t *)req;
+	client->data.result = res;
+	if ( (e = admctrlcl_submit_request(client)) != 0 )
+		e = errno;
+	client->data.request = own_req;
+	client->data.result = own_res;
+	client_put(pool,client);
+
+	if ( e != 0 )
+	{
+		DEBUG_CMD2(printf("admctrlcl_pool_submit: submission failed\n"));
+		errno = e;
+		return -1;
+	}
+	return 0;
+}
+
+/** \brief Submit a number of requests, given by reference, with an idle client of the pool
+	Waits until a client is idle and submits all the requests with it, by
+	admctrlcl_submit_vector(). Can be called by several threads at once, each
+	batch keeping a different client.
+
+	\param pool reference to the pool
+	\param reqs array of references to the requests to submit
+	\param results array of references to store the results
+	\param num number of requests
+
+	\return the number of results received. If less than num, errno is set
+	as for admctrlcl_submit_vector()
+*/
+size_t
+admctrlcl_pool_submit_vector(admctrlcl_pool_t *pool,const adm_ctrl_request_t *const *reqs,adm_ctrl_result_t *const *results,size_t num)
+{
+	admctrlcl_t *client;
+	size_t done;
+	int e;
+
+	client = client_get(pool);
+	done = admctrlcl_submit_vector(client,reqs,results,num);
+	e = errno;
+	client_put(pool,client);
+
+	if ( done < num )
+	{
+		DEBUG_CMD2(printf("admctrlcl_pool_submit_vector: submission failed\n"));
+		errno = e;
+	}
+	return done;
+}
+
+/** \brief Get the number of submissions that waited for an idle client
+	A large number shows that more clients should be given to the pool.
+
+	\param pool reference to the pool
+
+	\return the number of submissions that waited
+*/
+unsigned long
+admctrlcl_pool_waits(admctrlcl_pool_t *pool)
+{
+	unsigned long waits;
+
+	pthread_mutex_lock(&pool->lock);
+	waits = pool->waits;
+	pthread_mutex_unlock(&pool->lock);
+	return waits;
+}
@@ -24,7 +24,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
-#include <signal.h>
 #include <math.h>
 
 #include "stack.h"
@@ -38,18 +37,16 @@
  *  \author Georgios Portokalidis
  */
 
-static char *stream_p = NULL;
-
 /** \brief Extract an arithmetical expression token from string
 
-	The first call should have s set to the string containing the tokens 
-	to be extracted. Subsequent calls should have the first argument set
-	to NULL to continue processing the first call's argument until no 
-	more tokens are available.
+	The position in the string is kept by the caller, so strings can be
+	tokenized concurrently. It should point to the start of the string
+	before the first call, and is advanced past the token read by each call
+	until no more tokens are available.
 	When token NUM is returned the string representing the number read is
 	stored in numbuf.
 
-	\param s String to be tokenized, or NULL to use the string from a previous calll
+	\param sp Reference to the position in the string to be tokenized
 	\param numbuf Buffer where numbers read are going to be stored
 	\param maxnum Size of numbuf buffer
 
@@ -57,29 +54,29 @@ static char *stream_p = NULL;
 	or EMPTY if the end of the string was encountered
 	*/
 arith_op_t
-arith_parser_token(char *s,char *numbuf,size_t maxnum)
+arith_parser_token(const char **sp,char *numbuf,size_t maxnum)
 {
+	const char *stream_p = *sp;
 	size_t i;
 	arith_op_t ret;
 
-	if ( s != NULL )
-		stream_p = s;
-	else if ( stream_p == NULL )
+	if ( stream_p == NULL )
 		return INV;
 
 	// Skip spaces
-	for( ; isspace(*stream_p) ; ++stream_p )
+	for( ; isspace((unsigned char)*stream_p) ; ++stream_p )
 		;
 
 	for(i = 0; *stream_p != '\0' ; ++stream_p)
 	{
 		// Part of a number [0-9] or '-','.'
-		if ( isdigit(*stream_p) || *stream_p == '.' ||
-				((*stream_p == '-' || *stream_p == '+') && isdigit(*(stream_p+1))) )
+		if ( isdigit((unsigned char)*stream_p) || *stream_p == '.' ||
+				((*stream_p == '-' || *stream_p == '+') && isdigit((unsigned char)*(stream_p+1))) )
 		{
 			if ( i >= (maxnum - 1) )
       {
         DEBUG_CMD2(printf("DEBUG arith_parser: too many digits\n"));
+				*sp = stream_p;
 				return INV;
       }
 			else
@@ -115,11 +112,12 @@ arith_parser_token(char *s,char *numbuf,size_t maxnum)
 					ret = INV;
 					break;
 			}
-			++stream_p;
+			*sp = stream_p + 1;
 			return ret;
 		}
 	}//End for
 
+	*sp = stream_p;
 	// Return number
 	if ( i > 0 )
 	{
@@ -130,25 +128,20 @@ arith_parser_token(char *s,char *numbuf,size_t maxnum)
 	return EMPTY;
 }
 
-static char fpe_exception = 0;
-
-static void
-fpe_handler(int data)
-{
-  DEBUG_CMD2(printf("DEBUG arith_parser: FPE exception\n"));
-	fpe_exception = 1;
-}
-
 /** \brief Parse a postfix arithmetic expression
   Empty strings are treated as valid expressions and are evaluated as 0.
+	The evaluation uses no global state, and fails if a number or an
+	intermediate result is not finite, so it is safe to call concurrently.
+	At most ARITH_PARSER_MAX_DEPTH numbers can be on the stack.
 	\param s String containing the expression
 	\param res Reference where result is going to be placed
 
 	\return 0 on success, or -1 on failure
 	*/
 int
-postfix_expr_parse(char *s,double *res)
+postfix_expr_parse(const char *s,double *res)
 {
+	double values[ARITH_PARSER_MAX_DEPTH];
 	stack st;
 	double n,n1,n2;;
 	arith_op_t e;
@@ -160,20 +153,16 @@ postfix_expr_parse(char *s,double *res)
     return 0;
   }
 
-  if ( stack_init(&st,sizeof(double)) )
-		return -1;
-
-	fpe_exception = 0;
-	signal(SIGFPE,fpe_handler);
+	stack_init_fixed(&st,values,ARITH_PARSER_MAX_DEPTH,sizeof(double));
 
-	e = arith_parser_token(s,buf,MAX_NUMBER_SIZE);
+	e = arith_parser_token(&s,buf,MAX_NUMBER_SIZE);
 	while ( e != EMPTY && e != INV )
 	{
 		// Push number to stack
 		if ( e == NUM )
 		{
 			n = strtod(buf,NULL);
-			if ( stack_push(&st,&n) )
+			if ( !isfinite(n) || stack_push(&st,&n) )
 				goto error;
 		}
 		// Pop 2 numbers, apply operator and push result
@@ -202,41 +191,45 @@ postfix_expr_parse(char *s,double *res)
 				default:
 					goto error;
 			}
-			if ( fpe_exception || fpclassify(n) != FP_NORMAL )
+			// Overflow, division by zero and invalid operations
+			if ( !isfinite(n) )
+			{
+				DEBUG_CMD2(printf("DEBUG arith_parser: result is not finite\n"));
 				goto error;
+			}
 			if ( stack_push(&st,&n) )
 				goto error;
 		}
 		// Get next token
-		e = arith_parser_token(NULL,buf,MAX_NUMBER_SIZE);
+		e = arith_parser_token(&s,buf,MAX_NUMBER_SIZE);
 	}// End while()
   
 
-	if ( stack_isempty(&st) )
+	if ( e != EMPTY || stack_isempty(&st) )
 		goto error;
   *res = *(double *)stack_pop(&st);
-	stack_destroy(&st);
-	signal(SIGFPE,SIG_DFL);
-	return e;
+	return 0;
 
 error:
-	stack_destroy(&st);
-	signal(SIGFPE,SIG_DFL);
 	return -1;
 }
 
 
 /** \brief Parse an infix arithmetic expression
   Empty strings are treated as valid expressions and are evaluated as 0.
+	The expression is converted to a postfix one of at most
+	ARITH_PARSER_MAX_EXPR_SIZE characters, with at most ARITH_PARSER_MAX_DEPTH
+	pending operators, in buffers on the stack of the caller.
 	\param s String containing the expression
 	\param res Reference where result is going to be placed
 
 	\return 0 on success, or -1 on failure
 	*/
 int 
-infix_expr_parse(char *s,double *res)
+infix_expr_parse(const char *s,double *res)
 {
   char buf[MAX_NUMBER_SIZE];
+	char postfix[ARITH_PARSER_MAX_EXPR_SIZE],ops[ARITH_PARSER_MAX_DEPTH];
 	string_buf_t str_buf;
 	stack st;
 	char t,t1,t2;
@@ -248,15 +241,10 @@ infix_expr_parse(char *s,double *res)
     return 0;
   }
 
-  if ( stack_init(&st,sizeof(char)) )
-		return -1;
-	if ( string_buf_init(&str_buf,NULL) )
-	{
-		stack_destroy(&st);
-		return -1;
-	}
+	stack_init_fixed(&st,ops,ARITH_PARSER_MAX_DEPTH,sizeof(char));
+	string_buf_init_fixed(&str_buf,postfix,ARITH_PARSER_MAX_EXPR_SIZE);
 
-	e = arith_parser_token(s,buf,MAX_NUMBER_SIZE);
+	e = arith_parser_token(&s,buf,MAX_NUMBER_SIZE);
 	while( e != EMPTY && e != INV )
 	{
 		// Append number and space to string buffer
@@ -325,7 +313,7 @@ infix_expr_parse(char *s,double *res)
 			}
 		}
 		// Get next token
-		e = arith_parser_token(NULL,buf,MAX_NUMBER_SIZE);
+		e = arith_parser_token(&s,buf,MAX_NUMBER_SIZE);
 	}//End while
 
 	if ( e != EMPTY )
@@ -347,7 +335,5 @@ infix_expr_parse(char *s,double *res)
 	return 0;
 
 error:
-	stack_destroy(&st);
-	string_buf_destroy(&str_buf);
 	return -1;
 }
@@ -29,11 +29,17 @@
 //! Specifies the maximum length of supported numbers
 #define MAX_NUMBER_SIZE 512
 #define ARITH_PARSER_MAX_NUMBER_SIZE MAX_NUMBER_SIZE
+/* Expressions are evaluated in fixed buffers on the stack. Infix expressions of
+ * up to 1023 characters always fit in them. */
+//! Specifies the maximum number of pending numbers or operators in an expression
+#define ARITH_PARSER_MAX_DEPTH 512
+//! Specifies the maximum length of an expression converted to postfix
+#define ARITH_PARSER_MAX_EXPR_SIZE 2048
 
 typedef enum { INV = -1, EMPTY, NUM, ADD, SUB, MUL, DIV, LPAR, RPAR } arith_op_t;
 
-arith_op_t arith_parser_token(char *,char *,size_t);
-int postfix_expr_parse(char *,double *);
-int infix_expr_parse(char *,double *);
+arith_op_t arith_parser_token(const char **,char *,size_t);
+int postfix_expr_parse(const char *,double *);
+int infix_expr_parse(const char *,double *);
 
 #endif
@@ -26,11 +26,14 @@
 #include <sys/stat.h>
 #include <sys/param.h>
 #include <sys/ipc.h>
+#include <sys/time.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 #ifdef WITH_SYSLOG
 #include <syslog.h>
 #else
@@ -40,8 +43,12 @@ enum { LOG_INFO, LOG_CRIT, LOG_WARNING, LOG_ERR };
 #include "shm_sync.h"
 #include "shm.h"
 #include "adm_ctrl.h"
+#include "adm_ctrl_func.h"
+#include "adm_ctrl_session.h"
+#include "admctrl_schema.h"
 #include "admctrl_errno.h"
 #include "admctrl_comm.h"
+#include "authd_stats.h"
 
 
 /*! \file authd.c
@@ -55,14 +62,31 @@ enum { LOG_INFO, LOG_CRIT, LOG_WARNING, LOG_ERR };
 static admctrl_comm_t comm;
 //! Policy
 static adm_ctrl_policy_t policy;
+//! Schema registry of the function ids of requests
+static admctrl_schema_t schema;
 //! Executable's name, used for error reporting
 static const char *exec_name;
+//! Statistics segment
+static authd_stats_t *stats = NULL;
+//! Id of the statistics segment
+static int stats_id = -1;
+//! Time spent in the stages of authorisation
+static adm_ctrl_timing_t timing;
+//! Authenticated sessions
+static adm_ctrl_sessions_t sessions;
+//! Set by SIGUSR2 when all sessions need to be revoked
+static volatile sig_atomic_t sessions_revoke = 0;
 
 #ifdef WITH_RESOURCE_CONTROL
 #include "resource_ctrl.h"
+#include "resource_lease.h"
 
 //! Resource control db
 static resource_ctrl_db_t resctrl_db;
+//! Timer wheel of resource leases
+static resource_lease_wheel_t lease_wheel;
+//! Set by SIGALRM when leases need to be checked
+static volatile sig_atomic_t lease_tick = 0;
 //! Location of resource control home
 static char *resource_ctrl_home = DEFAULT_RESOURCE_CTRL_HOME;
 //! Database file name
@@ -76,14 +100,24 @@ static char *resource_ctrl_name = DEFAULT_RESOURCE_DBNAME;
 static char isdaemon = 0;
 //! Resource control status flag
 static char resource_control = 0;
+//! Resource lease expiration flag
+static char resource_leases = 0;
 //! Verbocity flag
 static char verbose = 0;
 //! Filename containing the policy
 static char *policy_fn = DEFAULT_POLICY_FILE;
+//! Filename containing the schema registry, or NULL
+static char *schema_fn = NULL;
 //! Filename to access shared memory
 static char *shm_fn = DEFAULT_SHM_FILE;
 //! Project id to access shared memory
 static char shm_pid = DEFAULT_SHM_PROJECT_ID;
+//! Project id of the statistics segment
+static char stats_pid = DEFAULT_STATS_PROJECT_ID;
+//! Seconds a session is valid for, 0 disables sessions
+static unsigned int session_lifetime = 0;
+//! Maximum number of sessions
+static unsigned int max_sessions = DEFAULT_MAX_SESSIONS;
 
 
 /** \brief Prints messages to syslog and additionally to stdout 
@@ -113,12 +147,18 @@ shutdown(int data)
 {
 	if ( comm.shm_id >= 0 )
 		admctrl_comm_uninit(&comm);
+	if ( stats )
+		authd_stats_destroy(stats,stats_id);
+	adm_ctrl_sessions_destroy(&sessions);
 #ifdef WITH_RESOURCE_CONTROL
+	if ( resource_leases )
+		resource_lease_wheel_destroy(&lease_wheel);
 	if ( resource_control )
 		resource_ctrl_dbclose(&resctrl_db);
 #endif
 	if ( policy.assertions )
 		free(policy.assertions);
+	admctrl_schema_free(&schema);
 	print_msg(LOG_INFO,"Exiting");
 #ifdef SYSLOG
 	closelog();
@@ -137,13 +177,18 @@ print_usage(const char *name)
 	printf("Usage: %s [OPTIONS]\n\n",name);
 	printf("  -d, --daemon                  Run as a daemon in the background\n");
 	printf("  -p, --policy  (filename)      Read policy from filename\n");
+	printf("  -F, --schema  (filename)      Read function schema registry from filename\n");
 	printf("  -s, --shmpath (pathname)      Use pathname for shared memory\n");
 	printf("  -i, --shmid   (id character)  Use id for shared memory\n");
+	printf("  -S, --statsid (id character)  Use id for the statistics segment\n");
 #ifdef WITH_RESOURCE_CONTROL
 	printf("  -D, --dbhome  (pathname)      Set resource control DB home to pathname\n");
 	printf("  -b, --dbname  (name)          Set resource control DB file name\n");
 	printf("  -R, --rc                      Enable resource control\n");
+	printf("  -l, --leases                  Expire resource leases (implies -R)\n");
 #endif
+	printf("  -T, --sessions (seconds)      Open sessions valid for seconds\n");
+	printf("  -M, --maxsessions (number)    Keep at most number sessions\n");
 	printf("  -v, --verbose                 Be verbose with clients' requests\n");
 	printf("  -h, --help                    Display this message\n");
 }
@@ -158,15 +203,20 @@ static void
 parse_arguments(int argc,char **argv)
 {
 	int c;
-	const char optstring[] = "dp:s:i:D:hvRb:";
+	const char optstring[] = "dp:F:s:i:S:D:hvRlb:T:M:";
 	const struct option longopts[] = {
 		{"daemon",no_argument,NULL,'d'},
 		{"policy",required_argument,NULL,'p'},
+		{"schema",required_argument,NULL,'F'},
 		{"shmpath",required_argument,NULL,'s'},
 		{"shmid",required_argument,NULL,'i'},
+		{"statsid",required_argument,NULL,'S'},
 		{"dbhome",required_argument,NULL,'D'},
 		{"dbname",required_argument,NULL,'b'},
 		{"rc",no_argument,NULL,'R'},
+		{"leases",no_argument,NULL,'l'},
+		{"sessions",required_argument,NULL,'T'},
+		{"maxsessions",required_argument,NULL,'M'},
 		{"help",no_argument,NULL,'h'},
 		{"verbose",no_argument,NULL,'v'},
 		{"",0,NULL,0}
@@ -181,12 +231,18 @@ parse_arguments(int argc,char **argv)
 			case 'p':
 				policy_fn = optarg;
 				break;
+			case 'F':
+				schema_fn = optarg;
+				break;
 			case 's':
 				shm_fn = optarg;
 				break;
 			case 'i':
 				shm_pid = *optarg;
 				break;
+			case 'S':
+				stats_pid = *optarg;
+				break;
 #ifdef WITH_RESOURCE_CONTROL
 			case 'D':
 				resource_ctrl_home = optarg;
@@ -194,10 +250,24 @@ parse_arguments(int argc,char **argv)
 			case 'R':
 				resource_control = 1;
 				break;
+			case 'l':
+				resource_control = 1;
+				resource_leases = 1;
+				break;
       case 'b':
         resource_ctrl_name = optarg;
         break;
 #endif
+			case 'T':
+				session_lifetime = strtoul(optarg,NULL,10);
+				break;
+			case 'M':
+				if ( (max_sessions = strtoul(optarg,NULL,10)) == 0 )
+				{
+					fprintf(stderr,"%s: Maximum number of sessions must be positive\n",argv[0]);
+					exit(1);
+				}
+				break;
 			case 'v':
 				verbose = 1;
 				break;
@@ -210,16 +280,255 @@ parse_arguments(int argc,char **argv)
 }
 
 
+#ifdef WITH_RESOURCE_CONTROL
+/** \brief Signal handler for the lease timer
+*/
+static void
+lease_alarm(int data)
+{
+	lease_tick = 1;
+}
+
+
+/** \brief Start the timer that triggers lease expiration
+
+	\return 0 on success, or -1 on failure
+*/
+static int
+lease_timer_start(void)
+{
+	struct sigaction sa;
+	struct itimerval it;
+
+	// Other system calls are restarted, but semop() never is, so a blocked
+	// shm_data_wait() returns with EINTR
+	bzero(&sa,sizeof(sa));
+	sa.sa_handler = lease_alarm;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if ( sigaction(SIGALRM,&sa,NULL) < 0 )
+		return -1;
+
+	it.it_interval.tv_sec = RESOURCE_CTRL_LEASE_TICK;
+	it.it_interval.tv_usec = 0;
+	it.it_value = it.it_interval;
+	return setitimer(ITIMER_REAL,&it,NULL);
+}
+
+
+/** \brief Return the resources of expired leases, if the timer has fired
+*/
+static void
+lease_expire(void)
+{
+	size_t expired;
+	char msg[64];
+
+	if ( lease_tick == 0 )
+		return;
+	lease_tick = 0;
+
+	if ( resource_lease_wheel_tick(&lease_wheel,(u_int32_t)time(NULL),&expired) != 0 )
+		print_msg(LOG_ERR,"error while expiring resource leases");
+	if ( stats && expired > 0 )
+	{
+		AUTHD_STATS_BEGIN(stats);
+		stats->leases_expired += expired;
+		AUTHD_STATS_END(stats);
+	}
+	if ( verbose && expired > 0 )
+	{
+		snprintf(msg,sizeof(msg),"%u resource lease(s) expired",(unsigned int)expired);
+		print_msg(LOG_INFO,msg);
+	}
+}
+#endif
+
+
+/** \brief Signal handler for revoking all sessions
+*/
+static void
+sessions_revoke_signal(int data)
+{
+	sessions_revoke = 1;
+}
+
+
+/** \brief Revoke all sessions, if SIGUSR2 was received
+*/
+static void
+sessions_revoke_pending(void)
+{
+	unsigned int revoked;
+	char msg[64];
+
+	if ( sessions_revoke == 0 )
+		return;
+	sessions_revoke = 0;
+
+	revoked = adm_ctrl_sessions_revoke(&sessions);
+	snprintf(msg,sizeof(msg),"%u session(s) revoked",revoked);
+	print_msg(LOG_INFO,msg);
+}
+
+
+/** \brief Authenticate a request, by its session or its encrypted nonce
+
+	\param req The request
+
+	\return 1 on successful authentication, or a negative error code
+*/
+static int
+authenticate(adm_ctrl_request_t *req)
+{
+	if ( req->session_flags & ADMCTRL_SESSION_USE )
+		return adm_ctrl_session_authenticate(&sessions,req);
+	return adm_ctrl_authenticate(req);
+}
+
+
+/** \brief Microseconds elapsed between two times
+*/
+static inline u_int32_t
+tv_usec(const struct timeval *start,const struct timeval *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000 + end->tv_usec - start->tv_usec;
+}
+
+
+/** \brief Record the statistics of a request
+
+	\param ipc_wait Microseconds authd waited for the request
+	\param auth Microseconds spent authenticating the request
+	\param total Microseconds spent serving the request
+	\param outcome The outcome of the request
+	\param queue_depth Number of clients waiting
+	\param session The request was authenticated by a session
+*/
+static void
+stats_request(u_int32_t ipc_wait,u_int32_t auth,u_int32_t total,int outcome,int queue_depth,
+		char session)
+{
+	unsigned int i;
+
+	AUTHD_STATS_BEGIN(stats);
+	++stats->requests;
+	++stats->outcomes[outcome];
+	if ( session )
+		++stats->session_requests;
+	stats->sessions = sessions.num;
+	if ( queue_depth >= 0 )
+	{
+		stats->queue_depth = (u_int32_t)queue_depth;
+		if ( stats->queue_depth > stats->queue_depth_max )
+			stats->queue_depth_max = stats->queue_depth;
+	}
+	authd_hist_record(&stats->stage[AUTHD_STAGE_IPC_WAIT],ipc_wait);
+	authd_hist_record(&stats->stage[AUTHD_STAGE_AUTHENTICATE],auth);
+	// The stages of adm_ctrl_authorise() that were run
+	for(i = 0 ; i < ADM_CTRL_STAGES ; ++i)
+		if ( timing.done & (1 << i) )
+			authd_hist_record(&stats->stage[AUTHD_STAGE_ASSERTIONS + i],timing.usec[i]);
+	authd_hist_record(&stats->outcome[outcome],total);
+	AUTHD_STATS_END(stats);
+}
+
+
+/** \brief Authenticate and authorise a request, replacing it with its result
+
+	\param slot Slot of the shared memory segment holding the request
+	\param wait_start Time authd started waiting for the request, updated to
+	the time it was served
+*/
+static void
+serve_request(void *slot,struct timeval *wait_start)
+{
+	adm_ctrl_request_t *auth_request = (adm_ctrl_request_t *)slot;
+	adm_ctrl_result_t auth_result;
+	struct timeval start,auth_end,end;
+	int i,e,outcome;
+	char session;
+#ifdef WITH_RESOURCE_CONTROL
+	resource_ctrl_db_t *DB = ( resource_control )? &resctrl_db : NULL;
+#endif
+
+	gettimeofday(&start,NULL);
+
+	bzero(&auth_result,sizeof(adm_ctrl_result_t));
+	timing.done = 0;
+	e = 0;
+	session = (auth_request->session_flags & ADMCTRL_SESSION_USE) != 0;
+	i = authenticate(auth_request);
+	gettimeofday(&auth_end,NULL);
+	if ( i == 1 )
+	{
+#ifdef WITH_RESOURCE_CONTROL
+		e = adm_ctrl_authorise(auth_request,&policy,&auth_result,DB);
+#else
+		e = adm_ctrl_authorise(auth_request,&policy,&auth_result);
+#endif
+		switch( e )
+		{
+			case ADMCTRL_MEMORY_ERROR:
+				print_msg(LOG_CRIT,"runned out of memory");
+				break;
+			case ADMCTRL_INTERNAL_ERROR:
+				print_msg(LOG_CRIT,"unexpected internal error");
+				break;
+		}
+		// A session is only opened by the encrypted nonce
+		if ( !session && (auth_request->session_flags & ADMCTRL_SESSION_OPEN) &&
+				adm_ctrl_session_open(&sessions,auth_request,&auth_result) == 0 && stats )
+		{
+			AUTHD_STATS_BEGIN(stats);
+			++stats->sessions_opened;
+			AUTHD_STATS_END(stats);
+		}
+	}
+	else
+		auth_result.error = i;
+
+	memcpy(slot,&auth_result,sizeof(adm_ctrl_result_t));
+
+	if ( stats )
+	{
+		gettimeofday(&end,NULL);
+		if ( i != 1 || e < 0 )
+			outcome = AUTHD_OUTCOME_FAILED;
+		else
+			outcome = ( auth_result.PCV > 0 )? AUTHD_OUTCOME_AUTHORISED : AUTHD_OUTCOME_REJECTED;
+		stats_request(tv_usec(wait_start,&start),tv_usec(&start,&auth_end),
+				tv_usec(&start,&end),outcome,shm_lock_waiting(comm.sem_id),
+				i == 1 && session);
+		*wait_start = end;
+	}
+
+	// Verbose error reporting
+	if ( verbose )
+	{
+		if ( i == ADMCTRL_AUTHENTICATION_ERROR )
+			print_msg(LOG_WARNING,"request authentication failed");
+		else if ( i == -ADMCTRL_SESSION_ERROR )
+			print_msg(LOG_WARNING,"request session invalid or expired");
+		else if ( i < 0 )
+			print_msg(LOG_ERR,"error while authenticating request");
+		else if ( auth_result.PCV < 1 )
+			print_msg(LOG_ERR,"request authorisation failed");
+		else
+			print_msg(LOG_INFO,"request authenticated & authorised successfully");
+	}
+}
+
+
 //! The main function of the process
 int 
 main(int argc,char **argv)
 {
-	int pid,i;
-	adm_ctrl_request_t *auth_request;
-  adm_ctrl_result_t auth_result;
-#ifdef WITH_RESOURCE_CONTROL
-	resource_ctrl_db_t *DB = NULL;
-#endif
+	int pid;
+	u_int32_t j,num;
+	struct admctrl_comm_header *header;
+	struct timeval wait_start;
+	key_t stats_key;
 
 	parse_arguments(argc,argv);
 
@@ -245,6 +554,18 @@ main(int argc,char **argv)
 		return 1;
 	}
 
+	// Load schema registry from file
+	if ( schema_fn )
+	{
+		if ( admctrl_schema_load(schema_fn,&schema) != 0 )
+		{
+			fprintf(stderr,"%s: Couldn't load schema registry from %s\n",argv[0],schema_fn);
+			perror("admctrl_schema_load");
+			return 1;
+		}
+		policy.schema = &schema;
+	}
+
 #ifdef WITH_RESOURCE_CONTROL
 	resctrl_db.ENV = NULL;
 	// Initialise resource control
@@ -257,14 +578,16 @@ main(int argc,char **argv)
 			resctrl_db.ENV = NULL;
 			shutdown(0);
 		}
-		if ( resource_ctrl_dbopen(&resctrl_db,resource_ctrl_home,resource_ctrl_name,RESOURCE_DB_RDONLY,0) != 0 )
+		if ( resource_ctrl_dbopen(&resctrl_db,resource_ctrl_home,resource_ctrl_name,
+					(resource_leases)? 0 : RESOURCE_DB_RDONLY,0) != 0 )
 		{
 			fprintf(stderr,"%s: Error opening resource control DB in %s\n",argv[0],resource_ctrl_home);
 			perror("resource_ctrl_dbopen");
 			resctrl_db.ENV = NULL;
 			shutdown(0);
 		}
-		DB = &resctrl_db;
+		if ( resource_leases )
+			resource_lease_wheel_init(&lease_wheel,&resctrl_db);
 	}
 #endif
 
@@ -280,7 +603,29 @@ main(int argc,char **argv)
 			perror("admctrl_comm_init");
 			shutdown(0);
 	}
-	auth_request = comm.shm_addr;
+	header = comm.shm_addr;
+
+	// Statistics are optional
+	if ( stats_pid == shm_pid )
+	{
+		fprintf(stderr,"%s: Statistics and IPC use the same id %c\n",argv[0],shm_pid);
+		shutdown(0);
+	}
+	if ( (stats_key = ftok(shm_fn,stats_pid)) < 0 ||
+			(stats = authd_stats_create(stats_key,&stats_id)) == NULL )
+	{
+		fprintf(stderr,"%s: Couldn't create statistics segment, statistics disabled\n",argv[0]);
+		stats = NULL;
+	}
+	else
+		adm_ctrl_set_timing(&timing);
+
+	if ( adm_ctrl_sessions_init(&sessions,( session_lifetime > 0 )? max_sessions : 0,
+				session_lifetime) != 0 )
+	{
+		fprintf(stderr,"%s: Couldn't allocate %u sessions\n",argv[0],max_sessions);
+		shutdown(0);
+	}
 
 	// Go daemon
 	if ( getppid() != 1 && isdaemon == 1 )
@@ -299,10 +644,12 @@ main(int argc,char **argv)
 		}
 		chdir("/");
 		umask(0);
+		if ( stats )
+			stats->pid = getpid();
 
 #if DEBUG == 0
-		for(i = 0 ; i < NOFILE ; i++)
-			close(i);
+		for(j = 0 ; j < NOFILE ; j++)
+			close(j);
 #else
     printf("DEBUG messages enabled\n");
 #endif
@@ -314,52 +661,68 @@ main(int argc,char **argv)
 		signal(SIGINT,shutdown);
 		signal(SIGQUIT,shutdown);
 	}
+	if ( session_lifetime > 0 )
+	{
+		// Like the lease timer, a blocked shm_data_wait() still returns
+		struct sigaction sa;
+
+		bzero(&sa,sizeof(sa));
+		sa.sa_handler = sessions_revoke_signal;
+		sa.sa_flags = SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGUSR2,&sa,NULL);
+	}
 
 #ifdef SYSLOG
 	openlog(SYSLOG_PREPEND,LOG_CONS|LOG_PID,LOG_AUTHPRIV);
 #endif
 
+#ifdef WITH_RESOURCE_CONTROL
+	// Timers are not inherited by fork(), so start it here
+	if ( resource_leases && lease_timer_start() < 0 )
+	{
+		perror("lease_timer_start");
+		shutdown(0);
+	}
+#endif
+
 	print_msg(LOG_INFO,"Running");
 
 	// Start processing data
-	while( shm_data_wait(comm.sem_id) == 0 )
+	gettimeofday(&wait_start,NULL);
+	for(;;)
 	{
-		bzero(&auth_result,sizeof(adm_ctrl_result_t));
-		if ( (i = adm_ctrl_authenticate(auth_request)) == 1 )
+		if ( shm_data_wait(comm.sem_id) != 0 )
 		{
+			// Interrupted by the lease timer or SIGUSR2
+			if ( errno == EINTR )
+			{
 #ifdef WITH_RESOURCE_CONTROL
-			switch( adm_ctrl_authorise(auth_request,&policy,&auth_result,DB) )
-#else
-			switch( adm_ctrl_authorise(auth_request,&policy,&auth_result) )
+				lease_expire();
 #endif
-			{
-				case ADMCTRL_MEMORY_ERROR:
-					print_msg(LOG_CRIT,"runned out of memory");
-					break;
-				case ADMCTRL_INTERNAL_ERROR:
-					print_msg(LOG_CRIT,"unexpected internal error");
-					break;
+				sessions_revoke_pending();
+				continue;
 			}
+			break;
 		}
-		else
-			auth_result.error = i;
+		sessions_revoke_pending();
 
-		memcpy(comm.shm_addr,&auth_result,sizeof(adm_ctrl_result_t));
+		// Serve the requests of the batch in order, each result replaces
+		// its request
+		if ( (num = header->num) == 0 || num > MAX_IPC_BATCH )
+		{
+			print_msg(LOG_ERR,"invalid number of requests in shared memory");
+			num = 0;
+		}
+		for(j = 0 ; j < num ; j++)
+			serve_request(ADMCTRL_COMM_SLOT(comm.shm_addr,j),&wait_start);
+		header->num = num;
 		if ( shm_result_ready(comm.sem_id) < 0 )
 			break;
 
-		// Verbose error reporting
-		if ( verbose )
-		{
-			if ( i == ADMCTRL_AUTHENTICATION_ERROR )
-				print_msg(LOG_WARNING,"request authentication failed");
-			else if ( i < 0 )
-				print_msg(LOG_ERR,"error while authenticating request");
-			else if ( auth_result.PCV < 1 )
-				print_msg(LOG_ERR,"request authorisation failed");
-			else
-				print_msg(LOG_INFO,"request authenticated & authorised successfully");
-		}
+#ifdef WITH_RESOURCE_CONTROL
+		lease_expire();
+#endif
 	}
 
 	print_msg(LOG_CRIT,"IPC failed");
@@ -0,0 +1,147 @@
+/* authd_stat.c
+
+  Copyright 2004  Georgios Portokalidis <digital_bull@users.sourceforge.net>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/ipc.h>
+
+#include "admctrl_config.h"
+#include "authd_stats.h"
+
+/*! \file authd_stat.c
+ *  \brief Display the statistics of a running authd
+ *  \author Georgios Portokalidis
+ */
+
+//! Filename used by authd to access shared memory
+static char *shm_fn = DEFAULT_SHM_FILE;
+//! Project id of the statistics segment
+static char stats_pid = DEFAULT_STATS_PROJECT_ID;
+//! Seconds between reports, 0 for a single report
+static unsigned int interval = 0;
+//! Number of reports, 0 for unlimited
+static unsigned int count = 0;
+
+
+/** \brief Display usage information
+
+	\param name Name of executable
+*/
+static void
+print_usage(const char *name)
+{
+	printf("Usage: %s [OPTIONS]\n\n",name);
+	printf("  -s, --shmpath  (pathname)      Pathname used by authd for shared memory\n");
+	printf("  -S, --statsid  (id character)  Id of authd's statistics segment\n");
+	printf("  -i, --interval (seconds)       Report every number of seconds\n");
+	printf("  -c, --count    (number)        Stop after a number of reports\n");
+	printf("  -h, --help                     Display this message\n");
+}
+
+
+/** \brief Parse command line arguments
+
+	\param argc Number of arguments
+	\param argv String array containing the arguments
+*/
+static void
+parse_arguments(int argc,char **argv)
+{
+	int c;
+	const char optstring[] = "s:S:i:c:h";
+	const struct option longopts[] = {
+		{"shmpath",required_argument,NULL,'s'},
+		{"statsid",required_argument,NULL,'S'},
+		{"interval",required_argument,NULL,'i'},
+		{"count",required_argument,NULL,'c'},
+		{"help",no_argument,NULL,'h'},
+		{"",0,NULL,0}
+	};
+
+	while( (c = getopt_long(argc,argv,optstring,longopts,NULL)) >= 0 )
+		switch( c )
+		{
+			case 's':
+				shm_fn = optarg;
+				break;
+			case 'S':
+				stats_pid = *optarg;
+				break;
+			case 'i':
+				interval = (unsigned int)atoi(optarg);
+				break;
+			case 'c':
+				count = (unsigned int)atoi(optarg);
+				break;
+			case 'h':
+				print_usage(argv[0]);
+				exit(0);
+			default:
+				exit(1);
+		}
+}
+
+
+int
+main(int argc,char **argv)
+{
+	authd_stats_t stats;
+	key_t key;
+	unsigned int i;
+
+	parse_arguments(argc,argv);
+
+	if ( (key = ftok(shm_fn,stats_pid)) < 0 )
+	{
+		fprintf(stderr,"%s: Couldn't generate shared memory key(%s,%c)\n",argv[0],shm_fn,stats_pid);
+		perror("ftok");
+		return 1;
+	}
+
+	for(i = 1 ; ; ++i)
+	{
+		switch( authd_stats_snapshot(key,&stats) )
+		{
+			case 0:
+				break;
+			case -1:
+				fprintf(stderr,"%s: Couldn't open statistics segment, is authd running?\n",argv[0]);
+				return 1;
+			default:
+				fprintf(stderr,"%s: Couldn't read statistics segment\n",argv[0]);
+				return 1;
+		}
+		authd_stats_print(stdout,&stats);
+		fflush(stdout);
+
+		if ( interval == 0 || i == count )
+			break;
+		sleep(interval);
+		printf("\n");
+	}
+
+	return 0;
+}
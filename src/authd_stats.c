@@ -0,0 +1,264 @@
+/* authd_stats.c
+
+  Copyright 2004  Georgios Portokalidis <digital_bull@users.sourceforge.net>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "shm.h"
+#include "authd_stats.h"
+
+/*! \file authd_stats.c
+ *  \brief Statistics kept by authd in a shared memory segment
+ *  \author Georgios Portokalidis
+ *
+ *  authd is the only writer. Readers copy the segment and retry if the
+ *  sequence number shows that it was updated while copying.
+ */
+
+//! Number of times a reader retries to get a consistent copy
+#define AUTHD_STATS_RETRIES 100
+
+static const char *stage_names[AUTHD_STAGES] = {
+	"authenticate",
+	"assertions",
+	"deserialize",
+	"actions",
+	"query",
+	"resources",
+	"ipc wait"
+};
+
+static const char *outcome_names[AUTHD_OUTCOMES] = {
+	"authorised",
+	"rejected",
+	"failed"
+};
+
+
+/** \brief Create the statistics segment
+
+	\param key The key of the segment as returned from ftok()
+	\param id Reference to store the id of the segment
+
+	\return the statistics segment, or NULL on failure
+*/
+authd_stats_t *
+authd_stats_create(key_t key,int *id)
+{
+	authd_stats_t *stats;
+
+	if ( (stats = shm_create(key,sizeof(authd_stats_t),id)) == NULL )
+		return NULL;
+
+	bzero(stats,sizeof(authd_stats_t));
+	stats->version = AUTHD_STATS_VERSION;
+	stats->started = time(NULL);
+	stats->pid = getpid();
+	return stats;
+}
+
+
+/** \brief Destroy the statistics segment
+
+	\param stats The statistics segment
+	\param id The id of the segment
+*/
+void
+authd_stats_destroy(authd_stats_t *stats,int id)
+{
+	shm_destroy(stats,id);
+}
+
+
+/** \brief Get a consistent copy of the statistics segment of authd
+
+	\param key The key of the segment as returned from ftok()
+	\param copy Reference to store the copy
+
+	\return 0 on success, -1 if the segment couldn't be opened, or -2 if it
+	had the wrong version or was being updated continuously
+*/
+int
+authd_stats_snapshot(key_t key,authd_stats_t *copy)
+{
+	authd_stats_t *stats;
+	u_int32_t seq;
+	int i,ret = -2;
+
+	if ( (stats = shm_open(key)) == NULL )
+		return -1;
+
+	for(i = 0 ; i < AUTHD_STATS_RETRIES ; ++i)
+	{
+		if ( (seq = stats->seq) & 1 )
+			continue;
+		memcpy(copy,stats,sizeof(authd_stats_t));
+		if ( stats->seq == seq )
+		{
+			ret = ( copy->version == AUTHD_STATS_VERSION )? 0 : -2;
+			break;
+		}
+	}
+
+	shm_close(stats);
+	return ret;
+}
+
+
+/** \brief Find the bucket of a value
+
+	Values smaller than AUTHD_HIST_SUB have their own bucket. Larger values
+	are divided into AUTHD_HIST_SUB buckets per power of 2.
+*/
+static inline unsigned int
+hist_bucket(u_int32_t value)
+{
+	unsigned int msb;
+
+	if ( value < AUTHD_HIST_SUB )
+		return value;
+	for(msb = AUTHD_HIST_SUB_BITS ; msb < 31 && (value >> (msb + 1)) != 0 ; ++msb)
+		;
+	return (msb - AUTHD_HIST_SUB_BITS + 1) * AUTHD_HIST_SUB +
+		((value >> (msb - AUTHD_HIST_SUB_BITS)) & (AUTHD_HIST_SUB - 1));
+}
+
+
+/** \brief Return the largest value kept in a bucket
+*/
+static u_int32_t
+hist_bucket_value(unsigned int bucket)
+{
+	unsigned int shift;
+
+	if ( bucket < AUTHD_HIST_SUB )
+		return bucket;
+	shift = bucket / AUTHD_HIST_SUB - 1;
+	return (((u_int32_t)AUTHD_HIST_SUB + bucket % AUTHD_HIST_SUB + 1) << shift) - 1;
+}
+
+
+/** \brief Record a value in a histogram
+
+	\param h The histogram
+	\param value The value
+*/
+void
+authd_hist_record(authd_histogram_t *h,u_int32_t value)
+{
+	if ( h->count == 0 || value < h->min )
+		h->min = value;
+	if ( value > h->max )
+		h->max = value;
+	++h->count;
+	h->sum += value;
+	++h->bucket[hist_bucket(value)];
+}
+
+
+/** \brief Return the value at a percentile of a histogram
+
+	\param h The histogram
+	\param p The percentile (0.0 - 100.0)
+
+	\return the largest value that falls in the same bucket as the
+	percentile, but never more than the maximum recorded
+*/
+u_int32_t
+authd_hist_percentile(const authd_histogram_t *h,double p)
+{
+	unsigned long long rank,seen = 0;
+	unsigned int i;
+	u_int32_t v;
+
+	if ( h->count == 0 )
+		return 0;
+
+	rank = (unsigned long long)(p / 100.0 * h->count + 0.5);
+	if ( rank < 1 )
+		rank = 1;
+	for(i = 0 ; i < AUTHD_HIST_BUCKETS ; ++i)
+		if ( (seen += h->bucket[i]) >= rank )
+			break;
+	v = hist_bucket_value(i);
+	return ( v > h->max )? h->max : v;
+}
+
+
+/** \brief Print the header of the table printed by authd_hist_print()
+
+	\param fp The stream to print to
+*/
+void
+authd_hist_print_header(FILE *fp)
+{
+	fprintf(fp,"%-13s %10s %9s %8s %8s %8s %8s %8s\n","latency (us)","count","mean",
+			"p50","p90","p99","p99.9","max");
+}
+
+
+/** \brief Print the count, mean, percentiles and maximum of a histogram
+
+	\param fp The stream to print to
+	\param name The name of the histogram
+	\param h The histogram
+*/
+void
+authd_hist_print(FILE *fp,const char *name,const authd_histogram_t *h)
+{
+	fprintf(fp,"%-13s %10u %9.1f %8u %8u %8u %8u %8u\n",name,h->count,
+			( h->count > 0 )? (double)h->sum / h->count : 0.0,
+			authd_hist_percentile(h,50.0),authd_hist_percentile(h,90.0),
+			authd_hist_percentile(h,99.0),authd_hist_percentile(h,99.9),h->max);
+}
+
+
+/** \brief Print statistics in human readable form
+
+	\param fp The stream to print to
+	\param stats The statistics
+*/
+void
+authd_stats_print(FILE *fp,const authd_stats_t *stats)
+{
+	unsigned int i;
+
+	fprintf(fp,"authd (pid %d) up %lu seconds\n",(int)stats->pid,
+			(unsigned long)(time(NULL) - stats->started));
+	fprintf(fp,"requests %u, authorised %u, rejected %u, failed %u\n",stats->requests,
+			stats->outcomes[AUTHD_OUTCOME_AUTHORISED],stats->outcomes[AUTHD_OUTCOME_REJECTED],
+			stats->outcomes[AUTHD_OUTCOME_FAILED]);
+	fprintf(fp,"queue depth %u, max %u\n",stats->queue_depth,stats->queue_depth_max);
+	fprintf(fp,"resource leases expired %u\n",stats->leases_expired);
+	fprintf(fp,"sessions %u, opened %u, requests by session %u\n\n",stats->sessions,
+			stats->sessions_opened,stats->session_requests);
+
+	authd_hist_print_header(fp);
+	for(i = 0 ; i < AUTHD_STAGES ; ++i)
+		authd_hist_print(fp,stage_names[i],&stats->stage[i]);
+	for(i = 0 ; i < AUTHD_OUTCOMES ; ++i)
+		authd_hist_print(fp,outcome_names[i],&stats->outcome[i]);
+}
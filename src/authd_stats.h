@@ -0,0 +1,115 @@
+/* authd_stats.h
+
+  Copyright 2004  Georgios Portokalidis <digital_bull@users.sourceforge.net>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef AUTHD_STATS_H
+#define AUTHD_STATS_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+/*! \file authd_stats.h
+ *  \brief Statistics kept by authd in a shared memory segment
+ *  \author Georgios Portokalidis
+ */
+
+//! Version of the statistics segment layout
+#define AUTHD_STATS_VERSION 2
+
+//! Bits of a value kept in a histogram bucket, after the most significant one
+#define AUTHD_HIST_SUB_BITS 4
+//! Number of buckets for each power of 2
+#define AUTHD_HIST_SUB (1 << AUTHD_HIST_SUB_BITS)
+//! Number of histogram buckets, enough for any 32bit value
+#define AUTHD_HIST_BUCKETS ((33 - AUTHD_HIST_SUB_BITS) * AUTHD_HIST_SUB)
+
+//! Latency histogram
+/** Values are kept with a relative error of at most 1/AUTHD_HIST_SUB, like
+ * an HDR histogram with 2 significant digits. */
+struct authd_histogram
+{
+	u_int32_t count; //!< Number of values recorded
+	u_int32_t min; //!< Smallest value recorded
+	u_int32_t max; //!< Largest value recorded
+	unsigned long long sum; //!< Sum of the values recorded
+	u_int32_t bucket[AUTHD_HIST_BUCKETS]; //!< Values recorded in each bucket
+};
+//! Latency histogram datatype
+typedef struct authd_histogram authd_histogram_t;
+
+//! Stages of a request that are timed
+/** The stages of adm_ctrl_authorise() follow the order of enum adm_ctrl_stage */
+enum authd_stage
+{
+	AUTHD_STAGE_AUTHENTICATE, //!< Nonce decryption
+	AUTHD_STAGE_ASSERTIONS, //!< Policy, credentials and authorizer
+	AUTHD_STAGE_DESERIALIZE, //!< Deserializing the function list
+	AUTHD_STAGE_ACTIONS, //!< Generating actions
+	AUTHD_STAGE_QUERY, //!< The keynote query
+	AUTHD_STAGE_RESOURCES, //!< Checking the availability of resources
+	AUTHD_STAGE_IPC_WAIT, //!< Waiting for a request
+	AUTHD_STAGES
+};
+
+//! Outcomes of a request
+enum authd_outcome
+{
+	AUTHD_OUTCOME_AUTHORISED, //!< Authorised
+	AUTHD_OUTCOME_REJECTED, //!< Not authorised
+	AUTHD_OUTCOME_FAILED, //!< Authentication failure or error
+	AUTHD_OUTCOMES
+};
+
+//! Statistics segment
+struct authd_stats
+{
+	u_int32_t version; //!< AUTHD_STATS_VERSION
+	//! Incremented before and after every update
+	/** An odd value means that an update is in progress. */
+	volatile u_int32_t seq;
+	time_t started; //!< Time authd started
+	pid_t pid; //!< Process id of authd
+	u_int32_t requests; //!< Requests served
+	u_int32_t outcomes[AUTHD_OUTCOMES]; //!< Requests per outcome
+	u_int32_t queue_depth; //!< Clients waiting when the last request arrived
+	u_int32_t queue_depth_max; //!< Largest number of clients waiting
+	u_int32_t leases_expired; //!< Resource leases expired
+	u_int32_t sessions; //!< Sessions open when the last request arrived
+	u_int32_t sessions_opened; //!< Sessions opened
+	u_int32_t session_requests; //!< Requests authenticated by a session
+	authd_histogram_t stage[AUTHD_STAGES]; //!< Latency of each stage
+	authd_histogram_t outcome[AUTHD_OUTCOMES]; //!< Service time per outcome
+};
+//! Statistics segment datatype
+typedef struct authd_stats authd_stats_t;
+
+//! Begin updating the statistics
+#define AUTHD_STATS_BEGIN(s) ((s)->seq++)
+//! Finish updating the statistics
+#define AUTHD_STATS_END(s) ((s)->seq++)
+
+authd_stats_t *authd_stats_create(key_t key,int *id);
+void authd_stats_destroy(authd_stats_t *stats,int id);
+int authd_stats_snapshot(key_t key,authd_stats_t *copy);
+void authd_stats_print(FILE *fp,const authd_stats_t *stats);
+void authd_hist_record(authd_histogram_t *h,u_int32_t value);
+u_int32_t authd_hist_percentile(const authd_histogram_t *h,double p);
+void authd_hist_print_header(FILE *fp);
+void authd_hist_print(FILE *fp,const char *name,const authd_histogram_t *h);
+
+#endif
@@ -23,6 +23,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
 
 /** \file authdb_manage.c
 	\brief Simple resource control db management application
@@ -32,30 +35,134 @@
 #include "resource_ctrl.h"
 
 static char *db_dir,*db_fn;
+static char *import_fn,*export_fn;
+static char check;
 static resource_ctrl_db_t db;
 static u_int32_t recover;
 
 static void
 process_args(int argc,char **argv)
 {
-	if ( argc < 3 || (argc > 3 && *argv[1] != 'R') )
+	int c;
+
+	while( (c = getopt(argc,argv,"i:e:c")) != -1 )
+		switch( c )
+		{
+			case 'i':
+				import_fn = optarg;
+				break;
+			case 'e':
+				export_fn = optarg;
+				break;
+			case 'c':
+				check = 1;
+				break;
+			default:
+				goto syntax;
+		}
+	argc -= optind;
+	argv += optind;
+
+	if ( argc < 2 || argc > 3 || (argc == 3 && strcmp(argv[0],"R") != 0) ||
+			(import_fn != NULL) + (export_fn != NULL) + check > 1 )
+		goto syntax;
+
+	if ( argc == 2 )
 	{
-		fprintf(stderr,"%s: Illegal arguments\n",argv[0]);
-		fprintf(stderr,"Syntax: %s [R] (db directory) (db filename)\n",argv[0]);
-		exit(1);
+		db_dir = argv[0];
+		db_fn = argv[1];
 	}
-
-	if ( argc == 3 )
+	else
 	{
+		recover = DB_RECOVER;
 		db_dir = argv[1];
 		db_fn = argv[2];
 	}
-	else
+	return;
+
+syntax:
+	fprintf(stderr,"authdb_manage: Illegal arguments\n");
+	fprintf(stderr,"Syntax: authdb_manage [-i file|-e file|-c] [R] (db directory) (db filename)\n");
+	exit(1);
+}
+
+/** \brief Import records from a file, or stdin if it is "-"
+
+	\return zero on success, or non-zero on failure
+	*/
+static int
+import(const char *fn)
+{
+	FILE *in;
+	unsigned int line;
+	int e;
+
+	if ( strcmp(fn,"-") == 0 )
+		in = stdin;
+	else if ( (in = fopen(fn,"r")) == NULL )
 	{
-		recover = DB_RECOVER;
-		db_dir = argv[2];
-		db_fn = argv[3];
+		perror(fn);
+		return 1;
+	}
+
+	if ( (e = resource_ctrl_import(&db,in,&line)) != 0 )
+	{
+		if ( line > 0 && (e == EINVAL || e == RESOURCE_DB_NOTFOUND) )
+			fprintf(stderr,"%s:%u: %s\n",fn,line,( e == RESOURCE_DB_NOTFOUND )? "unknown function or library" : "invalid record");
+		else
+			fprintf(stderr,"%s: import failed: %s\n",fn,db_strerror(e));
 	}
+	if ( in != stdin )
+		fclose(in);
+	return e;
+}
+
+/** \brief Export all records to a file, or stdout if it is "-"
+
+	\return zero on success, or non-zero on failure
+	*/
+static int
+export(const char *fn)
+{
+	FILE *out;
+	int e;
+
+	if ( strcmp(fn,"-") == 0 )
+		out = stdout;
+	else if ( (out = fopen(fn,"w")) == NULL )
+	{
+		perror(fn);
+		return 1;
+	}
+
+	if ( (e = resource_ctrl_export(&db,out)) != 0 )
+		fprintf(stderr,"%s: export failed: %s\n",fn,db_strerror(e));
+	if ( out != stdout && fclose(out) != 0 && e == 0 )
+	{
+		perror(fn);
+		e = 1;
+	}
+	return e;
+}
+
+/** \brief List the consumption records whose formula changed value to stdout
+
+	\return zero if there are none, or non-zero if there are or on failure
+	*/
+static int
+check_formulas(void)
+{
+	unsigned int num;
+	int e;
+
+	if ( (e = resource_ctrl_check_formulas(&db,stdout,&num)) != 0 )
+	{
+		fprintf(stderr,"check failed: %s\n",db_strerror(e));
+		return e;
+	}
+	if ( num > 0 )
+		fprintf(stderr,"%u formula(s) changed value with C operator precedence\n",num);
+	return ( num > 0 );
 }
 
 static int
@@ -132,6 +239,7 @@ print_menu()
 	printf("2. Libraries\n");
 	printf("3. Resources\n");
 	printf("4. Resource consumption\n");
+	printf("5. Resource leases\n");
 	printf("0. Exit\n");
 }
 
@@ -359,6 +467,47 @@ resources()
 	} while (sel != 0);
 }
 
+static void
+leases()
+{
+	int sel;
+	u_int32_t uint;
+
+	do {
+		printf("RESOURCE LEASES ACTIONS\n");
+		printf("1. List\n");
+		printf("2. Release\n");
+		printf("0. Return\n");
+		sel = get_selection("Selection:",0,2);
+		putchar('\n');
+		switch( sel )
+		{
+			case 0:
+				break;
+			case 1:
+				printf("Lease list:\n");
+				if ( resource_ctrl_display_leases(&db) != 0 )
+					printf("Listing failed!\n");
+				break;
+			case 2:
+				printf("Releasing lease...\nExisting leases:\n");
+				resource_ctrl_display_leases(&db);
+				uint = get_uint32("Enter lease id to release:");
+				if ( confirm("Are you sure(Y/N)?",'Y') != 0 )
+					break;
+				if ( resource_ctrl_lease_release(&db,uint) == 0 )
+					printf("Lease released and resources returned!\n");
+				else
+					printf("Release failed!\n");
+				break;
+			default:
+				printf("Invalid selection!\n");
+				break;
+		}
+		putchar('\n');
+	} while (sel != 0);
+}
+
 static void
 process_selection(int sel)
 {
@@ -378,6 +527,9 @@ process_selection(int sel)
 		case 4:
 			consumption();
 			break;
+		case 5:
+			leases();
+			break;
 		default:
 			break;
 	}
@@ -397,15 +549,23 @@ main(int argc,char **argv)
 		return 1;
 	}
 
-	if ( (e = resource_ctrl_dbopen(&db,db_dir,db_fn,DB_CREATE,DB_CREATE | recover)) != 0 )
+	if ( (e = resource_ctrl_dbopen(&db,db_dir,db_fn,( export_fn || check )? DB_RDONLY : DB_CREATE,DB_CREATE | recover)) != 0 )
 	{
 		fprintf(stderr,"%s: Error opening DB\n",argv[0]);
 		return 1;
 	}
 
+	// Non-interactive
+	if ( import_fn || export_fn || check )
+	{
+		e = ( import_fn )? import(import_fn) : ( export_fn )? export(export_fn) : check_formulas();
+		resource_ctrl_dbclose(&db);
+		return ( e != 0 );
+	}
+
 	do {
 		print_menu();
-		selection = get_selection("Selection:",0,4);
+		selection = get_selection("Selection:",0,5);
 		process_selection(selection);
 	} while( selection != 0 );
 
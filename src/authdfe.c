@@ -26,10 +26,16 @@
 #include <stdlib.h>
 #include <signal.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
 #include "admctrl_config.h"
 #include "admctrlcl.h"
 #include "mt_server.h"
 #include "filei.h"
+#include "authdev_msg.h"
+#include "admctrl_errno.h"
+#include "authd_stats.h"
 #include "debug.h"
 
 /************************************************/
@@ -44,15 +50,31 @@ static long in_timeout = 0;
 static long ipc_timeout = 1;
 static char allow_persistent = 0;
 static char *dev_filename = NULL;
+static unsigned int dev_batch = 8;
+static unsigned int dev_threads = 1;
+static char dev_ring = 1;
 static char *ssl_cert_file = "server.pem";
 static char *ssl_pk_file = "server.key";
 static char use_ssl = 0;
+static long ssl_cache_size = -1;
+static long ssl_session_timeout = 0;
+static unsigned int hs_threads_number = 0;
+static unsigned int authd_clients = 1;
 
 /************************************************/
 /*                GLOBAL VARIABLES              */
 /************************************************/
-static pthread_spinlock_t submit_lock;
-static admctrlcl_t *server_client = NULL;
+static pthread_spinlock_t stats_lock;
+static admctrlcl_t **server_clients = NULL;
+static admctrlcl_pool_t *server_pool = NULL;
+
+//! Statistics of the requests submitted to authd, protected by stats_lock
+static struct {
+	unsigned int submitted; //!< Requests submitted to authd
+	unsigned int failed; //!< Requests that authd didn't answer
+	authd_histogram_t authd; //!< Time waiting for a client and authd's reply
+	authd_histogram_t dev_queue; //!< Time requests were queued in the device
+} submit_stats;
 
 static void
 print_usage(void)
@@ -65,13 +87,25 @@ print_usage(void)
 	printf("  -t  --servtimeout=TIMEOUT  Set admission control server timeout\n");
 	printf("  -P  --ipcpath=PATH         Pathname to use for IPC with authd \n");
 	printf("  -i  --ipcid=NUMBER         Project id to use for IPC with authd\n");
+	printf("  -a  --authdclients=NUMBER  Submit to authd with a pool of NUMBER clients\n");
 	printf("  -r  --persistent           Allow persistent connections with clients\n");
 	printf("  -d  --dev=DEVNAME          Start a thread reading requests from\n");
   printf("                             charecter device DEVNAME\n");
+	printf("  -B  --devbatch=NUMBER      Read up to NUMBER requests from the device at\n");
+	printf("                             once\n");
+	printf("  -D  --devthreads=NUMBER    Read requests from the device with NUMBER\n");
+	printf("                             threads\n");
+	printf("  -R  --nodevring            Use read and write instead of the ring\n");
+	printf("                             shared with the device\n");
 #ifdef HAVE_LIBSSL
 	printf("  -s  --ssl                  Use SSL\n");
 	printf("  -c  --cert=FILENAME        File containining server certificate\n");
 	printf("  -k  --priv=FILENAME        File containining server private key\n");
+	printf("  -C  --sslcache=SIZE        Number of SSL sessions cached for resumption,\n");
+	printf("                             0 disables resumption\n");
+	printf("  -T  --sslsession=SECONDS   Time an SSL session can be resumed for\n");
+	printf("  -E  --hsthreads=NUMBER     Perform SSL handshakes on a separate pool of\n");
+	printf("                             NUMBER threads\n");
 #endif
 	printf("  -h  --help                 Display this message\n\n");
 }
@@ -80,7 +114,7 @@ static void
 parse_arguments(int argc,char **argv)
 {
 	int c;
-	const char optstring[] = "H:p:e:n:t:P:i:rsc:k:d:";
+	const char optstring[] = "H:p:e:n:t:P:i:a:rsc:k:d:B:D:RC:T:E:";
 	const struct option longopts[] = {
 		{ "host", required_argument, NULL, 'H' },
 		{ "port", required_argument, NULL, 'p' },
@@ -89,11 +123,18 @@ parse_arguments(int argc,char **argv)
 		{ "servtimeout", required_argument, NULL, 't' },
 		{ "ipcpath", required_argument, NULL, 'P' },
 		{ "ipcid", required_argument, NULL, 'i' },
+		{ "authdclients", required_argument, NULL, 'a' },
 		{ "persistent", no_argument, NULL, 'r' },
     { "dev", required_argument, NULL, 'd' },
+		{ "devbatch", required_argument, NULL, 'B' },
+		{ "devthreads", required_argument, NULL, 'D' },
+		{ "nodevring", no_argument, NULL, 'R' },
 		{ "ssl", no_argument, NULL, 's' },
 		{ "cert", required_argument, NULL, 'c' },
 		{ "priv", required_argument, NULL, 'k' },
+		{ "sslcache", required_argument, NULL, 'C' },
+		{ "sslsession", required_argument, NULL, 'T' },
+		{ "hsthreads", required_argument, NULL, 'E' },
 		{ "help", no_argument, NULL, 'h' },
 		{ "", 0, NULL , '\0' }
 	};
@@ -109,6 +150,7 @@ parse_arguments(int argc,char **argv)
 				break;
 			case 'e':
 				threads_number = atoi(optarg);
+				break;
 			case 'n':
 				in_timeout = strtol(optarg,NULL,10);
 				break;
@@ -121,12 +163,24 @@ parse_arguments(int argc,char **argv)
 			case 'i':
 				ipc_project_id= atoi(optarg);
 				break;
+			case 'a':
+				authd_clients = (unsigned int)atoi(optarg);
+				break;
 			case 'r':
 				allow_persistent = 1;
 				break;
       case 'd':
         dev_filename = optarg;
         break;
+			case 'B':
+				dev_batch = (unsigned int)atoi(optarg);
+				break;
+			case 'D':
+				dev_threads = (unsigned int)atoi(optarg);
+				break;
+			case 'R':
+				dev_ring = 0;
+				break;
 #ifdef HAVE_LIBSSL
 			case 's':
 				use_ssl = 1;
@@ -137,10 +191,22 @@ parse_arguments(int argc,char **argv)
 			case 'k':
 				ssl_pk_file = optarg;
 				break;
+			case 'C':
+				ssl_cache_size = strtol(optarg,NULL,10);
+				break;
+			case 'T':
+				ssl_session_timeout = strtol(optarg,NULL,10);
+				break;
+			case 'E':
+				hs_threads_number = (unsigned int)atoi(optarg);
+				break;
 #else
 			case 's':
 			case 'c':
 			case 'k':
+			case 'C':
+			case 'T':
+			case 'E':
 				fprintf(stderr,"SSL support has not been enabled at compile time\n");
 				exit(1);
 #endif
@@ -178,9 +244,18 @@ print_request(const adm_ctrl_request_t *req)
 }
 #endif
 
+static inline u_int32_t
+elapsed_usec(const struct timeval *start,struct timeval *now)
+{
+	gettimeofday(now,NULL);
+	return (now->tv_sec - start->tv_sec) * 1000000 + now->tv_usec - start->tv_usec;
+}
+
 static ssize_t
 submit_request(const unsigned char *src,size_t bufsize,unsigned char *dest)
 {
+	struct timeval start,now;
+	adm_ctrl_result_t *res;
 	int e;
 
 	DEBUG_CMD2(printf("submit_request: in\n"));
@@ -190,17 +265,160 @@ submit_request(const unsigned char *src,size_t bufsize,unsigned char *dest)
 
 	DEBUG_CMD2(print_request((const adm_ctrl_request_t *)src));
 
-	pthread_spin_lock(&submit_lock);
-	admctrlcl_set_request(server_client,(const adm_ctrl_request_t *)src);
-	if ( (e = admctrlcl_submit_request(server_client)) != 0 )
-		goto fail;
+	gettimeofday(&start,NULL);
+	// dest may overlap src, so the result is received in a buffer of the pool
+	if ( (res = admctrlcl_pool_result(server_pool)) == NULL )
+		e = -1;
+	else
+		e = admctrlcl_pool_submit(server_pool,(const adm_ctrl_request_t *)src,res);
+
+	pthread_spin_lock(&stats_lock);
+	++submit_stats.submitted;
+	if ( e != 0 )
+		++submit_stats.failed;
+	else
+		authd_hist_record(&submit_stats.authd,elapsed_usec(&start,&now));
+	pthread_spin_unlock(&stats_lock);
+
+	if ( e != 0 )
+		return e;
 	e = sizeof(adm_ctrl_result_t);
-	memcpy(dest,admctrlcl_get_result(server_client),e);
-fail:
-	pthread_spin_unlock(&submit_lock);
+	memcpy(dest,res,e);
 	return e;
 }
 
+/** \brief Submit a number of requests to authd through one client of the pool
+	Requests that cannot be submitted are answered with an error, so that the
+	kernel doesn't wait for them until they time out.
+*/
+static void
+submit_vector(const adm_ctrl_request_t *const *reqs,adm_ctrl_result_t *const *results,unsigned int num)
+{
+	struct timeval start,now;
+	u_int32_t usec;
+	size_t done;
+	unsigned int i;
+
+	gettimeofday(&start,NULL);
+	done = admctrlcl_pool_submit_vector(server_pool,reqs,results,num);
+	usec = elapsed_usec(&start,&now);
+
+	pthread_spin_lock(&stats_lock);
+	submit_stats.submitted += num;
+	submit_stats.failed += num - done;
+	for(i = 0; i < done ;i++)
+		authd_hist_record(&submit_stats.authd,usec);
+	pthread_spin_unlock(&stats_lock);
+
+	for(i = done; i < num ;i++)
+	{
+		memset(results[i],0,sizeof(adm_ctrl_result_t));
+		results[i]->error = ADMCTRL_INTERNAL_ERROR;
+	}
+}
+
+/** \brief Submit the tagged requests of one read from the device
+	Result i may overlap requests up to i, see filei_thread_vector(), so the
+	tags of a group are kept before the group is submitted.
+*/
+static void
+submit_dev_vector(unsigned char *const *src,unsigned char *const *dest,unsigned int num)
+{
+	const adm_ctrl_request_t *reqs[ADMCTRLCL_BATCH_WINDOW];
+	adm_ctrl_result_t *results[ADMCTRLCL_BATCH_WINDOW];
+	authdev_tag_t tags[ADMCTRLCL_BATCH_WINDOW];
+	const authdev_request_t *req;
+	unsigned int i,n,first;
+
+	for(first = 0; first < num ;first += n)
+	{
+		n = ( num - first < ADMCTRLCL_BATCH_WINDOW )? num - first : ADMCTRLCL_BATCH_WINDOW;
+		pthread_spin_lock(&stats_lock);
+		for(i = 0; i < n ;i++)
+			authd_hist_record(&submit_stats.dev_queue,((const authdev_request_t *)src[first + i])->delay);
+		pthread_spin_unlock(&stats_lock);
+		for(i = 0; i < n ;i++)
+		{
+			req = (const authdev_request_t *)src[first + i];
+			tags[i] = req->tag;
+			reqs[i] = &req->request;
+			results[i] = &((authdev_result_t *)dest[first + i])->result;
+		}
+		submit_vector(reqs,results,n);
+		for(i = 0; i < n ;i++)
+			((authdev_result_t *)dest[first + i])->tag = tags[i];
+	}
+}
+
+/** \brief Submit the requests placed by the device in ring slots
+	The requests are passed to authd in place and the results stored in the
+	slots.
+*/
+static void
+submit_ring_vector(unsigned char *const *src,unsigned char *const *dest,unsigned int num)
+{
+	const adm_ctrl_request_t *reqs[ADMCTRLCL_BATCH_WINDOW];
+	adm_ctrl_result_t *results[ADMCTRLCL_BATCH_WINDOW];
+	const authdev_ring_slot_t *slot;
+	unsigned int i,n,first;
+
+	for(first = 0; first < num ;first += n)
+	{
+		n = ( num - first < ADMCTRLCL_BATCH_WINDOW )? num - first : ADMCTRLCL_BATCH_WINDOW;
+		pthread_spin_lock(&stats_lock);
+		for(i = 0; i < n ;i++)
+		{
+			slot = (const authdev_ring_slot_t *)src[first + i];
+			authd_hist_record(&submit_stats.dev_queue,slot->delay);
+			reqs[i] = &slot->request;
+			results[i] = (adm_ctrl_result_t *)dest[first + i];
+		}
+		pthread_spin_unlock(&stats_lock);
+		submit_vector(reqs,results,n);
+	}
+}
+
+/** \brief Print the statistics of the front end to stdout
+
+	\param server The server accepting clients from the network
+	\param dev_server The threads reading requests from the device, or NULL
+	\param started Time the front end started
+*/
+static void
+print_stats(mt_server_t *server,filei_thread_t *dev_server,time_t started)
+{
+	mt_server_stats_t conn;
+	unsigned int submitted,failed;
+	unsigned long dev_reads,dev_records;
+	authd_histogram_t authd,dev_queue;
+
+	mt_server_get_stats(server,&conn);
+	pthread_spin_lock(&stats_lock);
+	submitted = submit_stats.submitted;
+	failed = submit_stats.failed;
+	memcpy(&authd,&submit_stats.authd,sizeof(authd_histogram_t));
+	memcpy(&dev_queue,&submit_stats.dev_queue,sizeof(authd_histogram_t));
+	pthread_spin_unlock(&stats_lock);
+
+	printf("authdfe (pid %d) up %lu seconds\n",(int)getpid(),
+			(unsigned long)(time(NULL) - started));
+	mt_server_print_stats(stdout,&conn,threads_number);
+	printf("\nrequests submitted %u, failed %u, authd clients %u, waited for a client %lu\n",
+			submitted,failed,authd_clients,admctrlcl_pool_waits(server_pool));
+	authd_hist_print(stdout,"authd",&authd);
+	if ( dev_server )
+	{
+		filei_thread_counters(dev_server,&dev_reads,&dev_records);
+		printf("\ndevice %s, threads %u, reads %lu, requests %lu, mean batch %.1f\n",
+				( filei_thread_ring_mapped(dev_server) )? "ring" : "read/write",
+				dev_threads,dev_reads,dev_records,
+				( dev_reads > 0 )? (double)dev_records / dev_reads : 0.0);
+		authd_hist_print(stdout,"device queue",&dev_queue);
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
 int
 main(int argc,char **argv)
 {
@@ -208,25 +426,50 @@ main(int argc,char **argv)
   filei_thread_t *dev_server = NULL;
 	sigset_t waitsigs;
 	struct timeval timeout;
-	adm_ctrl_request_t request;
-	adm_ctrl_result_t result;
+	unsigned int opened = 0;
 	int esig,e = -1;
+	time_t started;
 
 	parse_arguments(argc,argv);
+	started = time(NULL);
 
 	timeout.tv_sec = ipc_timeout;
 	timeout.tv_usec = 0;
-	if ( (server_client = admctrlcl_new_ipc(ipc_pathname,ipc_project_id,1,&timeout,&request,&result)) == NULL )
+#ifndef HAVE_SEMTIMEDOP
+	// Without semtimedop() IPC clients time out with the process-wide SIGALRM
+	if ( authd_clients > 1 && ipc_timeout > 0 )
+	{
+		fprintf(stderr,"Using 1 authd client, a timeout cannot be shared by several\n");
+		authd_clients = 1;
+	}
+#endif
+	if ( authd_clients == 0 )
+		authd_clients = 1;
+	if ( (server_clients = calloc(authd_clients,sizeof(admctrlcl_t *))) == NULL )
 	{
-		perror("admcrtrlcl_new_ipc");
+		perror("calloc");
 		return 1;
 	}
 
-	pthread_spin_init(&submit_lock,1);
+	pthread_spin_init(&stats_lock,1);
 
-	if ( admctrlcl_comm_open(server_client) != 0 )
+	for(opened = 0 ; opened < authd_clients ; opened++)
 	{
-		perror("admctrlcl_comm_open");
+		if ( (server_clients[opened] = admctrlcl_new_ipc(ipc_pathname,ipc_project_id,1,&timeout,NULL,NULL)) == NULL )
+		{
+			perror("admcrtrlcl_new_ipc");
+			goto admcl_open_error;
+		}
+		if ( admctrlcl_comm_open(server_clients[opened]) != 0 )
+		{
+			perror("admctrlcl_comm_open");
+			admctrlcl_destroy(server_clients[opened]);
+			goto admcl_open_error;
+		}
+	}
+	if ( (server_pool = admctrlcl_pool_new(server_clients,authd_clients)) == NULL )
+	{
+		perror("admctrlcl_pool_new");
 		goto admcl_open_error;
 	}
 
@@ -234,12 +477,19 @@ main(int argc,char **argv)
 	sigaddset(&waitsigs,SIGINT);
 	sigaddset(&waitsigs,SIGQUIT);
 	sigaddset(&waitsigs,SIGHUP);
+	sigaddset(&waitsigs,SIGUSR1);
+	// Threads created from now on inherit the mask, so only sigwait gets them
+	pthread_sigmask(SIG_BLOCK,&waitsigs,NULL);
 
-  if ( dev_filename && (dev_server = filei_thread_new(dev_filename,sizeof(adm_ctrl_request_t),submit_request)) == NULL )
+  if ( dev_filename && (dev_server = filei_thread_new(dev_filename,sizeof(authdev_request_t),dev_batch,dev_threads,NULL)) == NULL )
   {
     perror("filei_thread_new");
 		goto filei_error;
   }
+  if ( dev_filename )
+    filei_thread_vector(dev_server,submit_dev_vector,sizeof(authdev_result_t));
+  if ( dev_filename && dev_ring )
+    filei_thread_ring(dev_server,submit_ring_vector);
 
 	if ( (in_server = mt_server_new(server_hostname,server_port,threads_number)) == NULL )
 	{
@@ -255,10 +505,24 @@ main(int argc,char **argv)
     goto dev_server_start_error;
   }
 
-	if ( use_ssl && mt_server_use_SSL(in_server,ssl_pk_file,ssl_cert_file) != 0 )
+	if ( use_ssl )
 	{
-		perror("mt_server_use_SSL");
-		goto mt_server_start_error;
+		if ( mt_server_use_SSL(in_server,ssl_pk_file,ssl_cert_file) != 0 )
+		{
+			perror("mt_server_use_SSL");
+			goto mt_server_start_error;
+		}
+		if ( (ssl_cache_size >= 0 || ssl_session_timeout > 0) &&
+				mt_server_SSL_sessions(in_server,ssl_cache_size,ssl_session_timeout) != 0 )
+		{
+			perror("mt_server_SSL_sessions");
+			goto mt_server_start_error;
+		}
+		if ( hs_threads_number > 0 && mt_server_handshake_threads(in_server,hs_threads_number) != 0 )
+		{
+			perror("mt_server_handshake_threads");
+			goto mt_server_start_error;
+		}
 	}
 
 
@@ -269,7 +533,8 @@ main(int argc,char **argv)
 	}
 
 
-	sigwait(&waitsigs,&esig);
+	while( sigwait(&waitsigs,&esig) == 0 && esig == SIGUSR1 )
+		print_stats(in_server,dev_server,started);
 	e = 0;
 	mt_server_stop(in_server);
 
@@ -282,10 +547,15 @@ mt_server_error:
   if ( dev_filename )
     filei_thread_destroy(dev_server);
 filei_error:
-	admctrlcl_comm_close(server_client);
+	admctrlcl_pool_destroy(server_pool);
 admcl_open_error:
-	admctrlcl_destroy(server_client);
-	pthread_spin_destroy(&submit_lock);
+	while( opened-- > 0 )
+	{
+		admctrlcl_comm_close(server_clients[opened]);
+		admctrlcl_destroy(server_clients[opened]);
+	}
+	free(server_clients);
+	pthread_spin_destroy(&stats_lock);
 
 	exit(e);
 }
@@ -25,7 +25,12 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <signal.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
 
+#include "adm_ctrl.h"
+#include "authdev_msg.h"
 #include "filei.h"
 #include "debug.h"
 
@@ -33,37 +38,55 @@
 /** \brief Allocate and initialise a new file interaction  thread structure
 
   \param fn filename that the thread is going to use
-  \param rd_size the amount of bytes to read each time
-  \param op the operation to call after reading
+  \param rd_size the size of a record
+  \param batch the largest number of records read at once
+  \param threads the number of threads reading records
+  \param op the operation to call on each record read, or NULL if
+  filei_thread_vector() is called. It is called concurrently by all threads
 
   \return a new filei_thread structure, or NULL if memory couldn't be allocated
 */
 filei_thread_t *
-filei_thread_new(const char *fn,size_t rd_size,filei_thread_op op)
+filei_thread_new(const char *fn,size_t rd_size,unsigned int batch,unsigned int threads,filei_thread_op op)
 {
   filei_thread_t *ft;
+  unsigned int i;
 
   if ( (ft = calloc(1,sizeof(filei_thread_t))) == NULL )
   {
     errno = ENOMEM;
     return NULL;
   }
+  pthread_mutex_init(&ft->ring_lock,NULL);
 
   ft->rd_size = rd_size;
-  if ( (ft->buffer = malloc(rd_size)) == NULL )
-    goto buffer_error;
+  ft->batch = ( batch > 0 )? batch : 1;
+  ft->threads = ( threads > 0 )? threads : 1;
+  if ( (ft->workers = calloc(ft->threads,sizeof(struct filei_worker))) == NULL )
+    goto error;
+  for(i = 0; i < ft->threads ;i++)
+  {
+    ft->workers[i].ft = ft;
+    if ( (ft->workers[i].buffer = malloc(rd_size * ft->batch)) == NULL )
+      goto error;
+    if ( (ft->workers[i].claimed = malloc(ft->batch * sizeof(unsigned int))) == NULL )
+      goto error;
+    if ( (ft->workers[i].src = malloc(ft->batch * sizeof(unsigned char *))) == NULL )
+      goto error;
+    if ( (ft->workers[i].dest = malloc(ft->batch * sizeof(unsigned char *))) == NULL )
+      goto error;
+  }
 
   if ( (ft->filename = strdup(fn)) == NULL )
-    goto filename_error;
+    goto error;
 
   ft->bufop = op;
+  ft->fd = -1;
 
   return ft;
 
-filename_error:
-  free(ft->buffer);
-buffer_error:
-  free(ft);
+error:
+  filei_thread_destroy(ft);
   errno = ENOMEM;
   return NULL;
 }
@@ -76,26 +99,52 @@ buffer_error:
 void
 filei_thread_destroy(filei_thread_t *ft)
 {
-  free(ft->buffer);
-  free(ft->filename);
+  unsigned int i;
+
+  if ( ft->workers )
+  {
+    for(i = 0; i < ft->threads ;i++)
+    {
+      if ( ft->workers[i].buffer )
+        free(ft->workers[i].buffer);
+      if ( ft->workers[i].claimed )
+        free(ft->workers[i].claimed);
+      if ( ft->workers[i].src )
+        free(ft->workers[i].src);
+      if ( ft->workers[i].dest )
+        free(ft->workers[i].dest);
+    }
+    free(ft->workers);
+  }
+  pthread_mutex_destroy(&ft->ring_lock);
+  if ( ft->filename )
+    free(ft->filename);
   free(ft);
 }
 
 
 /** \brief file interaction thread work routine
-  It reads data from file, calls the assigned operation on the data read and
-  writes results to file. Normally it should be used with device file.
+  It reads up to batch records from file, calls the assigned operation on each
+  record and writes all results to file at once. Normally it should be used
+  with device file.
 
-  \param arg reference to file interaction thread structure
+  Results are stored in the same buffer, one after the other. A result
+  must not be larger than the record it answers, so it never overwrites a
+  record not yet processed. With filei_thread_vector() the vector operation
+  is called once on all the records read instead.
+
+  \param arg reference to file interaction worker structure
 
   \return always NULL
 */
 static void *
 filei_thread_run(void *arg)
 {
-  filei_thread_t *ft = (filei_thread_t *)arg;
-  ssize_t wr_size;
-  int e;
+  struct filei_worker *fw = (struct filei_worker *)arg;
+  filei_thread_t *ft = fw->ft;
+  ssize_t rd_size,wr_size,wr_total,e;
+  size_t off;
+  unsigned int n;
   sigset_t blksigs;
 
   // Ignore these signals. Only control thread needs to capture these.
@@ -105,16 +154,20 @@ filei_thread_run(void *arg)
   sigaddset(&blksigs,SIGHUP);
   pthread_sigmask(SIG_BLOCK,&blksigs,NULL);
 
-  // Cancel as soon as we receive a cancelation
-  pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS,NULL);
+  // Only cancel while waiting for requests, not while serving them
+  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE,NULL);
+  pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED,NULL);
 
   while( 1 )
   {
     DEBUG_CMD2(printf("DEBUG filei: reading ...\n"));
-    if ( (e = read(ft->fd,ft->buffer,ft->rd_size)) < ft->rd_size )
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE,NULL);
+    rd_size = read(ft->fd,fw->buffer,ft->rd_size * ft->batch);
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE,NULL);
+    if ( rd_size < (ssize_t)ft->rd_size )
     {
 #if DEBUG > 1
-      if ( e < 0 )
+      if ( rd_size < 0 )
       {
         perror("read");
         break;
@@ -124,14 +177,34 @@ filei_thread_run(void *arg)
 #endif
       continue;
     }
-    DEBUG_CMD2(printf("DEBUG filei: calling operation ...\n"));
-    if ( (wr_size = ft->bufop(ft->buffer,ft->rd_size,ft->buffer)) <= 0 )
+    fw->reads++;
+    fw->records += rd_size / ft->rd_size;
+    DEBUG_CMD2(printf("DEBUG filei: calling operation on %d records ...\n",
+          (int)(rd_size / ft->rd_size)));
+    wr_total = 0;
+    if ( ft->vec_op )
     {
-      DEBUG_CMD(fprintf(stderr,"filei->bufop returned error\n"));
-      continue;
+      for(n = 0; n < (unsigned int)(rd_size / ft->rd_size) ;n++)
+      {
+        fw->src[n] = fw->buffer + n * ft->rd_size;
+        fw->dest[n] = fw->buffer + n * ft->wr_size;
+      }
+      ft->vec_op(fw->src,fw->dest,n);
+      wr_total = n * ft->wr_size;
     }
+    else for(off = 0; off + ft->rd_size <= (size_t)rd_size ;off += ft->rd_size)
+    {
+      if ( (wr_size = ft->bufop(fw->buffer + off,ft->rd_size,fw->buffer + wr_total)) <= 0 )
+      {
+        DEBUG_CMD(fprintf(stderr,"filei->bufop returned error\n"));
+        continue;
+      }
+      wr_total += wr_size;
+    }
+    if ( wr_total == 0 )
+      continue;
     DEBUG_CMD2(printf("DEBUG filei: writing ...\n"));
-    if ( (e = write(ft->fd,ft->buffer,wr_size)) < wr_size )
+    if ( (e = write(ft->fd,fw->buffer,wr_total)) < wr_total )
     {
 #if DEBUG >1 
       if ( e < 0 )
@@ -140,7 +213,7 @@ filei_thread_run(void *arg)
         break;
       } 
       else
-        fprintf(stderr,"write less than %d bytes\n",wr_size);
+        fprintf(stderr,"write less than %d bytes\n",(int)wr_total);
 #endif
     }
   }
@@ -149,7 +222,181 @@ filei_thread_run(void *arg)
 }
 
 
-/** \brief Start a file interaction thread
+/** \brief file interaction thread work routine for the authdev ring
+  It claims up to batch slots holding requests, calls the ring operation
+  once on all of them with their results as destinations, and passes all
+  results back to the kernel with one ioctl. It waits with poll() when there
+  are no requests.
+
+  \param arg reference to file interaction worker structure
+
+  \return always NULL
+*/
+static void *
+filei_thread_ring_run(void *arg)
+{
+  struct filei_worker *fw = (struct filei_worker *)arg;
+  filei_thread_t *ft = fw->ft;
+  authdev_ring_t *ring = ft->ring;
+  struct pollfd pfd;
+  unsigned int i,j,n;
+  sigset_t blksigs;
+  int e;
+
+  // Ignore these signals. Only control thread needs to capture these.
+  sigemptyset(&blksigs);
+  sigaddset(&blksigs,SIGINT);
+  sigaddset(&blksigs,SIGQUIT);
+  sigaddset(&blksigs,SIGHUP);
+  pthread_sigmask(SIG_BLOCK,&blksigs,NULL);
+
+  // Only cancel while waiting for requests, not while holding ring_lock
+  // or serving them
+  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE,NULL);
+  pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED,NULL);
+
+  pfd.fd = ft->fd;
+  pfd.events = POLLIN;
+  while( 1 )
+  {
+    n = 0;
+    pthread_mutex_lock(&ft->ring_lock);
+    for(i = 0; i < ring->slots && n < ft->batch ;i++)
+    {
+      j = (ft->ring_next + i) % ring->slots;
+      if ( ring->slot[j].state == AUTHDEV_SLOT_REQUEST )
+      {
+        ring->slot[j].state = AUTHDEV_SLOT_BUSY;
+        fw->claimed[n++] = j;
+      }
+    }
+    if ( n > 0 )
+      ft->ring_next = (fw->claimed[n - 1] + 1) % ring->slots;
+    pthread_mutex_unlock(&ft->ring_lock);
+
+    if ( n == 0 )
+    {
+      DEBUG_CMD2(printf("DEBUG filei: polling ...\n"));
+      pthread_setcancelstate(PTHREAD_CANCEL_ENABLE,NULL);
+      e = poll(&pfd,1,-1);
+      pthread_setcancelstate(PTHREAD_CANCEL_DISABLE,NULL);
+      if ( e < 0 && errno != EINTR )
+      {
+        DEBUG_CMD(perror("poll"));
+        break;
+      }
+      continue;
+    }
+    // The requests must be read after the state
+    __sync_synchronize();
+
+    fw->reads++;
+    fw->records += n;
+    DEBUG_CMD2(printf("DEBUG filei: calling operation on %u slots ...\n",n));
+    for(i = 0; i < n ;i++)
+    {
+      fw->src[i] = (unsigned char *)&ring->slot[fw->claimed[i]];
+      fw->dest[i] = (unsigned char *)&ring->slot[fw->claimed[i]].result;
+    }
+    ft->ring_op(fw->src,fw->dest,n);
+    // The results must be visible before the state
+    __sync_synchronize();
+    for(i = 0; i < n ;i++)
+      ring->slot[fw->claimed[i]].state = AUTHDEV_SLOT_RESULT;
+
+    DEBUG_CMD2(printf("DEBUG filei: completing ...\n"));
+    if ( ioctl(ft->fd,AUTHDEV_IOC_COMPLETE) < 0 )
+    {
+      DEBUG_CMD(perror("ioctl"));
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+
+/** \brief Map the ring of the device
+  Fails if the device has no ring, or if its layout differs.
+
+  \param ft reference to file interaction structure
+
+  \return 0 on success, or -1 on failure
+*/
+static int
+filei_ring_map(filei_thread_t *ft)
+{
+  int size;
+
+  if ( (size = ioctl(ft->fd,AUTHDEV_IOC_RING_SIZE)) <= 0 )
+    return -1;
+  ft->ring_size = (size_t)size;
+  if ( (ft->ring = mmap(NULL,ft->ring_size,PROT_READ | PROT_WRITE,MAP_SHARED,
+          ft->fd,0)) == MAP_FAILED )
+  {
+    ft->ring = NULL;
+    return -1;
+  }
+  if ( ft->ring->version != AUTHDEV_RING_VERSION ||
+      ft->ring->slot_size != sizeof(authdev_ring_slot_t) )
+  {
+    munmap(ft->ring,ft->ring_size);
+    ft->ring = NULL;
+    return -1;
+  }
+  ft->ring_next = 0;
+  return 0;
+}
+
+
+/** \brief Pass all the records of a read to one operation
+  Must be called before filei_thread_start(). The operation is called once
+  per read instead of the one given to filei_thread_new() for each record,
+  so that it can submit them together. Results are stored in the buffer one
+  after the other, a result may overlap records up to the one it answers.
+
+  \param ft reference to file interaction structure
+  \param op the operation to call on the records read
+  \param wr_size the size of a result, no larger than a record
+*/
+void
+filei_thread_vector(filei_thread_t *ft,filei_thread_vec_op op,size_t wr_size)
+{
+  ft->vec_op = op;
+  ft->wr_size = wr_size;
+}
+
+
+/** \brief Serve requests through the ring of the authdev device
+  Must be called before filei_thread_start(). If the ring cannot be mapped,
+  the threads fall back to read() and write() with the operations given to
+  filei_thread_new() and filei_thread_vector().
+
+  \param ft reference to file interaction structure
+  \param op the operation to call on the authdev_ring_slot_t claimed at
+  once, with the result of each slot as destination
+*/
+void
+filei_thread_ring(filei_thread_t *ft,filei_thread_vec_op op)
+{
+  ft->ring_op = op;
+}
+
+
+/** \brief Return whether the threads use the ring of the device
+
+  \param ft reference to file interaction structure
+
+  \return 1 if the ring is mapped, 0 otherwise
+*/
+int
+filei_thread_ring_mapped(filei_thread_t *ft)
+{
+  return ( ft->ring != NULL );
+}
+
+
+/** \brief Start the threads of a file interaction structure
 
   \param ft reference to file interaction structure
   
@@ -158,20 +405,44 @@ filei_thread_run(void *arg)
 int
 filei_thread_start(filei_thread_t *ft)
 {
+  unsigned int i;
+
+  void *(*run)(void *) = filei_thread_run;
+
   if ( (ft->fd = open(ft->filename,O_RDWR)) == -1 )
     return -1;
+  if ( ft->ring_op )
+  {
+    if ( filei_ring_map(ft) == 0 )
+      run = filei_thread_ring_run;
+    else
+    {
+      DEBUG_CMD(fprintf(stderr,"filei: couldn't map ring of %s, using read/write\n",
+            ft->filename));
+    }
+  }
   pthread_attr_init(&ft->thread_attr);
-  if ( pthread_create(&ft->thread,&ft->thread_attr,filei_thread_run,ft) != 0 )
-    goto thread_error;
+  for(i = 0; i < ft->threads ;i++)
+    if ( pthread_create(&ft->workers[i].thread,&ft->thread_attr,run,&ft->workers[i]) != 0 )
+      goto thread_error;
   return 0;
 
 thread_error:
+  while( i-- > 0 )
+  {
+    pthread_cancel(ft->workers[i].thread);
+    pthread_join(ft->workers[i].thread,NULL);
+  }
+  if ( ft->ring )
+    munmap(ft->ring,ft->ring_size);
+  ft->ring = NULL;
   close(ft->fd);
+  ft->fd = -1;
   return -1;
 }
 
 
-/** \brief Stop a file interaction thread
+/** \brief Stop the threads of a file interaction structure
 
   \param ft reference to file interaction structure
 
@@ -180,7 +451,41 @@ thread_error:
 int
 filei_thread_stop(filei_thread_t *ft)
 {
-  if ( pthread_cancel(ft->thread) != 0 )
-    return -1;
-  return close(ft->fd);
+  unsigned int i;
+  int e = 0;
+
+  for(i = 0; i < ft->threads ;i++)
+    if ( pthread_cancel(ft->workers[i].thread) != 0 )
+      e = -1;
+  for(i = 0; i < ft->threads ;i++)
+    pthread_join(ft->workers[i].thread,NULL);
+  if ( ft->ring && munmap(ft->ring,ft->ring_size) != 0 )
+    e = -1;
+  ft->ring = NULL;
+  if ( close(ft->fd) != 0 )
+    e = -1;
+  ft->fd = -1;
+  return e;
+}
+
+
+/** \brief Return the number of reads and records read by all threads
+  The counters are not locked, so they may be slightly behind while the
+  threads are running.
+
+  \param ft reference to file interaction structure
+  \param reads reference to store the number of reads that returned records
+  \param records reference to store the number of records read
+*/
+void
+filei_thread_counters(filei_thread_t *ft,unsigned long *reads,unsigned long *records)
+{
+  unsigned int i;
+
+  *reads = *records = 0;
+  for(i = 0; i < ft->threads ;i++)
+  {
+    *reads += ft->workers[i].reads;
+    *records += ft->workers[i].records;
+  }
 }
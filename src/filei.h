@@ -24,24 +24,57 @@
 
 //! File interaction thread operation type
 typedef ssize_t (*filei_thread_op)(const unsigned char *,size_t,unsigned char *);
+//! File interaction thread operation on a number of records at once
+/** Called with the records, the destinations of their results and their
+ * number. It must store every result, even if its request fails. */
+typedef void (*filei_thread_vec_op)(unsigned char *const *,unsigned char *const *,unsigned int);
+
+struct filei_thread;
+struct authdev_ring;
+
+//! File interaction worker thread
+struct filei_worker {
+  pthread_t thread; //!< Thread
+  struct filei_thread *ft; //!< File interaction structure it belongs to
+  unsigned char *buffer; //!< Buffer to store records read
+  unsigned int *claimed; //!< Ring slots claimed
+  unsigned char **src; //!< Records passed to the vector operation
+  unsigned char **dest; //!< Destinations passed to the vector operation
+  unsigned long reads; //!< Reads that returned records
+  unsigned long records; //!< Records read
+};
 
 //! File interaction thread structure
+/** A number of worker threads read records from the same file descriptor. */
 struct filei_thread {
-  pthread_t thread; //!< Thread
   pthread_attr_t thread_attr; //!< Thread attributes
 
   char *filename; //!< Filename to use
   int fd; //!< File descriptor of opened file
-  size_t rd_size; //!< Number of bytes to read each time
-  unsigned char *buffer; //!< Buffer to store data read
+  size_t rd_size; //!< Size of a record read
+  unsigned int batch; //!< Largest number of records read at once
+  unsigned int threads; //!< Number of worker threads
+  struct filei_worker *workers; //!< Worker threads
   filei_thread_op bufop; //!< Operation to call on stored data
+  filei_thread_vec_op vec_op; //!< Operation to call on all records read, or NULL
+  size_t wr_size; //!< Size of a result of vec_op
+
+  filei_thread_vec_op ring_op; //!< Operation to call on claimed ring slots, or NULL
+  struct authdev_ring *ring; //!< Ring mapped from the device, or NULL
+  size_t ring_size; //!< Size of the ring mapping
+  unsigned int ring_next; //!< Ring slot to look at first
+  pthread_mutex_t ring_lock; //!< Protects claiming ring slots
 };
 
 typedef struct filei_thread filei_thread_t;
 
-filei_thread_t *filei_thread_new(const char *,size_t,filei_thread_op);
+filei_thread_t *filei_thread_new(const char *,size_t,unsigned int,unsigned int,filei_thread_op);
 void filei_thread_destroy(filei_thread_t *);
 int filei_thread_start(filei_thread_t *);
 int filei_thread_stop(filei_thread_t *);
+void filei_thread_counters(filei_thread_t *,unsigned long *,unsigned long *);
+void filei_thread_vector(filei_thread_t *,filei_thread_vec_op,size_t);
+void filei_thread_ring(filei_thread_t *,filei_thread_vec_op);
+int filei_thread_ring_mapped(filei_thread_t *);
 
 #endif
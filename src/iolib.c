@@ -155,7 +155,7 @@ iolib_ssl_call1(SSL *ssl,int sock,struct timeval *tm,int (*fcall)(SSL *))
 
 	while( 1 )
 	{	
-		if ( (e = select(sock + 1,NULL,&rdfds,&wrfds,&timer)) <= 0 )
+		if ( (e = select(sock + 1,&rdfds,&wrfds,NULL,&timer)) <= 0 )
 		{
 			if ( e == 0 )
 				errno = ETIME;
@@ -27,12 +27,24 @@
 #include <netdb.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <fcntl.h>
 
 #include "debug.h"
 #include "iolib.h"
 
 #define MAX_THREAD_WAIT 3
+//! Session id context of the SSL session cache
+#define MT_SERVER_SESSION_CTX "mt_server"
+
+static inline u_int32_t
+elapsed_usec(const struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now,NULL);
+	return (now.tv_sec - start->tv_sec) * 1000000 + now.tv_usec - start->tv_usec;
+}
 
 static void
 client_thread_cleanup(void *arg)
@@ -41,7 +53,13 @@ client_thread_cleanup(void *arg)
 
 	DEBUG_CMD(printf("client_thread_cleanup: cleaning up ...\n"));
 
-	close(ct->socket);
+#ifdef HAVE_LIBSSL
+	// A handshake thread may have handed over a session not yet served
+	if ( ct->ssl )
+		SSL_free(ct->ssl);
+#endif
+	if ( ct->socket >= 0 )
+		close(ct->socket);
 	if ( ct->buffer )
 		free(ct->buffer);
 	sem_destroy(&ct->awake);
@@ -91,6 +109,7 @@ client_ssl_destroy(client_thread_t *ct)
 {
 	SSL_shutdown(ct->ssl);
 	SSL_free(ct->ssl);
+	ct->ssl = NULL;
 }
 
 static inline int
@@ -101,7 +120,9 @@ client_ssl_init(client_thread_t *ct)
 		return -1;
 	if ( (sbio = BIO_new_socket(ct->socket,BIO_NOCLOSE)) == NULL )
 	{
+		// Client threads take a non-NULL ssl as an established session
 		SSL_free(ct->ssl);
+		ct->ssl = NULL;
 		return -1;
 	}
 	SSL_set_bio(ct->ssl,sbio,sbio);
@@ -112,13 +133,74 @@ client_ssl_init(client_thread_t *ct)
 	}
 	return 0;
 }
+
+static int
+client_ssl_handshake(client_thread_t *ct)
+{
+	struct timeval start;
+	mt_server_stats_t *stats = ct->stats;
+	u_int32_t usec;
+	int e;
+
+	gettimeofday(&start,NULL);
+	e = client_ssl_init(ct);
+	usec = elapsed_usec(&start);
+
+	pthread_mutex_lock(&stats->lock);
+	if ( e != 0 )
+		++stats->handshake_failed;
+	else if ( SSL_session_reused(ct->ssl) )
+	{
+		++stats->resumed;
+		authd_hist_record(&stats->resumption,usec);
+	}
+	else
+		authd_hist_record(&stats->handshake,usec);
+	pthread_mutex_unlock(&stats->lock);
+	return e;
+}
 #endif
 
+static inline client_thread_t *
+get_idle_thread(client_thread_t *threads,unsigned int num)
+{
+	unsigned int i;
+
+	for(i = 0; i < num ;i++)
+		if ( threads[i].state == IDLE )
+			return &threads[i];
+	return NULL;
+}
+
+/** Find an idle client thread and mark it busy. Called by the server thread
+ * and, when they are used, by the handshake threads. */
+static client_thread_t *
+assign_client_thread(mt_server_t *server)
+{
+	client_thread_t *ct;
+
+	pthread_mutex_lock(&server->idle_lock);
+	if ( (ct = get_idle_thread(server->c_threads,server->t_num)) != NULL )
+		ct->state = BUSY;
+	pthread_mutex_unlock(&server->idle_lock);
+
+	pthread_mutex_lock(&server->stats.lock);
+	if ( ct == NULL )
+		++server->stats.dropped;
+	else if ( ++server->stats.busy > server->stats.busy_max )
+		server->stats.busy_max = server->stats.busy;
+	pthread_mutex_unlock(&server->stats.lock);
+	return ct;
+}
+
 static void *
 client_thread_run(void *arg)
 {
 	sigset_t blksigs;
+	struct timeval start;
 	client_thread_t *ct = (client_thread_t *)arg;
+	mt_server_stats_t *stats = ct->stats;
+	u_int32_t usec;
 
 	DEBUG_CMD(printf("client_thread_run: running ...\n"));
 
@@ -128,19 +210,29 @@ client_thread_run(void *arg)
 	sigaddset(&blksigs,SIGHUP);
 	pthread_sigmask(SIG_BLOCK,&blksigs,NULL);
 
-	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS,NULL);
+	// Only cancel while waiting for clients, not while holding a lock or
+	// serving them
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE,NULL);
+	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED,NULL);
 	pthread_cleanup_push(client_thread_cleanup,arg);
 	sem_post(ct->isthreadalive);
 	while( 1 )
 	{
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE,NULL);
 		sem_wait(&ct->awake);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE,NULL);
+		gettimeofday(&start,NULL);
 
 		DEBUG_CMD2(printf("client_thread_run: handling client ...\n"));
 #ifdef HAVE_LIBSSL
-		if ( ct->ssl_ctx && client_ssl_init(ct) == 0 )
+		if ( ct->ssl_ctx )
 		{
-			client_handle_ssl(ct);
-			client_ssl_destroy(ct);
+			// A handshake thread may have already established the session
+			if ( ct->ssl || client_ssl_handshake(ct) == 0 )
+			{
+				client_handle_ssl(ct);
+				client_ssl_destroy(ct);
+			}
 		}
 		else
 #endif
@@ -148,6 +240,12 @@ client_thread_run(void *arg)
 		DEBUG_CMD2(printf("client_thread_run: closing client ...\n"));
 		close(ct->socket);
 		ct->socket = -1;
+
+		usec = elapsed_usec(&start);
+		pthread_mutex_lock(&stats->lock);
+		authd_hist_record(&stats->connection,usec);
+		--stats->busy;
+		pthread_mutex_unlock(&stats->lock);
 		ct->state = IDLE;
 	}
 
@@ -156,13 +254,77 @@ client_thread_run(void *arg)
 	return NULL;
 }
 
+#ifdef HAVE_LIBSSL
+static void *
+handshake_thread_run(void *arg)
+{
+	sigset_t blksigs;
+	client_thread_t *ht = (client_thread_t *)arg;
+	client_thread_t *ct;
+
+	DEBUG_CMD(printf("handshake_thread_run: running ...\n"));
+
+	sigemptyset(&blksigs);
+	sigaddset(&blksigs,SIGINT);
+	sigaddset(&blksigs,SIGQUIT);
+	sigaddset(&blksigs,SIGHUP);
+	pthread_sigmask(SIG_BLOCK,&blksigs,NULL);
+
+	// Only cancel while waiting for clients, not while holding a lock or
+	// handshaking
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE,NULL);
+	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED,NULL);
+	pthread_cleanup_push(client_thread_cleanup,arg);
+	sem_post(ht->isthreadalive);
+	while( 1 )
+	{
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE,NULL);
+		sem_wait(&ht->awake);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE,NULL);
+
+		DEBUG_CMD2(printf("handshake_thread_run: handshaking with client ...\n"));
+		if ( client_ssl_handshake(ht) != 0 )
+			close(ht->socket);
+		else if ( (ct = assign_client_thread(ht->server)) == NULL )
+		{
+			DEBUG_CMD(printf("handshake_thread_run: no available threads for client\n"));
+			client_ssl_destroy(ht);
+			close(ht->socket);
+		}
+		else
+		{
+			// Hand the established session over to the client thread, after
+			// becoming available again for the next connection
+			ct->socket = ht->socket;
+			ct->ssl = ht->ssl;
+			ht->ssl = NULL;
+			ht->socket = -1;
+			ht->state = IDLE;
+			sem_post(&ct->awake);
+			continue;
+		}
+		ht->socket = -1;
+		ht->state = IDLE;
+	}
+
+	pthread_cleanup_pop(1);
+
+	return NULL;
+}
+#endif
+
 static int
-client_thread_start(client_thread_t *ct,sem_t *st,size_t rd_size,struct timeval *timeout,char persistent,client_thread_op op)
+client_thread_start(client_thread_t *ct,sem_t *st,mt_server_t *server,size_t rd_size,struct timeval *timeout,char persistent,client_thread_op op,void *(*run)(void *))
 {
-	if ( (ct->buffer = malloc(rd_size)) == NULL )
+	// Handshake threads don't read requests, they have no buffer
+	ct->buffer = NULL;
+	if ( rd_size > 0 && (ct->buffer = malloc(rd_size)) == NULL )
 		return -1;
 	ct->state = IDLE;
+	ct->socket = -1;
 	ct->isthreadalive = st;
+	ct->server = server;
+	ct->stats = &server->stats;
 	ct->rd_size = rd_size;
 	ct->persistent = persistent;
 	ct->bufop = op;
@@ -170,7 +332,7 @@ client_thread_start(client_thread_t *ct,sem_t *st,size_t rd_size,struct timeval
 	pthread_attr_init(&ct->thread_attr);
 	if ( sem_init(&ct->awake,0,0) != 0 )
 		goto error;
-	if ( pthread_create(&ct->thread,&ct->thread_attr,client_thread_run,ct) != 0 )
+	if ( pthread_create(&ct->thread,&ct->thread_attr,run,ct) != 0 )
 		goto thread_error;
 	return 0;
 
@@ -182,27 +344,27 @@ error:
 }
 
 static void
-client_threads_stop(mt_server_t *server,unsigned int n)
+client_threads_stop(client_thread_t *threads,sem_t *status,unsigned int n)
 {
 	unsigned int i;
 	int sem_val;
 
-	if ( server->c_threads == NULL )
+	if ( threads == NULL )
 		return;
-	// Sleep until all threads report in
+	// Sleep until all started threads report in
 	do {
-		if ( sem_getvalue(&server->ct_status,&sem_val) != 0 )
+		if ( sem_getvalue(status,&sem_val) != 0 )
 			break;
-		if ( sem_val < 0 || sem_val == (int)server->t_num )
+		if ( sem_val < 0 || sem_val == (int)n )
 			break;
 		sleep(1);
 	} while( 1 );
 	for(i = 0; i < n ;i++)
-		pthread_cancel(server->c_threads[i].thread);
+		pthread_cancel(threads[i].thread);
 	// Sleep until all threads have terminated
 	for(i = 0 ; i < MAX_THREAD_WAIT ;i++)
 	{
-		if ( sem_getvalue(&server->ct_status,&sem_val) != 0 )
+		if ( sem_getvalue(status,&sem_val) != 0 )
 			break;
 		if ( sem_val <= 0)
 			break;
@@ -220,17 +382,6 @@ server_thread_cleanup(void *arg)
 }
 */
 
-static inline client_thread_t *
-get_idle_thread(mt_server_t *server)
-{
-	unsigned int i;
-
-	for(i = 0; i < server->t_num ;i++)
-		if ( server->c_threads[i].state == IDLE )
-			return &server->c_threads[i];
-	return NULL;
-}
-
 static void *
 server_thread_run(void *arg)
 {
@@ -243,7 +394,10 @@ server_thread_run(void *arg)
 
 	DEBUG_CMD(printf("server_thread_run: running ...\n"));
 
-	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS,NULL);
+	// Only cancel while waiting in accept(), where the thread holds neither
+	// a lock nor a client socket, so it needs no cleanup handler
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE,NULL);
+	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED,NULL);
 	sigemptyset(&blksigs);
 	sigaddset(&blksigs,SIGINT);
 	sigaddset(&blksigs,SIGQUIT);
@@ -254,17 +408,37 @@ server_thread_run(void *arg)
 	//pause();
 	do {
 		cli_addr_len = sizeof(cli_addr);
-		if ( (cli_sock = accept(server->socket,(struct sockaddr *)&cli_addr,&cli_addr_len)) < 0 )
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE,NULL);
+		cli_sock = accept(server->socket,(struct sockaddr *)&cli_addr,&cli_addr_len);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE,NULL);
+		if ( cli_sock < 0 )
 		{
 			perror("server_thread_run: accept");
 			break;
 		}
-		if ( (assigned_thread = get_idle_thread(server)) == NULL )
+		pthread_mutex_lock(&server->stats.lock);
+		++server->stats.accepted;
+		pthread_mutex_unlock(&server->stats.lock);
+		// Handshake threads are only assigned by this thread
+		if ( server->h_num > 0 )
+		{
+			if ( (assigned_thread = get_idle_thread(server->h_threads,server->h_num)) != NULL )
+				assigned_thread->state = BUSY;
+			else
+			{
+				pthread_mutex_lock(&server->stats.lock);
+				++server->stats.dropped;
+				pthread_mutex_unlock(&server->stats.lock);
+			}
+		}
+		else
+			assigned_thread = assign_client_thread(server);
+		if ( assigned_thread == NULL )
 		{
 			DEBUG_CMD(printf("server_thread_run: no available threads for client\n"));
+			close(cli_sock);
 			continue;
 		}
-		assigned_thread->state = BUSY;
 		assigned_thread->socket = cli_sock;
 		if ( assigned_thread->timeout.tv_sec || assigned_thread->timeout.tv_usec )
 			fcntl(assigned_thread->socket,F_SETFL,O_NONBLOCK);
@@ -304,30 +478,37 @@ void
 mt_server_stop(mt_server_t *server)
 {
 	server_thread_stop(server);
-	client_threads_stop(server,server->t_num);
+	client_threads_stop(server->h_threads,&server->ht_status,server->h_num);
+	client_threads_stop(server->c_threads,&server->ct_status,server->t_num);
 	close(server->socket);
 }
 
 int
 mt_server_start(mt_server_t *server,size_t rd_size,struct timeval *timeout,char persistent,client_thread_op op)
 {
-	unsigned int i;
+	unsigned int i,j = 0;
 
 	if ( server_listen(server) != 0 )
 		return -1;
 
 	for(i = 0; i < server->t_num ;i++)
-		if ( client_thread_start(&server->c_threads[i],&server->ct_status,rd_size,timeout,persistent,op) != 0 )
+		if ( client_thread_start(&server->c_threads[i],&server->ct_status,server,rd_size,timeout,persistent,op,client_thread_run) != 0 )
+			goto client_thread_error;
+#ifdef HAVE_LIBSSL
+	for(j = 0; j < server->h_num ;j++)
+		if ( client_thread_start(&server->h_threads[j],&server->ht_status,server,0,timeout,persistent,op,handshake_thread_run) != 0 )
 			goto client_thread_error;
+#endif
 	pthread_attr_init(&server->thread_attr);
 	if ( pthread_create(&server->thread,&server->thread_attr,server_thread_run,server) != 0 )
-		goto server_thread_error;
+		goto client_thread_error;
 	return 0;
 
-server_thread_error:
-	server_thread_stop(server);
 client_thread_error:
-	client_threads_stop(server,i);
+	client_threads_stop(server->h_threads,&server->ht_status,j);
+	client_threads_stop(server->c_threads,&server->ct_status,i);
+	close(server->socket);
+	server->socket = -1;
 	return -1;
 }
 
@@ -338,12 +519,19 @@ mt_server_free(mt_server_t *server)
 	{
 		if ( server->c_threads )
 			free(server->c_threads);
+		if ( server->h_threads )
+		{
+			free(server->h_threads);
+			sem_destroy(&server->ht_status);
+		}
 #ifdef HAVE_LIBSSL
 		if ( server->ssl_ctx )
 			SSL_CTX_free(server->ssl_ctx);
 #endif 
-		free(server);
 		sem_destroy(&server->ct_status);
+		pthread_mutex_destroy(&server->idle_lock);
+		pthread_mutex_destroy(&server->stats.lock);
+		free(server);
 	}
 }
 
@@ -353,7 +541,9 @@ mt_server_new(const char *hostname,int port,unsigned int t_num)
 	mt_server_t *s;
 
 	if ( (s = calloc(1,sizeof(mt_server_t))) == NULL )
-		goto error;
+		return NULL;
+	pthread_mutex_init(&s->idle_lock,NULL);
+	pthread_mutex_init(&s->stats.lock,NULL);
 	if ( (s->c_threads = calloc(t_num,sizeof(client_thread_t))) == NULL )
 		goto error;
 	if ( sem_init(&s->ct_status,0,0) != 0 )
@@ -410,6 +600,11 @@ mt_server_use_SSL(mt_server_t *server,const char *keyfl,const char *certfl)
   if ( SSL_CTX_use_certificate_chain_file(server->ssl_ctx,certfl) <= 0 )
     goto ssl_error;
 
+	// Cache sessions so that returning clients can skip the key exchange
+	SSL_CTX_set_session_id_context(server->ssl_ctx,(const unsigned char *)MT_SERVER_SESSION_CTX,
+			sizeof(MT_SERVER_SESSION_CTX) - 1);
+	SSL_CTX_set_session_cache_mode(server->ssl_ctx,SSL_SESS_CACHE_SERVER);
+
 	for(i = 0; i < server->t_num ;i++)
 		server->c_threads[i].ssl_ctx = server->ssl_ctx;
 
@@ -420,3 +615,115 @@ ssl_error:
 	return -1;
 #endif
 }
+
+/** \brief Configure the resumption of SSL sessions
+	Sessions are cached by default after mt_server_use_SSL(), using the
+	defaults of the SSL library. Session tickets are also issued if the
+	library supports them.
+
+	\param server reference to the server
+	\param cache_size Number of sessions cached, 0 disables both the cache and
+	session tickets, and a negative value keeps the default
+	\param timeout Seconds a session can be resumed for, 0 to keep the default
+
+	\return 0 on success, or -1 on error. errno is set to ENOPROTOOPT if SSL was
+	not enabled
+*/
+int
+mt_server_SSL_sessions(mt_server_t *server,long cache_size,long timeout)
+{
+#ifdef HAVE_LIBSSL
+	if ( server->ssl_ctx )
+	{
+		if ( cache_size == 0 )
+		{
+			SSL_CTX_set_session_cache_mode(server->ssl_ctx,SSL_SESS_CACHE_OFF);
+#ifdef SSL_OP_NO_TICKET
+			SSL_CTX_set_options(server->ssl_ctx,SSL_OP_NO_TICKET);
+#endif
+			return 0;
+		}
+		SSL_CTX_set_session_cache_mode(server->ssl_ctx,SSL_SESS_CACHE_SERVER);
+		if ( cache_size > 0 )
+			SSL_CTX_sess_set_cache_size(server->ssl_ctx,cache_size);
+		if ( timeout > 0 )
+			SSL_CTX_set_timeout(server->ssl_ctx,timeout);
+		return 0;
+	}
+#endif
+	errno = ENOPROTOOPT;
+	return -1;
+}
+
+/** \brief Perform SSL handshakes on a separate pool of threads
+	The server thread hands new connections to a handshake thread, which
+	passes the established session to a client thread. Client threads then
+	only serve requests, and the number of concurrent handshakes is bounded
+	separately. Must be called after mt_server_use_SSL() and before
+	mt_server_start().
+
+	\param server reference to the server
+	\param h_num Number of handshake threads
+
+	\return 0 on success, or -1 on error. errno is set to ENOPROTOOPT if SSL was
+	not enabled, EISCONN if the server was started, or ENOMEM
+*/
+int
+mt_server_handshake_threads(mt_server_t *server,unsigned int h_num)
+{
+#ifdef HAVE_LIBSSL
+	unsigned int i;
+
+	if ( server->ssl_ctx == NULL )
+	{
+		errno = ENOPROTOOPT;
+		return -1;
+	}
+	if ( server->socket >= 0 || server->h_threads )
+	{
+		errno = EISCONN;
+		return -1;
+	}
+	if ( h_num == 0 )
+		return 0;
+
+	if ( (server->h_threads = calloc(h_num,sizeof(client_thread_t))) == NULL )
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+	if ( sem_init(&server->ht_status,0,0) != 0 )
+	{
+		free(server->h_threads);
+		server->h_threads = NULL;
+		return -1;
+	}
+	for(i = 0; i < h_num ;i++)
+		server->h_threads[i].ssl_ctx = server->ssl_ctx;
+	server->h_num = h_num;
+	return 0;
+#else
+	errno = ENOPROTOOPT;
+	return -1;
+#endif
+}
+
+void
+mt_server_get_stats(mt_server_t *server,mt_server_stats_t *copy)
+{
+	pthread_mutex_lock(&server->stats.lock);
+	memcpy(copy,&server->stats,sizeof(mt_server_stats_t));
+	pthread_mutex_unlock(&server->stats.lock);
+}
+
+void
+mt_server_print_stats(FILE *fp,const mt_server_stats_t *stats,unsigned int t_num)
+{
+	fprintf(fp,"connections accepted %u, dropped %u, SSL handshake failed %u, resumed %u\n",
+			stats->accepted,stats->dropped,stats->handshake_failed,stats->resumed);
+	fprintf(fp,"threads %u, busy %u, max busy %u\n\n",t_num,stats->busy,stats->busy_max);
+	authd_hist_print_header(fp);
+	authd_hist_print(fp,"handshake",&stats->handshake);
+	authd_hist_print(fp,"resumption",&stats->resumption);
+	authd_hist_print(fp,"connection",&stats->connection);
+}
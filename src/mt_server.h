@@ -24,10 +24,13 @@
 #include "config.h"
 #endif
 
+#include <stdio.h>
 #include <pthread.h>
 #include <semaphore.h>
 #include <netinet/in.h>
 
+#include "authd_stats.h"
+
 #ifdef HAVE_LIBSSL
 #include <openssl/ssl.h>
 #endif
@@ -37,6 +40,24 @@
 
 typedef ssize_t (*client_thread_op)(const unsigned char *,size_t,unsigned char *);
 
+struct mt_server_stats
+{
+	pthread_mutex_t lock;
+
+	unsigned int accepted;
+	unsigned int dropped;
+	unsigned int handshake_failed;
+	unsigned int resumed;
+	unsigned int busy;
+	unsigned int busy_max;
+
+	authd_histogram_t handshake;
+	authd_histogram_t resumption;
+	authd_histogram_t connection;
+};
+
+typedef struct mt_server_stats mt_server_stats_t;
+
 struct client_thread
 {
 	pthread_t thread;
@@ -52,6 +73,8 @@ struct client_thread
 	char persistent;
 	sem_t awake;
 	sem_t *isthreadalive;
+	mt_server_stats_t *stats;
+	struct mt_server *server;
 
 #ifdef HAVE_LIBSSL
 	SSL_CTX *ssl_ctx;
@@ -69,10 +92,17 @@ struct mt_server
 	unsigned int t_num;
 	client_thread_t *c_threads;
 	sem_t ct_status;
+	pthread_mutex_t idle_lock;
+
+	unsigned int h_num;
+	client_thread_t *h_threads;
+	sem_t ht_status;
 
 	int socket;
 	struct sockaddr_in addr;
 
+	mt_server_stats_t stats;
+
 #ifdef HAVE_LIBSSL
 	SSL_CTX *ssl_ctx;
 #endif
@@ -82,8 +112,12 @@ typedef struct mt_server mt_server_t;
 
 mt_server_t *mt_server_new(const char *,int,unsigned int);
 int mt_server_use_SSL(mt_server_t *,const char *,const char *);
+int mt_server_SSL_sessions(mt_server_t *,long,long);
+int mt_server_handshake_threads(mt_server_t *,unsigned int);
 extern inline void mt_server_free(mt_server_t *);
 int mt_server_start(mt_server_t *,size_t,struct timeval *,char,client_thread_op);
 extern inline void mt_server_stop(mt_server_t *);
+void mt_server_get_stats(mt_server_t *,mt_server_stats_t *);
+void mt_server_print_stats(FILE *,const mt_server_stats_t *,unsigned int);
 
 #endif
@@ -26,10 +26,10 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <math.h>
-#include <printf.h>
+#include <time.h>
+#include <netinet/in.h>
 
 #include "resource_ctrl.h"
-#include "arith_parser.h"
 #include "debug.h"
 
 /** \file resource_ctrl.c 
@@ -40,8 +40,6 @@
 //! Mode of file containing the database
 #define DB_FILE_MODE 0600
 
-#define SNV_BUFFER_SIZE (RESOURCE_CTRL_MAX_VAR_FORM_LEN + MAX_ARGUMENTS_NUMBER * 64)
-
 typedef enum { INCREASE, DECREASE } ADJ_TYPE;
 
 typedef void (*dbt_print_t)(const DBT *,const DBT *);
@@ -59,9 +57,258 @@ static const struct db_conf db_meta[] = {
 	{ "functiondb", DB_HASH, 0 },
 	{ "librarydb", DB_HASH, 0 },
 	{ "resourcecondb", DB_BTREE, DB_DUP | DB_DUPSORT },
-	{ "resourcedb", DB_HASH, 0 }
+	{ "resourcedb", DB_HASH, 0 },
+	{ "leasedb", DB_BTREE, 0 },
+	{ "consumptionfuncdb", DB_BTREE, DB_DUP | DB_DUPSORT },
+	{ "consumptionlibdb", DB_BTREE, DB_DUP | DB_DUPSORT }
 };
 
+//! Consumption records of functions with global resource consumption have all the library bits set
+#define CONSUMPTION_GLOBAL(pk) (((pk) >> 16) == 0xffff)
+
+//! Key of the record holding the next lease id in leasedb
+#define LEASE_SEQ_KEY 0
+
+//! Initial number of entries of the tables memoising lookups
+#define TABLE_MIN_SIZE 16
+//! Hash of a resource key
+#define KEY_HASH(k) ((u_int32_t)(k) * 2654435761U)
+
+
+/** \brief FNV-1a hash of a string
+*/
+static u_int32_t
+string_hash(const char *s)
+{
+	u_int32_t h = 2166136261U;
+
+	while( *s )
+		h = (h ^ (unsigned char)*s++) * 16777619U;
+	return h;
+}
+
+
+/** \brief Look up the id of a function or library name
+
+	\return zero on success, or non-zero on failure
+*/
+static int
+name_id(DB *dbp,const char *name,u_int32_t *id)
+{
+	DBT key,data;
+	int e;
+
+	bzero(&key,sizeof(key));
+	key.data = (char *)name;
+	key.size = strlen(name) + 1;
+	bzero(&data,sizeof(data));
+	if ( (e = dbp->get(dbp,NULL,&key,&data,0)) == 0 )
+		*id = *(u_int32_t *)data.data;
+	return e;
+}
+
+
+/** \brief Key of a resource consumption record in a consumption index
+	Records of functions with global resource consumption are indexed by
+	their whole key, which is also the key of the function, and not by
+	library.
+
+	\param db_index 5 for the function index, or 6 for the library index
+	\param pk Key of the resource consumption record
+	\param part Reference where the key in the index is going to be stored
+
+	\return non-zero if the record is indexed, or zero otherwise
+*/
+static int
+consumption_index_key(unsigned int db_index,u_int32_t pk,u_int32_t *part)
+{
+	if ( CONSUMPTION_GLOBAL(pk) )
+	{
+		*part = pk;
+		return db_index == 5;
+	}
+	*part = ( db_index == 5 )? pk & 0xffff : pk >> 16;
+	return 1;
+}
+
+
+/** \brief Add the key of resource consumption records in the consumption indexes
+	The indexes map function and library keys to the keys of resourcecondb,
+	so that deleting a function or library touches only its own records.
+	Records have to be indexed before they are stored. Index entries
+	without records are allowed, and dropped along with their function or
+	library.
+
+	\param db Reference to a resource control database
+	\param tid Transaction, or NULL
+	\param pk Key of the resource consumption records
+
+	\return zero on success, or non-zero on failure
+*/
+int
+resource_ctrl_index_consumption(resource_ctrl_db_t *db,DB_TXN *tid,u_int32_t pk)
+{
+	DBT key,data;
+	u_int32_t part;
+	unsigned int i;
+	int e;
+
+	for(i = 5 ; i < RESOURCES_DB_NUM ; i++)
+	{
+		if ( db->DB[i] == NULL || !consumption_index_key(i,pk,&part) )
+			continue;
+		bzero(&key,sizeof(key));
+		key.data = &part;
+		key.size = sizeof(part);
+		bzero(&data,sizeof(data));
+		data.data = &pk;
+		data.size = sizeof(pk);
+		if ( (e = db->DB[i]->put(db->DB[i],tid,&key,&data,DB_NODUPDATA)) != 0 && e != DB_KEYEXIST )
+			return e;
+	}
+	return 0;
+}
+
+
+/** \brief Remove the key of resource consumption records from a consumption index
+
+	\return zero on success, or non-zero on failure
+*/
+static int
+consumption_unindex(resource_ctrl_db_t *db,DB_TXN *tid,unsigned int db_index,u_int32_t pk)
+{
+	DBT key,data;
+	DBC *dbc;
+	u_int32_t part;
+	int e;
+
+	if ( !consumption_index_key(db_index,pk,&part) )
+		return 0;
+	if ( (e = db->DB[db_index]->cursor(db->DB[db_index],tid,&dbc,0)) != 0 )
+		return e;
+
+	bzero(&key,sizeof(key));
+	key.data = &part;
+	key.size = sizeof(part);
+	bzero(&data,sizeof(data));
+	data.data = &pk;
+	data.size = sizeof(pk);
+	if ( (e = dbc->c_get(dbc,&key,&data,DB_GET_BOTH)) == 0 )
+		e = dbc->c_del(dbc,0);
+
+	dbc->c_close(dbc);
+	return ( e == DB_NOTFOUND )? 0 : e;
+}
+
+
+/** \brief Delete the resource consumption records of a function or library
+	Walks the entries of the function or library in a consumption index, and
+	deletes the records they point to and their entries in both indexes.
+
+	\param db Reference to a resource control database
+	\param tid Transaction
+	\param db_index 5 for the function index, or 6 for the library index
+	\param part Key of the function or library
+
+	\return zero on success, or non-zero on failure
+*/
+static int
+consumption_del_indexed(resource_ctrl_db_t *db,DB_TXN *tid,unsigned int db_index,u_int32_t part)
+{
+	DBT key,data,pkey;
+	DBC *dbc;
+	u_int32_t pk;
+	int e;
+
+	if ( (e = db->DB[db_index]->cursor(db->DB[db_index],tid,&dbc,0)) != 0 )
+		return e;
+
+	bzero(&key,sizeof(key));
+	key.data = &part;
+	key.size = sizeof(part);
+	bzero(&data,sizeof(data));
+	bzero(&pkey,sizeof(pkey));
+	pkey.data = &pk;
+	pkey.size = sizeof(pk);
+
+	for(e = dbc->c_get(dbc,&key,&data,DB_SET) ; e == 0 ; e = dbc->c_get(dbc,&key,&data,DB_NEXT_DUP))
+	{
+		pk = *(u_int32_t *)data.data;
+		if ( (e = db->DB[2]->del(db->DB[2],tid,&pkey,0)) != 0 && e != DB_NOTFOUND )
+			break;
+		if ( (e = consumption_unindex(db,tid,( db_index == 5 )? 6 : 5,pk)) != 0 ||
+				(e = dbc->c_del(dbc,0)) != 0 )
+			break;
+	}
+
+	dbc->c_close(dbc);
+	return ( e == DB_NOTFOUND )? 0 : e;
+}
+
+
+/** \brief Check whether a DB has any records
+
+	\return zero if it has, DB_NOTFOUND if it is empty, or another error code
+*/
+static int
+db_first(DB *dbp)
+{
+	DBT key,data;
+	DBC *dbc;
+	int e;
+
+	if ( (e = dbp->cursor(dbp,NULL,&dbc,0)) != 0 )
+		return e;
+	bzero(&key,sizeof(key));
+	bzero(&data,sizeof(data));
+	data.flags = DB_DBT_PARTIAL;
+	e = dbc->c_get(dbc,&key,&data,DB_FIRST);
+	dbc->c_close(dbc);
+	return e;
+}
+
+
+/** \brief Build the consumption indexes of databases created by older versions
+	Every stored record is in the function index, so it can only be empty
+	if resourcecondb is empty as well, or if it has just been created.
+*/
+static int
+consumption_index_check(resource_ctrl_db_t *db)
+{
+	DB_TXN *tid;
+	DBT key,data;
+	DBC *dbc;
+	int e;
+
+	if ( (e = db_first(db->DB[2])) != 0 )
+		return ( e == DB_NOTFOUND )? 0 : e;
+	if ( (e = db_first(db->DB[5])) != DB_NOTFOUND )
+		return e;
+
+	// BEGIN transaction
+	if ( (e = txn_begin(db->ENV,NULL,&tid,0)) != 0 )
+		return e;
+	if ( (e = db->DB[2]->cursor(db->DB[2],tid,&dbc,0)) != 0 )
+		goto abort;
+
+	bzero(&key,sizeof(key));
+	bzero(&data,sizeof(data));
+	data.flags = DB_DBT_PARTIAL;
+	while( (e = dbc->c_get(dbc,&key,&data,DB_NEXT_NODUP)) == 0 )
+		if ( (e = resource_ctrl_index_consumption(db,tid,*(u_int32_t *)key.data)) != 0 )
+			break;
+	dbc->c_close(dbc);
+	if ( e != DB_NOTFOUND )
+		goto abort;
+
+	// COMMIT transaction
+	return txn_commit(tid,0);
+
+abort:
+	txn_abort(tid);
+	return e;
+}
+
 
 /** \brief Initialise a resource control database
  *
@@ -115,7 +362,19 @@ resource_ctrl_dbopen(resource_ctrl_db_t *db,const char *home,const char *fn,u_in
 
 	for(i = 0 ; i < RESOURCES_DB_NUM ; i++)
 		if ( (e = db->DB[i]->open(db->DB[i],fn,db_meta[i].name,db_meta[i].type,flags,0)) != 0 )
+		{
+			// Files created by older versions have no lease database and no indexes
+			if ( i >= 4 && e == ENOENT && (flags & DB_RDONLY) )
+			{
+				db->DB[i]->close(db->DB[i],0);
+				db->DB[i] = NULL;
+				continue;
+			}
 			goto error;
+		}
+
+	if ( !(flags & DB_RDONLY) && (e = consumption_index_check(db)) != 0 )
+		goto error;
 
 	return 0;
 
@@ -139,18 +398,115 @@ resource_ctrl_dbclose(resource_ctrl_db_t *db)
 	int i;
 
 	for(i = 0 ; i < RESOURCES_DB_NUM ; i++)
-		db->DB[i]->close(db->DB[i],0);
+		if ( db->DB[i] )
+			db->DB[i]->close(db->DB[i],0);
 
 	db->ENV->close(db->ENV,0);
 }
 
 
+/** \brief Convert the result of a variable cost formula to a cost
+
+	\param var_result The result of the formula
+	\param cost Reference where the cost is going to be stored
+
+	\return zero on success, or -1 if the result is not a valid cost
+*/
+static int
+result_cost(double var_result,u_int32_t *cost)
+{
+	if ( !isfinite(var_result) )
+	{
+		DEBUG_CMD2(printf("DEBUG resource_ctrl_aggregate: failed to calculate variable cost formula\n"));
+		return -1;
+	}
+	if ( var_result < 0.0 )
+	{
+		DEBUG_CMD2(printf("DEBUG resource_ctrl_aggregate: negative variable cost returned\n"));
+		return -1;
+	}
+	if ( !isless(var_result,4294967296.0) )
+	{
+		DEBUG_CMD2(printf("DEBUG resource_ctrl_aggregate: variable cost exceeds maximum unsigned int\n"));
+		return -1;
+	}
+	*cost = (u_int32_t)lround(var_result);
+	DEBUG_CMD2(printf("DEBUG resource_ctrl_aggregate: variable formula --> %u\n",*cost));
+	return 0;
+}
+
+
+/** \brief Compute the variable cost of a consumption record
+
+	\param f The compiled variable cost formula of the record
+	\param args Arguments of the function instance, for the formula
+	\param args_num Number of arguments
+	\param cost Reference where the cost is going to be stored
+
+	\return zero on success, or -1 on failure
+*/
+static int
+variable_cost(const resource_formula_t *f,const resource_formula_arg_t *args,unsigned int args_num,u_int32_t *cost)
+{
+	double var_result;
+
+	if ( resource_formula_eval(f,args,args_num,&var_result) != 0 )
+	{
+		DEBUG_CMD2(printf("DEBUG resource_ctrl_aggregate: failed to calculate variable cost formula\n"));
+		return -1;
+	}
+	return result_cost(var_result,cost);
+}
+
+
+/** \brief Add the cost of n instances to an amount of resource
+	A huge batch must not wrap around into a small charge.
+
+	\param total Reference to the amount, updated on success
+	\param cost Cost of one instance
+	\param n Number of instances
+
+	\return zero on success, or -1 with errno set to ERANGE if the amount
+	would not fit in 32 bits
+*/
+static int
+add_cost(u_int32_t *total,u_int32_t cost,unsigned int n)
+{
+	u_int64_t t;
+
+	t = (u_int64_t)cost * n;
+	if ( t > 0xffffffffULL - *total )
+	{
+		DEBUG_CMD2(printf("DEBUG resource_ctrl_aggregate: required resource exceeds maximum unsigned int\n"));
+		errno = ERANGE;
+		return -1;
+	}
+	*total += (u_int32_t)t;
+	return 0;
+}
+
+
+/** \brief Aggregate the resources consumed by a function instance
+
+	Required resources are found by linear search and formulas are compiled
+	on every call, resource_ctrl_table_aggregate() finds resources in
+	constant time and uses the formulas compiled by the lookup.
+
+	\param con Consumption records of the function
+	\param con_size Number of records
+	\param req Array of required resources, of RESOURCE_CTRL_MAX_RESOURCES
+	\param req_size Number of required resources in req
+	\param args Arguments of the function instance
+	\param args_num Number of arguments
+
+	\return zero on success, or -1 on failure
+*/
 int
-resource_ctrl_aggregate(resource_consumption_t *con,size_t con_size,resource_required_t *req,size_t *req_size,snv_constpointer *args)
+resource_ctrl_aggregate(resource_consumption_t *con,size_t con_size,resource_required_t *req,size_t *req_size,const resource_formula_arg_t *args,unsigned int args_num)
 {
+	resource_formula_t f;
 	size_t i,j;
-	char buf[SNV_BUFFER_SIZE];
-	double var_result;
+	u_int32_t cost;
 
 	for(i = 0 ; i < con_size ; ++i)
 	{
@@ -166,33 +522,15 @@ resource_ctrl_aggregate(resource_consumption_t *con,size_t con_size,resource_req
 			req[j].required = con[i].fixed_cost;
 			++*req_size;
 		}
-		else
-			req[j].required += con[i].fixed_cost;
+		else if ( add_cost(&req[j].required,con[i].fixed_cost,1) != 0 )
+			return -1;
 
 		// Variable cost
-		if ( snprintfv(buf,SNV_BUFFER_SIZE,con[i].variable_cost_formula,args) >= SNV_BUFFER_SIZE )
-		{
-			DEBUG_CMD2(printf("DEBUG resource_ctrl_aggregate: variable cost formula exceeds %d characters\n",SNV_BUFFER_SIZE));
+		if ( resource_formula_compile(con[i].variable_cost_formula,&f) != 0 ||
+				variable_cost(&f,args,args_num,&cost) != 0 )
 			return -1;
-		}
-		if ( infix_expr_parse(buf,&var_result) != 0 )
-    {
-			DEBUG_CMD2(printf("DEBUG resource_ctrl_aggregate: failed to calculate variable cost formula\n"));
+		if ( add_cost(&req[j].required,cost,1) != 0 )
 			return -1;
-    }
-    if ( var_result < 0.0 )
-    {
-      DEBUG_CMD2(printf("DEBUG resource_ctrl_aggregate: negative variable cost returned\n"));
-      return -1;
-    }
-    if ( isless(var_result,4294967296.0) )
-      req[j].required += (uint32_t)lround(var_result);
-    else
-    {
-      DEBUG_CMD2(printf("DEBUG resource_ctrl_aggregate: variable cost exceeds maximum unsigned int\n"));
-      return -1;
-    }
-		DEBUG_CMD2(printf("DEBUG resource_ctrl_aggregate: variable formula=%s --> %u\n",con[i].variable_cost_formula,(uint32_t)lround(var_result)));
 	}
 
 	return 0;
@@ -210,25 +548,16 @@ resource_ctrl_aggregate(resource_consumption_t *con,size_t con_size,resource_req
 int
 resource_ctrl_resourcekey(resource_ctrl_db_t *db,char *func,char *lib,u_int32_t *rkey)
 {	
-	DBT key,data;
+	u_int32_t lib_id;
 	int e;
 
 	// Retrieve function part of key
-	bzero(&key,sizeof(key));
-	key.data = func;
-	key.size = strlen(func) + 1;
-	bzero(&data,sizeof(data));
-	if ( (e = db->DB[0]->get(db->DB[0],NULL,&key,&data,0)) != 0 )
+	if ( (e = name_id(db->DB[0],func,rkey)) != 0 )
 		goto error;
-	*rkey = *(u_int32_t *)data.data;
-	
 	// Retrieve lib part of key
-	key.data = lib;
-	key.size = strlen(lib) + 1;
-	bzero(&data,sizeof(data));
-	if ( (e = db->DB[1]->get(db->DB[1],NULL,&key,&data,0)) != 0 )
+	if ( (e = name_id(db->DB[1],lib,&lib_id)) != 0 )
 		goto error;
-	*rkey |= *(u_int32_t *)data.data << 16;
+	*rkey |= lib_id << 16;
 
 error:
 #if DEBUG > 1
@@ -238,224 +567,978 @@ error:
 	return e;
 }
 
-#if 0
-/** \brief Initialise a resource_ctrl_DBT
 
-	Allocates user memory in the DBT where DB results can be stored.
+/** \brief Looks up the function part of the keys of a function
+	The key for a library is completed by resource_ctrl_table_lookup().
 
-	\param data A reference to a resource_ctrl_DBT
-	\param size The amount of memory to allocate for the DBT
+  \param db Reference to a resource control database
+	\param func The name of the function
+	\param fid Reference where the function part of the keys is going to be stored
 
-	\return zero on success, or non-zero on failure
+	\return zero on success, or non-zero on failure. 
+	 If there was no matching function RESOURCE_DB_NOTFOUND is returned.
 */
 int
-resource_ctrl_DBT_init(resource_ctrl_DBT *data,size_t size)
+resource_ctrl_functionid(resource_ctrl_db_t *db,const char *func,u_int32_t *fid)
 {
-	bzero(data,sizeof(DBT));
-	if ( (data->data = malloc(size)) == NULL )
-		return - ENOMEM;
-	data->ulen = size;
-	data->flags = DB_DBT_USERMEM;
-	return 0;
-}
+	int e;
 
+#if DEBUG > 1
+	if ( (e = name_id(db->DB[0],func,fid)) != 0 )
+		db->DB[0]->err(db->DB[0],e,"resource_ctrl_functionid");
+#else
+	e = name_id(db->DB[0],func,fid);
+#endif
+	return e;
+}
 
-/** \brief Destroys a resource_ctrl_DBT
 
-	Frees the memory allocated for DBT.
+/** \brief Initialise a per-request lookup table
+	Memory is only allocated when lookups are memoised.
 
-	\param \data A reference to a resource_ctrl_DBT
+	\param t The table
 */
 void
-resource_ctrl_DBT_destroy(resource_ctrl_DBT *data)
+resource_ctrl_table_init(resource_ctrl_table_t *t)
 {
-	free(data->data);
+	bzero(t,sizeof(resource_ctrl_table_t));
 }
-#endif
 
 
-/** \brief Retrieve resource consumption for a key
+/** \brief Free the memory of a per-request lookup table
 
-  \param db Reference to a resource control database
-	\param rckey Key as returned by resource_ctrl_resourcekey()
-	\param con Array to place resource consumption records
-	\param con_size Number of records returned
+	\param t The table
+*/
+void
+resource_ctrl_table_free(resource_ctrl_table_t *t)
+{
+	free(t->memo);
+	free(t->libid);
+	free(t->records);
+	free(t->formulas);
+	resource_ctrl_table_init(t);
+}
 
-	\return zero on success, or non-zero on failure.
-	 If there was no matching key RESOURCE_DB_NOTFOUND is returned.
+
+/** \brief Find the library part of resource keys, memoising it in a table
+
+	\return zero on success, or non-zero on failure. 
+	 If there was no matching library RESOURCE_DB_NOTFOUND is returned.
 */
-int
-resource_ctrl_resourceconsumption(resource_ctrl_db_t *db,u_int32_t rckey,resource_consumption_t *con,size_t *con_size)
+static int
+table_libid(resource_ctrl_db_t *db,resource_ctrl_table_t *t,const char *lib,u_int32_t *lib_id)
 {
-	DBT key,data;
-	DBC *dbc = NULL;
+	struct resource_ctrl_libid *l,*old;
+	u_int32_t i,old_mask,h;
 	int e;
 
-	if ( (e = db->DB[2]->cursor(db->DB[2],NULL,&dbc,0)) != 0 )
-		goto ret;
+	// Grow when half full
+	if ( 2 * (t->libid_num + 1) > t->libid_mask + 1 )
+	{
+		old = t->libid;
+		old_mask = t->libid_mask;
+		t->libid_mask = ( old )? 2 * old_mask + 1 : TABLE_MIN_SIZE - 1;
+		if ( (t->libid = calloc(t->libid_mask + 1,sizeof(struct resource_ctrl_libid))) == NULL )
+		{
+			t->libid = old;
+			t->libid_mask = old_mask;
+			return ENOMEM;
+		}
+		for(i = 0 ; old && i <= old_mask ; i++)
+			if ( old[i].name )
+			{
+				for(h = string_hash(old[i].name) ; t->libid[h & t->libid_mask].name ; h++)
+					;
+				t->libid[h & t->libid_mask] = old[i];
+			}
+		free(old);
+	}
+
+	for(h = string_hash(lib) ; (l = t->libid + (h & t->libid_mask))->name ; h++)
+		if ( strcmp(l->name,lib) == 0 )
+		{
+			*lib_id = l->id;
+			return l->status;
+		}
+
+	if ( (e = name_id(db->DB[1],lib,&l->id)) != 0 && e != RESOURCE_DB_NOTFOUND )
+		return e;
+	l->name = lib;
+	l->status = e;
+	++t->libid_num;
+	*lib_id = l->id;
+	return e;
+}
+
+
+/** \brief Find the memoised consumption lookup of a key in a table
+
+	\return the entry of the key, or an unused entry for it
+*/
+static struct resource_ctrl_memo *
+table_memo(resource_ctrl_table_t *t,u_int32_t rkey)
+{
+	u_int32_t h;
+
+	for(h = KEY_HASH(rkey) ; t->memo[h & t->memo_mask].used && t->memo[h & t->memo_mask].rkey != rkey ; h++)
+		;
+	return t->memo + (h & t->memo_mask);
+}
+
+
+/** \brief Retrieve the resource consumption of a library function,
+	memoising the lookups in a per-request table
+	The variable cost formulas of the records are compiled once, when they
+	are looked up.
+
+  \param db Reference to a resource control database
+	\param t The table
+	\param fid The function part of the key, as returned by resource_ctrl_functionid()
+	\param lib The name of the library. It must remain valid while the table is used
+	\param con Reference where the records are going to be stored. They are valid
+	until the next lookup
+	\param con_size Number of records returned
+
+	\return zero on success, or non-zero on failure.
+	 If there was no matching key RESOURCE_DB_NOTFOUND is returned, and if
+	 a variable cost formula is invalid EINVAL.
+*/
+int
+resource_ctrl_table_lookup(resource_ctrl_db_t *db,resource_ctrl_table_t *t,u_int32_t fid,const char *lib,resource_consumption_t **con,size_t *con_size)
+{
+	struct resource_ctrl_memo *m,*old;
+	resource_consumption_t *records;
+	resource_formula_t *formulas;
+	DBT key,data;
+	DBC *dbc = NULL;
+	u_int32_t lib_id,rkey,i,old_mask;
+	size_t size;
+	int e;
+
+	if ( (e = table_libid(db,t,lib,&lib_id)) != 0 )
+		return e;
+	rkey = fid | lib_id << 16;
+
+	// Grow when half full
+	if ( 2 * (t->memo_num + 1) > t->memo_mask + 1 )
+	{
+		old = t->memo;
+		old_mask = t->memo_mask;
+		t->memo_mask = ( old )? 2 * old_mask + 1 : TABLE_MIN_SIZE - 1;
+		if ( (t->memo = calloc(t->memo_mask + 1,sizeof(struct resource_ctrl_memo))) == NULL )
+		{
+			t->memo = old;
+			t->memo_mask = old_mask;
+			return ENOMEM;
+		}
+		for(i = 0 ; old && i <= old_mask ; i++)
+			if ( old[i].used )
+				*table_memo(t,old[i].rkey) = old[i];
+		free(old);
+	}
+
+	if ( (m = table_memo(t,rkey))->used )
+		goto found;
+
+	m->rkey = rkey;
+	m->first = t->records_num;
+	m->num = 0;
+	if ( (e = db->DB[2]->cursor(db->DB[2],NULL,&dbc,0)) != 0 )
+		goto ret;
+	bzero(&key,sizeof(key));
+	key.data = &rkey;
+	key.size = sizeof(rkey);
+	bzero(&data,sizeof(data));
+	for(e = dbc->c_get(dbc,&key,&data,DB_SET) ; e == 0 ; e = dbc->c_get(dbc,&key,&data,DB_NEXT_DUP))
+	{
+		if ( t->records_num >= t->records_size )
+		{
+			size = ( t->records_size )? 2 * t->records_size : TABLE_MIN_SIZE;
+			if ( (records = realloc(t->records,size * sizeof(resource_consumption_t))) == NULL )
+			{
+				e = ENOMEM;
+				goto ret;
+			}
+			t->records = records;
+			if ( (formulas = realloc(t->formulas,size * sizeof(resource_formula_t))) == NULL )
+			{
+				e = ENOMEM;
+				goto ret;
+			}
+			t->formulas = formulas;
+			t->records_size = size;
+		}
+		records = t->records + t->records_num;
+		memcpy(records,data.data,sizeof(resource_consumption_t));
+		records->variable_cost_formula[RESOURCE_CTRL_MAX_VAR_FORM_LEN - 1] = '\0';
+		// Formulas are compiled once per request
+		if ( resource_formula_compile(records->variable_cost_formula,t->formulas + t->records_num) != 0 )
+		{
+			e = EINVAL;
+			goto ret;
+		}
+		++t->records_num;
+		++m->num;
+	}
+	if ( e == DB_NOTFOUND )
+	{
+		e = 0;
+		m->used = 1;
+		++t->memo_num;
+	}
+
+ret:
+	if ( dbc )
+		dbc->c_close(dbc);
+	if ( e != 0 )
+	{
+		// Drop the records of a failed lookup
+		t->records_num = m->first;
+#if DEBUG > 1
+		db->DB[2]->err(db->DB[2],e,"resource_ctrl_table_lookup");
+#endif
+		return e;
+	}
+
+found:
+	if ( m->num == 0 )
+		return RESOURCE_DB_NOTFOUND;
+	*con = t->records + m->first;
+	*con_size = m->num;
+	return 0;
+}
+
+
+/** \brief Find the slot of a required resource in a table
+	The slot of each required resource is found by hashing its key. A
+	resource that isn't required yet is added, requiring nothing.
+
+	\return the required resource, or NULL if the table is full
+*/
+static resource_required_t *
+table_required(resource_ctrl_table_t *t,u_int32_t rkey)
+{
+	resource_required_t *req;
+	u_int32_t h;
+
+	for(h = KEY_HASH(rkey) ; t->slot[h % RESOURCE_CTRL_SLOTS] ; h++)
+		if ( t->required[t->slot[h % RESOURCE_CTRL_SLOTS] - 1].rkey == rkey )
+			return t->required + t->slot[h % RESOURCE_CTRL_SLOTS] - 1;
+
+	if ( t->required_num >= RESOURCE_CTRL_MAX_RESOURCES )
+		return NULL;
+	req = t->required + t->required_num++;
+	t->slot[h % RESOURCE_CTRL_SLOTS] = t->required_num;
+	req->rkey = rkey;
+	req->required = 0;
+	return req;
+}
+
+
+/** \brief Aggregate the resources consumed by a function instance in a table
+
+	\param t The table
+	\param con Consumption records of the function, as returned by
+	resource_ctrl_table_lookup()
+	\param con_size Number of records
+	\param args Arguments of the function instance
+	\param args_num Number of arguments
+
+	\return zero on success, or -1 on failure. errno is ERANGE if a required
+	amount would not fit in 32 bits
+*/
+int
+resource_ctrl_table_aggregate(resource_ctrl_table_t *t,resource_consumption_t *con,size_t con_size,const resource_formula_arg_t *args,unsigned int args_num)
+{
+	const resource_formula_t *formulas = t->formulas + (con - t->records);
+	resource_required_t *req;
+	u_int32_t cost;
+	size_t i;
+
+	for(i = 0 ; i < con_size ; ++i)
+	{
+		if ( (req = table_required(t,con[i].rkey)) == NULL )
+			return -1;
+		// Fixed cost
+		if ( add_cost(&req->required,con[i].fixed_cost,1) != 0 )
+			return -1;
+
+		// Variable cost
+		if ( variable_cost(formulas + i,args,args_num,&cost) != 0 )
+			return -1;
+		if ( add_cost(&req->required,cost,1) != 0 )
+			return -1;
+	}
+
+	return 0;
+}
+
+
+/** \brief Aggregate the resources consumed by all the instances of a function in a table
+	Equivalent to calling resource_ctrl_table_aggregate() for each instance,
+	but each formula is evaluated on blocks of instances by
+	resource_formula_eval_block(), and only once if it has no arguments.
+
+	\param t The table
+	\param con Consumption records of the function, as returned by
+	resource_ctrl_table_lookup()
+	\param con_size Number of records
+	\param cols Columns of the values of each argument of the instances
+	\param args_num Number of arguments
+	\param n Number of instances
+
+	\return zero on success, or -1 on failure. errno is ERANGE if a required
+	amount would not fit in 32 bits
+*/
+int
+resource_ctrl_table_aggregate_batch(resource_ctrl_table_t *t,resource_consumption_t *con,size_t con_size,const resource_formula_col_t *cols,unsigned int args_num,unsigned int n)
+{
+	const resource_formula_t *formulas = t->formulas + (con - t->records);
+	double res[RESOURCE_FORMULA_BLOCK];
+	resource_required_t *req;
+	u_int32_t cost,sum;
+	unsigned int first,j,block;
+	size_t i;
+
+	if ( n == 0 )
+		return 0;
+	for(i = 0 ; i < con_size ; ++i)
+	{
+		if ( (req = table_required(t,con[i].rkey)) == NULL )
+			return -1;
+		// Fixed cost
+		if ( add_cost(&req->required,con[i].fixed_cost,n) != 0 )
+			return -1;
+
+		// Variable cost, the same for every instance without arguments
+		if ( formulas[i].args == 0 )
+		{
+			if ( variable_cost(formulas + i,NULL,0,&cost) != 0 )
+				return -1;
+			if ( add_cost(&req->required,cost,n) != 0 )
+				return -1;
+			continue;
+		}
+		for(sum = 0, first = 0 ; first < n ; first += block)
+		{
+			block = ( n - first < RESOURCE_FORMULA_BLOCK )? n - first : RESOURCE_FORMULA_BLOCK;
+			if ( resource_formula_eval_block(formulas + i,cols,args_num,first,block,res) != 0 )
+				return -1;
+			for(j = 0 ; j < block ; j++)
+			{
+				if ( result_cost(res[j],&cost) != 0 )
+					return -1;
+				if ( add_cost(&sum,cost,1) != 0 )
+					return -1;
+			}
+		}
+		if ( add_cost(&req->required,sum,1) != 0 )
+			return -1;
+	}
+
+	return 0;
+}
+
+#if 0
+/** \brief Initialise a resource_ctrl_DBT
+
+	Allocates user memory in the DBT where DB results can be stored.
+
+	\param data A reference to a resource_ctrl_DBT
+	\param size The amount of memory to allocate for the DBT
+
+	\return zero on success, or non-zero on failure
+*/
+int
+resource_ctrl_DBT_init(resource_ctrl_DBT *data,size_t size)
+{
+	bzero(data,sizeof(DBT));
+	if ( (data->data = malloc(size)) == NULL )
+		return - ENOMEM;
+	data->ulen = size;
+	data->flags = DB_DBT_USERMEM;
+	return 0;
+}
+
+
+/** \brief Destroys a resource_ctrl_DBT
+
+	Frees the memory allocated for DBT.
+
+	\param \data A reference to a resource_ctrl_DBT
+*/
+void
+resource_ctrl_DBT_destroy(resource_ctrl_DBT *data)
+{
+	free(data->data);
+}
+#endif
+
+
+/** \brief Retrieve resource consumption for a key
+
+  \param db Reference to a resource control database
+	\param rckey Key as returned by resource_ctrl_resourcekey()
+	\param con Array to place resource consumption records
+	\param con_size Number of records returned
+
+	\return zero on success, or non-zero on failure.
+	 If there was no matching key RESOURCE_DB_NOTFOUND is returned.
+*/
+int
+resource_ctrl_resourceconsumption(resource_ctrl_db_t *db,u_int32_t rckey,resource_consumption_t *con,size_t *con_size)
+{
+	DBT key,data;
+	DBC *dbc = NULL;
+	int e;
+
+	if ( (e = db->DB[2]->cursor(db->DB[2],NULL,&dbc,0)) != 0 )
+		goto ret;
+
+	bzero(&key,sizeof(key));
+	key.data = &rckey;
+	key.size = sizeof(rckey);
+	bzero(&data,sizeof(data));
+
+	*con_size = 0;
+
+	// Get first record
+	if ( (e = dbc->c_get(dbc,&key,&data,DB_SET)) != 0 )
+		goto ret;
+
+	do {
+		memcpy(con + *con_size,data.data,sizeof(resource_consumption_t));
+		++*con_size;
+	} while( (e = dbc->c_get(dbc,&key,&data,DB_NEXT_DUP)) == 0 );
+	if ( e == DB_NOTFOUND )
+		e = 0;
+
+ret:
+	if ( dbc )
+		dbc->c_close(dbc);
+#if DEBUG > 1
+	if ( e != 0 )
+		db->DB[2]->err(db->DB[2],e,"resource_ctrl_resourceconsumption");
+#endif
+	return e;
+}
+
+
+/** \brief Check that required resources are available
+  \param db Reference to a resource control database
+	\param rr Array of required resources
+	\param rr_size Size of rr array
+
+	\return zero on success, or non-zero on failure
+	A positive value indicates the resource that failed, 
+	while a negative a DB error
+*/
+int
+resource_ctrl_check(resource_ctrl_db_t *db,resource_required_t *rr,size_t rr_size)
+{
+	DBT key,data;
+	size_t i;
+	int e;
+
+	bzero(&key,sizeof(key));
+	key.size = sizeof(u_int32_t);
+	bzero(&data,sizeof(data));
+	data.flags = DB_DBT_PARTIAL;
+	data.doff = 0;
+	data.dlen = sizeof(u_int32_t);
+
+	for(i = 0 ; i < rr_size ; i++)
+	{
+		key.data = &(rr[i].rkey);
+		if ( (e = db->DB[3]->get(db->DB[3],NULL,&key,&data,0)) != 0 )
+		{
+			DEBUG_CMD2(db->DB[3]->err(db->DB[3],e,"resource_ctrl_check"));
+			return e;
+		}
+		if ( rr[i].required > *(u_int32_t *)data.data )
+			return (int)i;
+	}
+	return 0;
+}
+
+
+/** \brief Adjusts available resources values within a transaction
+
+  \param db Reference to a resource control database
+	\param tid Transaction the adjustment is part of
+	\param rr Required resources that indicate adjustment to be made
+	\param rr_size Size of rr array
+	\param type Type of adjustment:
+	\li INCREASE Increase resource values
+	\li DECREASE Decrease resource values
+
+	\return zero on success, or non-zero on failure
+	 If there was no matching resource RESOURCE_DB_NOTFOUND is returned.
+	*/
+static int
+resource_ctrl_adjust_txn(resource_ctrl_db_t *db,DB_TXN *tid,resource_required_t *rr,size_t rr_size,ADJ_TYPE type)
+{
+	DBT key,data;
+	size_t i;
+	u_int32_t new_value;
+	int e;
+
+	bzero(&key,sizeof(key));
+	key.size = sizeof(u_int32_t);
+	bzero(&data,sizeof(data));
+	data.flags = DB_DBT_PARTIAL;
+	data.doff = 0;
+	data.dlen = sizeof(u_int32_t);
+	data.size = sizeof(u_int32_t);
+
+	for(i = 0 ; i < rr_size ; i++)
+	{
+		key.data = &rr[i].rkey;
+		// Read available resources
+		if ( (e = db->DB[3]->get(db->DB[3],tid,&key,&data,0)) != 0 )
+			return e;
+		if ( type == DECREASE &&  rr[i].required > *(u_int32_t *)data.data )
+			return RESOURCE_CTRL_FAIL;
+		// Store new value for available resources
+		if ( type == DECREASE )
+			new_value = *(u_int32_t *)data.data - rr[i].required;
+		else 
+			new_value = *(u_int32_t *)data.data + rr[i].required;
+		data.data = &new_value;
+		if ( (e = db->DB[3]->put(db->DB[3],tid,&key,&data,0)) != 0 )
+			return e;
+	}
+
+	return 0;
+}
+
+
+/** \brief Adjusts available resources values
+
+  \param db Reference to a resource control database
+	\param rr Required resources that indicate adjustment to be made
+	\param rr_size Size of rr array
+	\param type Type of adjustment:
+	\li INCREASE Increase resource values
+	\li DECREASE Decrease resource values
+
+	\return zero on success, or non-zero on failure
+	 If there was no matching resource RESOURCE_DB_NOTFOUND is returned.
+	*/
+static int
+resource_ctrl_adjust(resource_ctrl_db_t *db,resource_required_t *rr,size_t rr_size,ADJ_TYPE type)
+{
+	DB_TXN *tid;
+	int e;
+
+	// BEGIN transaction
+	if ( (e = txn_begin(db->ENV,NULL,&tid,0)) != 0 )
+		return e;
+
+	if ( (e = resource_ctrl_adjust_txn(db,tid,rr,rr_size,type)) != 0 )
+	{
+		// ABORT transaction
+		txn_abort(tid);
+		return e;
+	}
+
+	// COMMIT transaction
+	return txn_commit(tid,0);
+}
+
+
+/** \brief Allocate required resources
+  \param db Reference to a resource control database
+	\param rr Array of required resources
+	\param rr_size Size of rr array
+
+	\return zero on success, or non-zero on failure.
+	 If there was no matching resource RESOURCE_DB_NOTFOUND is returned.
+*/
+int
+resource_ctrl_allocate(resource_ctrl_db_t *db,resource_required_t *rr,size_t rr_size)
+{
+	return resource_ctrl_adjust(db,rr,rr_size,DECREASE);
+}
+
+
+/** \brief Deallocate assigned resources
+
+  \param db Reference to a resource control database
+	\param rr Array of required resources
+	\param rr_size Size of rr array
+
+	\return zero on success, or non-zero on failure.
+	 If there was no matching resource RESOURCE_DB_NOTFOUND is returned.
+*/
+int
+resource_ctrl_deallocate(resource_ctrl_db_t *db,resource_required_t *rr,size_t rr_size)
+{
+	return resource_ctrl_adjust(db,rr,rr_size,INCREASE);
+}
+
+/** \brief Allocate required resources for a limited amount of time
+
+	The resources are returned to the database when the lease is released
+	with resource_ctrl_lease_release(), or by authd when the lease expires
+	without being renewed.
+
+  \param db Reference to a resource control database
+	\param rr Array of required resources
+	\param rr_size Size of rr array
+	\param duration Duration of the lease in seconds
+	\param lease_id Reference where the id of the new lease is going to be stored
+
+	\return zero on success, or non-zero on failure.
+	 If there was no matching resource RESOURCE_DB_NOTFOUND is returned.
+*/
+int
+resource_ctrl_lease_allocate(resource_ctrl_db_t *db,resource_required_t *rr,size_t rr_size,u_int32_t duration,u_int32_t *lease_id)
+{
+	DBT key,data;
+	DB_TXN *tid;
+	resource_lease_t lease;
+	u_int32_t lkey,next_id,first_id;
+	int e;
+
+	if ( db->DB[4] == NULL )
+		return ENOENT;
+	if ( rr_size > RESOURCE_CTRL_MAX_RESOURCES )
+		return EINVAL;
+
+	// BEGIN transaction
+	if ( (e = txn_begin(db->ENV,NULL,&tid,0)) != 0 )
+		return e;
+
+	if ( (e = resource_ctrl_adjust_txn(db,tid,rr,rr_size,DECREASE)) != 0 )
+		goto abort;
+
+	// Get next lease id
+	lkey = LEASE_SEQ_KEY;
+	bzero(&key,sizeof(key));
+	key.data = &lkey;
+	key.size = sizeof(lkey);
+	bzero(&data,sizeof(data));
+	if ( (e = db->DB[4]->get(db->DB[4],tid,&key,&data,0)) == 0 )
+		next_id = *(u_int32_t *)data.data;
+	else if ( e == DB_NOTFOUND )
+		next_id = 1;
+	else
+		goto abort;
+
+	// Store lease. Keys are big endian so that leases are sorted by id
+	// After the ids wrap around, those of leases still held are skipped
+	lease.expires = (u_int32_t)time(NULL) + duration;
+	lease.resources_num = rr_size;
+	memcpy(lease.required,rr,rr_size * sizeof(resource_required_t));
+	first_id = next_id;
+	for(;;)
+	{
+		lkey = htonl(next_id);
+		bzero(&data,sizeof(data));
+		data.data = &lease;
+		data.size = RESOURCE_LEASE_SIZE(rr_size);
+		if ( (e = db->DB[4]->put(db->DB[4],tid,&key,&data,DB_NOOVERWRITE)) == 0 )
+			break;
+		if ( e != DB_KEYEXIST )
+			goto abort;
+		if ( ++next_id == LEASE_SEQ_KEY )
+			next_id = 1;
+		if ( next_id == first_id )
+		{
+			e = ENOSPC;
+			goto abort;
+		}
+	}
+	*lease_id = next_id;
+
+	// Store the id of the next lease
+	if ( ++next_id == LEASE_SEQ_KEY )
+		next_id = 1;
+	lkey = LEASE_SEQ_KEY;
+	bzero(&data,sizeof(data));
+	data.data = &next_id;
+	data.size = sizeof(next_id);
+	if ( (e = db->DB[4]->put(db->DB[4],tid,&key,&data,0)) != 0 )
+		goto abort;
+
+	// COMMIT transaction
+	return txn_commit(tid,0);
+
+abort:
+	// ABORT transaction
+	txn_abort(tid);
+	DEBUG_CMD2(db->DB[4]->err(db->DB[4],e,"resource_ctrl_lease_allocate"));
+	return e;
+}
+
+
+/** \brief Renew a lease
+
+	Only the expiration time of the lease is updated.
+
+  \param db Reference to a resource control database
+	\param lease_id Id of the lease as returned by resource_ctrl_lease_allocate()
+	\param duration Duration of the lease in seconds, from now
+
+	\return zero on success, or non-zero on failure.
+	 If the lease has already expired RESOURCE_DB_NOTFOUND is returned.
+*/
+int
+resource_ctrl_lease_renew(resource_ctrl_db_t *db,u_int32_t lease_id,u_int32_t duration)
+{
+	DBT key,data;
+	DB_TXN *tid;
+	u_int32_t lkey,expires;
+	int e;
+
+	if ( db->DB[4] == NULL )
+		return ENOENT;
+
+	lkey = htonl(lease_id);
+	bzero(&key,sizeof(key));
+	key.data = &lkey;
+	key.size = sizeof(lkey);
+	bzero(&data,sizeof(data));
+	data.flags = DB_DBT_PARTIAL;
+	data.doff = 0;
+	data.dlen = sizeof(u_int32_t);
+
+	// BEGIN transaction
+	if ( (e = txn_begin(db->ENV,NULL,&tid,0)) != 0 )
+		return e;
+
+	// A partial put would create a missing record, so check first
+	if ( lease_id == LEASE_SEQ_KEY || 
+			(e = db->DB[4]->get(db->DB[4],tid,&key,&data,0)) != 0 )
+	{
+		txn_abort(tid);
+		return ( lease_id == LEASE_SEQ_KEY )? DB_NOTFOUND : e;
+	}
+
+	expires = (u_int32_t)time(NULL) + duration;
+	data.data = &expires;
+	data.size = sizeof(expires);
+	if ( (e = db->DB[4]->put(db->DB[4],tid,&key,&data,0)) != 0 )
+	{
+		txn_abort(tid);
+		return e;
+	}
+
+	return txn_commit(tid,0);
+}
+
+
+/** \brief Release or expire a lease
+
+  \param db Reference to a resource control database
+	\param lease_id Id of the lease
+	\param now Only release the lease if it expires before now. Zero 
+	releases the lease unconditionally
+	\param expires If not NULL, the expiration time of the lease is stored here
+
+	\return zero on success, or non-zero on failure.
+	 If there was no matching lease RESOURCE_DB_NOTFOUND is returned.
+*/
+static int
+resource_ctrl_lease_free(resource_ctrl_db_t *db,u_int32_t lease_id,u_int32_t now,u_int32_t *expires)
+{
+	DBT key,data;
+	DB_TXN *tid;
+	resource_lease_t lease;
+	u_int32_t lkey;
+	int e;
+
+	if ( db->DB[4] == NULL )
+		return ENOENT;
+	if ( lease_id == LEASE_SEQ_KEY )
+		return DB_NOTFOUND;
+
+	lkey = htonl(lease_id);
+	bzero(&key,sizeof(key));
+	key.data = &lkey;
+	key.size = sizeof(lkey);
+	bzero(&data,sizeof(data));
+	data.data = &lease;
+	data.ulen = sizeof(lease);
+	data.flags = DB_DBT_USERMEM;
+
+	// BEGIN transaction
+	if ( (e = txn_begin(db->ENV,NULL,&tid,0)) != 0 )
+		return e;
+
+	if ( (e = db->DB[4]->get(db->DB[4],tid,&key,&data,0)) != 0 )
+		goto abort;
+	if ( expires )
+		*expires = lease.expires;
+	// Renewed after it was scheduled to expire
+	if ( now != 0 && lease.expires > now )
+		goto abort;
+
+	if ( (e = resource_ctrl_adjust_txn(db,tid,lease.required,lease.resources_num,INCREASE)) != 0 )
+		goto abort;
+	if ( (e = db->DB[4]->del(db->DB[4],tid,&key,0)) != 0 )
+		goto abort;
+
+	// COMMIT transaction
+	return txn_commit(tid,0);
+
+abort:
+	// ABORT transaction
+	txn_abort(tid);
+	return e;
+}
+
+
+/** \brief Release a lease before it expires
+
+	Returns the leased resources to the database.
+
+  \param db Reference to a resource control database
+	\param lease_id Id of the lease as returned by resource_ctrl_lease_allocate()
+
+	\return zero on success, or non-zero on failure.
+	 If the lease has already expired RESOURCE_DB_NOTFOUND is returned.
+*/
+int
+resource_ctrl_lease_release(resource_ctrl_db_t *db,u_int32_t lease_id)
+{
+	return resource_ctrl_lease_free(db,lease_id,0,NULL);
+}
 
-	bzero(&key,sizeof(key));
-	key.data = &rckey;
-	key.size = sizeof(rckey);
-	bzero(&data,sizeof(data));
 
-	*con_size = 0;
+/** \brief Expire a lease
 
-	// Get first record
-	if ( (e = dbc->c_get(dbc,&key,&data,DB_SET)) != 0 )
-		goto ret;
+	Returns the leased resources to the database if the lease has 
+	not been renewed past now.
 
-	do {
-		memcpy(con + *con_size,data.data,sizeof(resource_consumption_t));
-		++*con_size;
-	} while( (e = dbc->c_get(dbc,&key,&data,DB_NEXT_DUP)) == 0 );
-	if ( e == DB_NOTFOUND )
-		e = 0;
+  \param db Reference to a resource control database
+	\param lease_id Id of the lease
+	\param now Current time
+	\param expires Reference where the expiration time of the lease is 
+	stored. If it is after now, the lease was renewed and has not expired
 
-ret:
-	if ( dbc )
-		dbc->c_close(dbc);
-#if DEBUG > 1
-	if ( e != 0 )
-		db->DB[2]->err(db->DB[2],e,"resource_ctrl_resourceconsumption");
-#endif
-	return e;
+	\return zero on success, or non-zero on failure.
+	 If there was no matching lease RESOURCE_DB_NOTFOUND is returned.
+*/
+int
+resource_ctrl_lease_expire(resource_ctrl_db_t *db,u_int32_t lease_id,u_int32_t now,u_int32_t *expires)
+{
+	return resource_ctrl_lease_free(db,lease_id,now,expires);
 }
 
 
-/** \brief Check that required resources are available
+/** \brief Get the id the next lease will be given
+
+	Ids wrap around, so leases allocated since the sequence was at some id
+	are those from that id up to, but not including, the next one.
+
   \param db Reference to a resource control database
-	\param rr Array of required resources
-	\param rr_size Size of rr array
+	\param next_id Reference where the id is stored
 
 	\return zero on success, or non-zero on failure
-	A positive value indicates the resource that failed, 
-	while a negative a DB error
 */
 int
-resource_ctrl_check(resource_ctrl_db_t *db,resource_required_t *rr,size_t rr_size)
+resource_ctrl_lease_next(resource_ctrl_db_t *db,u_int32_t *next_id)
 {
 	DBT key,data;
-	size_t i;
+	u_int32_t lkey;
 	int e;
 
+	if ( db->DB[4] == NULL )
+		return ENOENT;
+
+	lkey = LEASE_SEQ_KEY;
 	bzero(&key,sizeof(key));
-	key.size = sizeof(u_int32_t);
+	key.data = &lkey;
+	key.size = sizeof(lkey);
 	bzero(&data,sizeof(data));
-	data.flags = DB_DBT_PARTIAL;
-	data.doff = 0;
-	data.dlen = sizeof(u_int32_t);
-
-	for(i = 0 ; i < rr_size ; i++)
+	if ( (e = db->DB[4]->get(db->DB[4],NULL,&key,&data,0)) == 0 )
+		*next_id = *(u_int32_t *)data.data;
+	else if ( e == DB_NOTFOUND )
 	{
-		key.data = &(rr[i].rkey);
-		if ( (e = db->DB[3]->get(db->DB[3],NULL,&key,&data,0)) != 0 )
-		{
-			DEBUG_CMD2(db->DB[3]->err(db->DB[3],e,"resource_ctrl_check"));
-			return e;
-		}
-		if ( rr[i].required > *(u_int32_t *)data.data )
-			return (int)i;
+		*next_id = 1;
+		e = 0;
 	}
-	return 0;
+	return e;
 }
 
 
-/** \brief Adjusts available resources values
-
-  \param db Reference to a resource control database
-	\param rr Required resources that indicate adjustment to be made
-	\param rr_size Size of rr array
-	\param type Type of adjustment:
-	\li INCREASE Increase resource values
-	\li DECREASE Decrease resource values
-
-	\return zero on success, or non-zero on failure
-	 If there was no matching resource RESOURCE_DB_NOTFOUND is returned.
+/**
+	Visits the leases with ids from from up to, but not including, to, or 
+	all the leases from from if to is LEASE_SEQ_KEY
 	*/
 static int
-resource_ctrl_adjust(resource_ctrl_db_t *db,resource_required_t *rr,size_t rr_size,ADJ_TYPE type)
+resource_ctrl_lease_scan_range(DBC *dbc,u_int32_t from,u_int32_t to,resource_lease_cb_t cb,void *arg)
 {
 	DBT key,data;
-	size_t i;
-	u_int32_t new_value;
-	DB_TXN *tid;
+	u_int32_t lkey;
 	int e;
 
+	lkey = htonl(from);
 	bzero(&key,sizeof(key));
-	key.size = sizeof(u_int32_t);
+	key.data = &lkey;
+	key.size = sizeof(lkey);
 	bzero(&data,sizeof(data));
 	data.flags = DB_DBT_PARTIAL;
 	data.doff = 0;
 	data.dlen = sizeof(u_int32_t);
-	data.size = sizeof(u_int32_t);
-
-	// BEGIN transaction
-	if ( (e = txn_begin(db->ENV,NULL,&tid,0)) != 0 )
-		return e;
 
-	for(i = 0 ; i < rr_size ; i++)
+	for(e = dbc->c_get(dbc,&key,&data,DB_SET_RANGE) ; e == 0 ; 
+			e = dbc->c_get(dbc,&key,&data,DB_NEXT))
 	{
-		key.data = &rr[i].rkey;
-		// Read available resources
-		if ( (e = db->DB[3]->get(db->DB[3],tid,&key,&data,0)) != 0 )
-			goto abort;
-		if ( type == DECREASE &&  rr[i].required > *(u_int32_t *)data.data )
-		{
-			e = RESOURCE_CTRL_FAIL;
-			goto abort;
-		}
-		// Store new value for available resources
-		if ( type == DECREASE )
-			new_value = *(u_int32_t *)data.data - rr[i].required;
-		else 
-			new_value = *(u_int32_t *)data.data + rr[i].required;
-		data.data = &new_value;
-		if ( (e = db->DB[3]->put(db->DB[3],tid,&key,&data,0)) != 0 )
-			goto abort;
+		lkey = ntohl(*(u_int32_t *)key.data);
+		if ( lkey == LEASE_SEQ_KEY )
+			continue;
+		if ( to != LEASE_SEQ_KEY && lkey >= to )
+			break;
+		if ( (e = cb(lkey,*(u_int32_t *)data.data,arg)) != 0 )
+			return e;
 	}
+	return ( e == DB_NOTFOUND )? 0 : e;
+}
 
-	// COMMIT transaction
-	e = txn_commit(tid,0);
-	return e;
 
-abort:
-	// ABORT transaction
-	txn_abort(tid);
-	return e;
-}
+/** \brief Walk through leases in order of id
 
+	The ids visited wrap around like the lease ids do: if to is not after 
+	from, leases from from up to the largest id are visited first, and then 
+	leases from 1 up to to.
 
-/** \brief Allocate required resources
   \param db Reference to a resource control database
-	\param rr Array of required resources
-	\param rr_size Size of rr array
-
-	\return zero on success, or non-zero on failure.
-	 If there was no matching resource RESOURCE_DB_NOTFOUND is returned.
+	\param from Id of the first lease to visit
+	\param to Id after the last lease to visit, or 0 to visit all the leases 
+	from from. Nothing is visited if it is equal to from
+	\param cb Function called with the id and expiration time of each lease.
+	The scan stops if it returns non-zero
+	\param arg Passed to cb
+
+	\return zero on success, the non-zero value returned by cb, or a DB error
 */
 int
-resource_ctrl_allocate(resource_ctrl_db_t *db,resource_required_t *rr,size_t rr_size)
+resource_ctrl_lease_scan(resource_ctrl_db_t *db,u_int32_t from,u_int32_t to,resource_lease_cb_t cb,void *arg)
 {
-	return resource_ctrl_adjust(db,rr,rr_size,DECREASE);
-}
+	DBC *dbc;
+	int e;
 
+	if ( db->DB[4] == NULL )
+		return ENOENT;
+	if ( from == to )
+		return 0;
 
-/** \brief Deallocate assigned resources
+	if ( (e = db->DB[4]->cursor(db->DB[4],NULL,&dbc,0)) != 0 )
+		return e;
 
-  \param db Reference to a resource control database
-	\param rr Array of required resources
-	\param rr_size Size of rr array
+	if ( to == LEASE_SEQ_KEY || from < to )
+		e = resource_ctrl_lease_scan_range(dbc,from,to,cb,arg);
+	else if ( (e = resource_ctrl_lease_scan_range(dbc,from,LEASE_SEQ_KEY,cb,arg)) == 0 )
+		e = resource_ctrl_lease_scan_range(dbc,1,to,cb,arg);
 
-	\return zero on success, or non-zero on failure.
-	 If there was no matching resource RESOURCE_DB_NOTFOUND is returned.
-*/
-int
-resource_ctrl_deallocate(resource_ctrl_db_t *db,resource_required_t *rr,size_t rr_size)
-{
-	return resource_ctrl_adjust(db,rr,rr_size,INCREASE);
+	dbc->c_close(dbc);
+	return e;
 }
 
+
 /**
 	Prints function and library records
 	*/
@@ -548,6 +1631,41 @@ resource_ctrl_display_resources(resource_ctrl_db_t *db)
 }
 
 
+/**
+	Prints lease records
+	*/
+static void
+DBT_print_lease(const DBT *key,const DBT *data)
+{
+	resource_lease_t *lease = (resource_lease_t *)data->data;
+	u_int32_t i;
+	long remaining;
+
+	if ( *(u_int32_t *)key->data == LEASE_SEQ_KEY )
+		return;
+	remaining = (long)lease->expires - (long)time(NULL);
+	printf("%u: expires in %lds",ntohl(*(u_int32_t *)key->data),remaining);
+	for(i = 0 ; i < lease->resources_num ; i++)
+		printf(" %u=%u",lease->required[i].rkey,lease->required[i].required);
+	putchar('\n');
+}
+
+
+/** \brief Display all leases in database
+
+  \param db Reference to a resource control database
+
+	\return zero on success, or non-zero on failure
+	*/
+int
+resource_ctrl_display_leases(resource_ctrl_db_t *db)
+{
+	if ( db->DB[4] == NULL )
+		return ENOENT;
+	return resource_ctrl_display_db(db,4,DBT_print_lease);
+}
+
+
 /** \brief Display resource consumption for a specific library function
 
   \param db Reference to a resource control database
@@ -676,6 +1794,7 @@ resource_ctrl_put_struct(resource_ctrl_db_t *db,unsigned int db_index,u_int32_t
 
 
 /** \brief Add a resource consumption record in database
+	Records with an invalid variable cost formula are rejected with EINVAL.
 
   \param db Reference to a resource control database
 	\param pk Primary key for record
@@ -686,6 +1805,13 @@ resource_ctrl_put_struct(resource_ctrl_db_t *db,unsigned int db_index,u_int32_t
 int
 resource_ctrl_add_consumption(resource_ctrl_db_t *db,u_int32_t pk,resource_consumption_t *consumption)
 {
+	resource_formula_t f;
+	int e;
+
+	if ( resource_formula_compile(consumption->variable_cost_formula,&f) != 0 )
+		return EINVAL;
+	if ( (e = resource_ctrl_index_consumption(db,NULL,pk)) != 0 )
+		return e;
 	return resource_ctrl_put_struct(db,2,pk,consumption,sizeof(resource_consumption_t));
 }
 
@@ -705,145 +1831,84 @@ resource_ctrl_add_resource(resource_ctrl_db_t *db,u_int32_t rkey,resource_t *res
 }
 
 
-/** \brief Delete function from database
-	Also deletes all the resource consumption records associated with
-	the function.
-
-  \param db Reference to a resource control database
-	\param func Function to delete
-
-	\return zero on success, or non-zero on failure
+/**
+	Deletes a function or library, and its resource consumption records
 	*/
-int 
-resource_ctrl_del_function(resource_ctrl_db_t *db,char *func)
+static int
+resource_ctrl_del_key_str(resource_ctrl_db_t *db,unsigned int db_index,unsigned int index_db,char *str)
 {
 	DB_TXN *tid;
 	DBT key,data;
-	DBC *dbc;
+	u_int32_t part;
 	int e;
-	u_int32_t pk;
+
+	if ( db->DB[index_db] == NULL )
+		return ENOENT;
 
 	bzero(&key,sizeof(key));
-	key.data = func;
-	key.size = strlen(func) + 1;
+	key.data = str;
+	key.size = strlen(str) + 1;
 	bzero(&data,sizeof(data));
 
-	// Get function part key
-	if ( (e = db->DB[0]->get(db->DB[0],NULL,&key,&data,0)) != 0 )
-		return e;
-
-	pk = *(u_int32_t *)data.data;
-
 	// BEGIN transaction
 	if ( (e = txn_begin(db->ENV,NULL,&tid,0)) != 0 )
 		return e;
 
-	if ( (e = db->DB[2]->cursor(db->DB[2],tid,&dbc,0)) != 0 )
-		goto ret;
-	
-	// Delete function
-	if ( (e = db->DB[0]->del(db->DB[0],tid,&key,0)) != 0 )
-		goto ret;
-
-	key.data = &pk;
-	key.size = sizeof(pk);
-	bzero(&data,sizeof(data));
-	data.flags = DB_DBT_PARTIAL;
-	data.doff = 0;
-	data.dlen = sizeof(u_int32_t);
+	// Get function or library part key
+	if ( (e = db->DB[db_index]->get(db->DB[db_index],tid,&key,&data,0)) != 0 )
+		goto abort;
+	part = *(u_int32_t *)data.data;
 
-	// Delete matching resource consumption
-	while( (e = dbc->c_get(dbc,&key,&data,DB_NEXT)) == 0 )
-		if ( (*(u_int32_t *)key.data & pk) == pk )
-			if ( (e = dbc->c_del(dbc,0)) != 0 )
-				goto ret;
+	if ( (e = db->DB[db_index]->del(db->DB[db_index],tid,&key,0)) != 0 ||
+			(e = consumption_del_indexed(db,tid,index_db,part)) != 0 )
+		goto abort;
 
-ret:
-	dbc->c_close(dbc);
+	// COMMIT transaction
+	if ( (e = txn_commit(tid,0)) != 0 )
+	{
+		DEBUG_CMD(db->DB[2]->err(db->DB[2],e,"resource_ctrl_del_key_str"));
+	}
+	return e;
 
+abort:
 	if ( e != DB_NOTFOUND )
 	{
-		DEBUG_CMD(db->DB[2]->err(db->DB[2],e,"resource_ctrl_del_function"));
-		e = txn_abort(tid);
+		DEBUG_CMD(db->DB[2]->err(db->DB[2],e,"resource_ctrl_del_key_str"));
 	}
-	else
-		if ( (e = txn_commit(tid,0)) != 0 )
-		{
-			DEBUG_CMD(db->DB[2]->err(db->DB[2],e,"resource_ctrl_del_function"));
-		}
-
+	txn_abort(tid);
 	return e;
 }
 
 
-/** \brief Delete library from database
+/** \brief Delete function from database
 	Also deletes all the resource consumption records associated with
-	the library.
+	the function, found through the function index.
 
   \param db Reference to a resource control database
-	\param lib Library to delete
+	\param func Function to delete
 
 	\return zero on success, or non-zero on failure
 	*/
 int 
-resource_ctrl_del_library(resource_ctrl_db_t *db,char *lib)
+resource_ctrl_del_function(resource_ctrl_db_t *db,char *func)
 {
-	DB_TXN *tid;
-	DBT key,data;
-	DBC *dbc;
-	int e;
-	u_int32_t pk;
-
-	bzero(&key,sizeof(key));
-	key.data = lib;
-	key.size = strlen(lib) + 1;
-	bzero(&data,sizeof(data));
-
-	// Get function part key
-	if ( (e = db->DB[1]->get(db->DB[1],NULL,&key,&data,0)) != 0 )
-		return e;
-
-	pk = *(u_int32_t *)data.data;
-
-	// BEGIN transaction
-	if ( (e = txn_begin(db->ENV,NULL,&tid,0)) != 0 )
-		return e;
-
-	if ( (e = db->DB[2]->cursor(db->DB[2],tid,&dbc,0)) != 0 )
-		goto ret;
-	
-	// Delete function
-	if ( (e = db->DB[1]->del(db->DB[1],tid,&key,0)) != 0 )
-		goto ret;
-
-	key.data = &pk;
-	key.size = sizeof(pk);
-	bzero(&data,sizeof(data));
-	data.flags = DB_DBT_PARTIAL;
-	data.doff = 0;
-	data.dlen = sizeof(u_int32_t);
+	return resource_ctrl_del_key_str(db,0,5,func);
+}
 
-	// Delete matching resource consumption
-	while( (e = dbc->c_get(dbc,&key,&data,DB_NEXT)) == 0 )
-		if ( ((*(u_int32_t *)key.data >> 16) ^ pk) == 0 )
-			if ( (e = dbc->c_del(dbc,0)) != 0 )
-				goto ret;
 
-ret:
-	dbc->c_close(dbc);
+/** \brief Delete library from database
+	Also deletes all the resource consumption records associated with
+	the library, found through the library index.
 
-	if ( e != DB_NOTFOUND )
-	{
-		DEBUG_CMD(db->DB[2]->err(db->DB[2],e,"resource_ctrl_del_library"));
-		e = txn_abort(tid);
-	}
-	else
-		if ( (e = txn_commit(tid,0)) != 0 )
-		{
-			DEBUG_CMD(db->DB[2]->err(db->DB[2],e,"resource_ctrl_del_library"));
-		}
+  \param db Reference to a resource control database
+	\param lib Library to delete
 
-	return e;
+	\return zero on success, or non-zero on failure
+	*/
+int 
+resource_ctrl_del_library(resource_ctrl_db_t *db,char *lib)
+{
+	return resource_ctrl_del_key_str(db,1,6,lib);
 }
 
 
@@ -884,7 +1949,6 @@ resource_ctrl_del_consumption(resource_ctrl_db_t *db,u_int32_t pk,u_int32_t rkey
 		if ( *(u_int32_t *)data.data == rkey )
 			if ( (e = dbc->c_del(dbc,0)) != 0 )
 				goto error;
-		e = dbc->c_get(dbc,&key,&data,DB_NEXT_DUP);
 	} while( (e = dbc->c_get(dbc,&key,&data,DB_NEXT_DUP)) == 0 );
 
 	if ( e == DB_NOTFOUND )
@@ -20,9 +20,10 @@
 #ifndef RESOURCE_CTRL_H
 #define RESOURCE_CTRL_H
 
-#include <snprintfv/compat.h>
+#include <stdio.h>
 #include <db.h>
 #include <admctrl_config.h>
+#include "resource_formula.h"
 
 /** \file resource_ctrl.h
 	\brief Definitions of datatypes and functions for resource control
@@ -38,7 +39,7 @@
 #define RESOURCE_CTRL_FAIL -1
 
 //! Defines the number of DBs encapsulated by the resource_ctrl_db_t type
-#define RESOURCES_DB_NUM 4
+#define RESOURCES_DB_NUM 7
 
 //! Resource consumption of a function in a specific library
 struct resource_consumption
@@ -79,6 +80,63 @@ struct resource
 //! Resource datatype
 typedef struct resource resource_t;
 
+//! Resources reserved for a limited amount of time
+struct resource_lease
+{
+	u_int32_t expires; //!< Time the lease expires (seconds since the Epoch)
+	u_int32_t resources_num; //!< Number of leased resources
+	resource_required_t required[RESOURCE_CTRL_MAX_RESOURCES]; //!< Leased resources
+};
+//! Resource lease datatype
+typedef struct resource_lease resource_lease_t;
+
+//! Size of a lease record holding n resources
+#define RESOURCE_LEASE_SIZE(n) (2 * sizeof(u_int32_t) + (n) * sizeof(resource_required_t))
+
+//! Consumption records of a resource key, memoised by a lookup table
+struct resource_ctrl_memo
+{
+	u_int32_t rkey; //!< Resource key
+	u_int32_t first; //!< Index of the first record in the records of the table
+	u_int32_t num; //!< Number of records, 0 if the key has none
+	char used; //!< Whether the entry is used
+};
+
+//! Library part of resource keys, memoised by a lookup table
+struct resource_ctrl_libid
+{
+	const char *name; //!< Name of the library, NULL if the entry is unused
+	u_int32_t id; //!< Library part of resource keys
+	int status; //!< 0 if the library was found, or RESOURCE_DB_NOTFOUND
+};
+
+//! Per-request lookup table
+/** Memoises the library and consumption lookups of a request, since the same
+ * library and resource key can appear in several library groups, and sums
+ * the required resources in slots found by hashing their keys. */
+struct resource_ctrl_table
+{
+	resource_required_t required[RESOURCE_CTRL_MAX_RESOURCES]; //!< Required resources, in the order they were met
+	size_t required_num; //!< Number of required resources
+	//! Index + 1 of each required resource, hashed by its key, or 0
+	u_int16_t slot[RESOURCE_CTRL_SLOTS];
+	struct resource_ctrl_memo *memo; //!< Memoised consumption lookups, hashed by key
+	u_int32_t memo_num; //!< Used entries of memo
+	u_int32_t memo_mask; //!< Entries of memo - 1
+	struct resource_ctrl_libid *libid; //!< Memoised library lookups, hashed by name
+	u_int32_t libid_num; //!< Used entries of libid
+	u_int32_t libid_mask; //!< Entries of libid - 1
+	resource_consumption_t *records; //!< Consumption records of memoised keys
+	resource_formula_t *formulas; //!< Compiled variable cost formula of each record
+	size_t records_num; //!< Number of records
+	size_t records_size; //!< Allocated records
+};
+//! Per-request lookup table datatype
+typedef struct resource_ctrl_table resource_ctrl_table_t;
+
+//! Callback used by resource_ctrl_lease_scan()
+typedef int (*resource_lease_cb_t)(u_int32_t,u_int32_t,void *);
+
 
 
 int resource_ctrl_dbinit(resource_ctrl_db_t *);
@@ -87,20 +145,40 @@ void resource_ctrl_dbclose(resource_ctrl_db_t *);
 
 int resource_ctrl_resourcekey(resource_ctrl_db_t *,char *,char *,u_int32_t *);
 int resource_ctrl_resourceconsumption(resource_ctrl_db_t *,u_int32_t,resource_consumption_t *,size_t *);
-int resource_ctrl_aggregate(resource_consumption_t *,size_t,resource_required_t *,size_t *,snv_constpointer *);
+int resource_ctrl_aggregate(resource_consumption_t *,size_t,resource_required_t *,size_t *,const resource_formula_arg_t *,unsigned int);
+int resource_ctrl_functionid(resource_ctrl_db_t *,const char *,u_int32_t *);
+
+void resource_ctrl_table_init(resource_ctrl_table_t *);
+void resource_ctrl_table_free(resource_ctrl_table_t *);
+int resource_ctrl_table_lookup(resource_ctrl_db_t *,resource_ctrl_table_t *,u_int32_t,const char *,resource_consumption_t **,size_t *);
+int resource_ctrl_table_aggregate(resource_ctrl_table_t *,resource_consumption_t *,size_t,const resource_formula_arg_t *,unsigned int);
+int resource_ctrl_table_aggregate_batch(resource_ctrl_table_t *,resource_consumption_t *,size_t,const resource_formula_col_t *,unsigned int,unsigned int);
 int resource_ctrl_check(resource_ctrl_db_t *,resource_required_t *,size_t);
 extern inline int resource_ctrl_allocate(resource_ctrl_db_t *,resource_required_t *,size_t);
 extern inline int resource_ctrl_deallocate(resource_ctrl_db_t *,resource_required_t *,size_t);
 
+int resource_ctrl_lease_allocate(resource_ctrl_db_t *,resource_required_t *,size_t,u_int32_t,u_int32_t *);
+int resource_ctrl_lease_renew(resource_ctrl_db_t *,u_int32_t,u_int32_t);
+int resource_ctrl_lease_release(resource_ctrl_db_t *,u_int32_t);
+int resource_ctrl_lease_expire(resource_ctrl_db_t *,u_int32_t,u_int32_t,u_int32_t *);
+int resource_ctrl_lease_next(resource_ctrl_db_t *,u_int32_t *);
+int resource_ctrl_lease_scan(resource_ctrl_db_t *,u_int32_t,u_int32_t,resource_lease_cb_t,void *);
+
 extern inline int resource_ctrl_display_functions(resource_ctrl_db_t *);
 extern inline int resource_ctrl_display_libraries(resource_ctrl_db_t *);
 int resource_ctrl_display_consumption(resource_ctrl_db_t *,u_int32_t);
 extern inline int resource_ctrl_display_resources(resource_ctrl_db_t *);
+int resource_ctrl_display_leases(resource_ctrl_db_t *);
 
 extern inline int resource_ctrl_add_function(resource_ctrl_db_t *,char *,u_int32_t);
 extern inline int resource_ctrl_add_library(resource_ctrl_db_t *,char *,u_int32_t);
 extern inline int resource_ctrl_add_consumption(resource_ctrl_db_t *,u_int32_t,resource_consumption_t *);
 extern inline int resource_ctrl_add_resource(resource_ctrl_db_t *,u_int32_t,resource_t *);
+int resource_ctrl_index_consumption(resource_ctrl_db_t *,DB_TXN *,u_int32_t);
+
+int resource_ctrl_import(resource_ctrl_db_t *,FILE *,unsigned int *);
+int resource_ctrl_export(resource_ctrl_db_t *,FILE *);
+int resource_ctrl_check_formulas(resource_ctrl_db_t *,FILE *,unsigned int *);
 
 int resource_ctrl_del_function(resource_ctrl_db_t *,char *);
 int resource_ctrl_del_library(resource_ctrl_db_t *,char *);
@@ -0,0 +1,780 @@
+/* resource_ctrl_bulk.c
+
+  Copyright 2004  Georgios Portokalidis <digital_bull@users.sourceforge.net>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "resource_ctrl.h"
+#include "debug.h"
+
+/** \file resource_ctrl_bulk.c
+	\brief Import and export of resource control databases
+	\author Georgios Portokalidis
+
+	A database is described by lines of comma separated fields. The first
+	field is the type of the record:
+
+	\li function,(name),(key)
+	\li library,(name),(key)
+	\li resource,(key),(available),(description)
+	\li consumption,(function),(library),(resource key),(fixed cost),(formula)
+
+	The last field extends to the end of the line, so descriptions and
+	formulas can contain commas. Empty lines and lines starting with '#' are
+	ignored. Functions and libraries of consumption records are looked up
+	first among the imported ones, and then in the database.
+*/
+
+//! Maximum length of a line
+#define BULK_LINE_SIZE 512
+//! Initial number of records of each type
+#define BULK_MIN_SIZE 64
+
+//! Imported function or library
+struct bulk_name
+{
+	char name[MAX_ACTION_NAME_SIZE]; //!< Name
+	u_int32_t key; //!< Key
+	unsigned int line; //!< Line it was read from
+};
+
+//! Imported resource
+struct bulk_resource
+{
+	u_int32_t key; //!< Key
+	resource_t resource; //!< Resource
+	unsigned int line; //!< Line it was read from
+};
+
+//! Imported resource consumption record
+struct bulk_consumption
+{
+	char func[MAX_ACTION_NAME_SIZE]; //!< Name of the function
+	char lib[MAX_ACTION_NAME_SIZE]; //!< Name of the library
+	u_int32_t pk; //!< Key of the library function
+	resource_consumption_t con; //!< Record
+	unsigned int line; //!< Line it was read from
+};
+
+//! Records of an import, by type
+struct bulk
+{
+	struct bulk_name *func,*lib;
+	struct bulk_resource *res;
+	struct bulk_consumption *con;
+	size_t func_num,lib_num,res_num,con_num;
+	size_t func_size,lib_size,res_size,con_size;
+};
+
+
+/*************************************************************************/
+/*                                PARSING                                */
+/*************************************************************************/
+
+/**
+	Makes room for one more element in an array
+	*/
+static void *
+grow(void **array,size_t *size,size_t num,size_t elem)
+{
+	void *a;
+	size_t new_size;
+
+	if ( num >= *size )
+	{
+		new_size = ( *size )? 2 * *size : BULK_MIN_SIZE;
+		if ( (a = realloc(*array,new_size * elem)) == NULL )
+			return NULL;
+		*array = a;
+		*size = new_size;
+	}
+	return (char *)*array + num * elem;
+}
+
+
+/**
+	Strips white space from both ends of a string
+	*/
+static char *
+strip(char *s)
+{
+	char *end;
+
+	while( isspace((unsigned char)*s) )
+		++s;
+	for(end = s + strlen(s) ; end > s && isspace((unsigned char)end[-1]) ; --end)
+		;
+	*end = '\0';
+	return s;
+}
+
+
+/**
+	Splits a line in at most max fields. The last one extends to the end of
+	the line
+
+	\return the number of fields
+	*/
+static int
+split(char *line,char **field,int max)
+{
+	char *c;
+	int n;
+
+	for(n = 0 ; n < max - 1 && (c = strchr(line,',')) != NULL ; n++)
+	{
+		*c = '\0';
+		field[n] = strip(line);
+		line = c + 1;
+	}
+	field[n++] = strip(line);
+	return n;
+}
+
+
+/**
+	Parses an unsigned 32 bits integer
+
+	\return zero on success, or -1 if the string is not a valid number
+	*/
+static int
+parse_uint32(const char *s,u_int32_t *v)
+{
+	unsigned long ul;
+	char *end;
+
+	if ( *s == '\0' || *s == '-' )
+		return -1;
+	errno = 0;
+	ul = strtoul(s,&end,0);
+	if ( *end != '\0' || errno != 0 || ul > 0xffffffffUL )
+		return -1;
+	*v = (u_int32_t)ul;
+	return 0;
+}
+
+
+/**
+	Copies a string field to a buffer
+
+	\return zero on success, or -1 if the field is empty or too long
+	*/
+static int
+copy_field(char *buf,const char *field,size_t size,int empty)
+{
+	size_t len = strlen(field);
+
+	if ( len >= size || (len == 0 && !empty) )
+		return -1;
+	memcpy(buf,field,len + 1);
+	return 0;
+}
+
+
+/**
+	Parses one line of a description into the records of an import
+
+	\return zero on success, EINVAL for an invalid line, or ENOMEM
+	*/
+static int
+parse_line(struct bulk *b,char *line,unsigned int line_no)
+{
+	char *field[6];
+	struct bulk_name *n;
+	struct bulk_resource *r;
+	struct bulk_consumption *c;
+	resource_formula_t formula;
+	int fields;
+
+	line = strip(line);
+	if ( *line == '\0' || *line == '#' )
+		return 0;
+	// The number of fields depends on the type
+	if ( split(line,field,2) != 2 )
+		return EINVAL;
+	if ( strcmp(field[0],"function") == 0 || strcmp(field[0],"library") == 0 )
+		fields = 1 + split(field[1],field + 1,2);
+	else if ( strcmp(field[0],"resource") == 0 )
+		fields = 1 + split(field[1],field + 1,3);
+	else if ( strcmp(field[0],"consumption") == 0 )
+		fields = 1 + split(field[1],field + 1,5);
+	else
+		return EINVAL;
+
+	if ( strcmp(field[0],"function") == 0 || strcmp(field[0],"library") == 0 )
+	{
+		if ( *field[0] == 'f' )
+			n = grow((void **)&b->func,&b->func_size,b->func_num,sizeof(struct bulk_name));
+		else
+			n = grow((void **)&b->lib,&b->lib_size,b->lib_num,sizeof(struct bulk_name));
+		if ( n == NULL )
+			return ENOMEM;
+		if ( fields != 3 || copy_field(n->name,field[1],MAX_ACTION_NAME_SIZE,0) != 0 ||
+				parse_uint32(field[2],&n->key) != 0 )
+			return EINVAL;
+		n->line = line_no;
+		if ( *field[0] == 'f' )
+			++b->func_num;
+		else
+			++b->lib_num;
+	}
+	else if ( strcmp(field[0],"resource") == 0 )
+	{
+		if ( (r = grow((void **)&b->res,&b->res_size,b->res_num,sizeof(struct bulk_resource))) == NULL )
+			return ENOMEM;
+		bzero(r,sizeof(struct bulk_resource));
+		if ( fields != 4 || parse_uint32(field[1],&r->key) != 0 ||
+				parse_uint32(field[2],&r->resource.available) != 0 ||
+				copy_field(r->resource.description,field[3],RESOURCE_CTRL_MAX_RES_DESCR_LEN,1) != 0 )
+			return EINVAL;
+		r->line = line_no;
+		++b->res_num;
+	}
+	else if ( strcmp(field[0],"consumption") == 0 )
+	{
+		if ( (c = grow((void **)&b->con,&b->con_size,b->con_num,sizeof(struct bulk_consumption))) == NULL )
+			return ENOMEM;
+		bzero(c,sizeof(struct bulk_consumption));
+		if ( fields != 6 || copy_field(c->func,field[1],MAX_ACTION_NAME_SIZE,0) != 0 ||
+				copy_field(c->lib,field[2],MAX_ACTION_NAME_SIZE,0) != 0 ||
+				parse_uint32(field[3],&c->con.rkey) != 0 ||
+				parse_uint32(field[4],&c->con.fixed_cost) != 0 ||
+				copy_field(c->con.variable_cost_formula,field[5],RESOURCE_CTRL_MAX_VAR_FORM_LEN,0) != 0 ||
+				resource_formula_compile(c->con.variable_cost_formula,&formula) != 0 )
+			return EINVAL;
+		c->line = line_no;
+		++b->con_num;
+	}
+	else
+		return EINVAL;
+	return 0;
+}
+
+
+/*************************************************************************/
+/*                                SORTING                                */
+/*************************************************************************/
+
+// Records with the same key are ordered by descending line, so that the
+// last one in the description is kept
+
+static int
+name_cmp(const void *a,const void *b)
+{
+	const struct bulk_name *n1 = a,*n2 = b;
+	int c;
+
+	if ( (c = strcmp(n1->name,n2->name)) != 0 )
+		return c;
+	return ( n1->line < n2->line ) - ( n1->line > n2->line );
+}
+
+static int
+resource_cmp(const void *a,const void *b)
+{
+	const struct bulk_resource *r1 = a,*r2 = b;
+	int c;
+
+	// Keys are compared as stored
+	if ( (c = memcmp(&r1->key,&r2->key,sizeof(u_int32_t))) != 0 )
+		return c;
+	return ( r1->line < r2->line ) - ( r1->line > r2->line );
+}
+
+static int
+consumption_cmp(const void *a,const void *b)
+{
+	const struct bulk_consumption *c1 = a,*c2 = b;
+	int c;
+
+	// In the order of the btree and its sorted duplicates
+	if ( (c = memcmp(&c1->pk,&c2->pk,sizeof(u_int32_t))) != 0 )
+		return c;
+	if ( (c = memcmp(&c1->con.rkey,&c2->con.rkey,sizeof(u_int32_t))) != 0 )
+		return c;
+	return ( c1->line < c2->line ) - ( c1->line > c2->line );
+}
+
+
+/**
+	Sorts records and removes those overridden by later lines
+
+	\return the number of remaining records
+	*/
+static size_t
+sort_unique(void *array,size_t num,size_t elem,int (*cmp)(const void *,const void *),int (*same)(const void *,const void *))
+{
+	char *a = array;
+	size_t i,n;
+
+	if ( num == 0 )
+		return 0;
+	qsort(a,num,elem,cmp);
+	for(i = 1,n = 1 ; i < num ; i++)
+		if ( !same(a + (n - 1) * elem,a + i * elem) )
+		{
+			if ( n != i )
+				memcpy(a + n * elem,a + i * elem,elem);
+			++n;
+		}
+	return n;
+}
+
+static int
+name_same(const void *a,const void *b)
+{
+	return strcmp(((const struct bulk_name *)a)->name,((const struct bulk_name *)b)->name) == 0;
+}
+
+static int
+resource_same(const void *a,const void *b)
+{
+	return ((const struct bulk_resource *)a)->key == ((const struct bulk_resource *)b)->key;
+}
+
+static int
+consumption_same(const void *a,const void *b)
+{
+	const struct bulk_consumption *c1 = a,*c2 = b;
+
+	return c1->pk == c2->pk && c1->con.rkey == c2->con.rkey;
+}
+
+
+static int
+name_key_cmp(const void *key,const void *n)
+{
+	return strcmp((const char *)key,((const struct bulk_name *)n)->name);
+}
+
+
+/**
+	Finds the key of a function or library, among the imported ones or in
+	the database
+
+	\return zero on success, or non-zero on failure
+	*/
+static int
+find_key(DB *dbp,struct bulk_name *names,size_t num,const char *name,u_int32_t *key_value)
+{
+	struct bulk_name *n;
+	DBT key,data;
+	int e;
+
+	if ( num > 0 && (n = bsearch(name,names,num,sizeof(struct bulk_name),name_key_cmp)) != NULL )
+	{
+		*key_value = n->key;
+		return 0;
+	}
+	bzero(&key,sizeof(key));
+	key.data = (char *)name;
+	key.size = strlen(name) + 1;
+	bzero(&data,sizeof(data));
+	if ( (e = dbp->get(dbp,NULL,&key,&data,0)) == 0 )
+		*key_value = *(u_int32_t *)data.data;
+	return e;
+}
+
+
+/*************************************************************************/
+/*                                STORING                                */
+/*************************************************************************/
+
+/**
+	Stores a record within a transaction
+	*/
+static int
+put(DB *dbp,DB_TXN *tid,void *k,size_t ksize,void *d,size_t dsize)
+{
+	DBT key,data;
+
+	bzero(&key,sizeof(key));
+	key.data = k;
+	key.size = ksize;
+	bzero(&data,sizeof(data));
+	data.data = d;
+	data.size = dsize;
+	return dbp->put(dbp,tid,&key,&data,0);
+}
+
+
+/**
+	Replaces the consumption records of a library function with the same
+	resource keys as a sorted group of imported records
+	*/
+static int
+put_consumption(resource_ctrl_db_t *db,DB_TXN *tid,struct bulk_consumption *c,size_t num)
+{
+	DBT key,data;
+	DBC *dbc;
+	u_int32_t pk = c->pk,rkey;
+	size_t i;
+	int e;
+
+	if ( (e = db->DB[2]->cursor(db->DB[2],tid,&dbc,0)) != 0 )
+		return e;
+
+	bzero(&key,sizeof(key));
+	key.data = &pk;
+	key.size = sizeof(pk);
+	bzero(&data,sizeof(data));
+	data.flags = DB_DBT_PARTIAL;
+	data.doff = 0;
+	data.dlen = sizeof(u_int32_t);
+
+	// Delete stored records of the same resources
+	for(e = dbc->c_get(dbc,&key,&data,DB_SET) ; e == 0 ; e = dbc->c_get(dbc,&key,&data,DB_NEXT_DUP))
+	{
+		rkey = *(u_int32_t *)data.data;
+		for(i = 0 ; i < num && c[i].con.rkey != rkey ; i++)
+			;
+		if ( i < num && (e = dbc->c_del(dbc,0)) != 0 )
+			break;
+	}
+	dbc->c_close(dbc);
+	if ( e != DB_NOTFOUND )
+		return e;
+
+	if ( (e = resource_ctrl_index_consumption(db,tid,pk)) != 0 )
+		return e;
+	for(i = 0 ; i < num ; i++)
+		if ( (e = put(db->DB[2],tid,&pk,sizeof(pk),&c[i].con,sizeof(resource_consumption_t))) != 0 )
+			return e;
+	return 0;
+}
+
+
+/**
+	Stores all the records of an import within one transaction
+	*/
+static int
+store(resource_ctrl_db_t *db,struct bulk *b)
+{
+	DB_TXN *tid;
+	size_t i,j;
+	int e;
+
+	// BEGIN transaction
+	if ( (e = txn_begin(db->ENV,NULL,&tid,0)) != 0 )
+		return e;
+
+	for(i = 0 ; i < b->func_num ; i++)
+		if ( (e = put(db->DB[0],tid,b->func[i].name,strlen(b->func[i].name) + 1,&b->func[i].key,sizeof(u_int32_t))) != 0 )
+			goto abort;
+	for(i = 0 ; i < b->lib_num ; i++)
+		if ( (e = put(db->DB[1],tid,b->lib[i].name,strlen(b->lib[i].name) + 1,&b->lib[i].key,sizeof(u_int32_t))) != 0 )
+			goto abort;
+	for(i = 0 ; i < b->res_num ; i++)
+		if ( (e = put(db->DB[3],tid,&b->res[i].key,sizeof(u_int32_t),&b->res[i].resource,sizeof(resource_t))) != 0 )
+			goto abort;
+	for(i = 0 ; i < b->con_num ; i = j)
+	{
+		for(j = i + 1 ; j < b->con_num && b->con[j].pk == b->con[i].pk ; j++)
+			;
+		if ( (e = put_consumption(db,tid,b->con + i,j - i)) != 0 )
+			goto abort;
+	}
+
+	// COMMIT transaction
+	return txn_commit(tid,0);
+
+abort:
+	DEBUG_CMD(db->DB[0]->err(db->DB[0],e,"resource_ctrl_import"));
+	txn_abort(tid);
+	return e;
+}
+
+
+/*************************************************************************/
+/*                               EXPORTING                               */
+/*************************************************************************/
+
+/**
+	Reads all the functions or libraries of the database
+	*/
+static int
+read_names(DB *dbp,struct bulk_name **names,size_t *num,size_t *size)
+{
+	struct bulk_name *n;
+	DBT key,data;
+	DBC *dbc;
+	int e;
+
+	if ( (e = dbp->cursor(dbp,NULL,&dbc,0)) != 0 )
+		return e;
+	bzero(&key,sizeof(key));
+	bzero(&data,sizeof(data));
+	while( (e = dbc->c_get(dbc,&key,&data,DB_NEXT)) == 0 )
+	{
+		if ( (n = grow((void **)names,size,*num,sizeof(struct bulk_name))) == NULL )
+		{
+			e = ENOMEM;
+			break;
+		}
+		if ( key.size > MAX_ACTION_NAME_SIZE || key.size == 0 )
+			continue;
+		memcpy(n->name,key.data,key.size);
+		n->name[key.size - 1] = '\0';
+		n->key = *(u_int32_t *)data.data;
+		++*num;
+	}
+	dbc->c_close(dbc);
+	return ( e == DB_NOTFOUND )? 0 : e;
+}
+
+
+/**
+	Finds the name of a key
+	*/
+static const char *
+key_name(const struct bulk_name *names,size_t num,u_int32_t key)
+{
+	size_t i;
+
+	for(i = 0 ; i < num ; i++)
+		if ( names[i].key == key )
+			return names[i].name;
+	return NULL;
+}
+
+
+/**
+	Writes the consumption records of the database, or only those whose
+	formula changed value with C precedence if regrouped isn't NULL, in which
+	case their number is stored there
+	*/
+static int
+write_consumption(resource_ctrl_db_t *db,FILE *out,struct bulk *b,unsigned int *regrouped)
+{
+	resource_consumption_t con;
+	const char *func,*lib;
+	DBT key,data;
+	DBC *dbc;
+	u_int32_t pk;
+	int e;
+
+	if ( (e = db->DB[2]->cursor(db->DB[2],NULL,&dbc,0)) != 0 )
+		return e;
+	bzero(&key,sizeof(key));
+	bzero(&data,sizeof(data));
+	while( (e = dbc->c_get(dbc,&key,&data,DB_NEXT)) == 0 )
+	{
+		pk = *(u_int32_t *)key.data;
+		memcpy(&con,data.data,sizeof(resource_consumption_t));
+		con.variable_cost_formula[RESOURCE_CTRL_MAX_VAR_FORM_LEN - 1] = '\0';
+		if ( regrouped )
+		{
+			if ( resource_formula_regrouped(con.variable_cost_formula) != 1 )
+				continue;
+			++*regrouped;
+		}
+
+		// Functions with global resource consumption have a key for all libraries
+		lib = ( b->lib_num > 0 )? b->lib[0].name : NULL;
+		if ( (func = key_name(b->func,b->func_num,pk)) == NULL )
+		{
+			func = key_name(b->func,b->func_num,pk & 0xffff);
+			lib = key_name(b->lib,b->lib_num,pk >> 16);
+		}
+		if ( func && lib )
+			fprintf(out,"consumption,%s,%s,%u,%u,%s\n",func,lib,con.rkey,con.fixed_cost,con.variable_cost_formula);
+		else
+			fprintf(out,"# consumption key %u has no function or library: %u,%u,%s\n",pk,con.rkey,con.fixed_cost,con.variable_cost_formula);
+	}
+	dbc->c_close(dbc);
+	return ( e == DB_NOTFOUND )? 0 : e;
+}
+
+
+/*************************************************************************/
+/*                           PUBLIC FUNCTIONS                            */
+/*************************************************************************/
+
+/** \brief Import records into a resource control database
+
+	All the records are read before storing any of them. They are sorted by
+	key and stored in that order within one transaction, so either all or
+	none of them are stored. Records with the same key as stored ones replace
+	them, and consumption records replace those of the same library function
+	and resource. When a key appears more than once, the last line is used.
+
+  \param db Reference to a resource control database
+	\param in Stream to read the records from
+	\param line Reference where the number of the line that failed is going
+	to be stored, or 0 if the failure was not caused by a line
+
+	\return zero on success, or non-zero on failure. EINVAL is returned for
+	invalid lines and RESOURCE_DB_NOTFOUND for consumption records of unknown
+	functions or libraries.
+*/
+int
+resource_ctrl_import(resource_ctrl_db_t *db,FILE *in,unsigned int *line)
+{
+	struct bulk b;
+	char buf[BULK_LINE_SIZE];
+	u_int32_t fkey,lkey;
+	size_t i;
+	int e = 0;
+
+	bzero(&b,sizeof(b));
+	*line = 0;
+
+	while( fgets(buf,BULK_LINE_SIZE,in) != NULL )
+	{
+		++*line;
+		if ( strchr(buf,'\n') == NULL && !feof(in) )
+		{
+			e = EINVAL;
+			goto ret;
+		}
+		if ( (e = parse_line(&b,buf,*line)) != 0 )
+			goto ret;
+	}
+	if ( ferror(in) )
+	{
+		e = errno;
+		goto ret;
+	}
+
+	b.func_num = sort_unique(b.func,b.func_num,sizeof(struct bulk_name),name_cmp,name_same);
+	b.lib_num = sort_unique(b.lib,b.lib_num,sizeof(struct bulk_name),name_cmp,name_same);
+	b.res_num = sort_unique(b.res,b.res_num,sizeof(struct bulk_resource),resource_cmp,resource_same);
+
+	// Resolve the keys of consumption records
+	for(i = 0 ; i < b.con_num ; i++)
+	{
+		if ( (e = find_key(db->DB[0],b.func,b.func_num,b.con[i].func,&fkey)) != 0 ||
+				(e = find_key(db->DB[1],b.lib,b.lib_num,b.con[i].lib,&lkey)) != 0 )
+		{
+			*line = b.con[i].line;
+			goto ret;
+		}
+		b.con[i].pk = fkey | lkey << 16;
+	}
+	b.con_num = sort_unique(b.con,b.con_num,sizeof(struct bulk_consumption),consumption_cmp,consumption_same);
+
+	*line = 0;
+	e = store(db,&b);
+
+ret:
+	free(b.func);
+	free(b.lib);
+	free(b.res);
+	free(b.con);
+	return e;
+}
+
+
+/** \brief Export the records of a resource control database
+
+	The records are written in the format read by resource_ctrl_import().
+	Consumption records whose key doesn't match a function and library are
+	written as comments.
+
+  \param db Reference to a resource control database
+	\param out Stream to write the records to
+
+	\return zero on success, or non-zero on failure
+*/
+int
+resource_ctrl_export(resource_ctrl_db_t *db,FILE *out)
+{
+	struct bulk b;
+	resource_t resource;
+	DBT key,data;
+	DBC *dbc;
+	size_t i;
+	int e;
+
+	bzero(&b,sizeof(b));
+	if ( (e = read_names(db->DB[0],&b.func,&b.func_num,&b.func_size)) != 0 ||
+			(e = read_names(db->DB[1],&b.lib,&b.lib_num,&b.lib_size)) != 0 )
+		goto ret;
+
+	for(i = 0 ; i < b.func_num ; i++)
+		fprintf(out,"function,%s,%u\n",b.func[i].name,b.func[i].key);
+	for(i = 0 ; i < b.lib_num ; i++)
+		fprintf(out,"library,%s,%u\n",b.lib[i].name,b.lib[i].key);
+
+	if ( (e = db->DB[3]->cursor(db->DB[3],NULL,&dbc,0)) != 0 )
+		goto ret;
+	bzero(&key,sizeof(key));
+	bzero(&data,sizeof(data));
+	while( (e = dbc->c_get(dbc,&key,&data,DB_NEXT)) == 0 )
+	{
+		memcpy(&resource,data.data,sizeof(resource_t));
+		resource.description[RESOURCE_CTRL_MAX_RES_DESCR_LEN - 1] = '\0';
+		fprintf(out,"resource,%u,%u,%s\n",*(u_int32_t *)key.data,resource.available,resource.description);
+	}
+	dbc->c_close(dbc);
+	if ( e != DB_NOTFOUND )
+		goto ret;
+
+	e = write_consumption(db,out,&b,NULL);
+
+ret:
+	if ( e == 0 && (fflush(out) != 0 || ferror(out)) )
+		e = errno;
+	free(b.func);
+	free(b.lib);
+	return e;
+}
+
+
+/** \brief List the consumption records whose formula changed value
+	Formulas used to group + - and * / from the right, and are now evaluated
+	with the precedence and associativity of C, see
+	resource_formula_regrouped(). The records are written in the format read
+	by resource_ctrl_import(), so they can be corrected and imported again.
+
+  \param db Reference to a resource control database
+	\param out Stream to write the records to
+	\param num Reference where the number of records written is going to be
+	stored
+
+	\return zero on success, or non-zero on failure
+*/
+int
+resource_ctrl_check_formulas(resource_ctrl_db_t *db,FILE *out,unsigned int *num)
+{
+	struct bulk b;
+	int e;
+
+	*num = 0;
+	bzero(&b,sizeof(b));
+	if ( (e = read_names(db->DB[0],&b.func,&b.func_num,&b.func_size)) != 0 ||
+			(e = read_names(db->DB[1],&b.lib,&b.lib_num,&b.lib_size)) != 0 )
+		goto ret;
+	e = write_consumption(db,out,&b,num);
+
+ret:
+	if ( e == 0 && (fflush(out) != 0 || ferror(out)) )
+		e = errno;
+	free(b.func);
+	free(b.lib);
+	return e;
+}
@@ -0,0 +1,723 @@
+/* resource_formula.c
+
+  Copyright 2004  Georgios Portokalidis <digital_bull@users.sourceforge.net>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "resource_formula.h"
+#include "debug.h"
+
+/** \file resource_formula.c
+	\brief Compiler and evaluator of variable cost formulas
+	\author Georgios Portokalidis
+	*/
+
+//! Operation codes of compiled formulas
+enum
+{
+	OP_NUM, OP_ARG,
+	OP_NEG, OP_LOG, OP_CEIL, OP_FLOOR,
+	OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MIN, OP_MAX,
+	OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE,
+	OP_SELECT
+};
+
+//! Number of operands of each operation
+static const unsigned char op_arity[] = {
+	0, 0,
+	1, 1, 1, 1,
+	2, 2, 2, 2, 2, 2,
+	2, 2, 2, 2, 2, 2,
+	3
+};
+
+//! State of the compiler
+struct compiler
+{
+	const char *p; //!< Position in the formula
+	resource_formula_t *f; //!< Formula being compiled
+	unsigned int depth; //!< Depth of the stack after the operations compiled so far
+	unsigned int next_arg; //!< Argument of the next reference without a number
+	//! Group + - and * / from the right, as formulas were before C precedence
+	char legacy;
+};
+
+
+/** \brief Apply an operation on its operands, for a block of instances
+	Operations on operands that are not finite are not finite either, so
+	they make the formula fail, apart from the branch of a conditional that
+	isn't selected. The operation is chosen once for the block, so the loops
+	that apply it can be vectorized.
+
+	\param op The operation
+	\param x The first operands, where the results are going to be placed
+	\param y The second operands, NULL for unary operations
+	\param z The third operands, NULL but for conditionals
+	\param n Number of instances
+*/
+static void
+apply_block(unsigned char op,double *x,const double *y,const double *z,unsigned int n)
+{
+	unsigned int i;
+
+#define UNARY(expr) \
+	for(i = 0 ; i < n ; i++) \
+		x[i] = ( isfinite(x[i]) )? (expr) : NAN; \
+	break
+#define BINARY(expr) \
+	for(i = 0 ; i < n ; i++) \
+		x[i] = ( isfinite(x[i]) && isfinite(y[i]) )? (expr) : NAN; \
+	break
+
+	switch( op )
+	{
+		case OP_NEG:
+			UNARY(- x[i]);
+		case OP_LOG:
+			UNARY(log(x[i]));
+		case OP_CEIL:
+			UNARY(ceil(x[i]));
+		case OP_FLOOR:
+			UNARY(floor(x[i]));
+		case OP_ADD:
+			BINARY(x[i] + y[i]);
+		case OP_SUB:
+			BINARY(x[i] - y[i]);
+		case OP_MUL:
+			BINARY(x[i] * y[i]);
+		case OP_DIV:
+			BINARY(x[i] / y[i]);
+		case OP_MIN:
+			BINARY(( x[i] < y[i] )? x[i] : y[i]);
+		case OP_MAX:
+			BINARY(( x[i] > y[i] )? x[i] : y[i]);
+		case OP_LT:
+			BINARY(x[i] < y[i]);
+		case OP_LE:
+			BINARY(x[i] <= y[i]);
+		case OP_GT:
+			BINARY(x[i] > y[i]);
+		case OP_GE:
+			BINARY(x[i] >= y[i]);
+		case OP_EQ:
+			BINARY(x[i] == y[i]);
+		case OP_NE:
+			BINARY(x[i] != y[i]);
+		case OP_SELECT:
+			// Only the selected branch has to be finite
+			for(i = 0 ; i < n ; i++)
+				x[i] = ( !isfinite(x[i]) )? NAN : ( x[i] != 0.0 )? y[i] : z[i];
+			break;
+		default:
+			for(i = 0 ; i < n ; i++)
+				x[i] = NAN;
+			break;
+	}
+
+#undef UNARY
+#undef BINARY
+}
+
+
+/** \brief Apply an operation on its operands
+
+	\param op The operation
+	\param v The operands, in the order they appear in the formula
+
+	\return the result
+*/
+static double
+apply(unsigned char op,const double *v)
+{
+	double x = v[0];
+
+	apply_block(op,&x,( op_arity[op] > 1 )? v + 1 : NULL,( op_arity[op] > 2 )? v + 2 : NULL,1);
+	return x;
+}
+
+
+/** \brief Append an operation to a formula being compiled
+	If all the operands of the operation are numbers, they are replaced by
+	the result.
+
+	\return 0 on success, or -1 if the formula has too many operations
+*/
+static int
+emit(struct compiler *c,unsigned char op,double value)
+{
+	resource_formula_t *f = c->f;
+	struct resource_formula_op *o;
+	double v[3];
+	unsigned int i,n = op_arity[op];
+
+	// Constant folding
+	if ( n > 0 && f->len >= n )
+	{
+		for(i = 0 ; i < n && f->code[f->len - n + i].op == OP_NUM ; i++)
+			v[i] = f->code[f->len - n + i].value;
+		if ( i == n )
+		{
+			f->len -= n;
+			c->depth -= n;
+			value = apply(op,v);
+			op = OP_NUM;
+			n = 0;
+		}
+	}
+
+	if ( f->len >= RESOURCE_FORMULA_MAX_OPS )
+		return -1;
+	o = f->code + f->len++;
+	bzero(o,sizeof(struct resource_formula_op));
+	o->op = op;
+	o->value = value;
+	if ( (c->depth = c->depth + 1 - n) > f->depth )
+		f->depth = c->depth;
+	return 0;
+}
+
+
+/** \brief Skip spaces and check whether the formula continues with a token
+
+	\return non-zero if it does, in which case the token is skipped
+*/
+static int
+accept(struct compiler *c,const char *token)
+{
+	size_t len = strlen(token);
+
+	for( ; isspace((unsigned char)*c->p) ; c->p++)
+		;
+	if ( strncmp(c->p,token,len) != 0 )
+		return 0;
+	c->p += len;
+	return 1;
+}
+
+
+/** \brief Compile a reference to an argument
+	Either $n, or a printf conversion with an optional argument number.
+	Flags, width and precision of conversions are ignored.
+
+	\return 0 on success, or -1 on failure
+*/
+static int
+compile_arg(struct compiler *c)
+{
+	struct resource_formula_op *o;
+	unsigned long n = 0;
+	unsigned char type = RESOURCE_FORMULA_ANY,conv = 0;
+	char *end;
+	int ll = 0;
+
+	if ( *c->p++ == '$' )
+	{
+		if ( !isdigit((unsigned char)*c->p) || (n = strtoul(c->p,&end,10)) == 0 )
+			return -1;
+		c->p = end;
+	}
+	else
+	{
+		// Argument number
+		if ( isdigit((unsigned char)*c->p) && (n = strtoul(c->p,&end,10)) > 0 && *end == '$' )
+			c->p = end + 1;
+		else
+			n = ++c->next_arg;
+		// Flags, width and precision
+		c->p += strspn(c->p,"-+ #0'");
+		c->p += strspn(c->p,"0123456789");
+		if ( *c->p == '.' )
+			c->p += 1 + strspn(c->p + 1,"0123456789");
+		// Length, l, ll and q are all unsigned long long arguments
+		for( ; *c->p != '\0' && strchr("hlLqjzt",*c->p) ; c->p++)
+			ll |= ( *c->p == 'l' || *c->p == 'q' || *c->p == 'L' );
+		if ( (conv = *c->p) == '\0' )
+			return -1;
+		c->p++;
+		if ( strchr("diouxX",conv) )
+			type = ( ll )? RESOURCE_FORMULA_ULLONG : RESOURCE_FORMULA_INT;
+		else if ( strchr("fFeEgGaA",conv) )
+			type = RESOURCE_FORMULA_DOUBLE;
+		else
+			return -1;
+	}
+
+	if ( n > 255 || emit(c,OP_ARG,0.0) != 0 )
+		return -1;
+	o = c->f->code + c->f->len - 1;
+	o->arg = n - 1;
+	o->type = type;
+	o->conv = conv;
+	if ( n > c->f->args )
+		c->f->args = n;
+	return 0;
+}
+
+
+static int compile_cond(struct compiler *);
+
+
+/** \brief Compile a number, argument, function call or parenthesised formula
+
+	\return 0 on success, or -1 on failure
+*/
+static int
+compile_primary(struct compiler *c)
+{
+	static const struct { const char *name; unsigned char op; char args; } funcs[] = {
+		{ "min(", OP_MIN, 0 },
+		{ "max(", OP_MAX, 0 },
+		{ "log(", OP_LOG, 1 },
+		{ "ceil(", OP_CEIL, 1 },
+		{ "floor(", OP_FLOOR, 1 },
+		{ NULL, 0, 0 }
+	};
+	unsigned int i;
+	double value;
+	char *end;
+
+	if ( accept(c,"(") )
+		return ( compile_cond(c) != 0 || !accept(c,")") )? -1 : 0;
+
+	if ( *c->p == '$' || *c->p == '%' )
+		return compile_arg(c);
+
+	if ( isdigit((unsigned char)*c->p) || *c->p == '.' )
+	{
+		value = strtod(c->p,&end);
+		if ( end == c->p )
+			return -1;
+		c->p = end;
+		return emit(c,OP_NUM,value);
+	}
+
+	for(i = 0 ; funcs[i].name ; i++)
+		if ( accept(c,funcs[i].name) )
+		{
+			if ( compile_cond(c) != 0 )
+				return -1;
+			// min() and max() take any number of arguments
+			while( funcs[i].args == 0 && accept(c,",") )
+				if ( compile_cond(c) != 0 || emit(c,funcs[i].op,0.0) != 0 )
+					return -1;
+			if ( !accept(c,")") )
+				return -1;
+			return ( funcs[i].args == 1 )? emit(c,funcs[i].op,0.0) : 0;
+		}
+
+	return -1;
+}
+
+
+/** \brief Compile unary minus
+
+	\return 0 on success, or -1 on failure
+*/
+static int
+compile_unary(struct compiler *c)
+{
+	if ( accept(c,"-") )
+		return ( compile_unary(c) != 0 )? -1 : emit(c,OP_NEG,0.0);
+	accept(c,"+");
+	return compile_primary(c);
+}
+
+
+/** \brief Compile a sequence of left associative binary operators
+
+	\param c The compiler
+	\param ops Tokens of the operators, longest first when one is a prefix of another
+	\param codes Operation of each token
+	\param operand Compiles an operand
+
+	\return 0 on success, or -1 on failure
+*/
+static int
+compile_binary(struct compiler *c,const char **ops,const unsigned char *codes,int (*operand)(struct compiler *))
+{
+	unsigned int i;
+
+	if ( operand(c) != 0 )
+		return -1;
+	for(;;)
+	{
+		for(i = 0 ; ops[i] && !accept(c,ops[i]) ; i++)
+			;
+		if ( ops[i] == NULL )
+			return 0;
+		// The old parser grouped the arithmetic operators from the right
+		if ( c->legacy && (codes[0] == OP_MUL || codes[0] == OP_ADD) )
+			return ( compile_binary(c,ops,codes,operand) != 0 )? -1 : emit(c,codes[i],0.0);
+		if ( operand(c) != 0 || emit(c,codes[i],0.0) != 0 )
+			return -1;
+	}
+}
+
+
+static int
+compile_mul(struct compiler *c)
+{
+	static const char *ops[] = { "*", "/", NULL };
+	static const unsigned char codes[] = { OP_MUL, OP_DIV };
+
+	return compile_binary(c,ops,codes,compile_unary);
+}
+
+
+static int
+compile_add(struct compiler *c)
+{
+	static const char *ops[] = { "+", "-", NULL };
+	static const unsigned char codes[] = { OP_ADD, OP_SUB };
+
+	return compile_binary(c,ops,codes,compile_mul);
+}
+
+
+static int
+compile_rel(struct compiler *c)
+{
+	static const char *ops[] = { "<=", ">=", "<", ">", NULL };
+	static const unsigned char codes[] = { OP_LE, OP_GE, OP_LT, OP_GT };
+
+	return compile_binary(c,ops,codes,compile_add);
+}
+
+
+static int
+compile_eq(struct compiler *c)
+{
+	static const char *ops[] = { "==", "!=", NULL };
+	static const unsigned char codes[] = { OP_EQ, OP_NE };
+
+	return compile_binary(c,ops,codes,compile_rel);
+}
+
+
+/** \brief Compile a conditional, which is right associative
+
+	\return 0 on success, or -1 on failure
+*/
+static int
+compile_cond(struct compiler *c)
+{
+	if ( compile_eq(c) != 0 )
+		return -1;
+	if ( !accept(c,"?") )
+		return 0;
+	if ( compile_cond(c) != 0 || !accept(c,":") || compile_cond(c) != 0 )
+		return -1;
+	return emit(c,OP_SELECT,0.0);
+}
+
+
+/** \brief Compile a formula, with C precedence or as the old parser did
+
+	\return 0 on success, or -1 if the formula is invalid
+*/
+static int
+compile(const char *s,resource_formula_t *f,char legacy)
+{
+	struct compiler c;
+
+	f->len = f->depth = f->args = 0;
+	c.p = s;
+	c.f = f;
+	c.depth = 0;
+	c.next_arg = 0;
+	c.legacy = legacy;
+
+	if ( accept(&c,"") && *c.p == '\0' )
+		return 0;
+	if ( compile_cond(&c) != 0 || !accept(&c,"") || *c.p != '\0' )
+	{
+		DEBUG_CMD2(printf("DEBUG resource_formula_compile: invalid formula %s at %s\n",s,c.p));
+		f->len = 0;
+		return -1;
+	}
+	return 0;
+}
+
+
+/** \brief Compile a variable cost formula
+	Empty formulas are valid and evaluated as 0.
+
+	\param s The formula
+	\param f Reference where the compiled formula is going to be stored
+
+	\return 0 on success, or -1 if the formula is invalid
+*/
+int
+resource_formula_compile(const char *s,resource_formula_t *f)
+{
+	return compile(s,f,0);
+}
+
+
+/** \brief Values of an argument referred to by a formula, for a block of instances
+	Values are NaN if the argument doesn't have the type of the reference.
+
+	\param o The reference to the argument
+	\param col Column of the values of the argument
+	\param first Index of the first instance of the block in the column
+	\param n Number of instances
+	\param x Reference where the values are going to be placed
+*/
+static void
+col_values(const struct resource_formula_op *o,const resource_formula_col_t *col,unsigned int first,unsigned int n,double *x)
+{
+	const int *integer;
+	const double *dbl;
+	const unsigned long long *ullong;
+	unsigned int i;
+
+	if ( col->type == RESOURCE_FORMULA_NONE )
+	{
+		for(i = 0 ; i < n ; i++)
+			x[i] = 0.0;
+		return;
+	}
+	if ( (o->type != RESOURCE_FORMULA_ANY && o->type != col->type) || col->values == NULL )
+	{
+		for(i = 0 ; i < n ; i++)
+			x[i] = NAN;
+		return;
+	}
+
+	switch( col->type )
+	{
+		case RESOURCE_FORMULA_INT:
+			integer = (const int *)col->values + first;
+			if ( o->conv != 0 && o->conv != 'd' && o->conv != 'i' )
+				for(i = 0 ; i < n ; i++)
+					x[i] = (unsigned int)integer[i];
+			else
+				for(i = 0 ; i < n ; i++)
+					x[i] = integer[i];
+			break;
+		case RESOURCE_FORMULA_DOUBLE:
+			dbl = (const double *)col->values + first;
+			for(i = 0 ; i < n ; i++)
+				x[i] = dbl[i];
+			break;
+		case RESOURCE_FORMULA_ULLONG:
+			ullong = (const unsigned long long *)col->values + first;
+			if ( o->conv == 'd' || o->conv == 'i' )
+				for(i = 0 ; i < n ; i++)
+					x[i] = (long long)ullong[i];
+			else
+				for(i = 0 ; i < n ; i++)
+					x[i] = ullong[i];
+			break;
+		default:
+			for(i = 0 ; i < n ; i++)
+				x[i] = NAN;
+			break;
+	}
+}
+
+
+/** \brief Value of an argument referred to by a formula
+
+	\return the value, or NaN if the argument doesn't have the type of the reference
+*/
+static double
+arg_value(const struct resource_formula_op *o,const resource_formula_arg_t *arg)
+{
+	resource_formula_col_t col;
+	double x;
+
+	col.type = arg->type;
+	col.values = &arg->value;
+	col_values(o,&col,0,1,&x);
+	return x;
+}
+
+
+/** \brief Evaluate a compiled formula on the arguments of a function instance
+	Evaluation uses no global state, it is safe to call concurrently.
+
+	\param f The compiled formula
+	\param args Arguments of the function instance
+	\param args_num Number of arguments
+	\param res Reference where the result is going to be placed
+
+	\return 0 on success, or -1 on failure
+*/
+int
+resource_formula_eval(const resource_formula_t *f,const resource_formula_arg_t *args,unsigned int args_num,double *res)
+{
+	double st[RESOURCE_FORMULA_MAX_OPS];
+	const struct resource_formula_op *o;
+	unsigned int sp = 0;
+
+	if ( f->len == 0 )
+	{
+		*res = 0.0;
+		return 0;
+	}
+	if ( f->args > args_num )
+		return -1;
+
+	for(o = f->code ; o < f->code + f->len ; o++)
+		switch( o->op )
+		{
+			case OP_NUM:
+				st[sp++] = o->value;
+				break;
+			case OP_ARG:
+				st[sp++] = arg_value(o,args + o->arg);
+				break;
+			default:
+				sp -= op_arity[o->op];
+				st[sp] = apply(o->op,st + sp);
+				sp++;
+				break;
+		}
+
+	*res = st[0];
+	return ( isfinite(*res) )? 0 : -1;
+}
+
+
+/** \brief Evaluate a compiled formula on a block of function instances
+	The formula is evaluated one operation at a time on all the instances
+	of the block, instead of one instance at a time, so it is decoded once
+	per block and its operations run in loops that can be vectorized.
+	Results of instances the formula fails on are not finite. Evaluation
+	uses no global state, it is safe to call concurrently.
+
+	\param f The compiled formula
+	\param cols Columns of the values of each argument of the instances
+	\param args_num Number of arguments
+	\param first Index of the first instance of the block in the columns
+	\param n Number of instances, up to RESOURCE_FORMULA_BLOCK
+	\param res Array where the result of each instance is going to be placed
+
+	\return 0 on success, or -1 if the formula refers to more arguments
+	than there are, or the block is too large
+*/
+int
+resource_formula_eval_block(const resource_formula_t *f,const resource_formula_col_t *cols,unsigned int args_num,unsigned int first,unsigned int n,double *res)
+{
+	double st[RESOURCE_FORMULA_MAX_OPS][RESOURCE_FORMULA_BLOCK];
+	const struct resource_formula_op *o;
+	unsigned int i,sp = 0,arity;
+
+	if ( n > RESOURCE_FORMULA_BLOCK || f->args > args_num )
+		return -1;
+	if ( f->len == 0 )
+	{
+		for(i = 0 ; i < n ; i++)
+			res[i] = 0.0;
+		return 0;
+	}
+
+	for(o = f->code ; o < f->code + f->len ; o++)
+		switch( o->op )
+		{
+			case OP_NUM:
+				for(i = 0 ; i < n ; i++)
+					st[sp][i] = o->value;
+				sp++;
+				break;
+			case OP_ARG:
+				col_values(o,cols + o->arg,first,n,st[sp++]);
+				break;
+			default:
+				arity = op_arity[o->op];
+				sp -= arity;
+				apply_block(o->op,st[sp],( arity > 1 )? st[sp + 1] : NULL,( arity > 2 )? st[sp + 2] : NULL,n);
+				sp++;
+				break;
+		}
+
+	memcpy(res,st[0],n * sizeof(double));
+	return 0;
+}
+
+
+/** \brief Check whether the value of a formula changed with C precedence
+	Formulas used to be evaluated with * and / before + and -, but all of
+	them grouped from the right, so "8 - 2 - 2" was 8 and "8 / 2 * 2" was 2.
+	The formula is compiled both ways and, if the code differs, evaluated
+	both ways on a few sets of argument values of the types it refers to.
+
+	\param s The formula
+
+	\return 1 if its value changed, 0 if it didn't, or -1 if the formula is
+	invalid
+*/
+int
+resource_formula_regrouped(const char *s)
+{
+	static const double scale[] = { 1.0, 7.0, 1000.0 };
+	resource_formula_t *f,*old;
+	resource_formula_arg_t args[256];
+	unsigned int i,j;
+	double x,y;
+	int ret = -1,e,e_old;
+
+	if ( (f = malloc(2 * sizeof(resource_formula_t))) == NULL )
+		return -1;
+	old = f + 1;
+	if ( compile(s,f,0) != 0 || compile(s,old,1) != 0 )
+		goto ret;
+	ret = 0;
+	if ( f->len == old->len && memcmp(f->code,old->code,f->len * sizeof(struct resource_formula_op)) == 0 )
+		goto ret;
+
+	bzero(args,sizeof(args));
+	for(i = 0 ; i < f->len ; i++)
+		if ( f->code[i].op == OP_ARG )
+			args[f->code[i].arg].type = ( f->code[i].type == RESOURCE_FORMULA_ANY )?
+				RESOURCE_FORMULA_DOUBLE : f->code[i].type;
+	for(j = 0 ; j < sizeof(scale) / sizeof(scale[0]) && ret == 0 ; j++)
+	{
+		// Distinct values, none of which is 0 or 1
+		for(i = 0 ; i < f->args ; i++)
+			switch( args[i].type )
+			{
+				case RESOURCE_FORMULA_DOUBLE:
+					args[i].value.dbl = (i + 2) * scale[j] + 0.5;
+					break;
+				case RESOURCE_FORMULA_ULLONG:
+					args[i].value.ullong = (unsigned long long)((i + 2) * scale[j]) + 1;
+					break;
+				default:
+					args[i].value.integer = (int)((i + 2) * scale[j]) + 1;
+					break;
+			}
+		e = resource_formula_eval(f,args,f->args,&x);
+		e_old = resource_formula_eval(old,args,f->args,&y);
+		if ( e != e_old || (e == 0 && fabs(x - y) > 1e-9 * fmax(1.0,fabs(x))) )
+			ret = 1;
+	}
+
+ret:
+	free(f);
+	return ret;
+}
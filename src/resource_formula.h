@@ -0,0 +1,120 @@
+/* resource_formula.h
+
+  Copyright 2004  Georgios Portokalidis <digital_bull@users.sourceforge.net>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef RESOURCE_FORMULA_H
+#define RESOURCE_FORMULA_H
+
+#include <admctrl_config.h>
+
+/** \file resource_formula.h
+	\brief Compiled variable cost formulas
+	\author Georgios Portokalidis
+
+	Variable cost formulas are compiled once to postfix code, with constant
+	subexpressions folded, and evaluated on the numeric values of the
+	arguments of function instances. The language is:
+
+	\li numbers, such as 10 or 2.5
+	\li $n, the value of the nth argument, whatever its type
+	\li %n$d, %n$u, %n$lu, %n$llu, %n$f (and the other printf conversions of
+	integers, unsigned long longs and doubles), the nth argument, which must
+	have the type of the conversion. Conversions with the l, ll, q or L
+	length all refer to unsigned long longs. The argument number can be left
+	out, in which case arguments are taken in order as in printf
+	\li + - * / and unary -
+	\li min(a,b,...), max(a,b,...), log(a), ceil(a) and floor(a)
+	\li the comparisons < <= > >= == !=, which are 1 if true and 0 if false
+	\li c ? a : b, which is a if c is not 0, or b otherwise
+	\li parentheses
+
+	The length of string arguments is used as an integer, and the value of
+	function arguments is 0, whatever the conversion. The operators have the
+	precedence and associativity of C, see resource_formula_regrouped() for
+	formulas written for the old right to left grouping. A formula fails if a number, argument
+	or intermediate result is not finite, unless it is in the branch of a
+	conditional that isn't selected.
+	*/
+
+//! Maximum number of operations of a compiled formula
+/** Every operation takes at least one character of the formula */
+#define RESOURCE_FORMULA_MAX_OPS RESOURCE_CTRL_MAX_VAR_FORM_LEN
+
+//! Number of instances evaluated together by resource_formula_eval_block()
+#define RESOURCE_FORMULA_BLOCK 32
+
+//! Types of the arguments of a formula
+enum resource_formula_type
+{
+	RESOURCE_FORMULA_INT, //!< int, or the length of a string
+	RESOURCE_FORMULA_DOUBLE, //!< double
+	RESOURCE_FORMULA_ULLONG, //!< unsigned long long
+	RESOURCE_FORMULA_NONE, //!< Function, always 0
+	RESOURCE_FORMULA_ANY //!< Reference by $n, accepts every type
+};
+
+//! Argument of a function instance
+struct resource_formula_arg
+{
+	unsigned char type; //!< One of enum resource_formula_type, but RESOURCE_FORMULA_ANY
+	union
+	{
+		int integer;
+		double dbl;
+		unsigned long long ullong;
+	} value; //!< Value of the argument
+};
+//! Formula argument datatype
+typedef struct resource_formula_arg resource_formula_arg_t;
+
+//! Column of the values of an argument of several function instances
+struct resource_formula_col
+{
+	unsigned char type; //!< One of enum resource_formula_type, but RESOURCE_FORMULA_ANY
+	const void *values; //!< Array of ints, doubles or unsigned long longs, NULL for functions
+};
+//! Formula argument column datatype
+typedef struct resource_formula_col resource_formula_col_t;
+
+//! Operation of a compiled formula
+struct resource_formula_op
+{
+	unsigned char op; //!< Operation code
+	unsigned char type; //!< Type of an argument reference
+	unsigned char conv; //!< Conversion of an argument reference
+	unsigned char arg; //!< Index of an argument reference
+	double value; //!< Value of a number
+};
+
+//! Compiled formula
+struct resource_formula
+{
+	unsigned int len; //!< Number of operations, 0 for an empty formula
+	unsigned int depth; //!< Maximum depth of the stack when evaluated
+	unsigned int args; //!< Number of arguments referred to
+	struct resource_formula_op code[RESOURCE_FORMULA_MAX_OPS]; //!< Operations in postfix order
+};
+//! Compiled formula datatype
+typedef struct resource_formula resource_formula_t;
+
+int resource_formula_compile(const char *,resource_formula_t *);
+int resource_formula_eval(const resource_formula_t *,const resource_formula_arg_t *,unsigned int,double *);
+int resource_formula_eval_block(const resource_formula_t *,const resource_formula_col_t *,unsigned int,unsigned int,unsigned int,double *);
+int resource_formula_regrouped(const char *);
+
+#endif
@@ -0,0 +1,220 @@
+/* resource_lease.c
+
+  Copyright 2004  Georgios Portokalidis <digital_bull@users.sourceforge.net>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+
+#include "resource_lease.h"
+#include "debug.h"
+
+/** \file resource_lease.c
+	\brief Implementation of the lease timer wheel
+	\author Georgios Portokalidis
+
+	Leases are stored in the resource control database by the services 
+	that allocate resources. The wheel picks up new leases by following 
+	the sequence of lease ids, and returns the resources of those that were 
+	not renewed in time. Renewals only update the database, a lease is 
+	rescheduled when its original slot comes up.
+
+	A lease may be added to the wheel twice, when it is allocated while 
+	the wheel is scanning. The second timer to come up finds it expired or 
+	renewed, so this only costs a lookup.
+*/
+
+
+/**
+	Places a timer in the slot of the second it expires
+	*/
+static void
+wheel_insert(resource_lease_wheel_t *w,struct resource_lease_timer *t)
+{
+	u_int32_t sec;
+
+	sec = ( t->expires > w->now )? t->expires : w->now + 1;
+	t->next = w->slot[sec % RESOURCE_CTRL_LEASE_WHEEL_SLOTS];
+	w->slot[sec % RESOURCE_CTRL_LEASE_WHEEL_SLOTS] = t;
+}
+
+
+/**
+	Returns a timer to the free list
+	*/
+static void
+wheel_free(resource_lease_wheel_t *w,struct resource_lease_timer *t)
+{
+	t->next = w->free_timers;
+	w->free_timers = t;
+	--w->pending;
+}
+
+
+/**
+	Adds a lease found in the database to the wheel. 
+	Called by resource_ctrl_lease_scan()
+	*/
+static int
+wheel_add_lease(u_int32_t id,u_int32_t expires,void *arg)
+{
+	resource_lease_wheel_t *w = (resource_lease_wheel_t *)arg;
+	struct resource_lease_timer *t;
+
+	if ( (t = w->free_timers) != NULL )
+		w->free_timers = t->next;
+	else if ( (t = malloc(sizeof(struct resource_lease_timer))) == NULL )
+		return ENOMEM;
+
+	t->id = id;
+	t->expires = expires;
+	wheel_insert(w,t);
+	++w->pending;
+	return 0;
+}
+
+
+/** \brief Initialise a lease timer wheel
+
+	\param w Reference to the wheel
+	\param db Reference to an open resource control database
+
+	\return zero on success, or non-zero on failure
+*/
+int
+resource_lease_wheel_init(resource_lease_wheel_t *w,resource_ctrl_db_t *db)
+{
+	bzero(w,sizeof(resource_lease_wheel_t));
+	w->db = db;
+	w->now = (u_int32_t)time(NULL) - 1;
+	return 0;
+}
+
+
+/** \brief Free all memory used by a lease timer wheel
+
+	Leases are not affected, they remain in the database.
+
+	\param w Reference to the wheel
+*/
+void
+resource_lease_wheel_destroy(resource_lease_wheel_t *w)
+{
+	struct resource_lease_timer *t;
+	unsigned int i;
+
+	for(i = 0 ; i < RESOURCE_CTRL_LEASE_WHEEL_SLOTS ; i++)
+		while( (t = w->slot[i]) != NULL )
+		{
+			w->slot[i] = t->next;
+			free(t);
+		}
+	while( (t = w->free_timers) != NULL )
+	{
+		w->free_timers = t->next;
+		free(t);
+	}
+	w->pending = 0;
+}
+
+
+/** \brief Advance the wheel and expire leases
+
+	Adds new leases from the database to the wheel, and processes all 
+	slots up to now. Leases that were renewed are rescheduled, the rest 
+	return their resources to the database.
+
+	\param w Reference to the wheel
+	\param now Current time
+	\param expired Reference where the number of expired leases is stored
+
+	\return zero on success, or the last error encountered. Leases that 
+	failed to expire are retried on the next tick
+*/
+int
+resource_lease_wheel_tick(resource_lease_wheel_t *w,u_int32_t now,size_t *expired)
+{
+	struct resource_lease_timer *t,**prev,*retry = NULL;
+	u_int32_t sec,expires,next_id;
+	size_t slots;
+	int e,ret;
+
+	*expired = 0;
+
+	// Pick up leases allocated since the last tick, all of them on the first
+	if ( (ret = resource_ctrl_lease_next(w->db,&next_id)) == 0 &&
+			(ret = resource_ctrl_lease_scan(w->db,( w->next_id == 0 )? 1 : w->next_id,
+				( w->next_id == 0 )? 0 : next_id,wheel_add_lease,w)) == 0 )
+		w->next_id = next_id;
+
+	if ( now <= w->now )
+		return ret;
+	if ( (slots = now - w->now) > RESOURCE_CTRL_LEASE_WHEEL_SLOTS )
+		slots = RESOURCE_CTRL_LEASE_WHEEL_SLOTS;
+
+	for(sec = now - slots + 1 ; slots > 0 ; --slots, ++sec)
+	{
+		prev = &w->slot[sec % RESOURCE_CTRL_LEASE_WHEEL_SLOTS];
+		while( (t = *prev) != NULL )
+		{
+			// Expires in a later round of the wheel
+			if ( t->expires > now )
+			{
+				prev = &t->next;
+				continue;
+			}
+			*prev = t->next;
+
+			e = resource_ctrl_lease_expire(w->db,t->id,now,&expires);
+			if ( e == 0 && expires > now )
+			{
+				// Renewed
+				t->expires = expires;
+				wheel_insert(w,t);
+			}
+			else if ( e == 0 || e == RESOURCE_DB_NOTFOUND )
+			{
+				// Expired, or released by its owner
+				if ( e == 0 )
+					++*expired;
+				wheel_free(w,t);
+			}
+			else
+			{
+				DEBUG_CMD(w->db->DB[4]->err(w->db->DB[4],e,"resource_lease_wheel_tick"));
+				t->next = retry;
+				retry = t;
+				ret = e;
+			}
+		}
+	}
+	w->now = now;
+
+	while( (t = retry) != NULL )
+	{
+		retry = t->next;
+		wheel_insert(w,t);
+	}
+
+	return ret;
+}
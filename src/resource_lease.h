@@ -0,0 +1,55 @@
+/* resource_lease.h
+
+  Copyright 2004  Georgios Portokalidis <digital_bull@users.sourceforge.net>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef RESOURCE_LEASE_H
+#define RESOURCE_LEASE_H
+
+#include "resource_ctrl.h"
+
+/** \file resource_lease.h
+	\brief Timer wheel expiring resource leases
+	\author Georgios Portokalidis
+	*/
+
+//! A lease waiting to expire in the timer wheel
+struct resource_lease_timer
+{
+	u_int32_t id; //!< Lease id
+	u_int32_t expires; //!< Expiration time when the lease was scheduled
+	struct resource_lease_timer *next; //!< Next lease in the same slot
+};
+
+//! Timer wheel of leases. Slot i holds leases expiring at i modulo the wheel size
+struct resource_lease_wheel
+{
+	resource_ctrl_db_t *db; //!< Database holding the leases
+	struct resource_lease_timer *slot[RESOURCE_CTRL_LEASE_WHEEL_SLOTS]; //!< Timer slots
+	struct resource_lease_timer *free_timers; //!< Unused timers
+	u_int32_t next_id; //!< Id of the next lease to add to the wheel, 0 before the first scan
+	u_int32_t now; //!< Last second processed
+	size_t pending; //!< Number of leases in the wheel
+};
+//! Lease timer wheel datatype
+typedef struct resource_lease_wheel resource_lease_wheel_t;
+
+int resource_lease_wheel_init(resource_lease_wheel_t *,resource_ctrl_db_t *);
+void resource_lease_wheel_destroy(resource_lease_wheel_t *);
+int resource_lease_wheel_tick(resource_lease_wheel_t *,u_int32_t,size_t *);
+
+#endif
@@ -22,6 +22,8 @@
 #endif
 
 #include <errno.h>
+#include <time.h>
+#include <sys/time.h>
 #include <sys/ipc.h>
 #include <sys/sem.h>
 
@@ -220,6 +222,22 @@ shm_unlock(int id)
 }
 
 
+/** \brief Number of processes waiting for the lock
+ *
+ * Counts the requesting processes blocked in shm_lock(), while another one
+ * holds the lock.
+ *
+ *\param id The index number of the semaphore set
+ *
+ *\return the number of waiting processes, or -1 on failure
+ */
+int
+shm_lock_waiting(int id)
+{
+	return semctl(id,0,GETZCNT);
+}
+
+
 /** \brief  Wait for the data ready signal
  *
  * Blocks the serving side until the request data have been placed in
@@ -293,3 +311,36 @@ shm_result_wait(int id)
 
 	return 0;
 }
+
+/** \brief Wait for the result ready signal for a limited time
+ *
+ * Like shm_result_wait(), but without relying on SIGALRM to interrupt the
+ * wait, so it can be used by any thread.
+ *
+ *\param id The index number of the semaphore set
+ *\param timeout The longest time to wait
+ *
+ *\return 0 on success, or -1 on failure. errno is set to ETIME if the time
+ *expired, or ENOSYS if semtimedop() is not available
+ */
+int 
+shm_result_timedwait(int id,const struct timeval *timeout)
+{
+#ifdef HAVE_SEMTIMEDOP
+	struct timespec ts;
+
+	ts.tv_sec = timeout->tv_sec;
+	ts.tv_nsec = timeout->tv_usec * 1000;
+	if ( semtimedop(id,op_result_wait,RESULT_WAIT_OPS,&ts) < 0 )
+	{
+		if ( errno == EAGAIN )
+			errno = ETIME;
+		return -1;
+	}
+
+	return 0;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
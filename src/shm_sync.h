@@ -21,6 +21,7 @@
 #define SHM_SYNC_H
 
 #include <sys/types.h>
+#include <sys/time.h>
 
 /*! \file shm_sync.h
  *  \brief Definitions of the routines in shm_sync.h
@@ -34,7 +35,9 @@ int shm_data_ready(int id);
 int shm_result_ready(int id);
 int shm_data_wait(int id);
 int shm_result_wait(int id);
+int shm_result_timedwait(int id,const struct timeval *timeout);
 int shm_lock(int id);
 int shm_unlock(int id);
+int shm_lock_waiting(int id);
 
 #endif
@@ -38,6 +38,7 @@ stack_init(stack *s,size_t us)
 {
 	s->head = 0;
 	s->unit_size = us;
+	s->fixed = 0;
 	if ( (s->data = (unsigned char *)malloc(STACK_GROW_RATE * sizeof(unsigned char) * us)) == NULL )
 	{
 		s->size = 0;
@@ -48,6 +49,25 @@ stack_init(stack *s,size_t us)
 }
 
 
+/** \brief Initialize a stack on a memory area provided by the caller
+	The stack doesn't grow, pushing to a full stack fails.
+
+	\param s Pointer to a stack
+	\param buf Memory area for the stack
+	\param size Number of items that fit in buf
+	\param us Unit size of item stored on stack
+	*/
+void
+stack_init_fixed(stack *s,void *buf,size_t size,size_t us)
+{
+	s->head = 0;
+	s->unit_size = us;
+	s->size = size;
+	s->data = (unsigned char *)buf;
+	s->fixed = 1;
+}
+
+
 /** \brief Destroy a stack
 	\param s Pointer to a stack
 
@@ -56,7 +76,8 @@ stack_init(stack *s,size_t us)
 void
 stack_destroy(stack *s)
 {
-		free(s->data);
+		if ( !s->fixed )
+			free(s->data);
 		s->size = s->unit_size = 0;
 		s->head = 0;
 }
@@ -75,6 +96,8 @@ stack_push(stack *s,const void *n)
 	if ( s->head >= s->size )
 	{
 		unsigned char *t;
+		if ( s->fixed )
+			return 1;
 		if ( (t = (unsigned char *)realloc(s->data,(s->size + STACK_GROW_RATE) * sizeof(unsigned char) * s->unit_size)) == NULL )
 			return 1;
 		s->data = t;
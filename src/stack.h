@@ -33,12 +33,14 @@ struct stack_struct
 	size_t unit_size; //!< The size of stored units
 	unsigned int head; //!< The head of the stack
 	unsigned char *data; //!< Memory area for stack
+	char fixed; //!< Memory area is provided by the caller and doesn't grow
 };
 
 //! The stack datatype
 typedef struct stack_struct stack;
 
 char stack_init(stack *,size_t);
+void stack_init_fixed(stack *,void *,size_t,size_t);
 void stack_destroy(stack *);
 char stack_push(stack *,const void *);
 inline void *stack_pop(stack *);
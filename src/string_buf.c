@@ -42,6 +42,7 @@ string_buf_init(string_buf_t *s,const char *d)
 
 	if ( d != NULL && (t = strlen(d)) > size )
 		size = t + 1;
+	s->fixed = 0;
 
 	if ( (s->data = (char *)malloc(size * sizeof(char))) == NULL )
 	{
@@ -64,13 +65,32 @@ string_buf_init(string_buf_t *s,const char *d)
 }
 
 
+/** \brief Initialize an empty string buffer on memory provided by the caller
+	The string buffer doesn't grow, pushing to a full one fails.
+
+	\param s Pointer to a string buffer
+	\param d Memory for the data of the string buffer
+	\param size Size of d, at least 1
+	*/
+void
+string_buf_init_fixed(string_buf_t *s,char *d,unsigned int size)
+{
+	s->data = d;
+	s->data[0] = '\0';
+	s->length = 0;
+	s->size = size;
+	s->fixed = 1;
+}
+
+
 /** \brief Destroy a string buffer
 	\param s Pointer to a string buffer
 	*/
 void
 string_buf_destroy(string_buf_t *s)
 {
-	free(s->data);
+	if ( !s->fixed )
+		free(s->data);
 	s->length = s->size = 0;
 }
 
@@ -92,6 +112,8 @@ string_buf_push_s(string_buf_t *s,const char *d)
 	// Grow string buffer
 	if ( (size = length + s->length + 1) > s->size )
 	{
+		if ( s->fixed )
+			return 1;
 		if ( (s->size + STRING_BUF_GROW_RATE) > size )
 			size = s->size + STRING_BUF_GROW_RATE;
 		if ( (t = (char *)realloc(s->data,size * sizeof(char))) == NULL )
@@ -126,8 +148,10 @@ string_buf_push_c(string_buf_t *s,const char c)
 	char *t;
 
 	// Grow string buffer
-	if ( s->size == (s->length - 1) )
+	if ( (s->length + 1) >= s->size )
 	{
+		if ( s->fixed )
+			return 1;
 		if ( (t = (char *)realloc(s->data,(s->size + STRING_BUF_GROW_RATE) * sizeof(char))) == NULL )
 		{
 #ifdef DEBUG
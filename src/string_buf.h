@@ -32,12 +32,14 @@ struct string_buf_struct
 	unsigned int length;
 	unsigned int size;
 	char *data;
+	char fixed; //!< Data is provided by the caller and doesn't grow
 };
 
 //! The string buffer datatype
 typedef struct string_buf_struct string_buf_t;
 
 char string_buf_init(string_buf_t *,const char *);
+void string_buf_init_fixed(string_buf_t *,char *,unsigned int);
 inline void string_buf_destroy(string_buf_t *);
 char string_buf_push_s(string_buf_t *,const char *);
 char string_buf_push_c(string_buf_t *,const char);
@@ -0,0 +1,1034 @@
+/* authd_bench.c
+
+  Copyright 2004  Georgios Portokalidis <digital_bull@users.sourceforge.net>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <errno.h>
+#include <unistd.h>
+#include <math.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/fcntl.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <keynote.h>
+#include <openssl/rsa.h>
+
+#include "admctrl_argtypes.h"
+#include "admctrl_config.h"
+#include "admctrlcl.h"
+#include "admctrl_req.h"
+
+#ifdef HAVE_LIBSSL
+#include <openssl/err.h>
+#endif
+
+/*! \file authd_bench.c
+ *  \brief Load generator and latency benchmark for authd and authdfe
+ *  \author Georgios Portokalidis
+ *
+ *  A number of client processes submit the same signed request to authd,
+ *  or authdfe, as fast as possible. Each client reports the latency of
+ *  every request to the parent, which prints throughput and percentiles.
+ *  With -I a client keeps several requests in flight using the asynchronous
+ *  client API, instead of submitting one at a time.
+ */
+
+//! Size of keys generated for the credential chain
+#define BENCH_KEY_BITS 1024
+//! Algorithm used to sign generated credentials
+#define BENCH_SIG_ALGORITHM "sig-rsa-sha1-base64:"
+//! Maximum number of concurrent clients
+#define BENCH_MAX_CLIENTS 1024
+
+//! Statistics a client reports to the parent, followed by the latencies
+struct bench_report
+{
+  unsigned int sent; //!< Number of requests submitted
+  unsigned int errors; //!< Requests that failed to be submitted
+  unsigned int rejected; //!< Requests that were not authorised
+  struct timeval start; //!< Time the first request was submitted
+  struct timeval end; //!< Time the last result was received
+};
+
+static char *pubfile = "pub";
+static char *privfile = "priv";
+static char *credsfile = "creds";
+
+static char *shm_pathname = NULL;
+static int shm_project_id = 'A';
+static char *server_host = NULL;
+static unsigned int server_port = 7914;
+static char use_ssl = 0;
+static char *ssl_pk_file = "client.key";
+static char *ssl_ca_file = NULL;
+static char ssl_reuse = 1;
+static struct timeval timeout = { 0, 0 };
+static char persistent = 0;
+
+static unsigned int clients_num = 1;
+static unsigned int requests_num = 1000;
+static unsigned int functions_num = 4;
+static unsigned int pairs_num = 1;
+static unsigned int chain_depth = 1;
+static char sign_each = 0;
+static unsigned int presign_num = 0;
+static char auth_sessions = 0;
+static unsigned int inflight_num = 0;
+static unsigned int batch_num = 0;
+
+//! Public key of the requester, the last key in the credential chain
+static char pubkey[MAX_PUBKEY_SIZE];
+//! Credentials, including the generated chain
+static char credentials[MAX_CREDENTIALS_SIZE];
+//! Private key of the requester, used to sign nonces
+static admctrl_signer_t *requester = NULL;
+
+static const char *libs_array[] = { "stdlib", "dag" };
+
+
+static int
+read_file(const char *fn,char *buf,size_t len)
+{
+  int fp,r;
+
+  if ( (fp = open(fn,O_RDONLY)) < 0 )
+    return -1;
+  r = read(fp,buf,len - 1);
+  close(fp);
+  if ( r >= 0 )
+    buf[r] = '\0';
+  return r;
+}
+
+
+/** \brief Encode an RSA key as a KeyNote key string
+
+  \param rsa the key
+  \param type KEYNOTE_PUBLIC_KEY or KEYNOTE_PRIVATE_KEY
+
+  \return an allocated string on success, or NULL on failure
+*/
+static char *
+encode_key(RSA *rsa,int type)
+{
+  struct keynote_deckey dk;
+  const char *prefix;
+  char *enc,*s;
+
+  prefix = ( type == KEYNOTE_PRIVATE_KEY )? "private-rsa-base64:" : "rsa-base64:";
+  dk.dec_algorithm = KEYNOTE_ALGORITHM_RSA;
+  dk.dec_key = rsa;
+  if ( (enc = kn_encode_key(&dk,INTERNAL_ENC_PKCS1,ENCODING_BASE64,type)) == NULL )
+    return NULL;
+  if ( (s = malloc(strlen(prefix) + strlen(enc) + 1)) != NULL )
+    sprintf(s,"%s%s",prefix,enc);
+  free(enc);
+  return s;
+}
+
+
+/** \brief Load keys and credentials, and extend the credential chain
+
+  The credentials in credsfile license the key in pubfile. For a depth
+  larger than 1, new keys are generated and each is delegated the rights
+  of the previous one with an assertion signed by it. The last key is
+  used as the requester's key.
+
+  \return 0 on success, or -1 on failure
+*/
+static int
+load_credentials(void)
+{
+  char buf[MAX_PRIVKEY_SIZE],authorizer[MAX_PUBKEY_SIZE];
+  char *signer = NULL,*pub = NULL,*priv = NULL,*sig = NULL,*assertion = NULL;
+  size_t len,alen;
+  unsigned int i;
+  RSA *rsa = NULL;
+
+  if ( read_file(pubfile,pubkey,MAX_PUBKEY_SIZE) <= 0 )
+  {
+    perror(pubfile);
+    return -1;
+  }
+  if ( read_file(credsfile,credentials,MAX_CREDENTIALS_SIZE) <= 0 )
+  {
+    perror(credsfile);
+    return -1;
+  }
+  if ( read_file(privfile,buf,MAX_PRIVKEY_SIZE) <= 0 )
+  {
+    perror(privfile);
+    return -1;
+  }
+
+  if ( (signer = kn_get_string(buf)) == NULL )
+  {
+    fprintf(stderr,"Couldn't decode private key in %s\n",privfile);
+    return -1;
+  }
+  if ( (signer = strdup(signer)) == NULL )
+  {
+    perror("strdup");
+    return -1;
+  }
+
+  // An empty line would end the assertion
+  len = strlen(pubkey);
+  while( len > 0 && (pubkey[len - 1] == '\n' || pubkey[len - 1] == ' ') )
+    pubkey[--len] = '\0';
+  strcpy(authorizer,pubkey);
+
+  // Assertions are separated by an empty line
+  len = strlen(credentials);
+  while( len > 0 && credentials[len - 1] == '\n' )
+    --len;
+
+  for(i = 1 ; i < chain_depth ; i++)
+  {
+    if ( (rsa = RSA_generate_key(BENCH_KEY_BITS,RSA_F4,NULL,NULL)) == NULL )
+      goto fail;
+    if ( (pub = encode_key(rsa,KEYNOTE_PUBLIC_KEY)) == NULL ||
+        (priv = encode_key(rsa,KEYNOTE_PRIVATE_KEY)) == NULL )
+      goto fail;
+
+    alen = strlen(authorizer) + strlen(pub) + 64;
+    if ( (assertion = malloc(alen)) == NULL )
+      goto fail;
+    snprintf(assertion,alen,"KeyNote-Version: 2\nAuthorizer: %s\nLicensees: \"%s\"\nSignature: ",
+        authorizer,pub);
+    if ( (sig = kn_sign_assertion(assertion,strlen(assertion),signer,BENCH_SIG_ALGORITHM,0)) == NULL )
+    {
+      fprintf(stderr,"Couldn't sign credentials, keynote error %d\n",keynote_errno);
+      goto fail;
+    }
+    len += snprintf(credentials + len,MAX_CREDENTIALS_SIZE - len,"\n\n%s\"%s\"",assertion,sig);
+    free(assertion);
+    free(sig);
+    assertion = sig = NULL;
+    if ( len >= MAX_CREDENTIALS_SIZE - 1 )
+    {
+      fprintf(stderr,"Credential chain of depth %u exceeds %d bytes\n",chain_depth,MAX_CREDENTIALS_SIZE);
+      goto error;
+    }
+
+    // The new key signs the next assertion
+    free(signer);
+    signer = priv;
+    priv = NULL;
+    snprintf(authorizer,MAX_PUBKEY_SIZE,"\"%s\"",pub);
+    strcpy(pubkey,authorizer);
+    free(pub);
+    pub = NULL;
+    RSA_free(rsa);
+    rsa = NULL;
+  }
+  if ( len < MAX_CREDENTIALS_SIZE - 1 )
+    strcpy(credentials + len,"\n");
+
+  if ( (requester = admctrl_signer_new(signer)) == NULL )
+  {
+    fprintf(stderr,"Couldn't decode private key in %s\n",privfile);
+    goto error;
+  }
+  free(signer);
+  return 0;
+
+fail:
+  fprintf(stderr,"Couldn't generate credential chain\n");
+error:
+  free(assertion);
+  free(sig);
+  free(pub);
+  free(priv);
+  free(signer);
+  if ( rsa )
+    RSA_free(rsa);
+  return -1;
+}
+
+
+/** \brief Sign a new nonce and place it in the request
+  The public key and credentials are set by build_request().
+
+  \return 0 on success, or -1 on failure
+*/
+static int
+sign_nonce(adm_ctrl_request_t *request)
+{
+  return ( admctrl_signer_sign_next(requester,request) < 0 )? -1 : 0;
+}
+
+
+/** \brief Give the result of a request to the signer, when using sessions
+*/
+static void
+update_session(const adm_ctrl_result_t *result)
+{
+  if ( auth_sessions )
+    admctrl_signer_update(requester,result);
+}
+
+
+/** \brief Fill a request with the configured number of pairs and functions
+
+  \return 0 on success, or -1 on failure
+*/
+static int
+build_request(adm_ctrl_request_t *request)
+{
+  char name[MAX_PAIR_NAME],value[MAX_PAIR_VALUE];
+  const char *lib;
+  size_t off = 0;
+  unsigned int i;
+  int e;
+
+  bzero(request,sizeof(adm_ctrl_request_t));
+
+  // The first pair is required by the default policy
+  for(i = 0 ; i < pairs_num ; i++)
+  {
+    if ( i == 0 )
+      e = admctrl_req_add_nvpair(request,"app_domain","MY DOMAIN");
+    else
+    {
+      snprintf(name,MAX_PAIR_NAME,"BENCH_PAIR_%u",i);
+      snprintf(value,MAX_PAIR_VALUE,"%u",i);
+      e = admctrl_req_add_nvpair(request,name,value);
+    }
+    if ( e != 0 )
+    {
+      fprintf(stderr,"Too many pairs, maximum is %d\n",MAX_PAIR_ASSERTIONS);
+      return -1;
+    }
+  }
+
+  // Functions that satisfy the conditions in tests/conds
+  for(i = 0 ; i < functions_num ; i++)
+  {
+    lib = libs_array[i % 2];
+    switch( i % 5 )
+    {
+      case 0:
+        e = admctrl_req_add_function(request,&off,"STR_SEARCH",lib,"sii","http",32,1000);
+        break;
+      case 1:
+        e = admctrl_req_add_function(request,&off,"TO_TCPDUMP",lib,"sL","/home/user/test",123456789ULL);
+        break;
+      case 2:
+        e = admctrl_req_add_function(request,&off,"TIMEDIFF",lib,"d",1500.75);
+        break;
+      case 3:
+        e = admctrl_req_add_function(request,&off,"PKT_COUNTER",lib,"");
+        break;
+      default:
+        e = admctrl_req_add_function(request,&off,"BPF_FILTER",lib,"s","tcp port 80");
+        break;
+    }
+    if ( e != 0 )
+    {
+      fprintf(stderr,"Function list of %u functions exceeds %d bytes\n",functions_num,MAX_FUNCTION_LIST_SIZE);
+      return -1;
+    }
+  }
+
+  admctrl_req_set_authinfo(request,(unsigned char *)pubkey,(unsigned char *)credentials,0,
+      request->encrypted_nonce,0);
+  return sign_nonce(request);
+}
+
+
+static double
+tv_usec(const struct timeval *a,const struct timeval *b)
+{
+  return (b->tv_sec - a->tv_sec) * 1000000.0 + (b->tv_usec - a->tv_usec);
+}
+
+
+static void
+print_ssl_error(int e)
+{
+#ifdef HAVE_LIBSSL
+  char errbuf[120];
+  if ( e == EPROTO && ERR_error_string(ERR_get_error(),errbuf) )
+      fprintf(stderr,"%s\n",errbuf);
+#endif
+}
+
+
+/** \brief Create and open a client for the server given on the command line
+
+  \param request request used by the client, or NULL to allocate one
+  \param result result used by the client, or NULL to allocate one
+
+  \return the client, or NULL on failure
+*/
+static admctrlcl_t *
+open_client(adm_ctrl_request_t *request,adm_ctrl_result_t *result)
+{
+  admctrlcl_t *client;
+
+  if ( shm_pathname )
+    client = admctrlcl_new_ipc(shm_pathname,shm_project_id,persistent,&timeout,request,result);
+  else
+    client = admctrlcl_new_socket(server_host,server_port,persistent,&timeout,request,result);
+  if ( client == NULL )
+  {
+    perror("admctrlcl_new");
+    return NULL;
+  }
+  if ( use_ssl && admctrlcl_use_SSL(client,ssl_pk_file,ssl_ca_file) != 0 )
+  {
+    perror("admctrlcl_use_SSL");
+    print_ssl_error(errno);
+    goto error;
+  }
+  if ( use_ssl && !ssl_reuse )
+    admctrlcl_SSL_reuse_session(client,0);
+  if ( admctrlcl_comm_open(client) != 0 )
+  {
+    perror("admctrlcl_comm_open");
+    print_ssl_error(errno);
+    goto error;
+  }
+  return client;
+
+error:
+  admctrlcl_destroy(client);
+  return NULL;
+}
+
+
+//! State of a client keeping requests in flight, see run_async_client()
+static struct {
+  struct bench_report report; //!< Report of the client
+  struct timeval *submitted; //!< Time each request was submitted
+  double *latency; //!< Latency of each request
+  unsigned int completed; //!< Requests completed
+} async_run;
+
+
+/** \brief Completion callback of the requests of run_async_client()
+*/
+static void
+async_completed(admctrlcl_handle_t *h,int error,const adm_ctrl_result_t *result,void *arg)
+{
+  unsigned int i = (unsigned int)(size_t)arg;
+  struct timeval now;
+
+  gettimeofday(&now,NULL);
+  async_run.latency[i] = tv_usec(&async_run.submitted[i],&now);
+  if ( error != 0 )
+    ++async_run.report.errors;
+  else if ( result->PCV < 1 )
+    ++async_run.report.rejected;
+  if ( error == 0 )
+    update_session(result);
+  ++async_run.completed;
+}
+
+
+/** \brief Body of a client process keeping inflight_num requests in flight
+
+  Like run_client(), but submits with the asynchronous API over inflight_num
+  clients from a single thread.
+
+  \return exit status of the process
+*/
+static int
+run_async_client(int go_fd,int out_fd,adm_ctrl_request_t *request)
+{
+  admctrlcl_t **clients;
+  admctrlcl_async_t *async = NULL;
+  struct pollfd pfd;
+  unsigned int i,opened = 0;
+  char c;
+  int ret = 1;
+
+  clients = calloc(inflight_num,sizeof(admctrlcl_t *));
+  async_run.submitted = malloc(requests_num * sizeof(struct timeval));
+  async_run.latency = malloc(requests_num * sizeof(double));
+  if ( clients == NULL || async_run.submitted == NULL || async_run.latency == NULL )
+  {
+    perror("malloc");
+    return 1;
+  }
+  for(opened = 0 ; opened < inflight_num ; opened++)
+    if ( (clients[opened] = open_client(NULL,NULL)) == NULL )
+      goto ret;
+  if ( (async = admctrlcl_async_new(clients,inflight_num)) == NULL )
+  {
+    perror("admctrlcl_async_new");
+    goto ret;
+  }
+  pfd.fd = admctrlcl_async_fd(async);
+  pfd.events = POLLIN;
+
+  // Wait for all clients to be ready
+  read(go_fd,&c,1);
+
+  gettimeofday(&async_run.report.start,NULL);
+  while( async_run.completed < requests_num )
+  {
+    while( async_run.report.sent < requests_num &&
+        async_run.report.sent - async_run.completed < inflight_num )
+    {
+      if ( sign_each && sign_nonce(request) != 0 )
+      {
+        fprintf(stderr,"Couldn't sign nonce\n");
+        goto ret;
+      }
+      i = async_run.report.sent;
+      gettimeofday(&async_run.submitted[i],NULL);
+      if ( admctrlcl_async_submit(async,request,async_completed,(void *)(size_t)i) == NULL )
+      {
+        perror("admctrlcl_async_submit");
+        goto ret;
+      }
+      async_run.report.sent++;
+    }
+    if ( poll(&pfd,1,-1) < 0 && errno != EINTR )
+    {
+      perror("poll");
+      goto ret;
+    }
+    admctrlcl_async_dispatch(async);
+  }
+  gettimeofday(&async_run.report.end,NULL);
+
+  if ( write(out_fd,&async_run.report,sizeof(struct bench_report)) == sizeof(struct bench_report) &&
+      write(out_fd,async_run.latency,requests_num * sizeof(double)) == (ssize_t)(requests_num * sizeof(double)) )
+    ret = 0;
+
+ret:
+  if ( async )
+    admctrlcl_async_destroy(async);
+  for(i = 0 ; i < opened ; i++)
+  {
+    admctrlcl_comm_close(clients[i]);
+    admctrlcl_destroy(clients[i]);
+  }
+  free(clients);
+  free(async_run.latency);
+  free(async_run.submitted);
+  return ret;
+}
+
+
+/** \brief Body of a client process submitting batches of batch_num requests
+
+  Like run_client(), but submits with admctrlcl_submit_batch(). The latency
+  of each request is that of its batch.
+
+  \return exit status of the process
+*/
+static int
+run_batch_client(int go_fd,int out_fd,adm_ctrl_request_t *request)
+{
+  adm_ctrl_request_t *requests;
+  adm_ctrl_result_t *results;
+  admctrlcl_t *client;
+  struct bench_report report;
+  struct timeval t1,t2;
+  double *latency,l;
+  size_t i,n,done;
+  char c;
+  int ret = 1;
+
+  requests = malloc(batch_num * sizeof(adm_ctrl_request_t));
+  results = malloc(batch_num * sizeof(adm_ctrl_result_t));
+  latency = malloc(requests_num * sizeof(double));
+  if ( requests == NULL || results == NULL || latency == NULL )
+  {
+    perror("malloc");
+    return 1;
+  }
+  for(i = 0 ; i < batch_num ; i++)
+    memcpy(requests + i,request,sizeof(adm_ctrl_request_t));
+
+  if ( (client = open_client(NULL,NULL)) == NULL )
+    return 1;
+
+  // Wait for all clients to be ready
+  read(go_fd,&c,1);
+
+  bzero(&report,sizeof(report));
+  gettimeofday(&report.start,NULL);
+  while( report.sent < requests_num )
+  {
+    n = ( requests_num - report.sent < batch_num )? requests_num - report.sent : batch_num;
+    for(i = 0 ; sign_each && i < n ; i++)
+      if ( sign_nonce(requests + i) != 0 )
+      {
+        fprintf(stderr,"Couldn't sign nonce\n");
+        goto done;
+      }
+    gettimeofday(&t1,NULL);
+    done = admctrlcl_submit_batch(client,requests,results,n);
+    gettimeofday(&t2,NULL);
+    l = tv_usec(&t1,&t2);
+    for(i = 0 ; i < n ; i++)
+    {
+      if ( i >= done )
+        ++report.errors;
+      else
+      {
+        if ( results[i].PCV < 1 )
+          ++report.rejected;
+        update_session(results + i);
+      }
+      latency[report.sent++] = l;
+    }
+  }
+done:
+  gettimeofday(&report.end,NULL);
+
+  if ( write(out_fd,&report,sizeof(report)) == sizeof(report) &&
+      write(out_fd,latency,report.sent * sizeof(double)) == (ssize_t)(report.sent * sizeof(double)) )
+    ret = 0;
+
+  admctrlcl_comm_close(client);
+  admctrlcl_destroy(client);
+  free(latency);
+  free(results);
+  free(requests);
+  return ret;
+}
+
+
+/** \brief Body of a client process
+
+  Waits until the parent closes go_fd, then submits requests and writes
+  a report followed by the latencies to out_fd.
+
+  \return exit status of the process
+*/
+static int
+run_client(int go_fd,int out_fd)
+{
+  adm_ctrl_request_t *request;
+  adm_ctrl_result_t result;
+  admctrlcl_t *client;
+  struct bench_report report;
+  struct timeval t1,t2;
+  double *latency;
+  char c;
+  int ret = 1;
+
+  request = malloc(sizeof(adm_ctrl_request_t));
+  latency = malloc(requests_num * sizeof(double));
+  if ( request == NULL || latency == NULL )
+  {
+    perror("malloc");
+    return 1;
+  }
+  srandom(getpid());
+  if ( build_request(request) != 0 )
+    return 1;
+  // The thread must be started after fork()
+  if ( sign_each && presign_num > 0 && admctrl_signer_precompute(requester,presign_num) != 0 )
+  {
+    perror("admctrl_signer_precompute");
+    return 1;
+  }
+  if ( auth_sessions )
+    admctrl_signer_use_sessions(requester,1);
+
+  if ( inflight_num > 0 )
+  {
+    free(latency);
+    ret = run_async_client(go_fd,out_fd,request);
+    free(request);
+    return ret;
+  }
+  if ( batch_num > 0 )
+  {
+    free(latency);
+    ret = run_batch_client(go_fd,out_fd,request);
+    free(request);
+    return ret;
+  }
+
+  if ( (client = open_client(request,&result)) == NULL )
+    return 1;
+
+  // Wait for all clients to be ready
+  read(go_fd,&c,1);
+
+  bzero(&report,sizeof(report));
+  gettimeofday(&report.start,NULL);
+  for(report.sent = 0 ; report.sent < requests_num ; report.sent++)
+  {
+    if ( sign_each && sign_nonce(request) != 0 )
+    {
+      fprintf(stderr,"Couldn't sign nonce\n");
+      break;
+    }
+    gettimeofday(&t1,NULL);
+    if ( admctrlcl_submit_request(client) != 0 )
+      ++report.errors;
+    else
+    {
+      if ( result.PCV < 1 )
+        ++report.rejected;
+      update_session(&result);
+    }
+    gettimeofday(&t2,NULL);
+    latency[report.sent] = tv_usec(&t1,&t2);
+  }
+  gettimeofday(&report.end,NULL);
+
+  if ( write(out_fd,&report,sizeof(report)) == sizeof(report) &&
+      write(out_fd,latency,report.sent * sizeof(double)) == (ssize_t)(report.sent * sizeof(double)) )
+    ret = 0;
+
+  admctrlcl_comm_close(client);
+  admctrlcl_destroy(client);
+  free(latency);
+  free(request);
+  return ret;
+}
+
+
+static int
+compare_double(const void *a,const void *b)
+{
+  double x = *(const double *)a,y = *(const double *)b;
+
+  return ( x < y )? -1 : ( x > y );
+}
+
+
+static double
+percentile(const double *sorted,size_t n,double p)
+{
+  size_t i;
+
+  i = (size_t)ceil(p * n);
+  return sorted[ (i > 0)? i - 1 : 0 ];
+}
+
+
+/** \brief Collect the reports of all clients and print the results
+
+  \return 0 on success, or -1 on failure
+*/
+static int
+collect(int *fds)
+{
+  struct bench_report report;
+  struct timeval start,end;
+  unsigned int i,errors = 0,rejected = 0;
+  size_t total = 0,n;
+  double *latency,elapsed;
+  char *p;
+  ssize_t r;
+
+  if ( (latency = malloc(clients_num * requests_num * sizeof(double))) == NULL )
+    return -1;
+
+  for(i = 0 ; i < clients_num ; i++)
+  {
+    if ( read(fds[i],&report,sizeof(report)) != sizeof(report) )
+    {
+      fprintf(stderr,"Client %u failed\n",i);
+      continue;
+    }
+    // Read the latencies
+    p = (char *)(latency + total);
+    n = report.sent * sizeof(double);
+    while( n > 0 && (r = read(fds[i],p,n)) > 0 )
+    {
+      p += r;
+      n -= r;
+    }
+    if ( n > 0 )
+    {
+      fprintf(stderr,"Client %u failed\n",i);
+      continue;
+    }
+
+    if ( total == 0 || timercmp(&report.start,&start,<) )
+      start = report.start;
+    if ( total == 0 || timercmp(&report.end,&end,>) )
+      end = report.end;
+    total += report.sent;
+    errors += report.errors;
+    rejected += report.rejected;
+  }
+
+  if ( total == 0 )
+  {
+    fprintf(stderr,"No requests were submitted\n");
+    free(latency);
+    return -1;
+  }
+
+  qsort(latency,total,sizeof(double),compare_double);
+  elapsed = tv_usec(&start,&end) / 1000000.0;
+
+  if ( inflight_num > 0 )
+    printf("in flight per client: %u\n",inflight_num);
+  if ( batch_num > 0 )
+    printf("requests per batch: %u\n",batch_num);
+  printf("clients: %u functions: %u pairs: %u chain depth: %u\n",
+      clients_num,functions_num,pairs_num,chain_depth);
+  printf("requests: %u errors: %u rejected: %u\n",(unsigned int)total,errors,rejected);
+  printf("elapsed: %.3f s throughput: %.1f req/s\n",elapsed,total / elapsed);
+  printf("latency (usec): min %.0f p50 %.0f p99 %.0f p999 %.0f max %.0f\n",
+      latency[0],percentile(latency,total,0.5),percentile(latency,total,0.99),
+      percentile(latency,total,0.999),latency[total - 1]);
+
+  free(latency);
+  return 0;
+}
+
+
+static void
+print_usage(void)
+{
+  printf("Usage:\n");
+  printf("  -H  --host=HOSTNAME      Server port binded to HOSTNAME\n");
+  printf("  -p  --port=PORT          Use port number PORT \n");
+  printf("  -r  --persistent         Use persistent communication with server\n");
+  printf("  -t  --timeout=TIMEOUT    Set admission control timeout to TIMEOUT\n");
+  printf("  -P  --shmpath=path       Pathname to use for IPC with authd \n");
+  printf("  -i  --shmid=project id   Project id to use for IPC with authd\n");
+#ifdef HAVE_LIBSSL
+  printf("  -s  --ssl                Use SSL\n");
+  printf("  -k  --priv=FILENAME      Set file containing SSL private key\n");
+  printf("  -c  --ca=FILENAME        Set file containing SSL CA's\n");
+  printf("  -x  --nosessions         Don't resume SSL sessions\n");
+#endif
+  printf("  -K  --pubkey=FILENAME    Set file containing public key (pub)\n");
+  printf("  -S  --privkey=FILENAME   Set file containing private key (priv)\n");
+  printf("  -C  --creds=FILENAME     Set file containing credentials (creds)\n");
+  printf("  -n  --clients=NUMBER     Number of concurrent clients (1)\n");
+  printf("  -N  --requests=NUMBER    Requests submitted by each client (1000)\n");
+  printf("  -f  --functions=NUMBER   Function actions in each request (4)\n");
+  printf("  -a  --pairs=NUMBER       Name-value pairs in each request (1)\n");
+  printf("  -d  --depth=NUMBER       Depth of the credential chain (1)\n");
+  printf("  -R  --resign             Sign a new nonce for every request\n");
+  printf("  -G  --presign=NUMBER     With -R, keep NUMBER nonces signed ahead of time\n");
+  printf("  -A  --authsessions       Authenticate by authd sessions (implies -R)\n");
+  printf("  -I  --inflight=NUMBER    Keep NUMBER requests in flight from each client\n");
+  printf("  -B  --batch=NUMBER       Submit requests in batches of NUMBER\n");
+  printf("                           with the asynchronous API\n");
+  printf("  -h  --help               Display this message\n\n");
+}
+
+static void
+parse_arguments(int argc,char **argv)
+{
+  int c;
+  const char optstring[] = "H:p:hP:i:sk:c:xt:rK:S:C:n:N:f:a:d:RG:AI:B:";
+  const struct option longopts[] = {
+    { "host", required_argument, NULL, 'H' },
+    { "port", required_argument, NULL, 'p' },
+    { "persistent", no_argument, NULL, 'r' },
+    { "timeout", required_argument, NULL, 't' },
+    { "shmpath", required_argument, NULL, 'P' },
+    { "shmid", required_argument, NULL, 'i' },
+#ifdef HAVE_LIBSSL
+    { "ssl", no_argument, NULL, 's' },
+    { "priv", required_argument, NULL, 'k' },
+    { "ca", required_argument, NULL, 'c' },
+    { "nosessions", no_argument, NULL, 'x' },
+#endif
+    { "pubkey", required_argument, NULL, 'K' },
+    { "privkey", required_argument, NULL, 'S' },
+    { "creds", required_argument, NULL, 'C' },
+    { "clients", required_argument, NULL, 'n' },
+    { "requests", required_argument, NULL, 'N' },
+    { "functions", required_argument, NULL, 'f' },
+    { "pairs", required_argument, NULL, 'a' },
+    { "depth", required_argument, NULL, 'd' },
+    { "resign", no_argument, NULL, 'R' },
+    { "presign", required_argument, NULL, 'G' },
+    { "authsessions", no_argument, NULL, 'A' },
+    { "inflight", required_argument, NULL, 'I' },
+    { "batch", required_argument, NULL, 'B' },
+    { "help", no_argument, NULL, 'h' },
+    { "", 0, NULL , '\0' }
+  };
+
+  while ( (c = getopt_long(argc,argv,optstring,longopts,NULL)) >= 0 )
+    switch( c )
+    {
+      case 'H':
+        server_host = optarg;
+        break;
+      case 'r':
+        persistent = 1;
+        break;
+      case 'p':
+        server_port = (unsigned int)atoi(optarg);
+        break;
+      case 'P':
+        shm_pathname = optarg;
+        break;
+      case 'i':
+        shm_project_id = *optarg;
+        break;
+      case 't':
+        timeout.tv_sec = labs(strtol(optarg,NULL,10));
+        break;
+#ifdef HAVE_LIBSSL
+      case 's':
+        use_ssl = 1;
+        break;
+      case 'k':
+        ssl_pk_file = optarg;
+        break;
+      case 'c':
+        ssl_ca_file = optarg;
+        break;
+      case 'x':
+        ssl_reuse = 0;
+        break;
+#endif
+      case 'K':
+        pubfile = optarg;
+        break;
+      case 'S':
+        privfile = optarg;
+        break;
+      case 'C':
+        credsfile = optarg;
+        break;
+      case 'n':
+        clients_num = (unsigned int)atoi(optarg);
+        break;
+      case 'N':
+        requests_num = (unsigned int)atoi(optarg);
+        break;
+      case 'f':
+        functions_num = (unsigned int)atoi(optarg);
+        break;
+      case 'a':
+        pairs_num = (unsigned int)atoi(optarg);
+        break;
+      case 'd':
+        chain_depth = (unsigned int)atoi(optarg);
+        break;
+      case 'R':
+        sign_each = 1;
+        break;
+      case 'G':
+        presign_num = (unsigned int)atoi(optarg);
+        break;
+      case 'A':
+        sign_each = 1;
+        auth_sessions = 1;
+        break;
+      case 'I':
+        inflight_num = (unsigned int)atoi(optarg);
+        break;
+      case 'B':
+        batch_num = (unsigned int)atoi(optarg);
+        break;
+      case 'h':
+      default:
+        print_usage();
+        exit(1);
+        break;
+    }
+
+  if ( clients_num < 1 || clients_num > BENCH_MAX_CLIENTS || requests_num < 1 || chain_depth < 1 )
+  {
+    fprintf(stderr,"Invalid number of clients, requests or chain depth\n");
+    exit(1);
+  }
+}
+
+
+
+int
+main(int argc,char **argv)
+{
+  int go[2],out[2],fds[BENCH_MAX_CLIENTS];
+  unsigned int i,started;
+  pid_t pid;
+  int status,ret = 0;
+
+  parse_arguments(argc,argv);
+
+  if ( shm_pathname == NULL && server_host == NULL )
+  {
+    fprintf(stderr,"No server has been specified\n");
+    return 1;
+  }
+
+  if ( load_credentials() != 0 )
+    return 1;
+
+  if ( pipe(go) < 0 )
+  {
+    perror("pipe");
+    return 1;
+  }
+
+  for(started = 0 ; started < clients_num ; started++)
+  {
+    if ( pipe(out) < 0 )
+    {
+      perror("pipe");
+      break;
+    }
+    if ( (pid = fork()) < 0 )
+    {
+      perror("fork");
+      close(out[0]);
+      close(out[1]);
+      break;
+    }
+    else if ( pid == 0 )
+    {
+      close(go[1]);
+      close(out[0]);
+      exit(run_client(go[0],out[1]));
+    }
+    close(out[1]);
+    fds[started] = out[0];
+  }
+
+  // Start all clients at once
+  close(go[0]);
+  close(go[1]);
+
+  clients_num = started;
+  if ( clients_num == 0 || collect(fds) != 0 )
+    ret = 1;
+
+  for(i = 0 ; i < started ; i++)
+  {
+    close(fds[i]);
+    wait(&status);
+  }
+
+  admctrl_signer_destroy(requester);
+  return ret;
+}
@@ -0,0 +1,1230 @@
+/* deserialize_fuzz.c
+
+  Copyright 2004  Georgios Portokalidis <digital_bull@users.sourceforge.net>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+// The actions generated by authd are recorded instead of added to a session
+#define kn_add_action record_action
+#include "../src/adm_ctrl.c"
+#undef kn_add_action
+#include "admctrl_req.h"
+
+/*! \file deserialize_fuzz.c
+ *  \brief Fuzzing and differential test of the function list deserializer
+ *  \author Georgios Portokalidis
+ *
+ *  Function lists are deserialized and processed by adm_ctrl.c, and by the
+ *  reference implementation below, which is the linked list deserializer
+ *  and action generator of authd 0.8. The actions they generate are
+ *  compared. The reference reads numbers with memcpy() and is given a padded
+ *  copy of the buffer, since it reads past its end. It also accepts lists
+ *  adm_ctrl.c rejects, functions whose instances have different argument
+ *  types and functions nested too deeply, so only lists adm_ctrl.c accepts
+ *  are compared.
+ *
+ *  Lists in version 1 of the encoding are transcoded to the format of
+ *  authd 0.8 for the reference, byte by byte, by ref_transcode_function().
+ *  Half of the generated lists are encoded in version 1 with
+ *  admctrl_req_add_sfunction(), and half of their functions refer to a
+ *  schema registry generated for the list, with
+ *  admctrl_req_add_sfunction_id().
+ *
+ *  Built with -DLIBFUZZER and -fsanitize=fuzzer the input comes from
+ *  libFuzzer. Otherwise the files given as arguments are used as inputs,
+ *  like AFL does, or random function lists are generated and mutated.
+ *  The first byte of an input is the number of functions in the list and
+ *  the rest is the list. A mismatch aborts.
+ */
+
+//! Maximum number of functions in a generated list
+#define FUZZ_MAX_FUNCTIONS 64
+//! Number of function names in generated lists
+#define FUZZ_NAMES 6
+//! Number of library names in generated lists
+#define FUZZ_LIBS 4
+//! Maximum depth of functions passed as arguments in generated lists
+#define FUZZ_MAX_NESTING 3
+
+
+//! Actions generated for a function list
+struct action_set
+{
+  char **action; //!< "name=value" strings
+  unsigned int num; //!< Number of actions
+  unsigned int size; //!< Actions that fit in action
+};
+
+//! Set that kn_add_action() records to
+static struct action_set *recording = NULL;
+
+static unsigned int verbose = 0;
+//! Schema registry of the generated lists, or NULL
+static admctrl_schema_t *fuzz_schema = NULL;
+//! Schema registry used by ref_transcode_function(), or NULL
+static const admctrl_schema_t *ref_schema = NULL;
+
+
+/** \brief Record an action, in place of kn_add_action()
+ *
+ * \return 0 on success, or -1 if no memory was available
+ */
+int
+record_action(int id,char *name,char *value,int flags)
+{
+  struct action_set *s = recording;
+  char **a;
+
+  if ( s == NULL )
+    return 0;
+  if ( s->num == s->size )
+  {
+    if ( (a = realloc(s->action,(s->size + 64) * sizeof(char *))) == NULL )
+      return -1;
+    s->action = a;
+    s->size += 64;
+  }
+  if ( (s->action[s->num] = malloc(strlen(name) + strlen(value) + 2)) == NULL )
+    return -1;
+  sprintf(s->action[s->num++],"%s=%s",name,value);
+  return 0;
+}
+
+
+static void
+action_set_free(struct action_set *s)
+{
+  unsigned int i;
+
+  for(i = 0 ; i < s->num ; i++)
+    free(s->action[i]);
+  free(s->action);
+  bzero(s,sizeof(struct action_set));
+}
+
+
+static int
+compare_action(const void *a,const void *b)
+{
+  return strcmp(*(char * const *)a,*(char * const *)b);
+}
+
+
+/** \brief Remove the minimum and maximum of double arguments from a set
+ *
+ * The reference keeps running minimums with MIN(), which treats NaN and
+ * signed zeros differently depending on the order of the values.
+ */
+static void
+action_set_drop_minmax(struct action_set *s)
+{
+  unsigned int i,n;
+  size_t l;
+
+  for(i = 0,n = 0 ; i < s->num ; i++)
+  {
+    l = strcspn(s->action[i],"=");
+    if ( l > 4 && (strncmp(s->action[i] + l - 4,".min",4) == 0 ||
+          strncmp(s->action[i] + l - 4,".max",4) == 0) )
+      free(s->action[i]);
+    else
+      s->action[n++] = s->action[i];
+  }
+  s->num = n;
+}
+
+
+
+/*
+ * Reference implementation, authd 0.8
+ */
+
+struct ref_instance
+{
+  unsigned int pos;
+  unsigned int args;
+  adm_ctrl_funcarg_t arg[MAX_ARGUMENTS_NUMBER];
+  struct ref_instance *next;
+};
+
+struct ref_lib
+{
+  char *name;
+  unsigned int num,first,last;
+  struct ref_instance *instances;
+  struct ref_lib *next;
+};
+
+struct ref_func
+{
+  char *name;
+  unsigned int num,first,last,args;
+  struct ref_lib *library;
+  struct ref_func *next;
+};
+
+
+static void
+ref_free(struct ref_func *list)
+{
+  struct ref_func *f;
+  struct ref_lib *l;
+  struct ref_instance *i;
+
+  while( (f = list) != NULL )
+  {
+    list = f->next;
+    while( (l = f->library) != NULL )
+    {
+      f->library = l->next;
+      while( (i = l->instances) != NULL )
+      {
+        l->instances = i->next;
+        free(i);
+      }
+      free(l);
+    }
+    free(f);
+  }
+}
+
+
+/** \brief add_function_instance() of authd 0.8
+ *
+ * \return 0 on success, or -1 on failure, in which case inst is not freed
+ */
+static int
+ref_add_instance(struct ref_func **list,char *name,char *lib_name,struct ref_instance *inst)
+{
+  struct ref_func *f;
+  struct ref_lib *lib = NULL;
+  struct ref_instance *i;
+
+  for(f = *list ; f != NULL ; f = f->next)
+    if ( strcmp(name,f->name) == 0 )
+    {
+      for(lib = f->library ; lib != NULL ; lib = lib->next)
+        if ( strcmp(lib_name,lib->name) == 0 )
+          break;
+      break;
+    }
+
+  if ( f == NULL )
+  {
+    if ( (f = malloc(sizeof(struct ref_func))) == NULL )
+      return -1;
+    f->name = name;
+    f->num = 1;
+    f->first = f->last = inst->pos;
+    f->args = inst->args;
+    f->library = NULL;
+    f->next = *list;
+    *list = f;
+  }
+  else
+  {
+    f->num++;
+    f->first = MIN(inst->pos,f->first);
+    f->last = MAX(inst->pos,f->last);
+    if ( f->args != inst->args )
+      return -1;
+  }
+
+  if ( lib == NULL )
+  {
+    if ( (lib = malloc(sizeof(struct ref_lib))) == NULL )
+      return -1;
+    lib->name = lib_name;
+    lib->num = 1;
+    lib->first = lib->last = inst->pos;
+    lib->instances = inst;
+    lib->next = f->library;
+    f->library = lib;
+  }
+  else
+  {
+    lib->num++;
+    lib->first = MIN(lib->first,inst->pos);
+    lib->last = MAX(lib->last,inst->pos);
+    for(i = lib->instances ; i->next != NULL ; i = i->next)
+      ;
+    i->next = inst;
+  }
+  return 0;
+}
+
+
+/** \brief deserialize_function() of authd 0.8
+ *
+ * buf_size is decreased by one byte less than each string takes, and sizes
+ * of numbers are checked with <=, as they were.
+ *
+ * \return 0 on success, or -1 on failure
+ */
+static int
+ref_deserialize_function(struct ref_func **list,unsigned int index,unsigned char **buf,size_t *buf_size)
+{
+  struct ref_instance *f;
+  char *name,*lib,*argt;
+  unsigned int j;
+  size_t l;
+
+  if ( (f = calloc(1,sizeof(struct ref_instance))) == NULL )
+    return -1;
+  f->pos = index;
+
+  name = (char *)*buf;
+  if ( (l = strnlen(name,*buf_size)) == *buf_size )
+    goto error;
+  *buf_size -= l;
+  *buf += l + 1;
+
+  lib = (char *)*buf;
+  if ( (l = strnlen(lib,*buf_size)) == *buf_size )
+    goto error;
+  *buf_size -= l;
+  *buf += l + 1;
+
+  argt = (char *)*buf;
+  if ( (l = strnlen(argt,*buf_size)) == *buf_size )
+    goto error;
+  *buf_size -= l;
+  f->args = l;
+  if ( f->args > MAX_ARGUMENTS_NUMBER )
+    goto error;
+  *buf += f->args + 1;
+
+  for(j = 0 ; j < f->args ; j++)
+  {
+    f->arg[j].type = argt[j];
+    switch( f->arg[j].type )
+    {
+      case STRING_TYPE:
+        f->arg[j].value.cstring = (char *)*buf;
+        if ( (l = strnlen(f->arg[j].value.cstring,*buf_size)) == *buf_size )
+          goto error;
+        *buf_size -= l;
+        *buf += l + 1;
+        break;
+      case INT_TYPE:
+        memcpy(&f->arg[j].value.integer,*buf,sizeof(int));
+        if ( *buf_size <= sizeof(int) )
+          goto error;
+        *buf_size -= sizeof(int);
+        *buf += sizeof(int);
+        break;
+      case DOUBLE_TYPE:
+        memcpy(&f->arg[j].value.dbl,*buf,sizeof(double));
+        if ( *buf_size <= sizeof(double) )
+          goto error;
+        *buf_size -= sizeof(double);
+        *buf += sizeof(double);
+        break;
+      case ULONG_LONG_TYPE:
+        memcpy(&f->arg[j].value.ullong,*buf,sizeof(unsigned long long));
+        if ( *buf_size <= sizeof(unsigned long long) )
+          goto error;
+        *buf_size -= sizeof(unsigned long long);
+        *buf += sizeof(unsigned long long);
+        break;
+      case FUNCTION_TYPE:
+        f->arg[j].value.cstring = (char *)*buf;
+        if ( ref_deserialize_function(list,index,buf,buf_size) != 0 )
+          goto error;
+        break;
+      default:
+        goto error;
+    }
+  }
+
+  if ( ref_add_instance(list,name,lib,f) == 0 )
+    return 0;
+
+error:
+  free(f);
+  return -1;
+}
+
+
+//! Update a running minimum and maximum, as authd 0.8 did
+#define REF_MINMAX(first,min,max,v) \
+  do { \
+    if ( first ) \
+      (min) = (max) = (v); \
+    else \
+    { \
+      (max) = MAX((max),(v)); \
+      (min) = MIN((min),(v)); \
+    } \
+  } while( 0 )
+
+
+/** \brief Record the minimum and maximum actions of an argument
+ *
+ * \return 0 on success, or -1 on failure
+ */
+static int
+ref_minmax_actions(const char *prefix,unsigned int j,char type,
+    const adm_ctrl_funcarg_value_t *min,const adm_ctrl_funcarg_value_t *max)
+{
+  char name[MAX_ACTION_NAME_SIZE],value[MAX_ACTION_VALUE_SIZE];
+  const adm_ctrl_funcarg_value_t *v;
+  int k;
+
+  if ( type == FUNCTION_TYPE )
+    return 0;
+  for(k = 0 ; k < 2 ; k++)
+  {
+    v = ( k == 0 )? max : min;
+    snprintf(name,MAX_ACTION_NAME_SIZE,"%s.param.%u.%s",prefix,j,( k == 0 )? "max" : "min");
+    switch( type )
+    {
+      case INT_TYPE:
+      case STRING_TYPE:
+        snprintf(value,MAX_ACTION_VALUE_SIZE,"%d",v->integer);
+        break;
+      case DOUBLE_TYPE:
+        snprintf(value,MAX_ACTION_VALUE_SIZE,"%f",v->dbl);
+        break;
+      case ULONG_LONG_TYPE:
+        snprintf(value,MAX_ACTION_VALUE_SIZE,"%llu",v->ullong);
+        break;
+      default:
+        return -1;
+    }
+    if ( record_action(0,name,value,0) < 0 )
+      return -1;
+  }
+  return 0;
+}
+
+
+/** \brief adm_ctrl_flist_process() of authd 0.8, without resource control
+ *
+ * \return 0 on success, or -1 on failure
+ */
+static int
+ref_flist_process(struct ref_func *list)
+{
+  char name[MAX_ACTION_NAME_SIZE],value[MAX_ACTION_VALUE_SIZE],prefix[MAX_ACTION_NAME_SIZE];
+  adm_ctrl_funcarg_value_t arg_max[MAX_ARGUMENTS_NUMBER],arg_min[MAX_ARGUMENTS_NUMBER];
+  adm_ctrl_funcarg_value_t lib_max[MAX_ARGUMENTS_NUMBER],lib_min[MAX_ARGUMENTS_NUMBER];
+  struct ref_instance *inst;
+  struct ref_lib *lib;
+  unsigned int j,instance_no;
+  int first,lfirst,sz;
+
+  for(; list != NULL ; list = list->next)
+  {
+    if ( record_action(0,list->name,"defined",0) < 0 )
+      return -1;
+    snprintf(name,MAX_ACTION_NAME_SIZE,"%s.num",list->name);
+    snprintf(value,MAX_ACTION_VALUE_SIZE,"%u",list->num);
+    if ( record_action(0,name,value,0) < 0 )
+      return -1;
+    snprintf(name,MAX_ACTION_NAME_SIZE,"%s.first",list->name);
+    snprintf(value,MAX_ACTION_VALUE_SIZE,"%u",list->first);
+    if ( record_action(0,name,value,0) < 0 )
+      return -1;
+    snprintf(name,MAX_ACTION_NAME_SIZE,"%s.last",list->name);
+    snprintf(value,MAX_ACTION_VALUE_SIZE,"%u",list->last);
+    if ( record_action(0,name,value,0) < 0 )
+      return -1;
+
+    for(lib = list->library,instance_no = 0 ; lib != NULL ; lib = lib->next,++instance_no)
+    {
+      // The library's action was never added, the function's was instead
+      if ( record_action(0,list->name,"defined",0) < 0 )
+        return -1;
+      snprintf(name,MAX_ACTION_NAME_SIZE,"%s.%s.num",list->name,lib->name);
+      snprintf(value,MAX_ACTION_VALUE_SIZE,"%u",lib->num);
+      if ( record_action(0,name,value,0) < 0 )
+        return -1;
+      snprintf(name,MAX_ACTION_NAME_SIZE,"%s.%s.first",list->name,lib->name);
+      snprintf(value,MAX_ACTION_VALUE_SIZE,"%u",lib->first);
+      if ( record_action(0,name,value,0) < 0 )
+        return -1;
+      snprintf(name,MAX_ACTION_NAME_SIZE,"%s.%s.last",list->name,lib->name);
+      snprintf(value,MAX_ACTION_VALUE_SIZE,"%u",lib->last);
+      if ( record_action(0,name,value,0) < 0 )
+        return -1;
+
+      for(inst = lib->instances ; inst != NULL ; inst = inst->next)
+      {
+        // The library's index, not the instance's
+        snprintf(name,MAX_ACTION_NAME_SIZE,"%s.%u.pos",list->name,instance_no);
+        snprintf(value,MAX_ACTION_VALUE_SIZE,"%u",inst->pos);
+        if ( record_action(0,name,value,0) < 0 )
+          return -1;
+        snprintf(name,MAX_ACTION_NAME_SIZE,"func.%u.name",inst->pos);
+        if ( record_action(0,name,list->name,0) < 0 )
+          return -1;
+
+        first = ( lib == list->library && inst == lib->instances );
+        lfirst = ( inst == lib->instances );
+        for(j = 0 ; j < list->args ; j++)
+        {
+          switch( inst->arg[j].type )
+          {
+            case INT_TYPE:
+              snprintf(value,MAX_ACTION_VALUE_SIZE,"%d",inst->arg[j].value.integer);
+              REF_MINMAX(first,arg_min[j].integer,arg_max[j].integer,inst->arg[j].value.integer);
+              REF_MINMAX(lfirst,lib_min[j].integer,lib_max[j].integer,inst->arg[j].value.integer);
+              break;
+            case DOUBLE_TYPE:
+              snprintf(value,MAX_ACTION_VALUE_SIZE,"%f",inst->arg[j].value.dbl);
+              REF_MINMAX(first,arg_min[j].dbl,arg_max[j].dbl,inst->arg[j].value.dbl);
+              REF_MINMAX(lfirst,lib_min[j].dbl,lib_max[j].dbl,inst->arg[j].value.dbl);
+              break;
+            case STRING_TYPE:
+              snprintf(value,MAX_ACTION_VALUE_SIZE,"%s",inst->arg[j].value.cstring);
+              sz = (int)strlen(inst->arg[j].value.cstring);
+              REF_MINMAX(first,arg_min[j].integer,arg_max[j].integer,sz);
+              REF_MINMAX(lfirst,lib_min[j].integer,lib_max[j].integer,sz);
+              break;
+            case ULONG_LONG_TYPE:
+              snprintf(value,MAX_ACTION_VALUE_SIZE,"%llu",inst->arg[j].value.ullong);
+              REF_MINMAX(first,arg_min[j].ullong,arg_max[j].ullong,inst->arg[j].value.ullong);
+              REF_MINMAX(lfirst,lib_min[j].ullong,lib_max[j].ullong,inst->arg[j].value.ullong);
+              break;
+            case FUNCTION_TYPE:
+              snprintf(value,MAX_ACTION_VALUE_SIZE,"%s",inst->arg[j].value.cstring);
+              break;
+            default:
+              return -1;
+          }
+          snprintf(name,MAX_ACTION_NAME_SIZE,"%s.%u.param.%u",list->name,instance_no,j);
+          if ( record_action(0,name,value,0) < 0 )
+            return -1;
+          snprintf(name,MAX_ACTION_NAME_SIZE,"func.%u.param.%u",inst->pos,j);
+          if ( record_action(0,name,value,0) < 0 )
+            return -1;
+        }
+      }
+
+      snprintf(prefix,MAX_ACTION_NAME_SIZE,"%s.%s",list->name,lib->name);
+      for(j = 0 ; j < lib->instances->args ; j++)
+        if ( ref_minmax_actions(prefix,j,lib->instances->arg[j].type,lib_min + j,lib_max + j) != 0 )
+          return -1;
+    }
+
+    for(j = 0 ; j < list->library->instances->args ; j++)
+      if ( ref_minmax_actions(list->name,j,list->library->instances->arg[j].type,arg_min + j,arg_max + j) != 0 )
+        return -1;
+  }
+  return 0;
+}
+
+
+
+//! Maximum depth of nested functions transcoded by ref_transcode_function()
+#define REF_MAX_NESTING 64
+
+//! Reads a number of size bytes aligned to size, little-endian
+static int
+ref_read_le(const unsigned char *buf,size_t size,size_t *off,unsigned int bytes,unsigned long long *v)
+{
+  unsigned int k;
+
+  while ( *off % bytes != 0 )
+    (*off)++;
+  if ( *off > size || size - *off < bytes )
+    return -1;
+  for(k = bytes,*v = 0 ; k-- > 0 ; )
+    *v = (*v << 8) | buf[*off + k];
+  *off += bytes;
+  return 0;
+}
+
+
+//! Transcodes a length prefixed string up to its first zero
+static int
+ref_transcode_string(const unsigned char *buf,size_t size,size_t *off,unsigned char *out,size_t *out_off,char **s)
+{
+  unsigned long long len;
+  size_t k;
+
+  if ( ref_read_le(buf,size,off,2,&len) != 0 || size - *off < len + 1 || buf[*off + len] != '\0' )
+    return -1;
+  if ( s != NULL )
+    *s = (char *)out + *out_off;
+  for(k = 0 ; buf[*off + k] != '\0' ; k++)
+    out[(*out_off)++] = buf[*off + k];
+  out[(*out_off)++] = '\0';
+  *off += len + 1;
+  return 0;
+}
+
+
+/** \brief Transcodes a function of a version 1 list to the format of authd 0.8
+ *
+ * \param buf the version 1 list
+ * \param size the size of buf
+ * \param off reference to the offset of the function in buf
+ * \param out the buffer for the transcoded list, at least as big as buf
+ * \param out_off reference to the offset in out
+ * \param depth the number of functions this one is an argument of
+ *
+ * \return 0 on success, or -1 on failure
+ */
+static int
+ref_transcode_function(const unsigned char *buf,size_t size,size_t *off,unsigned char *out,size_t *out_off,unsigned int depth)
+{
+  unsigned long long v;
+  unsigned int j,args,id;
+  const char *field;
+  char *argt;
+  size_t o;
+  int integer;
+
+  if ( depth > REF_MAX_NESTING )
+    return -1;
+  // A function of the schema registry, copied from it
+  for(o = *off ; o % 2 != 0 ; o++)
+    ;
+  if ( o + 4 <= size && buf[o] == 0xff && buf[o + 1] == 0xff )
+  {
+    id = buf[o + 2] | (buf[o + 3] << 8);
+    if ( ref_schema == NULL || id >= ref_schema->size || ref_schema->func[id].name == NULL )
+      return -1;
+    for(j = 0 ; j < 3 ; j++)
+    {
+      field = ( j == 0 )? ref_schema->func[id].name : ( j == 1 )? ref_schema->func[id].lib : ref_schema->func[id].argt;
+      argt = (char *)out + *out_off;
+      strcpy(argt,field);
+      *out_off += strlen(field) + 1;
+    }
+    *off = o + 4;
+  }
+  else if ( ref_transcode_string(buf,size,off,out,out_off,NULL) != 0 ||
+      ref_transcode_string(buf,size,off,out,out_off,NULL) != 0 ||
+      ref_transcode_string(buf,size,off,out,out_off,&argt) != 0 )
+    return -1;
+  args = strlen(argt);
+  while ( *off % 8 != 0 )
+    (*off)++;
+
+  for(j = 0 ; j < args ; j++)
+    switch( argt[j] )
+    {
+      case STRING_TYPE:
+        if ( ref_transcode_string(buf,size,off,out,out_off,NULL) != 0 )
+          return -1;
+        break;
+      case INT_TYPE:
+        if ( ref_read_le(buf,size,off,4,&v) != 0 )
+          return -1;
+        integer = (int)(unsigned int)v;
+        memcpy(out + *out_off,&integer,sizeof(int));
+        *out_off += sizeof(int);
+        break;
+      case DOUBLE_TYPE:
+      case ULONG_LONG_TYPE:
+        if ( ref_read_le(buf,size,off,8,&v) != 0 )
+          return -1;
+        memcpy(out + *out_off,&v,sizeof(v));
+        *out_off += sizeof(v);
+        break;
+      case FUNCTION_TYPE:
+        if ( ref_transcode_function(buf,size,off,out,out_off,depth + 1) != 0 )
+          return -1;
+        break;
+      default:
+        return -1;
+    }
+  return 0;
+}
+
+
+
+/*
+ * Fuzzing
+ */
+
+/** \brief Check the structure of a deserialized function list
+ *
+ * \return 0 if it is consistent, or -1 otherwise
+ */
+static int
+check_flist(const adm_ctrl_flist_t *flist,unsigned int num)
+{
+  const adm_ctrl_func_t *func;
+  const adm_ctrl_lib_t *lib;
+  unsigned int l,i,n,instances = 0;
+
+  for(func = flist->func ; func < flist->func + flist->num ; func++)
+  {
+    if ( func->libs == 0 || func->args > MAX_ARGUMENTS_NUMBER || strlen(func->argt) != func->args )
+      return -1;
+    for(l = 0,n = 0,lib = func->library ; l < func->libs ; l++,lib++)
+    {
+      if ( lib < flist->lib || lib >= flist->lib + flist->libs || lib->num == 0 ||
+          lib->first > lib->last || lib->last >= num )
+        return -1;
+      for(i = 0 ; i < lib->num ; i++)
+        if ( lib->instances[i].pos < lib->first || lib->instances[i].pos > lib->last )
+          return -1;
+      n += lib->num;
+    }
+    if ( n != func->num || func->first > func->last )
+      return -1;
+    instances += n;
+  }
+  return ( instances == flist->instances )? 0 : -1;
+}
+
+
+//! Whether a list has double arguments whose minimum depends on their order
+static int
+has_unordered_doubles(const adm_ctrl_flist_t *flist)
+{
+  unsigned int i;
+
+  for(i = 0 ; i < flist->args ; i++)
+    if ( flist->arg[i].type == DOUBLE_TYPE &&
+        (isnan(flist->arg[i].value.dbl) || (flist->arg[i].value.dbl == 0.0 && signbit(flist->arg[i].value.dbl))) )
+      return 1;
+  return 0;
+}
+
+
+static void
+dump_actions(const char *title,const struct action_set *s)
+{
+  unsigned int i;
+
+  fprintf(stderr,"%s, %u actions:\n",title,s->num);
+  for(i = 0 ; i < s->num ; i++)
+    fprintf(stderr,"  %s\n",s->action[i]);
+}
+
+
+/** \brief Deserialize and process a function list with both implementations
+ *
+ * Aborts if adm_ctrl.c accepts a list the reference rejects, if the list is
+ * inconsistent, or if the actions differ.
+ *
+ * \param data The number of functions, followed by the list
+ * \param size The size of data
+ *
+ * \return 1 if adm_ctrl.c accepted the list, or 0 otherwise
+ */
+static int
+fuzz_one(const unsigned char *data,size_t size)
+{
+  struct action_set new_actions,ref_actions;
+  adm_ctrl_flist_t *flist;
+  struct ref_func *ref = NULL;
+  unsigned char *buf,*ref_buf,*p;
+  unsigned int num,i;
+  size_t buf_size,ref_size,off;
+  int ref_e = 0,e = -1;
+#ifdef WITH_RESOURCE_CONTROL
+  adm_ctrl_result_t res;
+#endif
+
+  if ( size < 1 )
+    return 0;
+  num = data[0];
+  buf_size = size - 1;
+
+  // Exactly the list, so that reading past it is caught by a sanitizer
+  if ( (buf = malloc(buf_size + 1)) == NULL )
+    abort();
+  memcpy(buf,data + 1,buf_size);
+  bzero(&new_actions,sizeof(struct action_set));
+  bzero(&ref_actions,sizeof(struct action_set));
+
+  if ( (flist = adm_ctrl_deserialize_functions(buf,num,buf_size,fuzz_schema)) != NULL )
+  {
+    if ( check_flist(flist,num) != 0 )
+    {
+      fprintf(stderr,"Inconsistent function list\n");
+      abort();
+    }
+    recording = &new_actions;
+#ifdef WITH_RESOURCE_CONTROL
+    bzero(&res,sizeof(adm_ctrl_result_t));
+    e = adm_ctrl_flist_process(0,flist,&res,NULL);
+#else
+    e = adm_ctrl_flist_process(0,flist);
+#endif
+    recording = NULL;
+    if ( e != 0 )
+    {
+      fprintf(stderr,"Processing an accepted function list failed with %d\n",e);
+      abort();
+    }
+
+    // The reference reads past the end of the list, by up to one byte for
+    // each string and 8 for a number, so it gets a copy with room for that
+    ref_size = 2 * buf_size + 16;
+    if ( (ref_buf = calloc(1,ref_size)) == NULL )
+      abort();
+    if ( buf_size >= ADMCTRL_FLIST_HEADER_SIZE && memcmp(buf,ADMCTRL_FLIST_MAGIC,ADMCTRL_FLIST_MAGIC_SIZE) == 0 )
+    {
+      ref_schema = NULL;
+      if ( fuzz_schema != NULL && buf[4] == (fuzz_schema->tag & 0xff) && buf[5] == ((fuzz_schema->tag >> 8) & 0xff) &&
+          buf[6] == ((fuzz_schema->tag >> 16) & 0xff) && buf[7] == (fuzz_schema->tag >> 24) )
+        ref_schema = fuzz_schema;
+      // Transcoded lists are never bigger
+      for(i = 0,off = ADMCTRL_FLIST_HEADER_SIZE,buf_size = 0 ; i < num && ref_e == 0 ; i++)
+        ref_e = ref_transcode_function(buf,size - 1,&off,ref_buf,&buf_size,0);
+      if ( ref_e != 0 )
+      {
+        fprintf(stderr,"Function list accepted, but its transcoding failed\n");
+        abort();
+      }
+    }
+    else
+      memcpy(ref_buf,data + 1,buf_size);
+    for(i = 0,p = ref_buf ; i < num && ref_e == 0 ; i++)
+      ref_e = ref_deserialize_function(&ref,i,&p,&buf_size);
+    if ( ref_e != 0 )
+    {
+      fprintf(stderr,"Function list accepted, but rejected by the reference\n");
+      abort();
+    }
+    recording = &ref_actions;
+    ref_e = ref_flist_process(ref);
+    recording = NULL;
+    if ( ref_e != 0 )
+      abort();
+
+    if ( has_unordered_doubles(flist) )
+    {
+      action_set_drop_minmax(&new_actions);
+      action_set_drop_minmax(&ref_actions);
+    }
+    qsort(new_actions.action,new_actions.num,sizeof(char *),compare_action);
+    qsort(ref_actions.action,ref_actions.num,sizeof(char *),compare_action);
+    for(i = 0 ; i < new_actions.num && i < ref_actions.num ; i++)
+      if ( strcmp(new_actions.action[i],ref_actions.action[i]) != 0 )
+        break;
+    if ( i < new_actions.num || i < ref_actions.num )
+    {
+      fprintf(stderr,"Actions differ at %u\n",i);
+      dump_actions("adm_ctrl.c",&new_actions);
+      dump_actions("Reference",&ref_actions);
+      abort();
+    }
+    if ( verbose > 1 )
+      dump_actions("Accepted",&new_actions);
+
+    ref_free(ref);
+    free(ref_buf);
+    adm_ctrl_free_functions(flist);
+  }
+
+  action_set_free(&new_actions);
+  action_set_free(&ref_actions);
+  free(buf);
+  return ( flist != NULL );
+}
+
+
+#ifdef LIBFUZZER
+int
+LLVMFuzzerTestOneInput(const unsigned char *data,size_t size)
+{
+  fuzz_one(data,size);
+  return 0;
+}
+
+#else
+
+//! Argument types of each generated function name
+static char gen_argt[FUZZ_NAMES][MAX_ARGUMENTS_NUMBER + 1];
+//! Offsets of the functions of the last generated list, and of its end
+static size_t gen_off[FUZZ_MAX_FUNCTIONS + 1];
+//! File of the generated schema registry
+static char gen_schema_fn[] = "/tmp/deserialize_fuzz.XXXXXX";
+
+
+/** \brief Generate a schema registry for the argument types of the names
+ *
+ * Every function name in every library gets an id, and the registry is
+ * loaded in fuzz_schema.
+ *
+ * \return 0 on success, or -1 on failure
+ */
+static int
+gen_schema(void)
+{
+  static admctrl_schema_t schema;
+  unsigned int f,l,base;
+  FILE *fl;
+
+  if ( (fl = fopen(gen_schema_fn,"w")) == NULL )
+    return -1;
+  fprintf(fl,"# Generated\n");
+  base = rand() % 1000;
+  for(f = 0 ; f < FUZZ_NAMES ; f++)
+    for(l = 0 ; l < FUZZ_LIBS ; l++)
+      fprintf(fl,"%u func%u lib%u %s\n",base + f * FUZZ_LIBS + l,f,l,( gen_argt[f][0] == '\0' )? "-" : gen_argt[f]);
+  fclose(fl);
+  if ( fuzz_schema != NULL )
+    admctrl_schema_free(fuzz_schema);
+  fuzz_schema = NULL;
+  if ( admctrl_schema_load(gen_schema_fn,&schema) != 0 )
+    return -1;
+  fuzz_schema = &schema;
+  return 0;
+}
+
+
+/** \brief Append a generated function to a list
+ *
+ * Only the first half of the names take functions as arguments, so at the
+ * maximum depth functions passed as arguments are named after the rest.
+ *
+ * \return 0 on success, or -1 if the list is full
+ */
+static int
+gen_function(unsigned char *buf,size_t *off,size_t size,unsigned int depth)
+{
+  char name[16],lib[16],str[32];
+  unsigned int f,j,k,len;
+  int integer;
+  double dbl;
+  unsigned long long ullong;
+
+  f = ( depth < FUZZ_MAX_NESTING )? rand() % FUZZ_NAMES : FUZZ_NAMES / 2 + rand() % (FUZZ_NAMES / 2);
+  sprintf(name,"func%u",f);
+  sprintf(lib,"lib%u",rand() % FUZZ_LIBS);
+  if ( *off + strlen(name) + strlen(lib) + strlen(gen_argt[f]) + 3 > size )
+    return -1;
+  strcpy((char *)buf + *off,name);
+  *off += strlen(name) + 1;
+  strcpy((char *)buf + *off,lib);
+  *off += strlen(lib) + 1;
+  strcpy((char *)buf + *off,gen_argt[f]);
+  *off += strlen(gen_argt[f]) + 1;
+
+  for(j = 0 ; gen_argt[f][j] != '\0' ; j++)
+  {
+    if ( *off + sizeof(str) > size )
+      return -1;
+    switch( gen_argt[f][j] )
+    {
+      case INT_TYPE:
+        integer = ( rand() % 8 == 0 )? (( rand() % 2 )? INT_MIN : INT_MAX) : rand() % 2001 - 1000;
+        memcpy(buf + *off,&integer,sizeof(int));
+        *off += sizeof(int);
+        break;
+      case DOUBLE_TYPE:
+        dbl = (rand() % 200001 - 100000) / 8.0;
+        memcpy(buf + *off,&dbl,sizeof(double));
+        *off += sizeof(double);
+        break;
+      case ULONG_LONG_TYPE:
+        ullong = ((unsigned long long)rand() << 33) ^ ((unsigned long long)rand() << 11) ^ rand();
+        memcpy(buf + *off,&ullong,sizeof(unsigned long long));
+        *off += sizeof(unsigned long long);
+        break;
+      case STRING_TYPE:
+        for(k = 0,len = rand() % (sizeof(str) - 1) ; k < len ; k++)
+          str[k] = ' ' + rand() % 95;
+        str[len] = '\0';
+        strcpy((char *)buf + *off,str);
+        *off += len + 1;
+        break;
+      case FUNCTION_TYPE:
+        if ( gen_function(buf,off,size,depth + 1) != 0 )
+          return -1;
+        break;
+    }
+  }
+  return 0;
+}
+
+
+/** \brief Generate a valid function list, preceded by its number of functions
+ *
+ * \return the size of the input
+ */
+static size_t
+gen_input(unsigned char *buf,size_t size)
+{
+  static const char types[] = { INT_TYPE, DOUBLE_TYPE, ULONG_LONG_TYPE, STRING_TYPE, FUNCTION_TYPE };
+  unsigned int f,j,n,num;
+  size_t off = 1;
+
+  for(f = 0 ; f < FUZZ_NAMES ; f++)
+  {
+    for(j = 0,n = rand() % (MAX_ARGUMENTS_NUMBER + 1) ; j < n ; j++)
+      gen_argt[f][j] = types[rand() % ( f < FUZZ_NAMES / 2 ? 5 : 4 )];
+    gen_argt[f][n] = '\0';
+  }
+  num = 1 + rand() % FUZZ_MAX_FUNCTIONS;
+  for(f = 0 ; f < num ; f++)
+  {
+    gen_off[f] = off;
+    if ( gen_function(buf,&off,size,0) != 0 )
+    {
+      off = gen_off[f];
+      break;
+    }
+  }
+  gen_off[f] = off;
+  buf[0] = f;
+  return off;
+}
+
+
+/** \brief Encode the last generated list in version 1 of the encoding
+ *
+ * Each function is added with admctrl_req_add_sfunction(), or with
+ * admctrl_req_add_sfunction_id() if the generated schema registry is
+ * loaded, half of the time.
+ *
+ * \return the size of the input, or 0 if it didn't fit
+ */
+static size_t
+gen_encode(const unsigned char *buf,unsigned char *out)
+{
+  static adm_ctrl_request_t request;
+  const char *fname,*lname,*argt;
+  const unsigned char *args;
+  size_t off = 0;
+  unsigned int f;
+  int id,e;
+
+  request.functions_num = 0;
+  for(f = 0 ; f < buf[0] ; f++)
+  {
+    fname = (const char *)buf + gen_off[f];
+    lname = fname + strlen(fname) + 1;
+    argt = lname + strlen(lname) + 1;
+    args = (const unsigned char *)argt + strlen(argt) + 1;
+    if ( fuzz_schema != NULL && rand() % 2 == 0 && (id = admctrl_schema_id(fuzz_schema,fname,lname)) >= 0 )
+      e = admctrl_req_add_sfunction_id(&request,&off,fuzz_schema,id,args,buf + gen_off[f + 1] - args);
+    else
+      e = admctrl_req_add_sfunction(&request,&off,fname,lname,argt,args,buf + gen_off[f + 1] - args);
+    if ( e != 0 )
+      return 0;
+  }
+  out[0] = buf[0];
+  memcpy(out + 1,request.function_list,off);
+  return 1 + off;
+}
+
+
+/** \brief Mutate an input in place
+ *
+ * \return the new size of the input
+ */
+static size_t
+mutate_input(unsigned char *buf,size_t len,size_t size)
+{
+  unsigned int m,k;
+  size_t a,b;
+
+  for(m = 1 + rand() % 4 ; m > 0 && len > 1 ; m--)
+  {
+    a = 1 + rand() % (len - 1);
+    switch( rand() % 6 )
+    {
+      case 0:
+        buf[a] ^= 1 << (rand() % 8);
+        break;
+      case 1:
+        buf[a] = ( rand() % 2 )? 0 : 0xff;
+        break;
+      case 2:
+        // Truncate
+        len = a;
+        break;
+      case 3:
+        // Delete a chunk
+        b = a + rand() % (len - a);
+        memmove(buf + a,buf + b,len - b);
+        len -= b - a;
+        break;
+      case 4:
+        // Duplicate a chunk
+        b = a + rand() % (len - a);
+        if ( len + (b - a) <= size )
+        {
+          memmove(buf + b + (b - a),buf + b,len - b);
+          memcpy(buf + b,buf + a,b - a);
+          len += b - a;
+        }
+        break;
+      case 5:
+        k = buf[0] + rand() % 3 - 1;
+        buf[0] = k;
+        break;
+    }
+  }
+  return len;
+}
+
+
+static int
+fuzz_file(const char *fn)
+{
+  unsigned char *data;
+  FILE *fl;
+  long size;
+
+  if ( (fl = fopen(fn,"rb")) == NULL )
+  {
+    perror(fn);
+    return -1;
+  }
+  if ( fseek(fl,0,SEEK_END) != 0 || (size = ftell(fl)) < 0 || fseek(fl,0,SEEK_SET) != 0 ||
+      (data = malloc(size + 1)) == NULL || fread(data,1,size,fl) != (size_t)size )
+  {
+    perror(fn);
+    fclose(fl);
+    return -1;
+  }
+  fclose(fl);
+  printf("%s: %s\n",fn,( fuzz_one(data,size) )? "accepted" : "rejected");
+  free(data);
+  return 0;
+}
+
+
+static void
+print_usage(void)
+{
+	printf("Usage: deserialize_fuzz [options] [file ...]\n");
+	printf("  -n  --iterations=NUMBER  Generated function lists (10000)\n");
+	printf("  -m  --mutations=NUMBER   Mutations of each generated list (8)\n");
+	printf("  -s  --seed=NUMBER        Random seed (time)\n");
+	printf("  -v  --verbose            Print the seed, twice to print the actions\n");
+	printf("  -h  --help               Display this message\n\n");
+}
+
+
+int
+main(int argc,char **argv)
+{
+  static unsigned char buf[1 + MAX_FUNCTION_LIST_SIZE],input[1 + MAX_FUNCTION_LIST_SIZE];
+  unsigned int iterations = 10000,mutations = 8,seed = time(NULL),it,m;
+  unsigned long accepted = 0,mutated = 0,mutated_accepted = 0;
+  size_t len,ilen;
+  int c,fd,ret = 0;
+	const char optstring[] = "n:m:s:vh";
+	const struct option longopts[] = {
+		{ "iterations", required_argument, NULL, 'n' },
+		{ "mutations", required_argument, NULL, 'm' },
+		{ "seed", required_argument, NULL, 's' },
+		{ "verbose", no_argument, NULL, 'v' },
+		{ "help", no_argument, NULL, 'h' },
+		{ "", 0, NULL , '\0' }
+	};
+
+	while ( (c = getopt_long(argc,argv,optstring,longopts,NULL)) >= 0 )
+		switch( c )
+		{
+      case 'n':
+        iterations = (unsigned int)atoi(optarg);
+        break;
+      case 'm':
+        mutations = (unsigned int)atoi(optarg);
+        break;
+      case 's':
+        seed = (unsigned int)strtoul(optarg,NULL,0);
+        break;
+      case 'v':
+        verbose++;
+        break;
+			case 'h':
+			default:
+				print_usage();
+				exit(1);
+				break;
+		}
+
+  // Inputs from files
+  if ( optind < argc )
+  {
+    for(; optind < argc ; optind++)
+      if ( fuzz_file(argv[optind]) != 0 )
+        ret = 1;
+    return ret;
+  }
+
+  if ( (fd = mkstemp(gen_schema_fn)) < 0 )
+  {
+    perror(gen_schema_fn);
+    return 1;
+  }
+  close(fd);
+
+  if ( verbose )
+    printf("Seed %u\n",seed);
+  srand(seed);
+  for(it = 0 ; it < iterations ; it++)
+  {
+    // A string takes up to 4 times as much in version 1
+    len = gen_input(buf,( it % 2 == 1 )? sizeof(buf) / 4 : sizeof(buf));
+    if ( it % 2 == 1 )
+    {
+      if ( gen_schema() != 0 )
+      {
+        perror(gen_schema_fn);
+        ret = 1;
+        break;
+      }
+      if ( (len = gen_encode(buf,input)) == 0 )
+      {
+        fprintf(stderr,"Generated function list %u of seed %u could not be encoded\n",it,seed);
+        ret = 1;
+        break;
+      }
+      memcpy(buf,input,len);
+    }
+    // Generated lists are valid
+    if ( !fuzz_one(buf,len) )
+    {
+      fprintf(stderr,"Generated function list %u of seed %u rejected\n",it,seed);
+      ret = 1;
+      break;
+    }
+    accepted++;
+    for(m = 0 ; m < mutations ; m++)
+    {
+      memcpy(input,buf,len);
+      ilen = mutate_input(input,len,sizeof(input));
+      mutated_accepted += fuzz_one(input,ilen);
+      mutated++;
+    }
+  }
+  unlink(gen_schema_fn);
+  if ( fuzz_schema != NULL )
+    admctrl_schema_free(fuzz_schema);
+  if ( ret == 0 )
+    printf("%lu generated function lists, %lu mutated of which %lu accepted\n",
+        accepted,mutated,mutated_accepted);
+  return ret;
+}
+#endif
@@ -0,0 +1,641 @@
+/* stage_bench.c
+
+  Copyright 2004  Georgios Portokalidis <digital_bull@users.sourceforge.net>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/fcntl.h>
+#include <keynote.h>
+#include <openssl/rsa.h>
+
+#include "admctrl_argtypes.h"
+#include "admctrl_config.h"
+#include "admctrl_req.h"
+#include "adm_ctrl.h"
+#include "adm_ctrl_func.h"
+
+/*! \file stage_bench.c
+ *  \brief Microbenchmark of the stages of authd's authorisation pipeline
+ *  \author Georgios Portokalidis
+ *
+ *  A synthetic request is built for every requested number of function
+ *  actions and each stage of adm_ctrl_authenticate() and
+ *  adm_ctrl_authorise() is timed on its own, without authd or IPC.
+ */
+
+//! Maximum number of request sizes
+#define BENCH_MAX_SIZES 32
+//! Algorithm used to sign generated credentials
+#define BENCH_SIG_ALGORITHM "sig-rsa-sha1-base64:"
+
+//! The stages that are timed
+enum bench_stage
+{
+  STAGE_DECRYPT, //!< adm_ctrl_decrypt_nonce()
+  STAGE_ASSERTIONS, //!< Policy, credentials and authorizer
+  STAGE_DESERIALIZE, //!< adm_ctrl_deserialize_functions()
+  STAGE_FLIST, //!< adm_ctrl_flist_process()
+  STAGE_QUERY, //!< kn_do_query()
+#ifdef WITH_RESOURCE_CONTROL
+  STAGE_AGGREGATE, //!< resource_ctrl_aggregate()
+  STAGE_AGGREGATE_BATCH, //!< resource_ctrl_table_aggregate_batch()
+#endif
+  STAGE_AUTHORISE, //!< The whole of adm_ctrl_authorise()
+  STAGES_NUM
+};
+
+static const char *stage_names[STAGES_NUM] = {
+  "decrypt_nonce",
+  "assertions",
+  "deserialize",
+  "flist_process",
+  "kn_do_query",
+#ifdef WITH_RESOURCE_CONTROL
+  "aggregate",
+  "aggregate_batch",
+#endif
+  "authorise"
+};
+
+static char *PCV[2] = { "false", "true" };
+
+static char *condsfile = "conds";
+static unsigned int key_bits = 1024;
+static unsigned int iterations = 1000;
+static unsigned int pairs_num = 1;
+static unsigned int sizes[BENCH_MAX_SIZES] = { 1, 4, 16, 64 };
+static unsigned int sizes_num = 4;
+
+//! Public key of the requester, quoted
+static char pubkey[MAX_PUBKEY_SIZE];
+//! Credentials of the requester
+static char credentials[MAX_CREDENTIALS_SIZE];
+//! Private key of the requester, used to sign nonces
+static RSA *requester_rsa = NULL;
+//! Policy licensing authd's key
+static adm_ctrl_policy_t policy;
+//! Schema registry, used if loaded with -F
+static admctrl_schema_t schema;
+
+//! Samples of every stage, in microseconds
+static double *samples[STAGES_NUM];
+
+static const char *libs_array[] = { "stdlib", "dag" };
+
+
+static int
+read_file(const char *fn,char *buf,size_t len)
+{
+  int fp,r;
+
+  if ( (fp = open(fn,O_RDONLY)) < 0 )
+    return -1;
+  r = read(fp,buf,len - 1);
+  close(fp);
+  if ( r >= 0 )
+    buf[r] = '\0';
+  return r;
+}
+
+
+static char *
+encode_key(RSA *rsa,int type)
+{
+  struct keynote_deckey dk;
+  const char *prefix;
+  char *enc,*s;
+
+  prefix = ( type == KEYNOTE_PRIVATE_KEY )? "private-rsa-base64:" : "rsa-base64:";
+  dk.dec_algorithm = KEYNOTE_ALGORITHM_RSA;
+  dk.dec_key = rsa;
+  if ( (enc = kn_encode_key(&dk,INTERNAL_ENC_PKCS1,ENCODING_BASE64,type)) == NULL )
+    return NULL;
+  if ( (s = malloc(strlen(prefix) + strlen(enc) + 1)) != NULL )
+    sprintf(s,"%s%s",prefix,enc);
+  free(enc);
+  return s;
+}
+
+
+/** \brief Generate authd's and the requester's keys, the policy and the
+  credentials
+
+  The conditions of the credentials are read from condsfile. If it cannot
+  be read only app_domain is checked.
+
+  \return 0 on success, or -1 on failure
+*/
+static int
+generate_credentials(void)
+{
+  char conds[MAX_CREDENTIALS_SIZE / 2];
+  char *authd_pub = NULL,*authd_priv = NULL,*req_pub = NULL,*sig;
+  RSA *authd_rsa;
+  size_t len;
+  int ret = -1;
+
+  if ( read_file(condsfile,conds,sizeof(conds)) <= 0 )
+  {
+    fprintf(stderr,"Couldn't read %s, using default conditions\n",condsfile);
+    strcpy(conds,"app_domain == \"MY DOMAIN\" -> \"true\";");
+  }
+  len = strlen(conds);
+  while( len > 0 && conds[len - 1] == '\n' )
+    conds[--len] = '\0';
+
+  if ( (authd_rsa = RSA_generate_key(key_bits,RSA_F4,NULL,NULL)) == NULL ||
+      (requester_rsa = RSA_generate_key(key_bits,RSA_F4,NULL,NULL)) == NULL )
+    goto exit;
+  if ( (authd_pub = encode_key(authd_rsa,KEYNOTE_PUBLIC_KEY)) == NULL ||
+      (authd_priv = encode_key(authd_rsa,KEYNOTE_PRIVATE_KEY)) == NULL ||
+      (req_pub = encode_key(requester_rsa,KEYNOTE_PUBLIC_KEY)) == NULL )
+    goto exit;
+
+  snprintf(policy.data,MAX_POLICY_SIZE,"KeyNote-Version: 2\nAuthorizer: \"POLICY\"\n"
+      "Licensees: \"%s\"\nConditions: app_domain == \"MY DOMAIN\" -> \"true\";\n",authd_pub);
+  if ( (policy.assertions = kn_read_asserts(policy.data,strlen(policy.data),&policy.assertions_num)) == NULL )
+    goto exit;
+
+  snprintf(pubkey,MAX_PUBKEY_SIZE,"\"%s\"",req_pub);
+  len = snprintf(credentials,MAX_CREDENTIALS_SIZE,"KeyNote-Version: 2\nAuthorizer: \"%s\"\n"
+      "Licensees: %s\nConditions: %s\nSignature: ",authd_pub,pubkey,conds);
+  if ( len >= MAX_CREDENTIALS_SIZE )
+    goto exit;
+  if ( (sig = kn_sign_assertion(credentials,len,authd_priv,BENCH_SIG_ALGORITHM,0)) == NULL )
+  {
+    fprintf(stderr,"Couldn't sign credentials, keynote error %d\n",keynote_errno);
+    goto exit;
+  }
+  if ( snprintf(credentials + len,MAX_CREDENTIALS_SIZE - len,"\"%s\"\n",sig) < MAX_CREDENTIALS_SIZE - len )
+    ret = 0;
+  free(sig);
+
+exit:
+  if ( ret != 0 )
+    fprintf(stderr,"Couldn't generate keys and credentials\n");
+  free(authd_pub);
+  free(authd_priv);
+  free(req_pub);
+  if ( authd_rsa )
+    RSA_free(authd_rsa);
+  return ret;
+}
+
+
+/** \brief Fill a request with a number of pairs and functions and sign its
+  nonce
+
+  \param request the request to fill
+  \param functions_num the number of function actions
+
+  \return 0 on success, or -1 on failure
+*/
+static int
+build_request(adm_ctrl_request_t *request,unsigned int functions_num)
+{
+  char name[MAX_PAIR_NAME],value[MAX_PAIR_VALUE];
+  unsigned char enc_nonce[MAX_ENC_NONCE_SIZE];
+  unsigned int i,nonce;
+  const char *lib;
+  size_t off = 0;
+  int e,id;
+
+  bzero(request,sizeof(adm_ctrl_request_t));
+
+  // The first pair is required by the policy
+  for(i = 0 ; i < pairs_num ; i++)
+  {
+    if ( i == 0 )
+      e = admctrl_req_add_nvpair(request,"app_domain","MY DOMAIN");
+    else
+    {
+      snprintf(name,MAX_PAIR_NAME,"BENCH_PAIR_%u",i);
+      snprintf(value,MAX_PAIR_VALUE,"%u",i);
+      e = admctrl_req_add_nvpair(request,name,value);
+    }
+    if ( e != 0 )
+    {
+      fprintf(stderr,"Too many pairs, maximum is %d\n",MAX_PAIR_ASSERTIONS);
+      return -1;
+    }
+  }
+
+  // Functions that satisfy the conditions in tests/conds, by id if they are
+  // in the schema registry
+#define ADD_FUNCTION(name,argt,...) \
+  (( policy.schema != NULL && (id = admctrl_schema_id(policy.schema,name,lib)) >= 0 )? \
+    admctrl_req_add_function_id(request,&off,policy.schema,(unsigned int)id,__VA_ARGS__) : \
+    admctrl_req_add_function(request,&off,name,lib,argt,__VA_ARGS__))
+  for(i = 0 ; i < functions_num ; i++)
+  {
+    lib = libs_array[i % 2];
+    switch( i % 5 )
+    {
+      case 0:
+        e = ADD_FUNCTION("STR_SEARCH","sii","http",32,1000);
+        break;
+      case 1:
+        e = ADD_FUNCTION("TO_TCPDUMP","sL","/home/user/test",123456789ULL);
+        break;
+      case 2:
+        e = ADD_FUNCTION("TIMEDIFF","d",1500.75);
+        break;
+      case 3:
+        // No arguments, 0 is ignored
+        e = ADD_FUNCTION("PKT_COUNTER","",0);
+        break;
+      default:
+        e = ADD_FUNCTION("BPF_FILTER","s","tcp port 80");
+        break;
+    }
+    if ( e != 0 )
+    {
+      fprintf(stderr,"Function list of %u functions exceeds %d bytes\n",functions_num,MAX_FUNCTION_LIST_SIZE);
+      return -1;
+    }
+  }
+
+  nonce = (unsigned int)random();
+  if ( RSA_size(requester_rsa) > MAX_ENC_NONCE_SIZE ||
+      (e = RSA_private_encrypt(sizeof(unsigned int),(unsigned char *)&nonce,
+      enc_nonce,requester_rsa,RSA_PKCS1_PADDING)) <= 0 )
+  {
+    fprintf(stderr,"Couldn't sign nonce\n");
+    return -1;
+  }
+  admctrl_req_set_authinfo(request,(unsigned char *)pubkey,(unsigned char *)credentials,nonce,enc_nonce,(size_t)e);
+  return 0;
+}
+
+
+static inline double
+now_usec(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+
+#ifdef WITH_RESOURCE_CONTROL
+/** \brief Time resource_ctrl_aggregate() for a number of function instances
+
+  Every instance has one consumption entry, spread over 4 resources, with a
+  variable cost formula using its first argument.
+*/
+static int
+bench_aggregate(unsigned int functions_num,unsigned int it)
+{
+  resource_consumption_t con;
+  resource_required_t req[RESOURCE_CTRL_MAX_RESOURCES];
+  resource_formula_arg_t args[MAX_ARGUMENTS_NUMBER];
+  size_t req_size = 0;
+  unsigned int i;
+  double t;
+
+  strcpy(con.variable_cost_formula,"%1$d * 2 + 10");
+  t = now_usec();
+  for(i = 0 ; i < functions_num ; i++)
+  {
+    con.rkey = i % 4;
+    con.fixed_cost = i;
+    args[0].type = RESOURCE_FORMULA_INT;
+    args[0].value.integer = i;
+    if ( resource_ctrl_aggregate(&con,1,req,&req_size,args,1) != 0 )
+      return -1;
+  }
+  samples[STAGE_AGGREGATE][it] = now_usec() - t;
+  return 0;
+}
+
+
+/** \brief Time resource_ctrl_table_aggregate_batch() for a number of function instances
+
+  The instances are all of the same function and library, with the
+  consumption entry and formula of bench_aggregate(), compiled once.
+*/
+static int
+bench_aggregate_batch(unsigned int functions_num,unsigned int it)
+{
+  resource_ctrl_table_t table;
+  resource_consumption_t con;
+  resource_formula_t formula;
+  resource_formula_col_t col;
+  int *values;
+  unsigned int i;
+  double t;
+  int e;
+
+  if ( (values = malloc((functions_num + 1) * sizeof(int))) == NULL )
+    return -1;
+  for(i = 0 ; i < functions_num ; i++)
+    values[i] = i;
+  col.type = RESOURCE_FORMULA_INT;
+  col.values = values;
+  con.rkey = 0;
+  con.fixed_cost = 1;
+  strcpy(con.variable_cost_formula,"%1$d * 2 + 10");
+  // The table only refers to the record and formula, it isn't freed
+  resource_ctrl_table_init(&table);
+  table.records = &con;
+  table.formulas = &formula;
+
+  t = now_usec();
+  if ( (e = resource_formula_compile(con.variable_cost_formula,&formula)) == 0 )
+    e = resource_ctrl_table_aggregate_batch(&table,&con,1,&col,1,functions_num);
+  samples[STAGE_AGGREGATE_BATCH][it] = now_usec() - t;
+
+  free(values);
+  return e;
+}
+#endif
+
+
+/** \brief Time every stage of a request iterations times
+
+  \return 0 on success, or -1 on failure
+*/
+static int
+bench_request(adm_ctrl_request_t *request)
+{
+  bytestream enc_nonce;
+  adm_ctrl_result_t res;
+  adm_ctrl_flist_t *flist;
+  unsigned int it,nonce;
+  int id,e,pcv;
+  double t;
+
+  enc_nonce.data = request->encrypted_nonce;
+  enc_nonce.length = request->encrypted_nonce_len;
+
+  for(it = 0 ; it < iterations ; it++)
+  {
+    t = now_usec();
+    e = adm_ctrl_decrypt_nonce(&enc_nonce,&nonce,(char *)request->pubkey);
+    samples[STAGE_DECRYPT][it] = now_usec() - t;
+    if ( e != 0 || nonce != request->nonce )
+    {
+      fprintf(stderr,"Nonce decryption failed\n");
+      return -1;
+    }
+
+    if ( (id = kn_init()) < 0 )
+      return -1;
+
+    t = now_usec();
+    e = adm_ctrl_add_assertions(id,request,&policy);
+    samples[STAGE_ASSERTIONS][it] = now_usec() - t;
+    if ( e != 0 || adm_ctrl_generate_pair_assertions(id,request->pairs_num,request->pair_assertions) != 0 )
+    {
+      fprintf(stderr,"Adding assertions failed (%d)\n",e);
+      goto fail;
+    }
+
+    flist = NULL;
+    t = now_usec();
+    if ( request->functions_num > 0 &&
+        (flist = adm_ctrl_deserialize_functions(request->function_list,request->functions_num,MAX_FUNCTION_LIST_SIZE,policy.schema)) == NULL )
+    {
+      fprintf(stderr,"Deserialization failed\n");
+      goto fail;
+    }
+    samples[STAGE_DESERIALIZE][it] = now_usec() - t;
+
+    bzero(&res,sizeof(adm_ctrl_result_t));
+    t = now_usec();
+#ifdef WITH_RESOURCE_CONTROL
+    e = adm_ctrl_flist_process(id,flist,&res,NULL);
+#else
+    e = adm_ctrl_flist_process(id,flist);
+#endif
+    samples[STAGE_FLIST][it] = now_usec() - t;
+    if ( flist )
+      adm_ctrl_free_functions(flist);
+    if ( e != 0 )
+    {
+      fprintf(stderr,"Processing function list failed (%d)\n",e);
+      goto fail;
+    }
+
+    t = now_usec();
+    pcv = kn_do_query(id,PCV,2);
+    samples[STAGE_QUERY][it] = now_usec() - t;
+    kn_close(id);
+    if ( pcv < 0 )
+    {
+      fprintf(stderr,"Query failed, keynote error %d\n",keynote_errno);
+      return -1;
+    }
+    if ( it == 0 && pcv != 1 )
+      fprintf(stderr,"Warning: request of %u functions was not authorised\n",request->functions_num);
+
+#ifdef WITH_RESOURCE_CONTROL
+    if ( bench_aggregate(request->functions_num,it) != 0 ||
+        bench_aggregate_batch(request->functions_num,it) != 0 )
+    {
+      fprintf(stderr,"Resource aggregation failed\n");
+      return -1;
+    }
+#endif
+
+    bzero(&res,sizeof(adm_ctrl_result_t));
+    t = now_usec();
+#ifdef WITH_RESOURCE_CONTROL
+    e = adm_ctrl_authorise(request,&policy,&res,NULL);
+#else
+    e = adm_ctrl_authorise(request,&policy,&res);
+#endif
+    samples[STAGE_AUTHORISE][it] = now_usec() - t;
+    if ( e < 0 )
+    {
+      fprintf(stderr,"Authorisation failed (%d)\n",e);
+      return -1;
+    }
+  }
+  return 0;
+
+fail:
+  kn_close(id);
+  return -1;
+}
+
+
+static int
+compare_double(const void *a,const void *b)
+{
+  double x = *(const double *)a,y = *(const double *)b;
+
+  return ( x < y )? -1 : ( x > y );
+}
+
+
+static double
+percentile(const double *sorted,size_t n,double p)
+{
+  size_t i;
+
+  i = (size_t)ceil(p * n);
+  return sorted[ (i > 0)? i - 1 : 0 ];
+}
+
+
+static void
+print_stages(unsigned int functions_num)
+{
+  unsigned int s,i;
+  double sum;
+
+  for(s = 0 ; s < STAGES_NUM ; s++)
+  {
+    for(sum = 0.0,i = 0 ; i < iterations ; i++)
+      sum += samples[s][i];
+    qsort(samples[s],iterations,sizeof(double),compare_double);
+    printf("%9u %-14s %10.2f %10.2f %10.2f %10.2f\n",functions_num,stage_names[s],
+        sum / iterations,percentile(samples[s],iterations,0.5),
+        percentile(samples[s],iterations,0.99),samples[s][iterations - 1]);
+  }
+}
+
+
+static void
+print_usage(void)
+{
+	printf("Usage:\n");
+	printf("  -f  --functions=LIST     Comma separated request sizes (1,4,16,64)\n");
+	printf("  -N  --iterations=NUMBER  Iterations for each request size (1000)\n");
+	printf("  -a  --pairs=NUMBER       Name-value pairs in each request (1)\n");
+	printf("  -b  --bits=NUMBER        Size of generated RSA keys (1024)\n");
+	printf("  -C  --conds=FILENAME     Set file containing credential conditions (conds)\n");
+	printf("  -F  --schema=FILENAME    Refer to functions by id, with the schema registry in FILENAME\n");
+	printf("  -h  --help               Display this message\n\n");
+}
+
+static void
+parse_arguments(int argc,char **argv)
+{
+	int c;
+  char *s;
+	const char optstring[] = "f:N:a:b:C:F:h";
+	const struct option longopts[] = {
+		{ "functions", required_argument, NULL, 'f' },
+		{ "iterations", required_argument, NULL, 'N' },
+		{ "pairs", required_argument, NULL, 'a' },
+		{ "bits", required_argument, NULL, 'b' },
+		{ "conds", required_argument, NULL, 'C' },
+		{ "schema", required_argument, NULL, 'F' },
+		{ "help", no_argument, NULL, 'h' },
+		{ "", 0, NULL , '\0' }
+	};
+
+	while ( (c = getopt_long(argc,argv,optstring,longopts,NULL)) >= 0 )
+		switch( c )
+		{
+      case 'f':
+        for(sizes_num = 0,s = strtok(optarg,",") ; s != NULL && sizes_num < BENCH_MAX_SIZES ; s = strtok(NULL,","))
+          sizes[sizes_num++] = (unsigned int)atoi(s);
+        break;
+      case 'N':
+        iterations = (unsigned int)atoi(optarg);
+        break;
+      case 'a':
+        pairs_num = (unsigned int)atoi(optarg);
+        break;
+      case 'b':
+        key_bits = (unsigned int)atoi(optarg);
+        break;
+      case 'C':
+        condsfile = optarg;
+        break;
+      case 'F':
+        if ( admctrl_schema_load(optarg,&schema) != 0 )
+        {
+          perror(optarg);
+          exit(1);
+        }
+        policy.schema = &schema;
+        break;
+			case 'h':
+			default:
+				print_usage();
+				exit(1);
+				break;
+		}
+
+  if ( iterations < 1 || sizes_num < 1 || pairs_num < 1 )
+  {
+    fprintf(stderr,"Invalid number of iterations, sizes or pairs\n");
+    exit(1);
+  }
+}
+
+
+
+int
+main(int argc,char **argv)
+{
+  adm_ctrl_request_t *request;
+  unsigned int i;
+  int ret = 0;
+
+	parse_arguments(argc,argv);
+
+  if ( generate_credentials() != 0 )
+    return 1;
+
+  for(i = 0 ; i < STAGES_NUM ; i++)
+    if ( (samples[i] = malloc(iterations * sizeof(double))) == NULL )
+    {
+      perror("malloc");
+      return 1;
+    }
+  if ( (request = malloc(sizeof(adm_ctrl_request_t))) == NULL )
+  {
+    perror("malloc");
+    return 1;
+  }
+
+  printf("%9s %-14s %10s %10s %10s %10s\n","functions","stage","mean(us)","p50(us)","p99(us)","max(us)");
+  for(i = 0 ; i < sizes_num ; i++)
+  {
+    if ( build_request(request,sizes[i]) != 0 || bench_request(request) != 0 )
+    {
+      ret = 1;
+      break;
+    }
+    print_stages(sizes[i]);
+  }
+
+  for(i = 0 ; i < STAGES_NUM ; i++)
+    free(samples[i]);
+  free(request);
+  admctrl_schema_free(&schema);
+  RSA_free(requester_rsa);
+	return ret;
+}